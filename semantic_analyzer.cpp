@@ -1,12 +1,55 @@
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <algorithm>
 #include <vector>
 #include <unordered_map>
 #include <memory>
+#include <new>
 #include <sstream>
 #include <fstream>
 #include <cctype>
 #include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <unordered_set>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+
+// The baseline JIT emits x86-64 machine code into mmap'd pages. Other targets,
+// or builds with -DOURLANG_NO_JIT, run everything on the bytecode VM.
+#if defined(__x86_64__) && defined(__linux__) && !defined(OURLANG_NO_JIT)
+#define OURLANG_JIT_X64 1
+#endif
+
+// Compiled .olc bytecode files are mapped straight into memory on POSIX
+// systems and read into a buffer elsewhere.
+#if defined(__unix__) || defined(__APPLE__)
+#define OURLANG_HAVE_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// The array builtins have AVX2 loops, used on x86-64 CPUs that support it
+// (checked at run time). -DOURLANG_NO_SIMD leaves only the portable loops.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && !defined(OURLANG_NO_SIMD)
+#define OURLANG_AVX2 1
+#include <immintrin.h>
+#endif
 
 // ============================================================================
 // Token Types and Lexer
@@ -241,6 +284,8 @@ struct Symbol {
     bool isInitialized;
     std::vector<DataType> paramTypes;
     DataType returnType;
+    bool keysKnown = false;              // an object whose literal is known here
+    std::vector<std::string> objectKeys;  // the keys of that literal
 
     Symbol() : name(""), type(DataType::UNKNOWN), isFunction(false), isInitialized(false), returnType(DataType::VOID) {}
 
@@ -251,6 +296,9 @@ struct Symbol {
 class SymbolTable {
 private:
     std::vector<std::unordered_map<std::string, Symbol>> scopes;
+    // First scope of each function being analyzed. A function sees its own
+    // scopes and the globals, not the locals of a function around it.
+    std::vector<size_t> functionBases;
 
 public:
     SymbolTable() {
@@ -268,6 +316,16 @@ public:
         }
     }
 
+    void enterFunction() {
+        functionBases.push_back(scopes.size());
+        enterScope();
+    }
+
+    void exitFunction() {
+        exitScope();
+        functionBases.pop_back();
+    }
+
     bool define(const std::string& name, DataType type, bool isFunc = false, bool isInit = true) {
         // Check if already defined in current scope
         if (scopes.back().find(name) != scopes.back().end()) {
@@ -278,25 +336,30 @@ public:
     }
 
     bool lookup(const std::string& name, Symbol& symbol) {
-        for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
-            auto found = it->find(name);
-            if (found != it->end()) {
-                symbol = found->second;
-                return true;
-            }
-        }
-        return false;
+        Symbol* found = find(name);
+        if (found) symbol = *found;
+        return found != nullptr;
     }
 
     bool update(const std::string& name) {
-        for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
-            auto found = it->find(name);
-            if (found != it->end()) {
-                found->second.isInitialized = true;
-                return true;
-            }
+        Symbol* found = find(name);
+        if (found) found->isInitialized = true;
+        return found != nullptr;
+    }
+
+    // Whether the visible definition of the name is a global.
+    bool isGlobal(const std::string& name) {
+        auto global = scopes[0].find(name);
+        return global != scopes[0].end() && find(name) == &global->second;
+    }
+
+    // Records the keys of the object literal a variable now holds, or that
+    // they are unknown (keys == nullptr).
+    void setObjectKeys(const std::string& name, const std::vector<std::string>* keys) {
+        if (Symbol* found = find(name)) {
+            found->keysKnown = keys != nullptr;
+            found->objectKeys = keys ? *keys : std::vector<std::string>();
         }
-        return false;
     }
 
     void addFunctionSignature(const std::string& name, const std::vector<DataType>& params, DataType returnType) {
@@ -307,6 +370,16 @@ public:
     }
 
 private:
+    Symbol* find(const std::string& name) {
+        size_t base = functionBases.empty() ? 1 : functionBases.back();
+        for (size_t i = scopes.size(); i-- > base;) {
+            auto found = scopes[i].find(name);
+            if (found != scopes[i].end()) return &found->second;
+        }
+        auto global = scopes[0].find(name);
+        return global != scopes[0].end() ? &global->second : nullptr;
+    }
+
     void initBuiltins() {
         // Built-in functions
         addFunctionSignature("dekh", {DataType::UNKNOWN}, DataType::VOID);
@@ -320,6 +393,12 @@ private:
         addFunctionSignature("min", {DataType::NUMBER, DataType::NUMBER}, DataType::NUMBER);
         addFunctionSignature("round", {DataType::NUMBER}, DataType::NUMBER);
         addFunctionSignature("random", {}, DataType::NUMBER);
+        addFunctionSignature("sum", {DataType::ARRAY}, DataType::NUMBER);
+        addFunctionSignature("dot", {DataType::ARRAY, DataType::ARRAY}, DataType::NUMBER);
+        addFunctionSignature("scale", {DataType::ARRAY, DataType::NUMBER}, DataType::ARRAY);
+        addFunctionSignature("minval", {DataType::ARRAY}, DataType::NUMBER);
+        addFunctionSignature("maxval", {DataType::ARRAY}, DataType::NUMBER);
+        addFunctionSignature("map", {DataType::ARRAY, DataType::UNKNOWN}, DataType::ARRAY);
     }
 };
 
@@ -334,12 +413,16 @@ struct ASTNode {
 
 struct Expression : public ASTNode {
     DataType type = DataType::UNKNOWN;
+    bool integral = false;  // a number that only ever holds integers (see IntegralInference)
     virtual DataType getType() const override { return type; }
 };
 
 struct NumberLiteral : public Expression {
     double value;
-    NumberLiteral(double v) : value(v) { type = DataType::NUMBER; }
+    NumberLiteral(double v, bool isIntegral = false) : value(v) {
+        type = DataType::NUMBER;
+        integral = isIntegral;
+    }
 };
 
 struct StringLiteral : public Expression {
@@ -357,13 +440,17 @@ struct Identifier : public Expression {
     Identifier(const std::string& n) : name(n) {}
 };
 
+// `&&` and `||` short-circuit: the right operand runs only when the left one
+// does not decide the result, so analyses treat it as conditionally executed
+// and every engine lowers it to a conditional jump.
 struct BinaryOp : public Expression {
     std::unique_ptr<Expression> left;
     std::string op;
     std::unique_ptr<Expression> right;
+    bool shortCircuit;
 
     BinaryOp(std::unique_ptr<Expression> l, const std::string& o, std::unique_ptr<Expression> r)
-        : left(std::move(l)), op(o), right(std::move(r)) {}
+        : left(std::move(l)), op(o), right(std::move(r)), shortCircuit(o == "&&" || o == "||") {}
 };
 
 struct UnaryOp : public Expression {
@@ -382,34 +469,104 @@ struct Assignment : public Expression {
         : name(n), value(std::move(v)) {}
 };
 
+// How a call in tail position (`wapas f(...)`) may run; see TailCallAnalysis.
+enum class TailCall {
+    NONE,    // an ordinary call
+    SELF,    // the function calls itself: rerun the body with new arguments
+    MUTUAL   // another function of the same call-graph cycle: replace the frame
+};
+
 struct FunctionCall : public Expression {
     std::string name;
     std::vector<std::unique_ptr<Expression>> args;
+    TailCall tailCall = TailCall::NONE;
 
     FunctionCall(const std::string& n) : name(n) {}
 };
 
+// The values of an array literal written with only number literals (each
+// may be negated) or only string literals. Data tables of 10^5 entries and
+// more are written this way, so the parser stores them here in one buffer
+// rather than as a node per element. Copies of the literal share it.
+struct PackedElements {
+    std::vector<double> numbers;
+    std::vector<std::string> strings;  // when `numbers` is empty
+
+    size_t size() const { return numbers.size() + strings.size(); }
+};
+
 struct ArrayLiteral : public Expression {
-    std::vector<std::unique_ptr<Expression>> elements;
+    std::vector<std::unique_ptr<Expression>> elements;  // empty when `packed` is set
+    std::shared_ptr<const PackedElements> packed;
+    bool inRegion = false;  // never outlives the call that creates it (see EscapeAnalysis)
 
     ArrayLiteral() { type = DataType::ARRAY; }
+
+    size_t size() const { return packed ? packed->size() : elements.size(); }
 };
 
 struct ObjectLiteral : public Expression {
     std::vector<std::pair<std::string, std::unique_ptr<Expression>>> members;
+    bool inRegion = false;  // never outlives the call that creates it (see EscapeAnalysis)
 
     ObjectLiteral() { type = DataType::OBJECT; }
 };
 
+// Element and member nodes name their variable in runtime errors. An
+// optimizer pass that renames the variable keeps the source name in
+// `sourceName`, so errors read the same at every optimization level.
 struct ArrayAccess : public Expression {
     std::string arrayName;
     std::unique_ptr<Expression> index;
+    std::string sourceName;  // empty unless renamed
 
     ArrayAccess(const std::string& n, std::unique_ptr<Expression> idx)
         : arrayName(n), index(std::move(idx)) {}
+
+    const std::string& shownName() const { return sourceName.empty() ? arrayName : sourceName; }
+};
+
+// `arr[i] = value` replaces an existing element; arrays never grow through it.
+// The index is evaluated before the value, and the value is the result.
+struct IndexAssignment : public Expression {
+    std::string arrayName;
+    std::unique_ptr<Expression> index;
+    std::unique_ptr<Expression> value;
+    std::string sourceName;  // empty unless renamed
+
+    IndexAssignment(const std::string& n, std::unique_ptr<Expression> idx, std::unique_ptr<Expression> v)
+        : arrayName(n), index(std::move(idx)), value(std::move(v)) {}
+
+    const std::string& shownName() const { return sourceName.empty() ? arrayName : sourceName; }
+};
+
+// `obj.key` reads a member of the object a variable holds.
+struct MemberAccess : public Expression {
+    std::string objectName;
+    std::string member;
+    std::string sourceName;  // empty unless renamed
+
+    MemberAccess(const std::string& n, const std::string& m) : objectName(n), member(m) {}
+
+    const std::string& shownName() const { return sourceName.empty() ? objectName : sourceName; }
+};
+
+// `obj.key = value` replaces a member the object already has; objects keep
+// the keys of their literal. The value is the result.
+struct MemberAssignment : public Expression {
+    std::string objectName;
+    std::string member;
+    std::unique_ptr<Expression> value;
+    std::string sourceName;  // empty unless renamed
+
+    MemberAssignment(const std::string& n, const std::string& m, std::unique_ptr<Expression> v)
+        : objectName(n), member(m), value(std::move(v)) {}
+
+    const std::string& shownName() const { return sourceName.empty() ? objectName : sourceName; }
 };
 
 struct Statement : public ASTNode {
+    int line = 0;  // line of the statement's first token
 };
 
 struct VariableDeclaration : public Statement {
@@ -492,6 +649,13 @@ public:
 
 private:
     std::unique_ptr<Statement> parseStatement() {
+        int line = peek().line;
+        auto stmt = parseStatementKind();
+        if (stmt) stmt->line = line;
+        return stmt;
+    }
+
+    std::unique_ptr<Statement> parseStatementKind() {
         if (match(TokenType::BANAO)) {
             return parseVariableDeclaration();
         }
@@ -638,6 +802,14 @@ private:
             if (auto id = dynamic_cast<Identifier*>(expr.get())) {
                 auto value = parseAssignment();
                 return std::make_unique<Assignment>(id->name, std::move(value));
+            } else if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr.get())) {
+                auto value = parseAssignment();
+                return std::make_unique<IndexAssignment>(arrAccess->arrayName, std::move(arrAccess->index),
+                                                         std::move(value));
+            } else if (auto memberAccess = dynamic_cast<MemberAccess*>(expr.get())) {
+                auto value = parseAssignment();
+                return std::make_unique<MemberAssignment>(memberAccess->objectName, memberAccess->member,
+                                                          std::move(value));
             } else {
                 throw std::runtime_error("Invalid assignment target");
             }
@@ -650,6 +822,33 @@ private:
                 auto binOp = std::make_unique<BinaryOp>(std::move(expr), op, std::move(value));
                 return std::make_unique<Assignment>(id->name, std::move(binOp));
             }
+            // The index appears twice, so it must be free of side effects
+            auto arrAccess = dynamic_cast<ArrayAccess*>(expr.get());
+            if (arrAccess && (dynamic_cast<Identifier*>(arrAccess->index.get()) ||
+                              dynamic_cast<NumberLiteral*>(arrAccess->index.get()))) {
+                std::string op = previous().value;
+                op = op.substr(0, op.length() - 1); // Remove '='
+                auto value = parseAssignment();
+                std::unique_ptr<Expression> index;
+                if (auto id = dynamic_cast<Identifier*>(arrAccess->index.get())) {
+                    index = std::make_unique<Identifier>(id->name);
+                } else {
+                    auto numLit = static_cast<NumberLiteral*>(arrAccess->index.get());
+                    index = std::make_unique<NumberLiteral>(numLit->value, numLit->integral);
+                }
+                std::string name = arrAccess->arrayName;
+                auto binOp = std::make_unique<BinaryOp>(std::move(expr), op, std::move(value));
+                return std::make_unique<IndexAssignment>(name, std::move(index), std::move(binOp));
+            }
+            if (auto memberAccess = dynamic_cast<MemberAccess*>(expr.get())) {
+                std::string op = previous().value;
+                op = op.substr(0, op.length() - 1); // Remove '='
+                auto value = parseAssignment();
+                std::string name = memberAccess->objectName, member = memberAccess->member;
+                auto binOp = std::make_unique<BinaryOp>(std::move(expr), op, std::move(value));
+                return std::make_unique<MemberAssignment>(name, member, std::move(binOp));
+            }
+            throw std::runtime_error("Invalid assignment target");
         }
 
         return expr;
@@ -748,6 +947,14 @@ private:
                 if (auto id = dynamic_cast<Identifier*>(expr.get())) {
                     expr = std::make_unique<ArrayAccess>(id->name, std::move(index));
                 }
+            } else if (match(TokenType::DOT)) {
+                auto id = dynamic_cast<Identifier*>(expr.get());
+                if (!id) {
+                    throw std::runtime_error("Expected a variable before '.' at line " +
+                                             std::to_string(previous().line));
+                }
+                Token member = consume(TokenType::IDENTIFIER, "Expected member name after '.'");
+                expr = std::make_unique<MemberAccess>(id->name, member.value);
             } else if (check(TokenType::LPAREN) && dynamic_cast<Identifier*>(expr.get())) {
                 auto id = dynamic_cast<Identifier*>(expr.get());
                 match(TokenType::LPAREN);
@@ -769,6 +976,36 @@ private:
         return expr;
     }
 
+    // Reads the elements and closing ']' of an array literal made only of
+    // number literals (each may be negated) or only of string literals into
+    // PackedElements, without building expression nodes. Any other literal
+    // leaves the position alone for the general element parser.
+    bool parsePackedElements(ArrayLiteral& arrayLit) {
+        TokenType kind = check(TokenType::MINUS) ? TokenType::NUMBER : peek().type;
+        if (kind != TokenType::NUMBER && kind != TokenType::STRING) return false;
+        auto packed = std::make_shared<PackedElements>();
+        size_t at = current;
+        for (;;) {
+            bool negated = kind == TokenType::NUMBER && tokens[at].type == TokenType::MINUS;
+            if (negated) at++;
+            const Token& literal = tokens[at];
+            if (literal.type != kind) return false;
+            if (kind == TokenType::NUMBER) {
+                double value = std::stod(literal.value);
+                packed->numbers.push_back(negated ? -value : value);
+            } else {
+                packed->strings.push_back(literal.value);
+            }
+            TokenType next = tokens[at + 1].type;
+            at += 2;
+            if (next == TokenType::RBRACKET) break;
+            if (next != TokenType::COMMA) return false;
+        }
+        current = at;
+        arrayLit.packed = std::move(packed);
+        return true;
+    }
+
     std::unique_ptr<Expression> parsePrimary() {
         if (match(TokenType::HAAN)) {
             return std::make_unique<BooleanLiteral>(true);
@@ -779,7 +1016,9 @@ private:
         }
 
         if (match(TokenType::NUMBER)) {
-            return std::make_unique<NumberLiteral>(std::stod(previous().value));
+            // Literals written without a '.' are integers
+            const std::string& lexeme = previous().value;
+            return std::make_unique<NumberLiteral>(std::stod(lexeme), lexeme.find('.') == std::string::npos);
         }
 
         if (match(TokenType::STRING)) {
@@ -805,6 +1044,9 @@ private:
 
         if (match(TokenType::LBRACKET)) {
             auto arrayLit = std::make_unique<ArrayLiteral>();
+            if (parsePackedElements(*arrayLit)) {
+                return arrayLit;
+            }
             if (!check(TokenType::RBRACKET)) {
                 do {
                     arrayLit->elements.push_back(parseExpression());
@@ -877,395 +1119,13749 @@ private:
 };
 
 // ============================================================================
-// Semantic Analyzer
+// Integral Inference
 // ============================================================================
 
-class SemanticAnalyzer {
+// Our-Lang has a single number type, but many numbers only ever hold
+// integers: loop counters, indices, `%` results. A variable is integral when
+// its initializer and every assignment to it are integral: literals written
+// without a '.', integral variables, + - * % and unary minus on integral
+// operands, round() and nikal(). The check is flow-insensitive and
+// optimistic: variables start integral and lose the property when a
+// non-integral value reaches them, until nothing changes.
+//
+// Integral means integer-valued, not bounded: arithmetic can still leave the
+// range a machine integer holds exactly, so execution that keeps these values
+// as int64 checks every result.
+class IntegralInference {
 private:
-    SymbolTable symbolTable;
-    std::vector<std::string> errors;
-    DataType currentReturnType;
-    bool inFunction;
+    std::unordered_map<const void*, bool> variables;  // VariableDeclaration* or parameter -> integral
+    std::unordered_set<const void*> parameters;
+    std::vector<std::vector<std::pair<std::string, const void*>>> scopes;
+    std::unordered_set<const Expression*> integral;
+    bool annotate = false;
+    bool parametersIntegral = false;
+    bool changed = false;
+    bool parameterAssigned = false;
+    int integerOps = 0;
 
 public:
-    SemanticAnalyzer() : currentReturnType(DataType::VOID), inFunction(false) {}
+    // Whole program: sets Expression::integral. Parameters are not integral
+    // since callers may pass any number.
+    void analyze(Program* program) {
+        annotate = true;
+        parametersIntegral = false;
+        fixpoint([&] { visitBlock(program->statements); });
+    }
 
-    bool analyze(Program* program) {
-        try {
-            for (auto& stmt : program->statements) {
-                analyzeStatement(stmt.get());
-            }
+    // A single function, assuming every argument is an integer; used to
+    // build integer kernels. The AST is left untouched.
+    void analyzeFunction(FunctionDeclaration* func) {
+        annotate = false;
+        parametersIntegral = true;
+        fixpoint([&] { visitFunction(func); });
+    }
 
-            // Check if main function exists
-            Symbol mainSym("", DataType::VOID);
-            if (!symbolTable.lookup("main", mainSym)) {
-                errors.push_back("ERROR: Main function 'kaam main()' not found");
-                return false;
+    bool isIntegral(const Expression* expr) const {
+        return integral.count(expr) > 0;
+    }
+
+    bool isIntegral(const VariableDeclaration* varDecl) const {
+        auto it = variables.find(varDecl);
+        return it != variables.end() && it->second;
+    }
+
+    // Whether the analyzed function assigns to one of its parameters.
+    bool assignsParameter() const { return parameterAssigned; }
+
+    // Arithmetic and comparisons whose operands are all integral.
+    int integerOperations() const { return integerOps; }
+
+private:
+    void fixpoint(const std::function<void()>& pass) {
+        do {
+            changed = false;
+            parameterAssigned = false;
+            integerOps = 0;
+            integral.clear();
+            scopes.clear();
+            scopes.emplace_back();
+            pass();
+        } while (changed);
+    }
+
+    // Records the value reaching a variable; a non-integral one clears it.
+    void assign(const void* variable, bool value) {
+        auto it = variables.find(variable);
+        if (it == variables.end()) {
+            variables[variable] = value;
+        } else if (it->second && !value) {
+            it->second = false;
+            changed = true;
+        }
+    }
+
+    const void* resolve(const std::string& name) const {
+        for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+            for (auto it = scope->rbegin(); it != scope->rend(); ++it) {
+                if (it->first == name) return it->second;
             }
+        }
+        return nullptr;
+    }
 
-            return errors.empty();
-        } catch (const std::exception& e) {
-            errors.push_back("EXCEPTION: " + std::string(e.what()));
-            return false;
+    void visitFunction(FunctionDeclaration* func) {
+        scopes.emplace_back();
+        for (const auto& param : func->params) {
+            parameters.insert(&param);
+            assign(&param, parametersIntegral);
+            scopes.back().push_back({param, &param});
         }
+        visitBlock(func->body, false);
+        scopes.pop_back();
     }
 
-    const std::vector<std::string>& getErrors() const {
-        return errors;
+    void visitBlock(const std::vector<std::unique_ptr<Statement>>& stmts, bool newScope = true) {
+        if (newScope) scopes.emplace_back();
+        for (auto& stmt : stmts) {
+            visitStatement(stmt.get());
+        }
+        if (newScope) scopes.pop_back();
     }
 
-private:
-    void analyzeStatement(Statement* stmt) {
+    void visitStatement(Statement* stmt) {
         if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt)) {
-            analyzeVariableDeclaration(varDecl);
+            bool value = varDecl->initializer && visit(varDecl->initializer.get());
+            assign(varDecl, value);
+            scopes.back().push_back({varDecl->name, varDecl});
         } else if (auto funcDecl = dynamic_cast<FunctionDeclaration*>(stmt)) {
-            analyzeFunctionDeclaration(funcDecl);
+            visitFunction(funcDecl);
         } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt)) {
-            analyzeIfStatement(ifStmt);
+            visit(ifStmt->condition.get());
+            visitBlock(ifStmt->thenBranch);
+            visitBlock(ifStmt->elseBranch);
         } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt)) {
-            analyzeLoopStatement(loopStmt);
+            visit(loopStmt->condition.get());
+            visitBlock(loopStmt->body);
         } else if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt)) {
-            analyzeReturnStatement(retStmt);
+            if (retStmt->value) visit(retStmt->value.get());
         } else if (auto exprStmt = dynamic_cast<ExpressionStatement*>(stmt)) {
-            analyzeExpression(exprStmt->expr.get());
+            visit(exprStmt->expr.get());
         }
     }
 
-    void analyzeVariableDeclaration(VariableDeclaration* varDecl) {
-        DataType varType = DataType::UNKNOWN;
+    bool visit(Expression* expr) {
+        bool result = visitKind(expr);
+        if (result) integral.insert(expr);
+        if (annotate) expr->integral = result;
+        return result;
+    }
 
-        if (varDecl->initializer) {
-            varType = analyzeExpression(varDecl->initializer.get());
+    bool visitKind(Expression* expr) {
+        if (auto numLit = dynamic_cast<NumberLiteral*>(expr)) {
+            return numLit->integral;
         }
-
-        if (!symbolTable.define(varDecl->name, varType)) {
-            errors.push_back("ERROR: Variable '" + varDecl->name + "' already defined in current scope");
+        if (auto id = dynamic_cast<Identifier*>(expr)) {
+            const void* variable = resolve(id->name);
+            return variable && variables[variable];
+        }
+        if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            bool left = visit(binOp->left.get());
+            bool right = visit(binOp->right.get());
+            if (!left || !right || binOp->shortCircuit) return false;
+            integerOps++;
+            return binOp->op == "+" || binOp->op == "-" || binOp->op == "*" || binOp->op == "%";
+        }
+        if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) {
+            bool operand = visit(unaryOp->operand.get());
+            return unaryOp->op == "-" && operand;
+        }
+        if (auto assign = dynamic_cast<Assignment*>(expr)) {
+            bool value = visit(assign->value.get());
+            const void* variable = resolve(assign->name);
+            if (!variable) return false;
+            if (parameters.count(variable)) parameterAssigned = true;
+            this->assign(variable, value);
+            return variables[variable];
+        }
+        if (auto funcCall = dynamic_cast<FunctionCall*>(expr)) {
+            for (auto& arg : funcCall->args) {
+                visit(arg.get());
+            }
+            return funcCall->name == "round" || funcCall->name == "nikal";
+        }
+        if (auto arrayLit = dynamic_cast<ArrayLiteral*>(expr)) {
+            for (auto& element : arrayLit->elements) {
+                visit(element.get());
+            }
+            return false;
+        }
+        if (auto objLit = dynamic_cast<ObjectLiteral*>(expr)) {
+            for (auto& member : objLit->members) {
+                visit(member.second.get());
+            }
+            return false;
+        }
+        if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr)) {
+            visit(arrAccess->index.get());
+            return false;
         }
+        if (auto indexAssign = dynamic_cast<IndexAssignment*>(expr)) {
+            visit(indexAssign->index.get());
+            return visit(indexAssign->value.get());
+        }
+        if (auto memberAssign = dynamic_cast<MemberAssignment*>(expr)) {
+            return visit(memberAssign->value.get());
+        }
+        return false;
     }
+};
 
-    void analyzeFunctionDeclaration(FunctionDeclaration* funcDecl) {
-        // Define function with its parameters
-        std::vector<DataType> paramTypes(funcDecl->params.size(), DataType::UNKNOWN);
-        symbolTable.addFunctionSignature(funcDecl->name, paramTypes, DataType::VOID);
+// ============================================================================
+// Call Graph
+// ============================================================================
 
-        // Enter function scope
-        symbolTable.enterScope();
-        bool prevInFunction = inFunction;
-        DataType prevReturnType = currentReturnType;
-        inFunction = true;
-        currentReturnType = DataType::UNKNOWN;
+// User functions and the calls between them, with strongly connected
+// components. Functions are called by name, so a name declared more than
+// once is left out of the graph.
+class CallGraph {
+private:
+    struct Node {
+        FunctionDeclaration* func;
+        std::vector<int> callees;
+        int index = -1;
+        int lowLink = 0;
+        bool onStack = false;
+        int component = -1;
+    };
 
-        // Define parameters in new scope
-        for (const auto& param : funcDecl->params) {
-            symbolTable.define(param, DataType::UNKNOWN);
-        }
+    std::vector<Node> nodes;
+    std::unordered_map<std::string, int> byName;  // -1 when declared twice
+    std::vector<int> componentSizes;
+    std::vector<int> order;  // callees before callers
+    std::vector<int> stack;
+    int nextIndex = 0;
 
-        // Analyze function body
-        for (auto& stmt : funcDecl->body) {
-            analyzeStatement(stmt.get());
+public:
+    void build(Program* program) {
+        collectFunctions(program->statements);
+        for (auto& node : nodes) {
+            collectCalls(node.func->body, node.callees);
+        }
+        for (size_t i = 0; i < nodes.size(); i++) {
+            if (nodes[i].index < 0) connect(static_cast<int>(i));
         }
+    }
 
-        inFunction = prevInFunction;
-        currentReturnType = prevReturnType;
-        symbolTable.exitScope();
+    int size() const { return static_cast<int>(nodes.size()); }
+    FunctionDeclaration* function(int id) const { return nodes[id].func; }
+    const std::vector<int>& callees(int id) const { return nodes[id].callees; }
+    int component(int id) const { return nodes[id].component; }
+
+    int lookup(const std::string& name) const {
+        auto it = byName.find(name);
+        return it != byName.end() ? it->second : -1;
     }
 
-    void analyzeIfStatement(IfStatement* ifStmt) {
-        DataType condType = analyzeExpression(ifStmt->condition.get());
-        if (condType != DataType::BOOLEAN && condType != DataType::UNKNOWN && condType != DataType::VOID) {
-            errors.push_back("ERROR: If condition must be boolean, got " + dataTypeToString(condType));
-        }
+    // On a cycle of calls, including a function that calls itself.
+    bool isRecursive(int id) const {
+        if (componentSizes[nodes[id].component] > 1) return true;
+        const auto& callees = nodes[id].callees;
+        return std::find(callees.begin(), callees.end(), id) != callees.end();
+    }
 
-        symbolTable.enterScope();
-        for (auto& stmt : ifStmt->thenBranch) {
-            analyzeStatement(stmt.get());
-        }
-        symbolTable.exitScope();
+    // Every function, each after the functions it calls (cycles aside).
+    const std::vector<int>& bottomUp() const { return order; }
 
-        if (!ifStmt->elseBranch.empty()) {
-            symbolTable.enterScope();
-            for (auto& stmt : ifStmt->elseBranch) {
-                analyzeStatement(stmt.get());
+private:
+    void collectFunctions(const std::vector<std::unique_ptr<Statement>>& stmts) {
+        for (auto& stmt : stmts) {
+            if (auto funcDecl = dynamic_cast<FunctionDeclaration*>(stmt.get())) {
+                int id = static_cast<int>(nodes.size());
+                nodes.push_back({funcDecl, {}});
+                auto inserted = byName.insert({funcDecl->name, id});
+                if (!inserted.second) inserted.first->second = -1;
+                collectFunctions(funcDecl->body);
+            } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                collectFunctions(ifStmt->thenBranch);
+                collectFunctions(ifStmt->elseBranch);
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                collectFunctions(loopStmt->body);
             }
-            symbolTable.exitScope();
         }
     }
 
-    void analyzeLoopStatement(LoopStatement* loopStmt) {
-        DataType condType = analyzeExpression(loopStmt->condition.get());
-        if (condType != DataType::BOOLEAN && condType != DataType::UNKNOWN && condType != DataType::VOID) {
-            errors.push_back("ERROR: Loop condition must be boolean, got " + dataTypeToString(condType));
-        }
-
-        symbolTable.enterScope();
-        for (auto& stmt : loopStmt->body) {
-            analyzeStatement(stmt.get());
+    // Call edges of one body; nested declarations have their own node.
+    void collectCalls(const std::vector<std::unique_ptr<Statement>>& stmts, std::vector<int>& out) {
+        for (auto& stmt : stmts) {
+            if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt.get())) {
+                collectCalls(varDecl->initializer.get(), out);
+            } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                collectCalls(ifStmt->condition.get(), out);
+                collectCalls(ifStmt->thenBranch, out);
+                collectCalls(ifStmt->elseBranch, out);
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                collectCalls(loopStmt->condition.get(), out);
+                collectCalls(loopStmt->body, out);
+            } else if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt.get())) {
+                collectCalls(retStmt->value.get(), out);
+            } else if (auto exprStmt = dynamic_cast<ExpressionStatement*>(stmt.get())) {
+                collectCalls(exprStmt->expr.get(), out);
+            }
         }
-        symbolTable.exitScope();
     }
 
-    void analyzeReturnStatement(ReturnStatement* retStmt) {
-        if (!inFunction) {
-            errors.push_back("ERROR: Return statement outside function");
-            return;
+    void collectCalls(Expression* expr, std::vector<int>& out) {
+        if (!expr) return;
+        if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            collectCalls(binOp->left.get(), out);
+            collectCalls(binOp->right.get(), out);
+        } else if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) {
+            collectCalls(unaryOp->operand.get(), out);
+        } else if (auto assign = dynamic_cast<Assignment*>(expr)) {
+            collectCalls(assign->value.get(), out);
+        } else if (auto funcCall = dynamic_cast<FunctionCall*>(expr)) {
+            int callee = lookup(funcCall->name);
+            if (callee >= 0) out.push_back(callee);
+            for (auto& arg : funcCall->args) {
+                collectCalls(arg.get(), out);
+            }
+        } else if (auto arrayLit = dynamic_cast<ArrayLiteral*>(expr)) {
+            for (auto& element : arrayLit->elements) {
+                collectCalls(element.get(), out);
+            }
+        } else if (auto objLit = dynamic_cast<ObjectLiteral*>(expr)) {
+            for (auto& member : objLit->members) {
+                collectCalls(member.second.get(), out);
+            }
+        } else if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr)) {
+            collectCalls(arrAccess->index.get(), out);
+        } else if (auto indexAssign = dynamic_cast<IndexAssignment*>(expr)) {
+            collectCalls(indexAssign->index.get(), out);
+            collectCalls(indexAssign->value.get(), out);
+        } else if (auto memberAssign = dynamic_cast<MemberAssignment*>(expr)) {
+            collectCalls(memberAssign->value.get(), out);
         }
+    }
 
-        if (retStmt->value) {
-            analyzeExpression(retStmt->value.get());
+    // Tarjan's algorithm; recursion depth is bounded by the function count.
+    void connect(int v) {
+        nodes[v].index = nodes[v].lowLink = nextIndex++;
+        stack.push_back(v);
+        nodes[v].onStack = true;
+        for (int w : nodes[v].callees) {
+            if (nodes[w].index < 0) {
+                connect(w);
+                nodes[v].lowLink = std::min(nodes[v].lowLink, nodes[w].lowLink);
+            } else if (nodes[w].onStack) {
+                nodes[v].lowLink = std::min(nodes[v].lowLink, nodes[w].index);
+            }
         }
+        if (nodes[v].lowLink != nodes[v].index) return;
+        int component = static_cast<int>(componentSizes.size());
+        componentSizes.push_back(0);
+        int w;
+        do {
+            w = stack.back();
+            stack.pop_back();
+            nodes[w].onStack = false;
+            nodes[w].component = component;
+            componentSizes[component]++;
+            order.push_back(w);
+        } while (w != v);
     }
+};
 
-    DataType analyzeExpression(Expression* expr) {
-        if (!expr) return DataType::UNKNOWN;
-
-        if (auto numLit = dynamic_cast<NumberLiteral*>(expr)) {
-            return DataType::NUMBER;
-        }
+// ============================================================================
+// Tail Calls
+// ============================================================================
 
-        if (auto strLit = dynamic_cast<StringLiteral*>(expr)) {
-            return DataType::STRING;
-        }
+// A call is in tail position when the function returns its value directly:
+// `wapas f(...)`. Such a call only matters for stack depth when it can recur,
+// that is when the callee is the function itself or shares a strongly
+// connected component of the call graph with it. Those calls are marked on
+// the FunctionCall node so every engine can run them in constant stack
+// space: a self call reuses the frame and jumps back to the start of the
+// body, a mutual call replaces the frame with the callee's (a trampoline).
+class TailCallAnalysis {
+private:
+    CallGraph graph;
 
-        if (auto boolLit = dynamic_cast<BooleanLiteral*>(expr)) {
-            return DataType::BOOLEAN;
+public:
+    // Safe to rerun after the AST changes: existing marks are recomputed.
+    void analyze(Program* program) {
+        graph.build(program);
+        for (int id = 0; id < graph.size(); id++) {
+            markBlock(graph.function(id)->body, id);
         }
+    }
 
-        if (auto id = dynamic_cast<Identifier*>(expr)) {
-            Symbol sym("", DataType::UNKNOWN);
-            if (symbolTable.lookup(id->name, sym)) {
-                expr->type = sym.type;
-                return sym.type;
-            } else {
-                errors.push_back("ERROR: Undefined variable '" + id->name + "'");
-                return DataType::UNKNOWN;
+    // Whether the body contains a self tail call, ignoring nested functions.
+    static bool hasSelfTailCall(const std::vector<std::unique_ptr<Statement>>& body) {
+        for (auto& stmt : body) {
+            if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt.get())) {
+                auto funcCall = dynamic_cast<FunctionCall*>(retStmt->value.get());
+                if (funcCall && funcCall->tailCall == TailCall::SELF) return true;
+            } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                if (hasSelfTailCall(ifStmt->thenBranch) || hasSelfTailCall(ifStmt->elseBranch)) return true;
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                if (hasSelfTailCall(loopStmt->body)) return true;
             }
         }
+        return false;
+    }
 
-        if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
-            return analyzeBinaryOp(binOp);
+    // Adds the caller and callee of every mutual tail call in the body,
+    // ignoring nested functions.
+    static void collectMutualTailCalls(const std::string& caller,
+                                       const std::vector<std::unique_ptr<Statement>>& body,
+                                       std::unordered_set<std::string>& names) {
+        for (auto& stmt : body) {
+            if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt.get())) {
+                auto funcCall = dynamic_cast<FunctionCall*>(retStmt->value.get());
+                if (funcCall && funcCall->tailCall == TailCall::MUTUAL) {
+                    names.insert(caller);
+                    names.insert(funcCall->name);
+                }
+            } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                collectMutualTailCalls(caller, ifStmt->thenBranch, names);
+                collectMutualTailCalls(caller, ifStmt->elseBranch, names);
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                collectMutualTailCalls(caller, loopStmt->body, names);
+            }
         }
+    }
 
+private:
+    void markBlock(const std::vector<std::unique_ptr<Statement>>& stmts, int caller) {
+        for (auto& stmt : stmts) {
+            if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt.get())) {
+                auto funcCall = dynamic_cast<FunctionCall*>(retStmt->value.get());
+                if (!funcCall) continue;
+                funcCall->tailCall = TailCall::NONE;
+                int callee = graph.lookup(funcCall->name);
+                if (callee < 0 || graph.function(callee)->params.size() != funcCall->args.size()) continue;
+                if (callee == caller) {
+                    funcCall->tailCall = TailCall::SELF;
+                } else if (graph.component(callee) == graph.component(caller)) {
+                    funcCall->tailCall = TailCall::MUTUAL;
+                }
+            } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                markBlock(ifStmt->thenBranch, caller);
+                markBlock(ifStmt->elseBranch, caller);
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                markBlock(loopStmt->body, caller);
+            }
+        }
+    }
+};
+
+// ============================================================================
+// Escape Analysis
+// ============================================================================
+
+// An array or object literal evaluated inside a function escapes when its
+// value may outlive the call: it is returned, stored in a global or in
+// another array or object, or passed to a parameter that escapes in the
+// callee (or to a callee that is not known, or through a marked tail call,
+// which ends the frame before the callee runs). Everything else dies with
+// the call, and engines allocate it in the call's region, which is
+// released in bulk when the call returns. Literals inside a daura loop stay
+// on the heap: the region would keep every iteration's copy until the
+// call returns, while the nursery reclaims them at the next collection.
+//
+// Within a function the analysis is flow-insensitive: locals and
+// allocation sites are unified when a value moves between them, and a
+// class escapes as a whole. A name that is also a global may refer to the
+// global before its local declaration, so it always escapes. Callee
+// summaries (which parameters escape) are iterated to a fixpoint over the
+// call graph, starting from "nothing escapes".
+class EscapeAnalysis {
+private:
+    CallGraph graph;
+    std::unordered_set<std::string> globals;
+    std::unordered_set<std::string> functionNames;  // including names declared twice
+    std::vector<std::vector<bool>> paramEscapes;  // by function id
+    bool changed = false;
+
+    // Per-function state: union-find over locals and allocation sites
+    std::unordered_map<std::string, int> locals;
+    std::vector<int> parent;
+    std::vector<bool> escapes;
+    std::vector<Expression*> sites;  // nullptr for locals
+    int loopDepth = 0;
+
+public:
+    void analyze(Program* program) {
+        graph.build(program);
+        for (auto& stmt : program->statements) {
+            if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt.get())) globals.insert(varDecl->name);
+        }
+        paramEscapes.resize(graph.size());
+        for (int id = 0; id < graph.size(); id++) {
+            functionNames.insert(graph.function(id)->name);
+            paramEscapes[id].assign(graph.function(id)->params.size(), false);
+        }
+
+        do {
+            changed = false;
+            for (int id : graph.bottomUp()) analyzeFunction(id);
+        } while (changed);
+
+        // Top-level allocations may be stored in globals; they stay on the heap
+        resetState();
+        walk(program->statements);
+        for (size_t node = 0; node < sites.size(); node++) escape(static_cast<int>(node));
+        markSites();
+        for (int id = 0; id < graph.size(); id++) {
+            analyzeFunction(id);
+            markSites();
+        }
+    }
+
+private:
+    void analyzeFunction(int id) {
+        FunctionDeclaration* func = graph.function(id);
+        resetState();
+        std::unordered_set<std::string> declared(func->params.begin(), func->params.end());
+        collectLocals(func->body, declared);
+        for (const auto& name : declared) locals[name] = newNode(nullptr, globals.count(name) > 0);
+
+        walk(func->body);
+
+        for (size_t i = 0; i < func->params.size(); i++) {
+            if (!paramEscapes[id][i] && escapes[find(locals[func->params[i]])]) {
+                paramEscapes[id][i] = true;
+                changed = true;
+            }
+        }
+    }
+
+    void resetState() {
+        locals.clear();
+        parent.clear();
+        escapes.clear();
+        sites.clear();
+    }
+
+    void markSites() {
+        for (size_t node = 0; node < sites.size(); node++) {
+            bool inRegion = !escapes[find(static_cast<int>(node))];
+            if (auto arrayLit = dynamic_cast<ArrayLiteral*>(sites[node])) arrayLit->inRegion = inRegion;
+            if (auto objLit = dynamic_cast<ObjectLiteral*>(sites[node])) objLit->inRegion = inRegion;
+        }
+    }
+
+    // Variables the body declares; nested functions have their own.
+    static void collectLocals(const std::vector<std::unique_ptr<Statement>>& stmts,
+                              std::unordered_set<std::string>& out) {
+        for (auto& stmt : stmts) {
+            if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt.get())) {
+                out.insert(varDecl->name);
+            } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                collectLocals(ifStmt->thenBranch, out);
+                collectLocals(ifStmt->elseBranch, out);
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                collectLocals(loopStmt->body, out);
+            }
+        }
+    }
+
+    int newNode(Expression* site, bool escaped) {
+        parent.push_back(static_cast<int>(parent.size()));
+        escapes.push_back(escaped);
+        sites.push_back(site);
+        return parent.back();
+    }
+
+    int find(int node) {
+        while (parent[node] != node) {
+            parent[node] = parent[parent[node]];
+            node = parent[node];
+        }
+        return node;
+    }
+
+    void unite(int a, int b) {
+        if (a < 0 || b < 0) return;
+        a = find(a);
+        b = find(b);
+        if (a == b) return;
+        parent[b] = a;
+        escapes[a] = escapes[a] || escapes[b];
+    }
+
+    void escape(int node) {
+        if (node >= 0) escapes[find(node)] = true;
+    }
+
+    int local(const std::string& name) const {
+        auto it = locals.find(name);
+        return it != locals.end() ? it->second : -1;
+    }
+
+    void walk(const std::vector<std::unique_ptr<Statement>>& stmts) {
+        for (auto& stmt : stmts) {
+            if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt.get())) {
+                unite(local(varDecl->name), walk(varDecl->initializer.get()));
+            } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                walk(ifStmt->condition.get());
+                walk(ifStmt->thenBranch);
+                walk(ifStmt->elseBranch);
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                loopDepth++;
+                walk(loopStmt->condition.get());
+                walk(loopStmt->body);
+                loopDepth--;
+            } else if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt.get())) {
+                escape(walk(retStmt->value.get()));
+            } else if (auto exprStmt = dynamic_cast<ExpressionStatement*>(stmt.get())) {
+                walk(exprStmt->expr.get());
+            }
+        }
+    }
+
+    // The node whose allocations the expression's value may be, or -1 when
+    // it is never one of this call's arrays or objects: call results and
+    // elements are heap values, operators produce numbers, booleans and
+    // new strings.
+    int walk(Expression* expr) {
+        if (!expr) return -1;
+        if (auto id = dynamic_cast<Identifier*>(expr)) return local(id->name);
+        if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            walk(binOp->left.get());
+            walk(binOp->right.get());
+            return -1;
+        }
         if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) {
-            return analyzeUnaryOp(unaryOp);
+            walk(unaryOp->operand.get());
+            return -1;
+        }
+        if (auto assign = dynamic_cast<Assignment*>(expr)) {
+            int value = walk(assign->value.get());
+            int target = local(assign->name);
+            if (target >= 0) {
+                unite(target, value);
+            } else {
+                escape(value);
+            }
+            return value;
+        }
+        if (auto funcCall = dynamic_cast<FunctionCall*>(expr)) {
+            int callee = graph.lookup(funcCall->name);
+            bool known = callee >= 0 && funcCall->tailCall == TailCall::NONE &&
+                         graph.function(callee)->params.size() == funcCall->args.size();
+            // Builtins keep none of their arguments
+            bool builtin = callee < 0 && !functionNames.count(funcCall->name);
+            for (size_t i = 0; i < funcCall->args.size(); i++) {
+                int arg = walk(funcCall->args[i].get());
+                if (!builtin && (!known || paramEscapes[callee][i])) escape(arg);
+            }
+            return -1;
+        }
+        if (auto arrayLit = dynamic_cast<ArrayLiteral*>(expr)) {
+            for (auto& element : arrayLit->elements) escape(walk(element.get()));
+            return newNode(arrayLit, loopDepth > 0);
+        }
+        if (auto objLit = dynamic_cast<ObjectLiteral*>(expr)) {
+            for (auto& member : objLit->members) escape(walk(member.second.get()));
+            return newNode(objLit, loopDepth > 0);
+        }
+        if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr)) {
+            walk(arrAccess->index.get());
+            return -1;
+        }
+        if (auto indexAssign = dynamic_cast<IndexAssignment*>(expr)) {
+            // The array may be any array, so what is stored in it escapes
+            walk(indexAssign->index.get());
+            escape(walk(indexAssign->value.get()));
+            return -1;
+        }
+        if (auto memberAssign = dynamic_cast<MemberAssignment*>(expr)) {
+            escape(walk(memberAssign->value.get()));
+            return -1;
+        }
+        return -1;
+    }
+};
+
+// ============================================================================
+// Semantic Analyzer
+// ============================================================================
+
+// map(a, f) needs an f the analyzer can reduce to postfix arithmetic on its
+// parameter (see ArrayLambda); evaluating it may hold at most this many
+// values at once.
+const int MAP_STACK_LIMIT = 16;
+
+class SemanticAnalyzer {
+private:
+    SymbolTable symbolTable;
+    std::vector<std::string> errors;
+    DataType currentReturnType;
+    bool inFunction;
+    std::unordered_map<std::string, FunctionDeclaration*> functions;
+
+public:
+    SemanticAnalyzer() : currentReturnType(DataType::VOID), inFunction(false) {}
+
+    bool analyze(Program* program) {
+        try {
+            for (auto& stmt : program->statements) {
+                analyzeStatement(stmt.get());
+            }
+
+            // Check if main function exists
+            Symbol mainSym("", DataType::VOID);
+            if (!symbolTable.lookup("main", mainSym)) {
+                errors.push_back("ERROR: Main function 'kaam main()' not found");
+                return false;
+            }
+
+            if (errors.empty()) {
+                // Refine NUMBER into its integral sub-kind on every expression;
+                // the PassManager adds the remaining annotations
+                IntegralInference().analyze(program);
+            }
+            return errors.empty();
+        } catch (const std::exception& e) {
+            errors.push_back("EXCEPTION: " + std::string(e.what()));
+            return false;
+        }
+    }
+
+    const std::vector<std::string>& getErrors() const {
+        return errors;
+    }
+
+private:
+    void analyzeStatement(Statement* stmt) {
+        if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt)) {
+            analyzeVariableDeclaration(varDecl);
+        } else if (auto funcDecl = dynamic_cast<FunctionDeclaration*>(stmt)) {
+            analyzeFunctionDeclaration(funcDecl);
+        } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt)) {
+            analyzeIfStatement(ifStmt);
+        } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt)) {
+            analyzeLoopStatement(loopStmt);
+        } else if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt)) {
+            analyzeReturnStatement(retStmt);
+        } else if (auto exprStmt = dynamic_cast<ExpressionStatement*>(stmt)) {
+            analyzeExpression(exprStmt->expr.get());
+        }
+    }
+
+    void analyzeVariableDeclaration(VariableDeclaration* varDecl) {
+        DataType varType = DataType::UNKNOWN;
+
+        if (varDecl->initializer) {
+            varType = analyzeExpression(varDecl->initializer.get());
+        }
+
+        if (!symbolTable.define(varDecl->name, varType)) {
+            errors.push_back("ERROR: Variable '" + varDecl->name + "' already defined in current scope");
+        } else {
+            std::vector<std::string> keys;
+            bool known = varDecl->initializer && objectKeysOf(varDecl->initializer.get(), keys);
+            symbolTable.setObjectKeys(varDecl->name, known ? &keys : nullptr);
+        }
+    }
+
+    // The keys of the object an expression evaluates to, when they are known
+    // at this point: a literal, or a variable holding a known literal.
+    bool objectKeysOf(Expression* expr, std::vector<std::string>& keys) {
+        if (auto objLit = dynamic_cast<ObjectLiteral*>(expr)) {
+            for (const auto& member : objLit->members) keys.push_back(member.first);
+            return true;
+        }
+        Symbol sym("", DataType::UNKNOWN);
+        auto id = dynamic_cast<Identifier*>(expr);
+        if (!id || !symbolTable.lookup(id->name, sym) || !sym.keysKnown) return false;
+        keys = sym.objectKeys;
+        return true;
+    }
+
+    static void collectAssigned(Statement* stmt, std::unordered_set<std::string>& names) {
+        if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt)) {
+            collectAssigned(varDecl->initializer.get(), names);
+        } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt)) {
+            collectAssigned(ifStmt->condition.get(), names);
+            for (auto& s : ifStmt->thenBranch) collectAssigned(s.get(), names);
+            for (auto& s : ifStmt->elseBranch) collectAssigned(s.get(), names);
+        } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt)) {
+            collectAssigned(loopStmt->condition.get(), names);
+            for (auto& s : loopStmt->body) collectAssigned(s.get(), names);
+        } else if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt)) {
+            collectAssigned(retStmt->value.get(), names);
+        } else if (auto exprStmt = dynamic_cast<ExpressionStatement*>(stmt)) {
+            collectAssigned(exprStmt->expr.get(), names);
+        }
+    }
+
+    static void collectAssigned(Expression* expr, std::unordered_set<std::string>& names) {
+        if (auto assign = dynamic_cast<Assignment*>(expr)) {
+            names.insert(assign->name);
+            collectAssigned(assign->value.get(), names);
+        } else if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            collectAssigned(binOp->left.get(), names);
+            collectAssigned(binOp->right.get(), names);
+        } else if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) {
+            collectAssigned(unaryOp->operand.get(), names);
+        } else if (auto funcCall = dynamic_cast<FunctionCall*>(expr)) {
+            for (auto& arg : funcCall->args) collectAssigned(arg.get(), names);
+        } else if (auto arrayLit = dynamic_cast<ArrayLiteral*>(expr)) {
+            for (auto& element : arrayLit->elements) collectAssigned(element.get(), names);
+        } else if (auto objLit = dynamic_cast<ObjectLiteral*>(expr)) {
+            for (auto& member : objLit->members) collectAssigned(member.second.get(), names);
+        } else if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr)) {
+            collectAssigned(arrAccess->index.get(), names);
+        } else if (auto indexAssign = dynamic_cast<IndexAssignment*>(expr)) {
+            collectAssigned(indexAssign->index.get(), names);
+            collectAssigned(indexAssign->value.get(), names);
+        } else if (auto memberAssign = dynamic_cast<MemberAssignment*>(expr)) {
+            collectAssigned(memberAssign->value.get(), names);
+        }
+    }
+
+    // Looks up the object behind `obj.key`; an error when the variable cannot
+    // hold an object or its literal lacks the key. Inside a function a
+    // global's keys are not trusted, since code elsewhere may reassign it
+    // before the call.
+    void checkMember(const std::string& objectName, const std::string& member) {
+        Symbol sym("", DataType::UNKNOWN);
+        if (!symbolTable.lookup(objectName, sym)) {
+            errors.push_back("ERROR: Undefined object '" + objectName + "'");
+            return;
+        }
+        if (inFunction && symbolTable.isGlobal(objectName)) sym.keysKnown = false;
+        if (sym.type != DataType::OBJECT && sym.type != DataType::UNKNOWN) {
+            errors.push_back("ERROR: Cannot access member '" + member + "' of non-object '" + objectName + "'");
+            return;
+        }
+        if (sym.keysKnown &&
+            std::find(sym.objectKeys.begin(), sym.objectKeys.end(), member) == sym.objectKeys.end()) {
+            errors.push_back("ERROR: Object '" + objectName + "' has no member '" + member + "'");
+        }
+    }
+
+    void analyzeFunctionDeclaration(FunctionDeclaration* funcDecl) {
+        // Define function with its parameters
+        // The engines and optimizer take a call to a builtin's name for the builtin
+        Symbol existing("", DataType::UNKNOWN);
+        if (symbolTable.lookup(funcDecl->name, existing) && existing.isFunction && !functions.count(funcDecl->name)) {
+            errors.push_back("ERROR: Function '" + funcDecl->name + "' has the name of a builtin");
+        }
+        // The engines resolve calls by name, so one name is one function
+        if (functions.count(funcDecl->name)) {
+            errors.push_back("ERROR: Function '" + funcDecl->name + "' is already defined");
+        }
+        std::vector<DataType> paramTypes(funcDecl->params.size(), DataType::UNKNOWN);
+        symbolTable.addFunctionSignature(funcDecl->name, paramTypes, DataType::VOID);
+        functions[funcDecl->name] = funcDecl;
+
+        // Enter function scope; the locals of an enclosing function stay hidden
+        symbolTable.enterFunction();
+        bool prevInFunction = inFunction;
+        DataType prevReturnType = currentReturnType;
+        inFunction = true;
+        currentReturnType = DataType::UNKNOWN;
+
+        // Define parameters in new scope
+        for (const auto& param : funcDecl->params) {
+            symbolTable.define(param, DataType::UNKNOWN);
+        }
+
+        // Analyze function body
+        for (auto& stmt : funcDecl->body) {
+            analyzeStatement(stmt.get());
+        }
+
+        inFunction = prevInFunction;
+        currentReturnType = prevReturnType;
+        symbolTable.exitFunction();
+    }
+
+    void analyzeIfStatement(IfStatement* ifStmt) {
+        DataType condType = analyzeExpression(ifStmt->condition.get());
+        if (condType != DataType::BOOLEAN && condType != DataType::UNKNOWN && condType != DataType::VOID) {
+            errors.push_back("ERROR: If condition must be boolean, got " + dataTypeToString(condType));
+        }
+
+        symbolTable.enterScope();
+        for (auto& stmt : ifStmt->thenBranch) {
+            analyzeStatement(stmt.get());
+        }
+        symbolTable.exitScope();
+
+        if (!ifStmt->elseBranch.empty()) {
+            symbolTable.enterScope();
+            for (auto& stmt : ifStmt->elseBranch) {
+                analyzeStatement(stmt.get());
+            }
+            symbolTable.exitScope();
+        }
+    }
+
+    void analyzeLoopStatement(LoopStatement* loopStmt) {
+        // A later iteration sees what the body assigns, so those objects'
+        // keys are unknown throughout the loop
+        std::unordered_set<std::string> assigned;
+        collectAssigned(loopStmt->condition.get(), assigned);
+        for (auto& stmt : loopStmt->body) collectAssigned(stmt.get(), assigned);
+        for (const auto& name : assigned) symbolTable.setObjectKeys(name, nullptr);
+
+        DataType condType = analyzeExpression(loopStmt->condition.get());
+        if (condType != DataType::BOOLEAN && condType != DataType::UNKNOWN && condType != DataType::VOID) {
+            errors.push_back("ERROR: Loop condition must be boolean, got " + dataTypeToString(condType));
+        }
+
+        symbolTable.enterScope();
+        for (auto& stmt : loopStmt->body) {
+            analyzeStatement(stmt.get());
         }
+        symbolTable.exitScope();
+    }
+
+    void analyzeReturnStatement(ReturnStatement* retStmt) {
+        if (!inFunction) {
+            errors.push_back("ERROR: Return statement outside function");
+            return;
+        }
+
+        if (retStmt->value) {
+            analyzeExpression(retStmt->value.get());
+        }
+    }
+
+    DataType analyzeExpression(Expression* expr) {
+        if (!expr) return DataType::UNKNOWN;
+
+        if (auto numLit = dynamic_cast<NumberLiteral*>(expr)) {
+            return DataType::NUMBER;
+        }
+
+        if (auto strLit = dynamic_cast<StringLiteral*>(expr)) {
+            return DataType::STRING;
+        }
+
+        if (auto boolLit = dynamic_cast<BooleanLiteral*>(expr)) {
+            return DataType::BOOLEAN;
+        }
+
+        if (auto id = dynamic_cast<Identifier*>(expr)) {
+            Symbol sym("", DataType::UNKNOWN);
+            if (symbolTable.lookup(id->name, sym)) {
+                expr->type = sym.type;
+                return sym.type;
+            } else {
+                errors.push_back("ERROR: Undefined variable '" + id->name + "'");
+                return DataType::UNKNOWN;
+            }
+        }
+
+        if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            return analyzeBinaryOp(binOp);
+        }
+
+        if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) {
+            return analyzeUnaryOp(unaryOp);
+        }
+
+        if (auto assign = dynamic_cast<Assignment*>(expr)) {
+            return analyzeAssignment(assign);
+        }
+
+        if (auto funcCall = dynamic_cast<FunctionCall*>(expr)) {
+            return analyzeFunctionCall(funcCall);
+        }
+
+        if (auto arrayLit = dynamic_cast<ArrayLiteral*>(expr)) {
+            return DataType::ARRAY;
+        }
+
+        if (auto objLit = dynamic_cast<ObjectLiteral*>(expr)) {
+            std::unordered_set<std::string> seen;
+            for (auto& member : objLit->members) {
+                if (!seen.insert(member.first).second) {
+                    errors.push_back("ERROR: Duplicate member '" + member.first + "' in object literal");
+                }
+                analyzeExpression(member.second.get());
+            }
+            return DataType::OBJECT;
+        }
+
+        if (auto memberAccess = dynamic_cast<MemberAccess*>(expr)) {
+            checkMember(memberAccess->objectName, memberAccess->member);
+            return DataType::UNKNOWN;  // Member types are not tracked
+        }
+
+        if (auto memberAssign = dynamic_cast<MemberAssignment*>(expr)) {
+            checkMember(memberAssign->objectName, memberAssign->member);
+            return analyzeExpression(memberAssign->value.get());
+        }
+
+        if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr)) {
+            Symbol sym("", DataType::UNKNOWN);
+            if (symbolTable.lookup(arrAccess->arrayName, sym)) {
+                if (sym.type != DataType::ARRAY && sym.type != DataType::UNKNOWN) {
+                    errors.push_back("ERROR: Cannot index non-array type '" + arrAccess->arrayName + "'");
+                }
+                DataType indexType = analyzeExpression(arrAccess->index.get());
+                if (indexType != DataType::NUMBER && indexType != DataType::UNKNOWN) {
+                    errors.push_back("ERROR: Array index must be number, got " + dataTypeToString(indexType));
+                }
+                return DataType::UNKNOWN; // Element type unknown
+            } else {
+                errors.push_back("ERROR: Undefined array '" + arrAccess->arrayName + "'");
+                return DataType::UNKNOWN;
+            }
+        }
+
+        if (auto indexAssign = dynamic_cast<IndexAssignment*>(expr)) {
+            Symbol sym("", DataType::UNKNOWN);
+            if (!symbolTable.lookup(indexAssign->arrayName, sym)) {
+                errors.push_back("ERROR: Undefined array '" + indexAssign->arrayName + "'");
+                return DataType::UNKNOWN;
+            }
+            if (sym.type != DataType::ARRAY && sym.type != DataType::UNKNOWN) {
+                errors.push_back("ERROR: Cannot assign to an element of non-array '" + indexAssign->arrayName + "'");
+            }
+            DataType indexType = analyzeExpression(indexAssign->index.get());
+            if (indexType != DataType::NUMBER && indexType != DataType::UNKNOWN) {
+                errors.push_back("ERROR: Array index must be number, got " + dataTypeToString(indexType));
+            }
+            return analyzeExpression(indexAssign->value.get());
+        }
+
+        return DataType::UNKNOWN;
+    }
+
+    DataType analyzeBinaryOp(BinaryOp* binOp) {
+        DataType leftType = analyzeExpression(binOp->left.get());
+        DataType rightType = analyzeExpression(binOp->right.get());
+
+        // Arithmetic operators
+        if (binOp->op == "+" || binOp->op == "-" || binOp->op == "*" ||
+            binOp->op == "/" || binOp->op == "%") {
+            // Allow void or unknown for recursive function calls
+            if (leftType != DataType::NUMBER && leftType != DataType::UNKNOWN && leftType != DataType::VOID) {
+                errors.push_back("ERROR: Left operand of '" + binOp->op + "' must be number");
+            }
+            if (rightType != DataType::NUMBER && rightType != DataType::UNKNOWN && rightType != DataType::VOID) {
+                errors.push_back("ERROR: Right operand of '" + binOp->op + "' must be number");
+            }
+            return DataType::NUMBER;
+        }
+
+        // Comparison operators
+        if (binOp->op == "<" || binOp->op == "<=" || binOp->op == ">" || binOp->op == ">=") {
+            if (leftType != DataType::NUMBER && leftType != DataType::UNKNOWN) {
+                errors.push_back("ERROR: Left operand of '" + binOp->op + "' must be number");
+            }
+            if (rightType != DataType::NUMBER && rightType != DataType::UNKNOWN) {
+                errors.push_back("ERROR: Right operand of '" + binOp->op + "' must be number");
+            }
+            return DataType::BOOLEAN;
+        }
+
+        // Equality operators
+        if (binOp->op == "==" || binOp->op == "!=") {
+            return DataType::BOOLEAN;
+        }
+
+        // Logical operators
+        if (binOp->shortCircuit) {
+            if (leftType != DataType::BOOLEAN && leftType != DataType::UNKNOWN) {
+                errors.push_back("ERROR: Left operand of '" + binOp->op + "' must be boolean");
+            }
+            if (rightType != DataType::BOOLEAN && rightType != DataType::UNKNOWN) {
+                errors.push_back("ERROR: Right operand of '" + binOp->op + "' must be boolean");
+            }
+            return DataType::BOOLEAN;
+        }
+
+        return DataType::UNKNOWN;
+    }
+
+    DataType analyzeUnaryOp(UnaryOp* unaryOp) {
+        DataType operandType = analyzeExpression(unaryOp->operand.get());
+
+        if (unaryOp->op == "-") {
+            if (operandType != DataType::NUMBER && operandType != DataType::UNKNOWN) {
+                errors.push_back("ERROR: Operand of '-' must be number");
+            }
+            return DataType::NUMBER;
+        }
+
+        if (unaryOp->op == "!") {
+            if (operandType != DataType::BOOLEAN && operandType != DataType::UNKNOWN) {
+                errors.push_back("ERROR: Operand of '!' must be boolean");
+            }
+            return DataType::BOOLEAN;
+        }
+
+        return DataType::UNKNOWN;
+    }
+
+    DataType analyzeAssignment(Assignment* assign) {
+        Symbol sym("", DataType::UNKNOWN);
+        if (!symbolTable.lookup(assign->name, sym)) {
+            errors.push_back("ERROR: Undefined variable '" + assign->name + "'");
+            return DataType::UNKNOWN;
+        }
+
+        DataType valueType = analyzeExpression(assign->value.get());
+
+        if (sym.type != DataType::UNKNOWN && valueType != DataType::UNKNOWN &&
+            sym.type != valueType) {
+            errors.push_back("ERROR: Type mismatch in assignment to '" + assign->name +
+                           "': expected " + dataTypeToString(sym.type) +
+                           ", got " + dataTypeToString(valueType));
+        }
+
+        symbolTable.update(assign->name);
+        // Only an object with the same keys keeps them known: the assignment
+        // may sit in a branch that does not run
+        std::vector<std::string> keys;
+        if (sym.keysKnown && (!objectKeysOf(assign->value.get(), keys) || keys != sym.objectKeys)) {
+            symbolTable.setObjectKeys(assign->name, nullptr);
+        }
+        return valueType;
+    }
+
+    DataType analyzeFunctionCall(FunctionCall* funcCall) {
+        Symbol funcSym("", DataType::VOID);
+        if (!symbolTable.lookup(funcCall->name, funcSym)) {
+            errors.push_back("ERROR: Undefined function '" + funcCall->name + "'");
+            return DataType::UNKNOWN;
+        }
+
+        if (!funcSym.isFunction) {
+            errors.push_back("ERROR: '" + funcCall->name + "' is not a function");
+            return DataType::UNKNOWN;
+        }
+
+        // Check argument count for built-ins
+        if (funcCall->name == "dekh") {
+            for (auto& arg : funcCall->args) {
+                analyzeExpression(arg.get());
+            }
+            return DataType::VOID;
+        }
+
+        if (funcCall->name == "lou") {
+            if (!funcCall->args.empty()) {
+                analyzeExpression(funcCall->args[0].get());
+            }
+            return DataType::NUMBER;
+        }
+
+        if (funcCall->name == "nikal") {
+            if (funcCall->args.size() != 1) {
+                errors.push_back("ERROR: nikal() expects 1 argument, got " + std::to_string(funcCall->args.size()));
+            } else {
+                analyzeExpression(funcCall->args[0].get());
+            }
+            return DataType::NUMBER;
+        }
+
+        if (funcCall->name == "band") {
+            return DataType::VOID;
+        }
+
+        if (funcCall->name == "abs" || funcCall->name == "sqrt" || funcCall->name == "round") {
+            if (funcCall->args.size() != 1) {
+                errors.push_back("ERROR: " + funcCall->name + "() expects 1 argument");
+            } else {
+                DataType argType = analyzeExpression(funcCall->args[0].get());
+                if (argType != DataType::NUMBER && argType != DataType::UNKNOWN) {
+                    errors.push_back("ERROR: " + funcCall->name + "() expects number argument");
+                }
+            }
+            return DataType::NUMBER;
+        }
+
+        if (funcCall->name == "pow" || funcCall->name == "max" || funcCall->name == "min") {
+            if (funcCall->args.size() != 2) {
+                errors.push_back("ERROR: " + funcCall->name + "() expects 2 arguments");
+            } else {
+                for (auto& arg : funcCall->args) {
+                    DataType argType = analyzeExpression(arg.get());
+                    if (argType != DataType::NUMBER && argType != DataType::UNKNOWN) {
+                        errors.push_back("ERROR: " + funcCall->name + "() expects number arguments");
+                    }
+                }
+            }
+            return DataType::NUMBER;
+        }
+
+        if (funcCall->name == "random") {
+            return DataType::NUMBER;
+        }
+
+        if (funcCall->name == "sum" || funcCall->name == "minval" || funcCall->name == "maxval" ||
+            funcCall->name == "dot") {
+            size_t arity = funcCall->name == "dot" ? 2 : 1;
+            if (funcCall->args.size() != arity) {
+                errors.push_back("ERROR: " + funcCall->name + "() expects " + std::to_string(arity) +
+                                 (arity == 1 ? " argument" : " arguments"));
+            } else {
+                for (auto& arg : funcCall->args) {
+                    DataType argType = analyzeExpression(arg.get());
+                    if (argType != DataType::ARRAY && argType != DataType::UNKNOWN) {
+                        errors.push_back("ERROR: " + funcCall->name + "() expects array " +
+                                         (arity == 1 ? "argument" : "arguments"));
+                    }
+                }
+            }
+            return DataType::NUMBER;
+        }
+
+        if (funcCall->name == "scale" || funcCall->name == "map") {
+            if (funcCall->args.size() != 2) {
+                errors.push_back("ERROR: " + funcCall->name + "() expects 2 arguments");
+                return DataType::ARRAY;
+            }
+            DataType arrayType = analyzeExpression(funcCall->args[0].get());
+            if (arrayType != DataType::ARRAY && arrayType != DataType::UNKNOWN) {
+                errors.push_back("ERROR: " + funcCall->name + "() expects an array as its first argument");
+            }
+            if (funcCall->name == "scale") {
+                DataType factorType = analyzeExpression(funcCall->args[1].get());
+                if (factorType != DataType::NUMBER && factorType != DataType::UNKNOWN) {
+                    errors.push_back("ERROR: scale() expects a number as its second argument");
+                }
+                return DataType::ARRAY;
+            }
+            // The function becomes the postfix text the runtime evaluates
+            std::string program;
+            if (!mapFunction(funcCall->args[1].get(), program)) {
+                errors.push_back("ERROR: map() needs a function of one parameter that returns arithmetic on it");
+            } else {
+                funcCall->args[1] = std::make_unique<StringLiteral>(program);
+            }
+            return DataType::ARRAY;
+        }
+
+        // User-defined function
+        if (funcCall->args.size() != funcSym.paramTypes.size()) {
+            errors.push_back("ERROR: Function '" + funcCall->name + "' expects " +
+                           std::to_string(funcSym.paramTypes.size()) + " arguments, got " +
+                           std::to_string(funcCall->args.size()));
+        }
+
+        for (auto& arg : funcCall->args) {
+            analyzeExpression(arg.get());
+        }
+
+        return funcSym.returnType;
+    }
+
+    // A function declared so far whose body is `wapas <expr>`, with expr
+    // built from its one parameter, number literals, + - * /, unary - and
+    // sqrt() or abs(); `program` gets expr in ArrayLambda's postfix text.
+    bool mapFunction(Expression* arg, std::string& program) {
+        auto id = dynamic_cast<Identifier*>(arg);
+        Symbol sym("", DataType::UNKNOWN);
+        if (!id || !symbolTable.lookup(id->name, sym) || !sym.isFunction) return false;
+        auto found = functions.find(id->name);
+        if (found == functions.end()) return false;
+        FunctionDeclaration* func = found->second;
+        if (func->params.size() != 1 || func->body.size() != 1) return false;
+        auto retStmt = dynamic_cast<ReturnStatement*>(func->body[0].get());
+        if (!retStmt || !retStmt->value) return false;
+        int depth = 0, maxDepth = 0;
+        return postfix(retStmt->value.get(), func->params[0], program, depth, maxDepth) &&
+               maxDepth <= MAP_STACK_LIMIT;
+    }
+
+    static bool postfix(const Expression* expr, const std::string& param, std::string& program,
+                        int& depth, int& maxDepth) {
+        auto emit = [&](const std::string& token, int pushes) {
+            program += (program.empty() ? "" : " ") + token;
+            depth += pushes;
+            maxDepth = std::max(maxDepth, depth);
+            return true;
+        };
+        if (auto numLit = dynamic_cast<const NumberLiteral*>(expr)) {
+            std::ostringstream text;
+            text << std::hexfloat << numLit->value;
+            return emit(text.str(), 1);
+        }
+        if (auto id = dynamic_cast<const Identifier*>(expr)) {
+            return id->name == param && emit("x", 1);
+        }
+        if (auto binOp = dynamic_cast<const BinaryOp*>(expr)) {
+            const std::string& op = binOp->op;
+            if (op != "+" && op != "-" && op != "*" && op != "/") return false;
+            return postfix(binOp->left.get(), param, program, depth, maxDepth) &&
+                   postfix(binOp->right.get(), param, program, depth, maxDepth) && emit(op, -1);
+        }
+        if (auto unaryOp = dynamic_cast<const UnaryOp*>(expr)) {
+            return unaryOp->op == "-" && postfix(unaryOp->operand.get(), param, program, depth, maxDepth) &&
+                   emit("neg", 0);
+        }
+        if (auto funcCall = dynamic_cast<const FunctionCall*>(expr)) {
+            return (funcCall->name == "sqrt" || funcCall->name == "abs") && funcCall->args.size() == 1 &&
+                   postfix(funcCall->args[0].get(), param, program, depth, maxDepth) && emit(funcCall->name, 0);
+        }
+        return false;
+    }
+};
+
+// ============================================================================
+// Runtime Values (NaN-boxed)
+// ============================================================================
+
+enum class ObjKind {
+    STRING, ARRAY, OBJECT
+};
+
+// Where an object lives; see Heap.
+enum class Generation : uint8_t {
+    NURSERY, OLD, REGION, PERMANENT
+};
+
+struct HeapObject {
+    ObjKind kind;
+    Generation generation;
+    bool marked;                    // reached by the running major collection
+    std::atomic<bool> remembered;   // an old object in the remembered set
+    HeapObject* next;               // old objects: the next one; promoted nursery objects: the copy
+
+    HeapObject(ObjKind k) : kind(k), generation(Generation::NURSERY), marked(false), remembered(false), next(nullptr) {}
+    // A copy is a new object; the heap decides where it lives.
+    HeapObject(const HeapObject& other) : HeapObject(other.kind) {}
+    virtual ~HeapObject() = default;
+};
+
+// Up to 2^53 every integer is exact as a double, so int64 and double
+// arithmetic agree on it.
+const int64_t EXACT_INTEGER_LIMIT = int64_t(1) << 53;
+
+inline bool isExactInteger(double d) {
+    return d >= -static_cast<double>(EXACT_INTEGER_LIMIT) && d <= static_cast<double>(EXACT_INTEGER_LIMIT) &&
+           static_cast<double>(static_cast<int64_t>(d)) == d && !(d == 0 && std::signbit(d));
+}
+
+// Every runtime value fits in 8 bytes. Numbers are stored as raw IEEE doubles;
+// everything else is packed into the quiet-NaN space:
+//   nil / na / haan   QNAN | 1, 2, 3
+//   heap object       SIGN | QNAN | 48-bit pointer
+// Arithmetic on numbers therefore never allocates.
+class Value {
+private:
+    uint64_t bits;
+
+    static constexpr uint64_t SIGN_BIT = 0x8000000000000000ULL;
+    static constexpr uint64_t QNAN = 0x7ffc000000000000ULL;
+    static constexpr uint64_t TAG_NIL = 1;
+    static constexpr uint64_t TAG_FALSE = 2;
+    static constexpr uint64_t TAG_TRUE = 3;
+
+public:
+    Value() : bits(QNAN | TAG_NIL) {}
+
+    static Value number(double d) {
+        Value v;
+        std::memcpy(&v.bits, &d, sizeof(d));
+        return v;
+    }
+
+    // Integer kernels keep int64 values in registers; such a Value is only
+    // meaningful to the kernel instructions and never escapes a kernel.
+    static Value integer(int64_t i) {
+        Value v;
+        v.bits = static_cast<uint64_t>(i);
+        return v;
+    }
+
+    static Value boolean(bool b) {
+        Value v;
+        v.bits = QNAN | (b ? TAG_TRUE : TAG_FALSE);
+        return v;
+    }
+
+    static Value nil() {
+        return Value();
+    }
+
+    static Value object(HeapObject* obj) {
+        Value v;
+        v.bits = SIGN_BIT | QNAN | static_cast<uint64_t>(reinterpret_cast<uintptr_t>(obj));
+        return v;
+    }
+
+    bool isNumber() const { return (bits & QNAN) != QNAN; }
+    bool isNil() const { return bits == (QNAN | TAG_NIL); }
+    bool isBool() const { return (bits | 1) == (QNAN | TAG_TRUE); }
+    bool isObject() const { return (bits & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT); }
+
+    double asNumber() const {
+        double d;
+        std::memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+
+    int64_t asInteger() const { return static_cast<int64_t>(bits); }
+
+    bool asBool() const { return bits == (QNAN | TAG_TRUE); }
+
+    HeapObject* asObject() const {
+        return reinterpret_cast<HeapObject*>(static_cast<uintptr_t>(bits & ~(SIGN_BIT | QNAN)));
+    }
+
+    bool isObjKind(ObjKind kind) const { return isObject() && asObject()->kind == kind; }
+    bool isString() const { return isObjKind(ObjKind::STRING); }
+    bool isArray() const { return isObjKind(ObjKind::ARRAY); }
+    bool isRecord() const { return isObjKind(ObjKind::OBJECT); }
+
+    uint64_t raw() const { return bits; }
+    bool sameAs(Value other) const { return bits == other.bits; }
+};
+
+static_assert(sizeof(Value) == 8, "Value must stay NaN-boxed in 8 bytes");
+
+// Strings never change once built. Up to INLINE_CAPACITY bytes are stored
+// in the object itself, longer text in one buffer of its own. A long result
+// of `+` is a rope node holding its two halves until its characters are
+// first read, when it is flattened into a buffer; a string built up piece
+// by piece is then copied once instead of once per step. The length is
+// known without flattening and the hash is computed at most once. Interned
+// strings (Runtime::intern) are unique per content, so two of them are
+// equal exactly when they are the same object.
+class StringObject : public HeapObject {
+public:
+    static constexpr size_t INLINE_CAPACITY = 15;
+
+    bool interned = false;
+
+    explicit StringObject(std::string_view s) : HeapObject(ObjKind::STRING), len(s.size()) {
+        if (len > INLINE_CAPACITY) large = std::make_unique<char[]>(len);
+        std::memcpy(len > INLINE_CAPACITY ? large.get() : inlineChars, s.data(), len);
+        flat.store(true, std::memory_order_relaxed);
+    }
+
+    // left + right. Ropes are always longer than INLINE_CAPACITY, so the
+    // halves of a short result are flat and copied at once.
+    StringObject(const StringObject* left, const StringObject* right)
+        : HeapObject(ObjKind::STRING), len(left->len + right->len) {
+        if (len > INLINE_CAPACITY) {
+            halves[0] = left;
+            halves[1] = right;
+            return;
+        }
+        std::memcpy(inlineChars, left->inlineChars, left->len);
+        std::memcpy(inlineChars + left->len, right->inlineChars, right->len);
+        flat.store(true, std::memory_order_relaxed);
+    }
+
+    StringObject(StringObject&& other) noexcept
+        : HeapObject(other), interned(other.interned), len(other.len),
+          hashCode(other.hashCode.load(std::memory_order_relaxed)),
+          flat(other.flat.load(std::memory_order_relaxed)), large(std::move(other.large)) {
+        std::memcpy(inlineChars, other.inlineChars, sizeof(inlineChars));
+    }
+
+    size_t length() const { return len; }
+
+    bool isRope() const { return !flat.load(std::memory_order_acquire); }
+
+    std::string_view view() const {
+        if (isRope()) flatten();
+        return {len > INLINE_CAPACITY ? large.get() : inlineChars, len};
+    }
+
+    size_t hash() const {
+        size_t h = hashCode.load(std::memory_order_relaxed);
+        if (h == 0) {
+            h = std::max<size_t>(std::hash<std::string_view>()(view()), 1);
+            hashCode.store(h, std::memory_order_relaxed);
+        }
+        return h;
+    }
+
+    // Whether hash() is already known; 0 is never a computed hash.
+    bool hashed() const { return hashCode.load(std::memory_order_relaxed) != 0; }
+
+private:
+    friend class Heap;  // moves rope halves
+
+    size_t len;
+    mutable std::atomic<size_t> hashCode{0};
+    mutable std::atomic<bool> flat{false};
+    union {
+        char inlineChars[INLINE_CAPACITY + 1];
+        const StringObject* halves[2];
+    };
+    mutable std::unique_ptr<char[]> large;
+
+    // Parallel loop workers may read the same rope, so it is flattened once
+    // under a lock. The walk keeps its own stack: a string built by a long
+    // loop is a rope as deep as the loop ran.
+    void flatten() const {
+        static std::mutex lock;
+        std::lock_guard<std::mutex> guard(lock);
+        if (!isRope()) return;
+        auto chars = std::make_unique<char[]>(len);
+        size_t at = 0;
+        std::vector<const StringObject*> pending{this};
+        while (!pending.empty()) {
+            const StringObject* node = pending.back();
+            pending.pop_back();
+            if (node->isRope()) {
+                pending.push_back(node->halves[1]);
+                pending.push_back(node->halves[0]);
+                continue;
+            }
+            std::memcpy(chars.get() + at, node->len > INLINE_CAPACITY ? node->large.get() : node->inlineChars,
+                        node->len);
+            at += node->len;
+        }
+        large = std::move(chars);
+        flat.store(true, std::memory_order_release);
+    }
+};
+
+// What the elements of an array are known to be. Kinds only widen: storing
+// a fraction (or -0, or an integer past 2^53) into an INTEGER array makes it
+// NUMBER, storing anything but a number makes it GENERIC. Numbers are raw
+// doubles in a Value, so the elements of an INTEGER or NUMBER array are a
+// packed double array that the array kernels read without checking them.
+enum class ElementsKind : uint8_t {
+    INTEGER, NUMBER, GENERIC
+};
+
+struct ArrayObject : public HeapObject {
+    std::vector<Value> elements;
+    // Atomic because parallel loop workers may store into one array together
+    std::atomic<ElementsKind> elementsKind;
+
+    ArrayObject() : HeapObject(ObjKind::ARRAY), elementsKind(ElementsKind::INTEGER) {}
+
+    ArrayObject(ArrayObject&& other) noexcept
+        : HeapObject(other), elements(std::move(other.elements)), elementsKind(other.kind()) {}
+
+    ElementsKind kind() const { return elementsKind.load(std::memory_order_relaxed); }
+    bool packed() const { return kind() != ElementsKind::GENERIC; }
+
+    void append(Value v) {
+        widenFor(v);
+        elements.push_back(v);
+    }
+
+    void store(size_t i, Value v) {
+        widenFor(v);
+        elements[i] = v;
+    }
+
+    void widen(ElementsKind needed) {
+        ElementsKind current = kind();
+        while (current < needed &&
+               !elementsKind.compare_exchange_weak(current, needed, std::memory_order_relaxed)) {
+        }
+    }
+
+private:
+    void widenFor(Value v) {
+        if (kind() == ElementsKind::GENERIC) return;
+        widen(!v.isNumber()                   ? ElementsKind::GENERIC
+              : isExactInteger(v.asNumber()) ? ElementsKind::INTEGER
+                                             : ElementsKind::NUMBER);
+    }
+};
+
+// A hidden class: the keys of an object in insertion order, where a key's
+// position is its slot in the object. Shapes form a transition tree rooted
+// at the empty shape, so objects given the same keys in the same order share
+// one Shape and a member site can remember the slot for it (InlineCache).
+// Shapes never change once created and live as long as the process, so a
+// cached Shape pointer cannot dangle; they are created on the main thread
+// only (parallel loop workers never build objects).
+class Shape {
+private:
+    std::vector<std::string> keys;
+    std::unordered_map<std::string, int> slots;
+    mutable std::unordered_map<std::string, std::unique_ptr<Shape>> transitions;
+
+    Shape() = default;
+
+    Shape(const Shape& parent, const std::string& key) : keys(parent.keys), slots(parent.slots) {
+        slots[key] = static_cast<int>(keys.size());
+        keys.push_back(key);
+    }
+
+public:
+    static const Shape* empty() {
+        static const Shape root;
+        return &root;
+    }
+
+    // The shape after adding a key this shape lacks.
+    const Shape* withKey(const std::string& key) const {
+        auto found = transitions.find(key);
+        if (found != transitions.end()) return found->second.get();
+        auto child = std::unique_ptr<Shape>(new Shape(*this, key));
+        const Shape* result = child.get();
+        transitions.emplace(key, std::move(child));
+        return result;
+    }
+
+    static const Shape* of(const std::vector<std::string>& keys) {
+        const Shape* shape = empty();
+        for (const auto& key : keys) shape = shape->withKey(key);
+        return shape;
+    }
+
+    // Slot of the key, or -1.
+    int find(const std::string& key) const {
+        auto found = slots.find(key);
+        return found == slots.end() ? -1 : found->second;
+    }
+
+    int size() const { return static_cast<int>(keys.size()); }
+    const std::string& keyAt(int slot) const { return keys[slot]; }
+};
+
+// Backs an ObjectLiteral: one slot per key of its shape.
+struct RecordObject : public HeapObject {
+    const Shape* shape;
+    std::vector<Value> slots;
+
+    explicit RecordObject(const Shape* s = Shape::empty())
+        : HeapObject(ObjKind::OBJECT), shape(s), slots(static_cast<size_t>(s->size())) {}
+};
+
+// What one member site (`obj.key`) has learned about the shapes reaching it:
+// up to ENTRIES shapes with the slot of the key in each. A site that has
+// seen one shape is monomorphic and a hit costs a single pointer compare;
+// up to ENTRIES it is polymorphic. After that it is megamorphic: the
+// entries stay, and other shapes look the key up in the shape.
+struct InlineCache {
+    static constexpr int ENTRIES = 4;
+
+    const Shape* shapes[ENTRIES] = {};
+    int slots[ENTRIES] = {};
+    int count = 0;
+    bool megamorphic = false;
+
+    // Slot of the key in objects of this shape, or -1 if they lack it.
+    int lookup(const Shape* shape, const std::string& key) {
+        for (int i = 0; i < count; i++) {
+            if (shapes[i] == shape) return slots[i];
+        }
+        int slot = shape->find(key);
+        if (slot < 0) return slot;
+        if (count < ENTRIES) {
+            shapes[count] = shape;
+            slots[count] = slot;
+            count++;
+        } else {
+            megamorphic = true;
+        }
+        return slot;
+    }
+};
+
+// Statistics for --gc-stats. Pause times are wall-clock milliseconds.
+struct GcStats {
+    size_t objectsAllocated = 0;
+    size_t bytesAllocated = 0;
+    size_t minorCollections = 0;
+    size_t majorCollections = 0;
+    double minorPauseMs = 0;
+    double majorPauseMs = 0;
+    double longestPauseMs = 0;
+    size_t objectsPromoted = 0;
+    size_t bytesPromoted = 0;
+    size_t objectsFreed = 0;
+    size_t peakOldBytes = 0;
+};
+
+// Objects start in the nursery, a fixed block filled by bumping an offset.
+// A minor collection moves the nursery objects that are still reachable
+// into the old generation and empties the nursery in one step. The old
+// generation is collected by mark-sweep once it has doubled since the last
+// major collection.
+//
+// Collections run only at safepoints: loop back edges and function entry
+// in every engine. Allocating never collects. A full nursery asks for a
+// collection and allocates in the old generation until the next safepoint.
+// At a safepoint every live value is in a root. A root is one of:
+//   - a RootSet registered by the running engine (its frames, read through
+//     each function's slot map, and its globals);
+//   - a C++ local held by a Heap::Root;
+//   - a region object.
+// A moved object's roots are updated in place. The remembered set holds
+// the old objects that may point into the nursery: those written through
+// writeBarrier, and those allocated old since the last minor collection.
+//
+// Arrays and objects that EscapeAnalysis proved never outlive their call go
+// to the region instead. The region is a stack of fixed-size slots. Each
+// call records the top when it starts and releases everything above it
+// when it returns. Released slots are reused by the next call, so a
+// function that allocates scratch arrays runs in the same memory however
+// often it is called. Interned strings are permanent.
+class Heap {
+public:
+    // The values an engine keeps outside heap objects.
+    class RootSet {
+    public:
+        virtual void visitRoots(const std::function<void(Value&)>& visit) = 0;
+
+    protected:
+        ~RootSet() = default;
+    };
+
+    // Makes C++ locals roots while in scope, for values an engine holds
+    // across a nested evaluation that may reach a safepoint. An empty
+    // range registers nothing.
+    class Root {
+    public:
+        Root(Heap& h, Value* values, size_t count) : heap(count ? &h : nullptr) {
+            if (heap) heap->localRoots.push_back({values, count});
+        }
+        Root(Heap& h, Value& value) : Root(h, &value, 1) {}
+        ~Root() {
+            if (heap) heap->localRoots.pop_back();
+        }
+
+        Root(const Root&) = delete;
+        Root& operator=(const Root&) = delete;
+
+    private:
+        Heap* heap;
+    };
+
+    GcStats stats;
+    bool stress;  // --gc-stress: collect at every safepoint after an allocation
+
+private:
+    struct alignas(alignof(std::max_align_t)) RegionSlot {
+        unsigned char bytes[std::max(sizeof(ArrayObject), sizeof(RecordObject))];
+    };
+    static constexpr size_t REGION_CHUNK_SLOTS = 256;
+
+    struct alignas(alignof(std::max_align_t)) NurseryCell {
+        unsigned char bytes[alignof(std::max_align_t)];
+    };
+    static constexpr size_t NURSERY_BYTES = size_t(1) << 20;
+    static constexpr size_t MIN_MAJOR_BYTES = size_t(8) << 20;
+
+    std::unique_ptr<NurseryCell[]> nursery;
+    size_t nurseryTop;
+    HeapObject* oldObjects;
+    HeapObject* permanentObjects;
+    size_t oldBytes;
+    size_t nextMajorBytes;
+    std::vector<HeapObject*> rememberedSet;
+    std::mutex rememberLock;  // parallel loop workers store into arrays
+    bool collectionRequested;
+    std::vector<RootSet*> rootSets;
+    std::vector<std::pair<Value*, size_t>> localRoots;
+    std::vector<std::unique_ptr<RegionSlot[]>> regionChunks;
+    size_t regionTop;
+
+    HeapObject* regionObject(size_t slot) const {
+        return reinterpret_cast<HeapObject*>(regionChunks[slot / REGION_CHUNK_SLOTS][slot % REGION_CHUNK_SLOTS].bytes);
+    }
+
+    unsigned char* nurseryBytes() const {
+        return nursery[0].bytes;
+    }
+
+    template <typename T>
+    static constexpr size_t nurserySize() {
+        return (sizeof(T) + sizeof(NurseryCell) - 1) / sizeof(NurseryCell) * sizeof(NurseryCell);
+    }
+
+    static size_t nurserySize(ObjKind kind) {
+        switch (kind) {
+            case ObjKind::STRING: return nurserySize<StringObject>();
+            case ObjKind::ARRAY: return nurserySize<ArrayObject>();
+            default: return nurserySize<RecordObject>();
+        }
+    }
+
+public:
+    Heap()
+        : stress(false), nursery(std::make_unique<NurseryCell[]>(NURSERY_BYTES / sizeof(NurseryCell))),
+          nurseryTop(0), oldObjects(nullptr), permanentObjects(nullptr), oldBytes(0),
+          nextMajorBytes(MIN_MAJOR_BYTES), collectionRequested(false), regionTop(0) {}
+
+    ~Heap() {
+        releaseRegion(0);
+        emptyNursery();
+        for (HeapObject* list : {oldObjects, permanentObjects}) {
+            while (list) {
+                HeapObject* next = list->next;
+                delete list;
+                list = next;
+            }
+        }
+    }
+
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    template <typename T, typename... Args>
+    T* allocate(Args&&... args) {
+        constexpr size_t size = nurserySize<T>();
+        stats.objectsAllocated++;
+        stats.bytesAllocated += size;
+        if (stress) collectionRequested = true;
+        if (nurseryTop + size <= NURSERY_BYTES) {
+            T* obj = new (nurseryBytes() + nurseryTop) T(std::forward<Args>(args)...);
+            nurseryTop += size;
+            return obj;
+        }
+        collectionRequested = true;
+        T* obj = new T(std::forward<Args>(args)...);
+        adopt(obj, sizeof(T));
+        remember(obj);
+        return obj;
+    }
+
+    // For objects that live as long as the heap and never move.
+    template <typename T, typename... Args>
+    T* allocatePermanent(Args&&... args) {
+        T* obj = new T(std::forward<Args>(args)...);
+        obj->generation = Generation::PERMANENT;
+        obj->next = permanentObjects;
+        permanentObjects = obj;
+        return obj;
+    }
+
+    template <typename T, typename... Args>
+    T* allocateInRegion(Args&&... args) {
+        static_assert(sizeof(T) <= sizeof(RegionSlot), "region objects must fit a slot");
+        if (regionTop == regionChunks.size() * REGION_CHUNK_SLOTS) {
+            regionChunks.push_back(std::make_unique<RegionSlot[]>(REGION_CHUNK_SLOTS));
+        }
+        void* slot = regionChunks[regionTop / REGION_CHUNK_SLOTS][regionTop % REGION_CHUNK_SLOTS].bytes;
+        regionTop++;
+        T* obj = new (slot) T(std::forward<Args>(args)...);
+        obj->generation = Generation::REGION;
+        return obj;
+    }
+
+    size_t regionMark() const {
+        return regionTop;
+    }
+
+    // Destroys every region object allocated since the mark was taken.
+    void releaseRegion(size_t mark) {
+        while (regionTop > mark) {
+            regionObject(--regionTop)->~HeapObject();
+        }
+    }
+
+    void addRoots(RootSet* roots) {
+        rootSets.push_back(roots);
+    }
+
+    void removeRoots(RootSet* roots) {
+        rootSets.erase(std::find(rootSets.begin(), rootSets.end(), roots));
+    }
+
+    // Call after storing `value` into `owner`.
+    void writeBarrier(HeapObject* owner, Value value) {
+        if (owner->generation == Generation::OLD && value.isObject() &&
+            value.asObject()->generation == Generation::NURSERY && !owner->remembered.load(std::memory_order_relaxed)) {
+            remember(owner);
+        }
+    }
+
+    void safepoint() {
+        if (collectionRequested) collect();
+    }
+
+    size_t oldGenerationBytes() const {
+        return oldBytes;
+    }
+
+    static constexpr size_t nurseryCapacity() {
+        return NURSERY_BYTES;
+    }
+
+private:
+    void remember(HeapObject* obj) {
+        std::lock_guard<std::mutex> guard(rememberLock);
+        if (obj->remembered.load(std::memory_order_relaxed)) return;
+        obj->remembered.store(true, std::memory_order_relaxed);
+        rememberedSet.push_back(obj);
+    }
+
+    void adopt(HeapObject* obj, size_t bytes) {
+        obj->generation = Generation::OLD;
+        obj->next = oldObjects;
+        oldObjects = obj;
+        oldBytes += bytes;
+        stats.peakOldBytes = std::max(stats.peakOldBytes, oldBytes);
+    }
+
+    // Memory an old object holds, its own and its buffers.
+    static size_t footprint(const HeapObject* obj) {
+        switch (obj->kind) {
+            case ObjKind::STRING: {
+                // A rope owns no characters until it is flattened
+                auto str = static_cast<const StringObject*>(obj);
+                bool buffered = !str->isRope() && str->length() > StringObject::INLINE_CAPACITY;
+                return sizeof(StringObject) + (buffered ? str->length() : 0);
+            }
+            case ObjKind::ARRAY:
+                return sizeof(ArrayObject) + static_cast<const ArrayObject*>(obj)->elements.capacity() * sizeof(Value);
+            default:
+                return sizeof(RecordObject) + static_cast<const RecordObject*>(obj)->slots.capacity() * sizeof(Value);
+        }
+    }
+
+    static void traceChildren(HeapObject* obj, const std::function<void(Value&)>& visit) {
+        switch (obj->kind) {
+            case ObjKind::ARRAY:
+                for (Value& element : static_cast<ArrayObject*>(obj)->elements) visit(element);
+                break;
+            case ObjKind::OBJECT:
+                for (Value& slot : static_cast<RecordObject*>(obj)->slots) visit(slot);
+                break;
+            case ObjKind::STRING: {
+                auto str = static_cast<StringObject*>(obj);
+                if (!str->isRope()) break;
+                for (const StringObject*& half : str->halves) {
+                    Value v = Value::object(const_cast<StringObject*>(half));
+                    visit(v);
+                    half = static_cast<const StringObject*>(v.asObject());
+                }
+                break;
+            }
+        }
+    }
+
+    void visitRoots(const std::function<void(Value&)>& visit) {
+        for (RootSet* roots : rootSets) roots->visitRoots(visit);
+        for (const auto& range : localRoots) {
+            for (size_t i = 0; i < range.second; i++) visit(range.first[i]);
+        }
+        for (size_t slot = 0; slot < regionTop; slot++) traceChildren(regionObject(slot), visit);
+    }
+
+    void collect() {
+        using Clock = std::chrono::steady_clock;
+        collectionRequested = false;
+        auto start = Clock::now();
+        collectNursery();
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        stats.minorCollections++;
+        stats.minorPauseMs += ms;
+        stats.longestPauseMs = std::max(stats.longestPauseMs, ms);
+        if (!stress && oldBytes < nextMajorBytes) return;
+
+        start = Clock::now();
+        collectOld();
+        ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        stats.majorCollections++;
+        stats.majorPauseMs += ms;
+        stats.longestPauseMs = std::max(stats.longestPauseMs, ms);
+    }
+
+    // Moves a reachable nursery object into the old generation, leaving
+    // the copy in its `next` for the references still to be updated.
+    HeapObject* promote(HeapObject* obj) {
+        HeapObject* copy;
+        switch (obj->kind) {
+            case ObjKind::STRING: copy = new StringObject(std::move(*static_cast<StringObject*>(obj))); break;
+            case ObjKind::ARRAY: copy = new ArrayObject(std::move(*static_cast<ArrayObject*>(obj))); break;
+            default: copy = new RecordObject(std::move(*static_cast<RecordObject*>(obj))); break;
+        }
+        size_t bytes = footprint(copy);
+        adopt(copy, bytes);
+        obj->next = copy;
+        stats.objectsPromoted++;
+        stats.bytesPromoted += bytes;
+        return copy;
+    }
+
+    void collectNursery() {
+        std::vector<HeapObject*> promoted;
+        std::function<void(Value&)> forward = [&](Value& v) {
+            if (!v.isObject()) return;
+            HeapObject* obj = v.asObject();
+            if (obj->generation != Generation::NURSERY) return;
+            if (!obj->next) promoted.push_back(promote(obj));
+            v = Value::object(obj->next);
+        };
+        visitRoots(forward);
+        for (HeapObject* obj : rememberedSet) {
+            obj->remembered.store(false, std::memory_order_relaxed);
+            traceChildren(obj, forward);
+        }
+        rememberedSet.clear();
+        while (!promoted.empty()) {
+            HeapObject* obj = promoted.back();
+            promoted.pop_back();
+            traceChildren(obj, forward);
+        }
+        emptyNursery();
+    }
+
+    // Destroys the dead nursery objects and what promotion left behind.
+    void emptyNursery() {
+        for (size_t at = 0; at < nurseryTop;) {
+            auto obj = reinterpret_cast<HeapObject*>(nurseryBytes() + at);
+            at += nurserySize(obj->kind);
+            if (!obj->next) stats.objectsFreed++;
+            obj->~HeapObject();
+        }
+        nurseryTop = 0;
+    }
+
+    // Runs right after collectNursery, so no object is young.
+    void collectOld() {
+        std::vector<HeapObject*> pending;
+        std::function<void(Value&)> mark = [&](Value& v) {
+            if (!v.isObject()) return;
+            HeapObject* obj = v.asObject();
+            if (obj->generation != Generation::OLD || obj->marked) return;
+            obj->marked = true;
+            pending.push_back(obj);
+        };
+        visitRoots(mark);
+        while (!pending.empty()) {
+            HeapObject* obj = pending.back();
+            pending.pop_back();
+            traceChildren(obj, mark);
+        }
+
+        oldBytes = 0;
+        HeapObject** link = &oldObjects;
+        while (HeapObject* obj = *link) {
+            if (obj->marked) {
+                obj->marked = false;
+                oldBytes += footprint(obj);
+                link = &obj->next;
+            } else {
+                *link = obj->next;
+                stats.objectsFreed++;
+                delete obj;
+            }
+        }
+        nextMajorBytes = std::max(MIN_MAJOR_BYTES, oldBytes * 2);
+    }
+};
+
+// ============================================================================
+// Array Kernels
+// ============================================================================
+
+// The loops behind the array builtins. They read the elements of packed
+// arrays (see ElementsKind) as doubles, in an AVX2 version and a portable
+// one that agree bit for bit: a reduction keeps one partial result per lane
+// of four, combines the lanes as (0, 1) then (2, 3) then both, and folds in
+// the elements past the last full block in order. Products and sums are
+// separate roundings in both versions (no fused multiply-add).
+class ArrayKernels {
+public:
+    static constexpr size_t LANES = 4;
+
+    // Whether the AVX2 loops run: the CPU has AVX2 and --simd=off was not given.
+    static bool& simd() {
+        static bool enabled = cpuHasAvx2();
+        return enabled;
+    }
+
+    static bool cpuHasAvx2() {
+#ifdef OURLANG_AVX2
+        return __builtin_cpu_supports("avx2");
+#else
+        return false;
+#endif
+    }
+
+    static double sum(const Value* x, size_t n) {
+#ifdef OURLANG_AVX2
+        if (simd()) return sumAvx2(x, n);
+#endif
+        double lanes[LANES] = {0, 0, 0, 0};
+        size_t i = 0;
+        for (; i + LANES <= n; i += LANES) {
+            for (size_t j = 0; j < LANES; j++) lanes[j] += x[i + j].asNumber();
+        }
+        double total = combine(lanes, [](double a, double b) { return a + b; });
+        for (; i < n; i++) total += x[i].asNumber();
+        return total;
+    }
+
+    static double dot(const Value* x, const Value* y, size_t n) {
+#ifdef OURLANG_AVX2
+        if (simd()) return dotAvx2(x, y, n);
+#endif
+        double lanes[LANES] = {0, 0, 0, 0};
+        size_t i = 0;
+        for (; i + LANES <= n; i += LANES) {
+            for (size_t j = 0; j < LANES; j++) {
+                double product = x[i + j].asNumber() * y[i + j].asNumber();
+                lanes[j] += product;
+            }
+        }
+        double total = combine(lanes, [](double a, double b) { return a + b; });
+        for (; i < n; i++) {
+            double product = x[i].asNumber() * y[i].asNumber();
+            total += product;
+        }
+        return total;
+    }
+
+    static void scale(const Value* x, double k, Value* out, size_t n) {
+        size_t i = 0;
+#ifdef OURLANG_AVX2
+        if (simd()) i = scaleAvx2(x, k, out, n);
+#endif
+        for (; i < n; i++) out[i] = Value::number(x[i].asNumber() * k);
+    }
+
+    // The smallest (or largest) of n > 0 elements, NaN if any is NaN. Like
+    // MINPD, ties between 0 and -0 go to the element already held.
+    static double minimum(const Value* x, size_t n) { return extreme(x, n, false); }
+    static double maximum(const Value* x, size_t n) { return extreme(x, n, true); }
+
+private:
+    template <typename Op>
+    static double combine(const double* lanes, Op op) {
+        return op(op(lanes[0], lanes[1]), op(lanes[2], lanes[3]));
+    }
+
+    static double pick(double held, double next, bool largest) {
+        return (largest ? held > next : held < next) ? held : next;
+    }
+
+    static double extreme(const Value* x, size_t n, bool largest) {
+#ifdef OURLANG_AVX2
+        if (simd()) return extremeAvx2(x, n, largest);
+#endif
+        bool nan = false;
+        size_t i = 0;
+        double result;
+        if (n >= LANES) {
+            double lanes[LANES];
+            for (size_t j = 0; j < LANES; j++) lanes[j] = x[j].asNumber();
+            for (i = LANES; i + LANES <= n; i += LANES) {
+                for (size_t j = 0; j < LANES; j++) lanes[j] = pick(lanes[j], x[i + j].asNumber(), largest);
+            }
+            result = combine(lanes, [largest](double a, double b) { return pick(a, b, largest); });
+        } else {
+            result = x[i++].asNumber();
+        }
+        for (size_t j = 0; j < i; j++) nan |= std::isnan(x[j].asNumber());
+        for (; i < n; i++) {
+            double next = x[i].asNumber();
+            nan |= std::isnan(next);
+            result = pick(result, next, largest);
+        }
+        return nan ? std::numeric_limits<double>::quiet_NaN() : result;
+    }
+
+#ifdef OURLANG_AVX2
+    static const double* doubles(const Value* x) { return reinterpret_cast<const double*>(x); }
+
+    __attribute__((target("avx2"))) static double sumAvx2(const Value* x, size_t n) {
+        __m256d acc = _mm256_setzero_pd();
+        size_t i = 0;
+        for (; i + LANES <= n; i += LANES) acc = _mm256_add_pd(acc, _mm256_loadu_pd(doubles(x + i)));
+        double lanes[LANES];
+        _mm256_storeu_pd(lanes, acc);
+        double total = combine(lanes, [](double a, double b) { return a + b; });
+        for (; i < n; i++) total += x[i].asNumber();
+        return total;
+    }
+
+    __attribute__((target("avx2"))) static double dotAvx2(const Value* x, const Value* y, size_t n) {
+        __m256d acc = _mm256_setzero_pd();
+        size_t i = 0;
+        for (; i + LANES <= n; i += LANES) {
+            __m256d product = _mm256_mul_pd(_mm256_loadu_pd(doubles(x + i)), _mm256_loadu_pd(doubles(y + i)));
+            acc = _mm256_add_pd(acc, product);
+        }
+        double lanes[LANES];
+        _mm256_storeu_pd(lanes, acc);
+        double total = combine(lanes, [](double a, double b) { return a + b; });
+        for (; i < n; i++) {
+            double product = x[i].asNumber() * y[i].asNumber();
+            total += product;
+        }
+        return total;
+    }
+
+    // Returns how many elements it scaled (whole blocks only).
+    __attribute__((target("avx2"))) static size_t scaleAvx2(const Value* x, double k, Value* out, size_t n) {
+        __m256d factor = _mm256_set1_pd(k);
+        size_t i = 0;
+        for (; i + LANES <= n; i += LANES) {
+            __m256d product = _mm256_mul_pd(_mm256_loadu_pd(doubles(x + i)), factor);
+            _mm256_storeu_pd(reinterpret_cast<double*>(out + i), product);
+        }
+        return i;
+    }
+
+    __attribute__((target("avx2"))) static double extremeAvx2(const Value* x, size_t n, bool largest) {
+        if (n < LANES) {
+            bool nan = false;
+            double result = x[0].asNumber();
+            for (size_t i = 0; i < n; i++) {
+                double next = x[i].asNumber();
+                nan |= std::isnan(next);
+                if (i > 0) result = pick(result, next, largest);
+            }
+            return nan ? std::numeric_limits<double>::quiet_NaN() : result;
+        }
+        __m256d acc = _mm256_loadu_pd(doubles(x));
+        __m256d nans = _mm256_cmp_pd(acc, acc, _CMP_UNORD_Q);
+        size_t i = LANES;
+        for (; i + LANES <= n; i += LANES) {
+            __m256d next = _mm256_loadu_pd(doubles(x + i));
+            nans = _mm256_or_pd(nans, _mm256_cmp_pd(next, next, _CMP_UNORD_Q));
+            acc = largest ? _mm256_max_pd(acc, next) : _mm256_min_pd(acc, next);
+        }
+        bool nan = _mm256_movemask_pd(nans) != 0;
+        double lanes[LANES];
+        _mm256_storeu_pd(lanes, acc);
+        double result = combine(lanes, [largest](double a, double b) { return pick(a, b, largest); });
+        for (; i < n; i++) {
+            double next = x[i].asNumber();
+            nan |= std::isnan(next);
+            result = pick(result, next, largest);
+        }
+        return nan ? std::numeric_limits<double>::quiet_NaN() : result;
+    }
+#endif
+};
+
+// The function given to map(), which the semantic analyzer reduced to
+// postfix text over its one parameter: "x", hexadecimal number literals
+// and + - * / neg sqrt abs, e.g. "x x * 0x1p+0 +" for x * x + 1. Evaluating
+// it needs at most MAP_STACK_LIMIT values on the stack.
+class ArrayLambda {
+private:
+    enum class Op : uint8_t {
+        PARAM, CONSTANT, ADD, SUB, MUL, DIV, NEG, SQRT, ABS
+    };
+
+    struct Step {
+        Op op;
+        double constant;
+    };
+
+    std::vector<Step> steps;
+
+public:
+    explicit ArrayLambda(const std::string& text) {
+        std::istringstream in(text);
+        std::string token;
+        int depth = 0;
+        while (in >> token) {
+            Step step{Op::CONSTANT, 0};
+            if (token == "x") step.op = Op::PARAM;
+            else if (token == "+") step.op = Op::ADD;
+            else if (token == "-") step.op = Op::SUB;
+            else if (token == "*") step.op = Op::MUL;
+            else if (token == "/") step.op = Op::DIV;
+            else if (token == "neg") step.op = Op::NEG;
+            else if (token == "sqrt") step.op = Op::SQRT;
+            else if (token == "abs") step.op = Op::ABS;
+            else step.constant = std::strtod(token.c_str(), nullptr);
+            if (step.op == Op::PARAM || step.op == Op::CONSTANT) depth++;
+            else if (step.op <= Op::DIV) depth--;
+            if (depth < 1 || depth > MAP_STACK_LIMIT) break;
+            steps.push_back(step);
+        }
+        if (depth != 1 || !in.eof()) {
+            throw std::runtime_error("Runtime error: map() got a malformed function");
+        }
+    }
+
+    void apply(const Value* x, Value* out, size_t n) const {
+        size_t i = 0;
+#ifdef OURLANG_AVX2
+        if (ArrayKernels::simd()) i = applyAvx2(x, out, n);
+#endif
+        for (; i < n; i++) out[i] = Value::number(evaluate(x[i].asNumber()));
+    }
+
+private:
+    double evaluate(double x) const {
+        double stack[MAP_STACK_LIMIT];
+        int top = 0;
+        for (const Step& step : steps) {
+            switch (step.op) {
+                case Op::PARAM: stack[top++] = x; break;
+                case Op::CONSTANT: stack[top++] = step.constant; break;
+                case Op::ADD: top--; stack[top - 1] = stack[top - 1] + stack[top]; break;
+                case Op::SUB: top--; stack[top - 1] = stack[top - 1] - stack[top]; break;
+                case Op::MUL: top--; stack[top - 1] = stack[top - 1] * stack[top]; break;
+                case Op::DIV: top--; stack[top - 1] = stack[top - 1] / stack[top]; break;
+                case Op::NEG: stack[top - 1] = -stack[top - 1]; break;
+                case Op::SQRT: stack[top - 1] = std::sqrt(stack[top - 1]); break;
+                case Op::ABS: stack[top - 1] = std::fabs(stack[top - 1]); break;
+            }
+        }
+        return stack[0];
+    }
+
+#ifdef OURLANG_AVX2
+    // Runs the steps on four elements at a time; returns how many it mapped.
+    __attribute__((target("avx2"))) size_t applyAvx2(const Value* x, Value* out, size_t n) const {
+        const __m256d sign = _mm256_set1_pd(-0.0);
+        __m256d stack[MAP_STACK_LIMIT];
+        size_t i = 0;
+        for (; i + ArrayKernels::LANES <= n; i += ArrayKernels::LANES) {
+            __m256d param = _mm256_loadu_pd(reinterpret_cast<const double*>(x + i));
+            int top = 0;
+            for (const Step& step : steps) {
+                switch (step.op) {
+                    case Op::PARAM: stack[top++] = param; break;
+                    case Op::CONSTANT: stack[top++] = _mm256_set1_pd(step.constant); break;
+                    case Op::ADD: top--; stack[top - 1] = _mm256_add_pd(stack[top - 1], stack[top]); break;
+                    case Op::SUB: top--; stack[top - 1] = _mm256_sub_pd(stack[top - 1], stack[top]); break;
+                    case Op::MUL: top--; stack[top - 1] = _mm256_mul_pd(stack[top - 1], stack[top]); break;
+                    case Op::DIV: top--; stack[top - 1] = _mm256_div_pd(stack[top - 1], stack[top]); break;
+                    case Op::NEG: stack[top - 1] = _mm256_xor_pd(stack[top - 1], sign); break;
+                    case Op::SQRT: stack[top - 1] = _mm256_sqrt_pd(stack[top - 1]); break;
+                    case Op::ABS: stack[top - 1] = _mm256_andnot_pd(sign, stack[top - 1]); break;
+                }
+            }
+            _mm256_storeu_pd(reinterpret_cast<double*>(out + i), stack[0]);
+        }
+        return i;
+    }
+#endif
+};
+
+// ============================================================================
+// Runtime Support (shared by all execution engines)
+// ============================================================================
+
+enum class BuiltinId {
+    DEKH, LOU, NIKAL, BAND, ABS, SQRT, POW, MAX, MIN, ROUND, RANDOM,
+    SUM, DOT, SCALE, MINVAL, MAXVAL, MAP, NONE
+};
+
+struct BuiltinInfo {
+    const char* name;
+    BuiltinId id;
+    int arity;          // -1 for variadic
+    bool pure;          // no effects; the result depends only on the arguments
+    bool readsElements; // ...and on the elements of its array arguments
+};
+
+const BuiltinInfo BUILTINS[] = {
+    {"dekh", BuiltinId::DEKH, -1, false, false},
+    {"lou", BuiltinId::LOU, -1, false, false},
+    {"nikal", BuiltinId::NIKAL, 1, true, false},
+    {"band", BuiltinId::BAND, 0, false, false},
+    {"abs", BuiltinId::ABS, 1, true, false},
+    {"sqrt", BuiltinId::SQRT, 1, true, false},
+    {"pow", BuiltinId::POW, 2, true, false},
+    {"max", BuiltinId::MAX, 2, true, false},
+    {"min", BuiltinId::MIN, 2, true, false},
+    {"round", BuiltinId::ROUND, 1, true, false},
+    {"random", BuiltinId::RANDOM, 0, false, false},
+    {"sum", BuiltinId::SUM, 1, true, true},
+    {"dot", BuiltinId::DOT, 2, true, true},
+    {"scale", BuiltinId::SCALE, 2, false, true},  // scale and map build a new array
+    {"minval", BuiltinId::MINVAL, 1, true, true},
+    {"maxval", BuiltinId::MAXVAL, 1, true, true},
+    {"map", BuiltinId::MAP, 2, false, true}
+};
+
+BuiltinId builtinIdFor(const std::string& name) {
+    for (const auto& info : BUILTINS) {
+        if (name == info.name) return info.id;
+    }
+    return BuiltinId::NONE;
+}
+
+const BuiltinInfo& builtinInfo(BuiltinId id) {
+    return BUILTINS[static_cast<int>(id)];
+}
+
+enum class BinaryOpKind {
+    ADD, SUB, MUL, DIV, MOD, EQ, NE, LT, LE, GT, GE, AND, OR, UNKNOWN
+};
+
+BinaryOpKind binaryOpKind(const std::string& op) {
+    if (op == "+") return BinaryOpKind::ADD;
+    if (op == "-") return BinaryOpKind::SUB;
+    if (op == "*") return BinaryOpKind::MUL;
+    if (op == "/") return BinaryOpKind::DIV;
+    if (op == "%") return BinaryOpKind::MOD;
+    if (op == "==") return BinaryOpKind::EQ;
+    if (op == "!=") return BinaryOpKind::NE;
+    if (op == "<") return BinaryOpKind::LT;
+    if (op == "<=") return BinaryOpKind::LE;
+    if (op == ">") return BinaryOpKind::GT;
+    if (op == ">=") return BinaryOpKind::GE;
+    if (op == "&&") return BinaryOpKind::AND;
+    if (op == "||") return BinaryOpKind::OR;
+    return BinaryOpKind::UNKNOWN;
+}
+
+// x % y with fmod's result. Integer operands, the usual case, use the
+// integer divider, which is several times faster than fmod.
+inline double numberModulo(double x, double y) {
+    if (y != 0 && isExactInteger(x) && isExactInteger(y)) {
+        int64_t r = static_cast<int64_t>(x) % static_cast<int64_t>(y);
+        return r == 0 && x < 0 ? -0.0 : static_cast<double>(r);
+    }
+    return std::fmod(x, y);
+}
+
+// Thrown by band() to unwind every engine back to its entry point.
+struct ProgramExit {};
+
+// A runtime error whose message already ends with the source line. Every
+// engine adds the line of the innermost statement that sees the error, so
+// statements further out and the frames of callers pass it on unchanged.
+struct LocatedRuntimeError : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+inline LocatedRuntimeError locatedAt(const std::runtime_error& e, int line) {
+    return LocatedRuntimeError(std::string(e.what()) + " (line " + std::to_string(line) + ")");
+}
+
+// Called from a catch block: rethrows the error being handled with the line
+// added, unless it already has one or is not a runtime error. Kept out of
+// line so the statements of the hot paths stay small.
+[[noreturn]] __attribute__((noinline, cold)) inline void rethrowAtLine(int line) {
+    try {
+        throw;
+    } catch (const LocatedRuntimeError&) {
+        throw;
+    } catch (const std::runtime_error& e) {
+        if (line <= 0) throw;
+        throw locatedAt(e, line);
+    }
+}
+
+// Runs part of the statement on `line`, adding the line to an error it
+// raises.
+template <typename F>
+inline auto atLine(int line, F&& body) -> decltype(body()) {
+    try {
+        return body();
+    } catch (...) {
+        rethrowAtLine(line);
+    }
+}
+
+std::string formatNumber(double d) {
+    if (std::isfinite(d) && d == std::floor(d) && std::fabs(d) < 1e15) {
+        return std::to_string(static_cast<long long>(d));
+    }
+    std::ostringstream oss;
+    oss.precision(15);
+    oss << d;
+    return oss.str();
+}
+
+// Cached results of one memoized function (--memoize=auto), keyed by the
+// bits of its number arguments. Open addressing with a probe window of
+// WAYS slots, so a lookup reads at most that many entries. The table
+// doubles while it is below MAX_ENTRIES; after that a full window evicts by
+// the clock algorithm, giving entries hit since the hand last passed a
+// second chance. Callers push the key of a missed call with begin() and
+// store its result with finish() when the call returns.
+class MemoTable {
+public:
+    static constexpr int MAX_ARGS = 4;
+    static constexpr size_t MAX_ENTRIES = size_t(1) << 16;
+
+    std::string name;
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+
+private:
+    static constexpr size_t WAYS = 8;
+    static constexpr size_t INITIAL_ENTRIES = 64;
+
+    struct Key {
+        uint64_t bits[MAX_ARGS] = {};
+    };
+
+    struct Entry {
+        Key key;
+        Value result;
+        bool used = false;
+        bool referenced = false;
+    };
+
+    int arity;
+    std::vector<Entry> entries;
+    std::vector<Key> pending;
+    size_t count = 0;
+    size_t hand = 0;
+
+public:
+    MemoTable(std::string n, int a) : name(std::move(n)), arity(a), entries(INITIAL_ENTRIES) {}
+
+    size_t size() const { return count; }
+
+    // Only calls with the right number of number arguments are cached.
+    bool accepts(const Value* args, size_t argc) const {
+        if (argc != static_cast<size_t>(arity)) return false;
+        for (size_t i = 0; i < argc; i++) {
+            if (!args[i].isNumber()) return false;
+        }
+        return true;
+    }
+
+    bool lookup(const Value* args, Value& result) {
+        Key key = keyOf(args);
+        size_t mask = entries.size() - 1;
+        size_t start = hashOf(key);
+        for (size_t i = 0; i < WAYS; i++) {
+            Entry& entry = entries[(start + i) & mask];
+            if (entry.used && sameKey(entry.key, key)) {
+                entry.referenced = true;
+                result = entry.result;
+                hits++;
+                return true;
+            }
+        }
+        misses++;
+        return false;
+    }
+
+    void begin(const Value* args) { pending.push_back(keyOf(args)); }
+
+    // Objects are not cached: a later call must build its own.
+    void finish(Value result) {
+        Key key = pending.back();
+        pending.pop_back();
+        if (!result.isObject()) insert(key, result);
+    }
+
+private:
+    Key keyOf(const Value* args) const {
+        Key key;
+        for (int i = 0; i < arity; i++) key.bits[i] = args[i].raw();
+        return key;
+    }
+
+    static bool sameKey(const Key& a, const Key& b) {
+        return std::memcmp(a.bits, b.bits, sizeof(a.bits)) == 0;
+    }
+
+    static size_t hashOf(const Key& key) {
+        uint64_t h = 0x9e3779b97f4a7c15ULL;
+        for (uint64_t bits : key.bits) {
+            h ^= bits;
+            h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+            h ^= h >> 31;
+        }
+        return static_cast<size_t>(h);
+    }
+
+    void insert(const Key& key, Value result) {
+        Entry* slot = findSlot(key);
+        if (!slot && entries.size() < MAX_ENTRIES) {
+            grow();
+            slot = findSlot(key);
+        }
+        if (!slot) slot = evict(key);
+        if (!slot->used) count++;
+        slot->key = key;
+        slot->result = result;
+        slot->used = true;
+        slot->referenced = false;
+    }
+
+    // The entry already holding `key`, else a free one in its window.
+    Entry* findSlot(const Key& key) {
+        size_t mask = entries.size() - 1;
+        size_t start = hashOf(key);
+        Entry* free = nullptr;
+        for (size_t i = 0; i < WAYS; i++) {
+            Entry& entry = entries[(start + i) & mask];
+            if (!entry.used) {
+                if (!free) free = &entry;
+            } else if (sameKey(entry.key, key)) {
+                return &entry;
+            }
+        }
+        return free;
+    }
+
+    // Entries that no longer fit their window after rehashing are dropped.
+    void grow() {
+        std::vector<Entry> old(entries.size() * 2);
+        old.swap(entries);
+        count = 0;
+        for (const Entry& entry : old) {
+            if (!entry.used) continue;
+            if (Entry* slot = findSlot(entry.key)) {
+                *slot = entry;
+                count++;
+            } else {
+                evictions++;
+            }
+        }
+    }
+
+    Entry* evict(const Key& key) {
+        size_t mask = entries.size() - 1;
+        size_t start = hashOf(key);
+        for (;;) {
+            Entry& entry = entries[(start + hand++ % WAYS) & mask];
+            if (!entry.referenced) {
+                evictions++;
+                count--;
+                entry.used = false;
+                return &entry;
+            }
+            entry.referenced = false;
+        }
+    }
+};
+
+class Runtime {
+public:
+    Heap heap;
+    std::ostream& out;
+    std::istream& in;
+    std::mt19937_64 rng;
+
+    // Calls a program may nest, in every engine. The tree-walking engines
+    // recurse on the native stack, which bounds it.
+    static constexpr int MAX_CALL_DEPTH = 10000;
+
+    Runtime(std::ostream& o = std::cout, std::istream& i = std::cin)
+        : out(o), in(i), rng(std::random_device{}()) {}
+
+    std::vector<std::unique_ptr<MemoTable>> memoTables;  // --memoize=auto
+    std::unordered_map<std::string_view, StringObject*> internTable;  // see intern()
+
+    Value makeString(std::string_view s) {
+        return Value::object(heap.allocate<StringObject>(s));
+    }
+
+    // The one string object with this content, for string literals and
+    // one-character strings. Keys view the objects' own characters.
+    Value intern(std::string_view s) {
+        auto found = internTable.find(s);
+        if (found != internTable.end()) return Value::object(found->second);
+        StringObject* str = heap.allocatePermanent<StringObject>(s);
+        str->interned = true;
+        str->hash();
+        internTable.emplace(str->view(), str);
+        return Value::object(str);
+    }
+
+    // a + b where either is a string.
+    Value concat(Value a, Value b) {
+        Value left = a.isString() ? a : makeString(toString(a));
+        Value right = b.isString() ? b : makeString(toString(b));
+        const StringObject* x = static_cast<StringObject*>(left.asObject());
+        const StringObject* y = static_cast<StringObject*>(right.asObject());
+        if (x->length() == 0) return right;
+        if (y->length() == 0) return left;
+        return Value::object(heap.allocate<StringObject>(x, y));
+    }
+
+    // A new array with the values of a packed array literal.
+    Value packedArray(const PackedElements& packed, bool inRegion) {
+        ArrayObject* array = inRegion ? heap.allocateInRegion<ArrayObject>() : heap.allocate<ArrayObject>();
+        array->elements.reserve(packed.size());
+        for (double d : packed.numbers) array->append(Value::number(d));
+        for (const auto& s : packed.strings) array->append(intern(s));
+        return Value::object(array);
+    }
+
+    MemoTable* addMemoTable(const std::string& name, int arity) {
+        memoTables.push_back(std::make_unique<MemoTable>(name, arity));
+        return memoTables.back().get();
+    }
+
+    std::string toString(Value v, bool quoteStrings = false) const {
+        if (v.isNumber()) return formatNumber(v.asNumber());
+        if (v.isNil()) return "nil";
+        if (v.isBool()) return v.asBool() ? "haan" : "na";
+
+        HeapObject* obj = v.asObject();
+        if (obj->kind == ObjKind::STRING) {
+            std::string chars(static_cast<StringObject*>(obj)->view());
+            return quoteStrings ? "'" + chars + "'" : chars;
+        }
+        if (obj->kind == ObjKind::ARRAY) {
+            std::string result = "[";
+            const auto& elements = static_cast<ArrayObject*>(obj)->elements;
+            for (size_t i = 0; i < elements.size(); i++) {
+                if (i > 0) result += ", ";
+                result += toString(elements[i], true);
+            }
+            return result + "]";
+        }
+        std::string result = "{ ";
+        const RecordObject* record = static_cast<RecordObject*>(obj);
+        for (int i = 0; i < record->shape->size(); i++) {
+            if (i > 0) result += ", ";
+            result += record->shape->keyAt(i) + ": " + toString(record->slots[i], true);
+        }
+        return record->slots.empty() ? "{}" : result + " }";
+    }
+
+    std::string typeName(Value v) const {
+        if (v.isNumber()) return "number";
+        if (v.isNil()) return "nil";
+        if (v.isBool()) return "boolean";
+        switch (v.asObject()->kind) {
+            case ObjKind::STRING: return "string";
+            case ObjKind::ARRAY: return "array";
+            default: return "object";
+        }
+    }
+
+    bool isTruthy(Value v) const {
+        if (v.isBool()) return v.asBool();
+        if (v.isNumber()) return v.asNumber() != 0;
+        if (v.isNil()) return false;
+        if (v.isString()) return static_cast<StringObject*>(v.asObject())->length() != 0;
+        return true;
+    }
+
+    bool equals(Value a, Value b) const {
+        if (a.isNumber() && b.isNumber()) return a.asNumber() == b.asNumber();
+        if (a.isString() && b.isString()) {
+            const StringObject* x = static_cast<StringObject*>(a.asObject());
+            const StringObject* y = static_cast<StringObject*>(b.asObject());
+            if (x == y) return true;
+            if ((x->interned && y->interned) || x->length() != y->length()) return false;
+            if (x->hashed() && y->hashed() && x->hash() != y->hash()) return false;
+            return x->view() == y->view();
+        }
+        return a.sameAs(b);
+    }
+
+    // Evaluates every non-short-circuit binary operator.
+    Value binary(BinaryOpKind op, Value a, Value b) {
+        if (a.isNumber() && b.isNumber()) {
+            double x = a.asNumber(), y = b.asNumber();
+            switch (op) {
+                case BinaryOpKind::ADD: return Value::number(x + y);
+                case BinaryOpKind::SUB: return Value::number(x - y);
+                case BinaryOpKind::MUL: return Value::number(x * y);
+                case BinaryOpKind::DIV: return Value::number(x / y);
+                case BinaryOpKind::MOD: return Value::number(numberModulo(x, y));
+                case BinaryOpKind::LT: return Value::boolean(x < y);
+                case BinaryOpKind::LE: return Value::boolean(x <= y);
+                case BinaryOpKind::GT: return Value::boolean(x > y);
+                case BinaryOpKind::GE: return Value::boolean(x >= y);
+                default: break;
+            }
+        }
+
+        switch (op) {
+            case BinaryOpKind::EQ: return Value::boolean(equals(a, b));
+            case BinaryOpKind::NE: return Value::boolean(!equals(a, b));
+            case BinaryOpKind::AND: return Value::boolean(isTruthy(a) && isTruthy(b));
+            case BinaryOpKind::OR: return Value::boolean(isTruthy(a) || isTruthy(b));
+            case BinaryOpKind::ADD:
+                if (a.isString() || b.isString()) return concat(a, b);
+                break;
+            case BinaryOpKind::LT: case BinaryOpKind::LE:
+            case BinaryOpKind::GT: case BinaryOpKind::GE:
+                if (a.isString() && b.isString()) {
+                    int cmp = static_cast<StringObject*>(a.asObject())->view().compare(
+                              static_cast<StringObject*>(b.asObject())->view());
+                    if (op == BinaryOpKind::LT) return Value::boolean(cmp < 0);
+                    if (op == BinaryOpKind::LE) return Value::boolean(cmp <= 0);
+                    if (op == BinaryOpKind::GT) return Value::boolean(cmp > 0);
+                    return Value::boolean(cmp >= 0);
+                }
+                break;
+            default:
+                break;
+        }
+
+        throw std::runtime_error("Runtime error: unsupported operands " + typeName(a) +
+                                 " and " + typeName(b) + " for binary operator");
+    }
+
+    Value negate(Value v) {
+        if (!v.isNumber()) {
+            throw std::runtime_error("Runtime error: Operand of '-' must be number, got " + typeName(v));
+        }
+        return Value::number(-v.asNumber());
+    }
+
+    Value index(Value container, Value idx, const std::string& name) {
+        if (!idx.isNumber()) {
+            throw std::runtime_error("Runtime error: Array index must be number, got " + typeName(idx));
+        }
+        double d = idx.asNumber();
+        if (container.isArray()) {
+            const auto& elements = static_cast<ArrayObject*>(container.asObject())->elements;
+            if (d >= 0 && d < elements.size() && d == std::floor(d)) {
+                return elements[static_cast<size_t>(d)];
+            }
+            throw std::runtime_error("Runtime error: Index " + formatNumber(d) + " out of bounds for '" +
+                                     name + "' of length " + std::to_string(elements.size()));
+        }
+        if (container.isString()) {
+            std::string_view chars = static_cast<StringObject*>(container.asObject())->view();
+            if (d >= 0 && d < chars.size() && d == std::floor(d)) {
+                return intern(chars.substr(static_cast<size_t>(d), 1));
+            }
+            throw std::runtime_error("Runtime error: Index " + formatNumber(d) + " out of bounds for '" +
+                                     name + "' of length " + std::to_string(chars.size()));
+        }
+        throw std::runtime_error("Runtime error: Cannot index non-array type '" + name + "'");
+    }
+
+    // arr[i] = value; the element must already exist.
+    void setIndex(Value container, Value idx, Value value, const std::string& name) {
+        if (!idx.isNumber()) {
+            throw std::runtime_error("Runtime error: Array index must be number, got " + typeName(idx));
+        }
+        if (!container.isArray()) {
+            throw std::runtime_error("Runtime error: Cannot assign to an element of non-array '" + name + "'");
+        }
+        double d = idx.asNumber();
+        auto array = static_cast<ArrayObject*>(container.asObject());
+        if (d >= 0 && d < array->elements.size() && d == std::floor(d)) {
+            array->store(static_cast<size_t>(d), value);
+            heap.writeBarrier(array, value);
+            return;
+        }
+        throw std::runtime_error("Runtime error: Index " + formatNumber(d) + " out of bounds for '" +
+                                 name + "' of length " + std::to_string(array->elements.size()));
+    }
+
+    // obj.key through the site's cache; the object must have the key.
+    Value& member(Value object, const std::string& key, InlineCache& cache, const std::string& name) {
+        if (!object.isRecord()) {
+            throw std::runtime_error("Runtime error: Cannot access member '" + key + "' of non-object '" + name + "'");
+        }
+        RecordObject* record = static_cast<RecordObject*>(object.asObject());
+        int slot = cache.lookup(record->shape, key);
+        if (slot < 0) {
+            throw std::runtime_error("Runtime error: Object '" + name + "' has no member '" + key + "'");
+        }
+        return record->slots[slot];
+    }
+
+    // obj.key = value.
+    void setMember(Value object, const std::string& key, InlineCache& cache, const std::string& name, Value value) {
+        member(object, key, cache, name) = value;
+        heap.writeBarrier(object.asObject(), value);
+    }
+
+    double length(Value v) const {
+        if (v.isString()) return static_cast<double>(static_cast<StringObject*>(v.asObject())->length());
+        if (v.isArray()) return static_cast<double>(static_cast<ArrayObject*>(v.asObject())->elements.size());
+        if (v.isRecord()) return static_cast<double>(static_cast<RecordObject*>(v.asObject())->slots.size());
+        throw std::runtime_error("Runtime error: nikal() expects array or string, got " + typeName(v));
+    }
+
+    Value callBuiltin(BuiltinId id, const Value* args, size_t argc) {
+        const BuiltinInfo& info = builtinInfo(id);
+        if (info.arity >= 0 && static_cast<size_t>(info.arity) != argc) {
+            throw std::runtime_error("Runtime error: " + std::string(info.name) + "() expects " +
+                                     std::to_string(info.arity) + " arguments, got " + std::to_string(argc));
+        }
+
+        switch (id) {
+            case BuiltinId::DEKH: {
+                for (size_t i = 0; i < argc; i++) {
+                    if (i > 0) out << ' ';
+                    if (args[i].isString()) {
+                        out << static_cast<StringObject*>(args[i].asObject())->view();
+                    } else {
+                        out << toString(args[i]);
+                    }
+                }
+                out << '\n';
+                return Value::nil();
+            }
+            case BuiltinId::LOU: {
+                if (argc > 0) {
+                    out << toString(args[0]);
+                }
+                out.flush();
+                std::string line;
+                std::getline(in, line);
+                char* end = nullptr;
+                double d = std::strtod(line.c_str(), &end);
+                if (!line.empty() && end && *end == '\0') {
+                    return Value::number(d);
+                }
+                return makeString(line);
+            }
+            case BuiltinId::NIKAL:
+                return Value::number(length(args[0]));
+            case BuiltinId::BAND:
+                throw ProgramExit();
+            case BuiltinId::ABS:
+                return Value::number(std::fabs(numberArg(id, args, 0)));
+            case BuiltinId::SQRT:
+                return Value::number(std::sqrt(numberArg(id, args, 0)));
+            case BuiltinId::POW:
+                return Value::number(std::pow(numberArg(id, args, 0), numberArg(id, args, 1)));
+            case BuiltinId::MAX:
+                return Value::number(std::max(numberArg(id, args, 0), numberArg(id, args, 1)));
+            case BuiltinId::MIN:
+                return Value::number(std::min(numberArg(id, args, 0), numberArg(id, args, 1)));
+            case BuiltinId::ROUND:
+                return Value::number(std::round(numberArg(id, args, 0)));
+            case BuiltinId::RANDOM:
+                return Value::number(std::uniform_real_distribution<double>(0.0, 1.0)(rng));
+            case BuiltinId::SUM: {
+                const auto& x = numberArrayArg(id, args, 0)->elements;
+                return Value::number(ArrayKernels::sum(x.data(), x.size()));
+            }
+            case BuiltinId::DOT: {
+                const auto& x = numberArrayArg(id, args, 0)->elements;
+                const auto& y = numberArrayArg(id, args, 1)->elements;
+                if (x.size() != y.size()) {
+                    throw std::runtime_error("Runtime error: dot() expects arrays of the same length, got " +
+                                             std::to_string(x.size()) + " and " + std::to_string(y.size()));
+                }
+                return Value::number(ArrayKernels::dot(x.data(), y.data(), x.size()));
+            }
+            case BuiltinId::SCALE: {
+                const auto& x = numberArrayArg(id, args, 0)->elements;
+                double k = numberArg(id, args, 1);
+                ArrayObject* result = numberArray(x.size());
+                ArrayKernels::scale(x.data(), k, result->elements.data(), x.size());
+                return Value::object(result);
+            }
+            case BuiltinId::MINVAL:
+            case BuiltinId::MAXVAL: {
+                const auto& x = numberArrayArg(id, args, 0)->elements;
+                if (x.empty()) {
+                    throw std::runtime_error("Runtime error: " + std::string(info.name) + "() of an empty array");
+                }
+                return Value::number(id == BuiltinId::MINVAL ? ArrayKernels::minimum(x.data(), x.size())
+                                                             : ArrayKernels::maximum(x.data(), x.size()));
+            }
+            case BuiltinId::MAP: {
+                const auto& x = numberArrayArg(id, args, 0)->elements;
+                if (!args[1].isString()) {
+                    throw std::runtime_error("Runtime error: map() expects a function, got " + typeName(args[1]));
+                }
+                const ArrayLambda& lambda = arrayLambda(std::string(static_cast<StringObject*>(args[1].asObject())->view()));
+                ArrayObject* result = numberArray(x.size());
+                lambda.apply(x.data(), result->elements.data(), x.size());
+                return Value::object(result);
+            }
+            default:
+                throw std::runtime_error("Runtime error: unknown builtin");
+        }
+    }
+
+private:
+    std::unordered_map<std::string, std::unique_ptr<ArrayLambda>> arrayLambdas;  // by postfix text
+
+    const ArrayLambda& arrayLambda(const std::string& text) {
+        auto& lambda = arrayLambdas[text];
+        if (!lambda) lambda = std::make_unique<ArrayLambda>(text);
+        return *lambda;
+    }
+
+    // An array the kernels can read: packed, or generic with only numbers.
+    ArrayObject* numberArrayArg(BuiltinId id, const Value* args, size_t i) const {
+        const char* name = builtinInfo(id).name;
+        if (!args[i].isArray()) {
+            throw std::runtime_error("Runtime error: " + std::string(name) + "() expects array arguments, got " +
+                                     typeName(args[i]));
+        }
+        ArrayObject* array = static_cast<ArrayObject*>(args[i].asObject());
+        if (!array->packed()) {
+            for (Value element : array->elements) {
+                if (!element.isNumber()) {
+                    throw std::runtime_error("Runtime error: " + std::string(name) +
+                                             "() expects an array of numbers, got " + typeName(element));
+                }
+            }
+        }
+        return array;
+    }
+
+    // A new array of n elements for a kernel to fill with numbers.
+    ArrayObject* numberArray(size_t n) {
+        ArrayObject* array = heap.allocate<ArrayObject>();
+        array->elements.resize(n);
+        array->widen(ElementsKind::NUMBER);
+        return array;
+    }
+
+    double numberArg(BuiltinId id, const Value* args, size_t i) const {
+        if (!args[i].isNumber()) {
+            throw std::runtime_error("Runtime error: " + std::string(builtinInfo(id).name) +
+                                     "() expects number arguments, got " + typeName(args[i]));
+        }
+        return args[i].asNumber();
+    }
+};
+
+// ============================================================================
+// Tree-Walking Interpreter
+// ============================================================================
+
+class Interpreter : private Heap::RootSet {
+private:
+    Runtime& runtime;
+    std::unordered_map<std::string, FunctionDeclaration*> functions;
+    std::unordered_map<std::string, Value> globals;
+    // The block scopes of every active call; the running function's start
+    // at frameBase.
+    std::vector<std::unordered_map<std::string, Value>> scopes;
+    size_t frameBase;
+    Value returnValue;
+    bool returning;
+    int callDepth;
+
+    // A marked tail call returns without calling; callFunction then runs the
+    // callee in place of the returning function.
+    FunctionDeclaration* tailCallee;
+    std::vector<Value> tailArgs;
+
+    std::unordered_map<std::string, MemoTable*> memoTables;
+    std::unordered_map<const Expression*, InlineCache> memberCaches;  // per obj.key site
+
+public:
+    Interpreter(Runtime& rt) : runtime(rt), frameBase(0), returning(false), callDepth(0), tailCallee(nullptr) {
+        runtime.heap.addRoots(this);
+    }
+
+    ~Interpreter() {
+        runtime.heap.removeRoots(this);
+    }
+
+    // Caches the results of direct calls to `name` in `table`.
+    void memoize(const std::string& name, MemoTable* table) {
+        memoTables[name] = table;
+    }
+
+    // Runs the top-level statements in order, then enters kaam main().
+    void run(Program* program) {
+        try {
+            for (auto& stmt : program->statements) {
+                execute(stmt.get());
+            }
+
+            auto mainIt = functions.find("main");
+            if (mainIt == functions.end()) {
+                throw std::runtime_error("Runtime error: Main function 'kaam main()' not found");
+            }
+            std::vector<Value> noArgs;
+            callFunction(mainIt->second, noArgs);
+        } catch (const ProgramExit&) {
+            // band() ends the program normally
+        }
+        runtime.out.flush();
+    }
+
+private:
+    void visitRoots(const std::function<void(Value&)>& visit) override {
+        for (auto& global : globals) visit(global.second);
+        for (auto& scope : scopes) {
+            for (auto& local : scope) visit(local.second);
+        }
+        visit(returnValue);
+        for (Value& arg : tailArgs) visit(arg);
+    }
+
+    void execute(Statement* stmt) {
+        atLine(stmt->line, [&] { executeStatement(stmt); });
+    }
+
+    void executeStatement(Statement* stmt) {
+        if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt)) {
+            Value value = varDecl->initializer ? evaluate(varDecl->initializer.get()) : Value::nil();
+            declare(varDecl->name, value);
+        } else if (auto funcDecl = dynamic_cast<FunctionDeclaration*>(stmt)) {
+            functions[funcDecl->name] = funcDecl;
+        } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt)) {
+            if (runtime.isTruthy(evaluate(ifStmt->condition.get()))) {
+                executeBlock(ifStmt->thenBranch);
+            } else if (!ifStmt->elseBranch.empty()) {
+                executeBlock(ifStmt->elseBranch);
+            }
+        } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt)) {
+            while (!returning && runtime.isTruthy(evaluate(loopStmt->condition.get()))) {
+                executeBlock(loopStmt->body);
+                runtime.heap.safepoint();
+            }
+        } else if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt)) {
+            auto funcCall = dynamic_cast<FunctionCall*>(retStmt->value.get());
+            if (funcCall && funcCall->tailCall != TailCall::NONE) {
+                returnValue = tailCall(funcCall);
+            } else {
+                returnValue = retStmt->value ? evaluate(retStmt->value.get()) : Value::nil();
+            }
+            returning = true;
+        } else if (auto exprStmt = dynamic_cast<ExpressionStatement*>(stmt)) {
+            evaluate(exprStmt->expr.get());
+        }
+    }
+
+    void executeBlock(const std::vector<std::unique_ptr<Statement>>& stmts) {
+        scopes.emplace_back();
+        for (auto& stmt : stmts) {
+            execute(stmt.get());
+            if (returning) break;
+        }
+        scopes.pop_back();
+    }
+
+    void declare(const std::string& name, Value value) {
+        if (scopes.empty()) {
+            globals[name] = value;
+        } else {
+            scopes.back()[name] = value;
+        }
+    }
+
+    Value* resolve(const std::string& name) {
+        for (auto it = scopes.rbegin(); it != scopes.rend() - frameBase; ++it) {
+            auto found = it->find(name);
+            if (found != it->end()) {
+                return &found->second;
+            }
+        }
+        auto global = globals.find(name);
+        return global != globals.end() ? &global->second : nullptr;
+    }
+
+    static void checkArity(FunctionDeclaration* func, const std::vector<Value>& args) {
+        if (args.size() != func->params.size()) {
+            throw std::runtime_error("Runtime error: Function '" + func->name + "' expects " +
+                                     std::to_string(func->params.size()) + " arguments, got " +
+                                     std::to_string(args.size()));
+        }
+    }
+
+    Value callFunction(FunctionDeclaration* func, std::vector<Value>& args) {
+        checkArity(func, args);
+        if (++callDepth > Runtime::MAX_CALL_DEPTH) {
+            throw std::runtime_error("Runtime error: Maximum call depth exceeded in '" + func->name + "'");
+        }
+
+        size_t callerBase = frameBase;
+        frameBase = scopes.size();
+        std::vector<Value> calleeArgs;
+        std::vector<Value>* current = &args;
+        size_t regionMark = runtime.heap.regionMark();
+
+        // Each pass runs one function body; a tail call starts the next pass
+        // instead of nesting, so the call depth stays the same.
+        for (;;) {
+            runtime.heap.releaseRegion(regionMark);
+            scopes.resize(frameBase);
+            scopes.emplace_back();
+            for (size_t i = 0; i < current->size(); i++) {
+                scopes.back()[func->params[i]] = (*current)[i];
+            }
+            runtime.heap.safepoint();
+
+            returnValue = Value::nil();
+            for (auto& stmt : func->body) {
+                execute(stmt.get());
+                if (returning) break;
+            }
+            if (!tailCallee) break;
+
+            func = tailCallee;
+            tailCallee = nullptr;
+            returning = false;
+            calleeArgs.swap(tailArgs);
+            current = &calleeArgs;
+            checkArity(func, calleeArgs);
+        }
+        Value result = returning ? returnValue : Value::nil();
+        returning = false;
+        runtime.heap.releaseRegion(regionMark);
+
+        scopes.resize(frameBase);
+        frameBase = callerBase;
+        callDepth--;
+        return result;
+    }
+
+    // Evaluates the arguments of a marked tail call and leaves the call itself
+    // to callFunction; the returned value is replaced by the callee's result.
+    Value tailCall(FunctionCall* funcCall) {
+        std::vector<Value> args(funcCall->args.size());
+        Heap::Root keep(runtime.heap, args.data(), args.size());
+        for (size_t i = 0; i < args.size(); i++) {
+            args[i] = evaluate(funcCall->args[i].get());
+        }
+        auto func = functions.find(funcCall->name);
+        if (func != functions.end()) {
+            tailCallee = func->second;
+            tailArgs = std::move(args);
+            return Value::nil();
+        }
+        BuiltinId builtin = builtinIdFor(funcCall->name);
+        if (builtin != BuiltinId::NONE) {
+            return runtime.callBuiltin(builtin, args.data(), args.size());
+        }
+        throw std::runtime_error("Runtime error: Undefined function '" + funcCall->name + "'");
+    }
+
+    Value evaluate(Expression* expr) {
+        if (auto numLit = dynamic_cast<NumberLiteral*>(expr)) {
+            return Value::number(numLit->value);
+        }
+
+        if (auto strLit = dynamic_cast<StringLiteral*>(expr)) {
+            return runtime.intern(strLit->value);
+        }
+
+        if (auto boolLit = dynamic_cast<BooleanLiteral*>(expr)) {
+            return Value::boolean(boolLit->value);
+        }
+
+        if (auto id = dynamic_cast<Identifier*>(expr)) {
+            if (Value* slot = resolve(id->name)) {
+                return *slot;
+            }
+            throw std::runtime_error("Runtime error: Undefined variable '" + id->name + "'");
+        }
+
+        if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            BinaryOpKind kind = binaryOpKind(binOp->op);
+            Value left = evaluate(binOp->left.get());
+            if (kind == BinaryOpKind::AND) {
+                return Value::boolean(runtime.isTruthy(left) && runtime.isTruthy(evaluate(binOp->right.get())));
+            }
+            if (kind == BinaryOpKind::OR) {
+                return Value::boolean(runtime.isTruthy(left) || runtime.isTruthy(evaluate(binOp->right.get())));
+            }
+            Heap::Root keep(runtime.heap, &left, left.isObject() ? 1 : 0);
+            Value right = evaluate(binOp->right.get());
+            return runtime.binary(kind, left, right);
+        }
+
+        if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) {
+            Value operand = evaluate(unaryOp->operand.get());
+            if (unaryOp->op == "!") {
+                return Value::boolean(!runtime.isTruthy(operand));
+            }
+            return runtime.negate(operand);
+        }
+
+        if (auto assign = dynamic_cast<Assignment*>(expr)) {
+            Value value = evaluate(assign->value.get());
+            Value* slot = resolve(assign->name);
+            if (!slot) {
+                throw std::runtime_error("Runtime error: Undefined variable '" + assign->name + "'");
+            }
+            *slot = value;
+            return value;
+        }
+
+        if (auto funcCall = dynamic_cast<FunctionCall*>(expr)) {
+            std::vector<Value> args(funcCall->args.size());
+            Heap::Root keep(runtime.heap, args.data(), args.size());
+            for (size_t i = 0; i < args.size(); i++) {
+                args[i] = evaluate(funcCall->args[i].get());
+            }
+
+            auto func = functions.find(funcCall->name);
+            if (func != functions.end()) {
+                if (!memoTables.empty()) {
+                    auto memo = memoTables.find(funcCall->name);
+                    if (memo != memoTables.end() && memo->second->accepts(args.data(), args.size())) {
+                        MemoTable* table = memo->second;
+                        Value cached;
+                        if (table->lookup(args.data(), cached)) return cached;
+                        table->begin(args.data());
+                        Value result = callFunction(func->second, args);
+                        table->finish(result);
+                        return result;
+                    }
+                }
+                return callFunction(func->second, args);
+            }
+            BuiltinId builtin = builtinIdFor(funcCall->name);
+            if (builtin != BuiltinId::NONE) {
+                return runtime.callBuiltin(builtin, args.data(), args.size());
+            }
+            throw std::runtime_error("Runtime error: Undefined function '" + funcCall->name + "'");
+        }
+
+        if (auto arrayLit = dynamic_cast<ArrayLiteral*>(expr)) {
+            if (arrayLit->packed) return runtime.packedArray(*arrayLit->packed, arrayLit->inRegion);
+            ArrayObject* array = arrayLit->inRegion ? runtime.heap.allocateInRegion<ArrayObject>()
+                                                    : runtime.heap.allocate<ArrayObject>();
+            array->elements.reserve(arrayLit->elements.size());
+            Value result = Value::object(array);
+            Heap::Root keep(runtime.heap, result);
+            for (auto& element : arrayLit->elements) {
+                Value value = evaluate(element.get());
+                array = static_cast<ArrayObject*>(result.asObject());
+                array->append(value);
+                runtime.heap.writeBarrier(array, value);
+            }
+            return result;
+        }
+
+        if (auto objLit = dynamic_cast<ObjectLiteral*>(expr)) {
+            const Shape* shape = Shape::empty();
+            for (auto& member : objLit->members) shape = shape->withKey(member.first);
+            RecordObject* record = objLit->inRegion ? runtime.heap.allocateInRegion<RecordObject>(shape)
+                                                    : runtime.heap.allocate<RecordObject>(shape);
+            Value result = Value::object(record);
+            Heap::Root keep(runtime.heap, result);
+            for (size_t i = 0; i < objLit->members.size(); i++) {
+                Value value = evaluate(objLit->members[i].second.get());
+                record = static_cast<RecordObject*>(result.asObject());
+                record->slots[i] = value;
+                runtime.heap.writeBarrier(record, value);
+            }
+            return result;
+        }
+
+        if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr)) {
+            Value* slot = resolve(arrAccess->arrayName);
+            if (!slot) {
+                throw std::runtime_error("Runtime error: Undefined array '" + arrAccess->shownName() + "'");
+            }
+            Value container = *slot;
+            Heap::Root keep(runtime.heap, container);
+            Value index = evaluate(arrAccess->index.get());
+            return runtime.index(container, index, arrAccess->shownName());
+        }
+
+        if (auto indexAssign = dynamic_cast<IndexAssignment*>(expr)) {
+            Value index = evaluate(indexAssign->index.get());
+            Heap::Root keep(runtime.heap, &index, index.isObject() ? 1 : 0);
+            Value value = evaluate(indexAssign->value.get());
+            Value* slot = resolve(indexAssign->arrayName);
+            if (!slot) {
+                throw std::runtime_error("Runtime error: Undefined array '" + indexAssign->shownName() + "'");
+            }
+            runtime.setIndex(*slot, index, value, indexAssign->shownName());
+            return value;
+        }
+
+        if (auto memberAccess = dynamic_cast<MemberAccess*>(expr)) {
+            Value* slot = resolve(memberAccess->objectName);
+            if (!slot) {
+                throw std::runtime_error("Runtime error: Undefined object '" + memberAccess->shownName() + "'");
+            }
+            return runtime.member(*slot, memberAccess->member, memberCaches[expr], memberAccess->shownName());
+        }
+
+        if (auto memberAssign = dynamic_cast<MemberAssignment*>(expr)) {
+            Value value = evaluate(memberAssign->value.get());
+            Value* slot = resolve(memberAssign->objectName);
+            if (!slot) {
+                throw std::runtime_error("Runtime error: Undefined object '" + memberAssign->shownName() + "'");
+            }
+            runtime.setMember(*slot, memberAssign->member, memberCaches[expr], memberAssign->shownName(), value);
+            return value;
+        }
+
+        throw std::runtime_error("Runtime error: Unsupported expression");
+    }
+};
+
+// ============================================================================
+// Numeric Function Analysis
+// ============================================================================
+
+// Finds functions whose parameters, locals and return values are numbers
+// whenever every argument is a number. Such functions can run on raw doubles.
+// Calls between candidates are assumed numeric, and candidates that fail a
+// check are removed until the set stops changing.
+class NumericFunctionAnalysis {
+private:
+    std::unordered_map<std::string, FunctionDeclaration*> functions;
+    std::vector<std::string> order;
+    std::unordered_set<std::string> candidates;
+    std::unordered_map<std::string, std::string> rejections;
+
+    // Per-check state
+    std::vector<std::unordered_set<std::string>> scopes;
+    std::string failure;
+
+public:
+    void analyze(Program* program) {
+        collect(program->statements, true);
+        for (const auto& name : order) {
+            candidates.insert(name);
+        }
+
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (const auto& name : order) {
+                if (candidates.count(name) && !checkFunction(functions[name])) {
+                    candidates.erase(name);
+                    rejections[name] = failure;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    bool isNumeric(const std::string& name) const {
+        return candidates.count(name) > 0;
+    }
+
+    FunctionDeclaration* getFunction(const std::string& name) const {
+        auto it = functions.find(name);
+        return it != functions.end() ? it->second : nullptr;
+    }
+
+    const std::vector<std::string>& functionNames() const {
+        return order;
+    }
+
+    std::string rejectionReason(const std::string& name) const {
+        auto it = rejections.find(name);
+        return it != rejections.end() ? it->second : "";
+    }
+
+    static bool isNumericBuiltin(BuiltinId id) {
+        return id == BuiltinId::ABS || id == BuiltinId::SQRT || id == BuiltinId::ROUND ||
+               id == BuiltinId::POW || id == BuiltinId::MAX || id == BuiltinId::MIN;
+    }
+
+    // True when every path through the statements ends in wapas.
+    static bool alwaysReturns(const std::vector<std::unique_ptr<Statement>>& stmts) {
+        for (auto& stmt : stmts) {
+            if (dynamic_cast<ReturnStatement*>(stmt.get())) return true;
+            if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                if (alwaysReturns(ifStmt->thenBranch) && alwaysReturns(ifStmt->elseBranch)) return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    void collect(const std::vector<std::unique_ptr<Statement>>& stmts, bool topLevel) {
+        for (auto& stmt : stmts) {
+            if (auto funcDecl = dynamic_cast<FunctionDeclaration*>(stmt.get())) {
+                if (!functions.count(funcDecl->name)) order.push_back(funcDecl->name);
+                functions[funcDecl->name] = funcDecl;
+                collect(funcDecl->body, false);
+            } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                collect(ifStmt->thenBranch, topLevel);
+                collect(ifStmt->elseBranch, topLevel);
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                collect(loopStmt->body, topLevel);
+            }
+        }
+    }
+
+    bool fail(const std::string& reason) {
+        if (failure.empty()) failure = reason;
+        return false;
+    }
+
+    bool isLocal(const std::string& name) const {
+        for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+            if (it->count(name)) return true;
+        }
+        return false;
+    }
+
+    bool checkFunction(FunctionDeclaration* func) {
+        failure.clear();
+        scopes.clear();
+        scopes.emplace_back(func->params.begin(), func->params.end());
+        if (!checkBlock(func->body, false)) return false;
+        if (!alwaysReturns(func->body)) return fail("may finish without 'wapas'");
+        return true;
+    }
+
+    bool checkBlock(const std::vector<std::unique_ptr<Statement>>& stmts, bool newScope) {
+        if (newScope) scopes.emplace_back();
+        bool ok = true;
+        for (auto& stmt : stmts) {
+            if (!checkStatement(stmt.get())) {
+                ok = false;
+                break;
+            }
+        }
+        if (newScope) scopes.pop_back();
+        return ok;
+    }
+
+    bool checkStatement(Statement* stmt) {
+        if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt)) {
+            if (!varDecl->initializer) return fail("local '" + varDecl->name + "' starts as nil");
+            if (!isNumberExpr(varDecl->initializer.get())) return false;
+            scopes.back().insert(varDecl->name);
+            return true;
+        }
+        if (auto ifStmt = dynamic_cast<IfStatement*>(stmt)) {
+            return isCondition(ifStmt->condition.get()) && checkBlock(ifStmt->thenBranch, true) &&
+                   checkBlock(ifStmt->elseBranch, true);
+        }
+        if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt)) {
+            return isCondition(loopStmt->condition.get()) && checkBlock(loopStmt->body, true);
+        }
+        if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt)) {
+            if (!retStmt->value) return fail("returns nil");
+            return isNumberExpr(retStmt->value.get());
+        }
+        if (auto exprStmt = dynamic_cast<ExpressionStatement*>(stmt)) {
+            return isNumberExpr(exprStmt->expr.get());
+        }
+        return fail("contains a nested function");
+    }
+
+    bool isNumberExpr(Expression* expr) {
+        if (dynamic_cast<NumberLiteral*>(expr)) return true;
+
+        if (auto id = dynamic_cast<Identifier*>(expr)) {
+            return isLocal(id->name) || fail("reads global '" + id->name + "'");
+        }
+
+        if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            BinaryOpKind kind = binaryOpKind(binOp->op);
+            if (kind == BinaryOpKind::ADD || kind == BinaryOpKind::SUB || kind == BinaryOpKind::MUL ||
+                kind == BinaryOpKind::DIV || kind == BinaryOpKind::MOD) {
+                return isNumberExpr(binOp->left.get()) && isNumberExpr(binOp->right.get());
+            }
+            return fail("uses '" + binOp->op + "' as a value");
+        }
+
+        if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) {
+            if (unaryOp->op == "-") return isNumberExpr(unaryOp->operand.get());
+            return fail("uses '!' as a value");
+        }
+
+        if (auto assign = dynamic_cast<Assignment*>(expr)) {
+            if (!isLocal(assign->name)) return fail("assigns global '" + assign->name + "'");
+            return isNumberExpr(assign->value.get());
+        }
+
+        if (auto funcCall = dynamic_cast<FunctionCall*>(expr)) {
+            for (auto& arg : funcCall->args) {
+                if (!isNumberExpr(arg.get())) return false;
+            }
+            if (functions.count(funcCall->name)) {
+                if (!candidates.count(funcCall->name)) {
+                    return fail("calls non-numeric function '" + funcCall->name + "'");
+                }
+                return true;
+            }
+            BuiltinId builtin = builtinIdFor(funcCall->name);
+            if (isNumericBuiltin(builtin) &&
+                funcCall->args.size() == static_cast<size_t>(builtinInfo(builtin).arity)) {
+                return true;
+            }
+            return fail("calls '" + funcCall->name + "'");
+        }
+
+        return fail("uses a non-number value");
+    }
+
+    bool isCondition(Expression* expr) {
+        if (dynamic_cast<BooleanLiteral*>(expr)) return true;
+
+        if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            BinaryOpKind kind = binaryOpKind(binOp->op);
+            if (kind == BinaryOpKind::AND || kind == BinaryOpKind::OR) {
+                return isCondition(binOp->left.get()) && isCondition(binOp->right.get());
+            }
+            if (kind == BinaryOpKind::EQ || kind == BinaryOpKind::NE || kind == BinaryOpKind::LT ||
+                kind == BinaryOpKind::LE || kind == BinaryOpKind::GT || kind == BinaryOpKind::GE) {
+                return isNumberExpr(binOp->left.get()) && isNumberExpr(binOp->right.get());
+            }
+        }
+
+        if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) {
+            if (unaryOp->op == "!") return isCondition(unaryOp->operand.get());
+        }
+
+        return fail("condition is not a number comparison");
+    }
+};
+
+// ============================================================================
+// AST Optimization
+// ============================================================================
+
+// Passes that rewrite the analyzed AST before it reaches an engine. Every
+// pass keeps the program's observable behaviour; the PassManager at the end
+// of this section runs them in pipeline order and then recomputes the
+// integral, tail-call and escape annotations for the new tree.
+
+// Size of a subtree in AST nodes, the unit of every cost and growth figure.
+int countNodes(const Expression* expr) {
+    if (!expr) return 0;
+    if (auto binOp = dynamic_cast<const BinaryOp*>(expr)) {
+        return 1 + countNodes(binOp->left.get()) + countNodes(binOp->right.get());
+    }
+    if (auto unaryOp = dynamic_cast<const UnaryOp*>(expr)) return 1 + countNodes(unaryOp->operand.get());
+    if (auto assign = dynamic_cast<const Assignment*>(expr)) return 1 + countNodes(assign->value.get());
+    if (auto funcCall = dynamic_cast<const FunctionCall*>(expr)) {
+        int count = 1;
+        for (auto& arg : funcCall->args) count += countNodes(arg.get());
+        return count;
+    }
+    if (auto arrayLit = dynamic_cast<const ArrayLiteral*>(expr)) {
+        int count = 1;
+        for (auto& element : arrayLit->elements) count += countNodes(element.get());
+        return count;
+    }
+    if (auto objLit = dynamic_cast<const ObjectLiteral*>(expr)) {
+        int count = 1;
+        for (auto& member : objLit->members) count += countNodes(member.second.get());
+        return count;
+    }
+    if (auto arrAccess = dynamic_cast<const ArrayAccess*>(expr)) return 1 + countNodes(arrAccess->index.get());
+    if (auto indexAssign = dynamic_cast<const IndexAssignment*>(expr)) {
+        return 1 + countNodes(indexAssign->index.get()) + countNodes(indexAssign->value.get());
+    }
+    if (auto memberAssign = dynamic_cast<const MemberAssignment*>(expr)) {
+        return 1 + countNodes(memberAssign->value.get());
+    }
+    return 1;
+}
+
+int countNodes(const std::vector<std::unique_ptr<Statement>>& stmts);
+
+int countNodes(const Statement* stmt) {
+    if (auto varDecl = dynamic_cast<const VariableDeclaration*>(stmt)) {
+        return 1 + countNodes(varDecl->initializer.get());
+    }
+    if (auto funcDecl = dynamic_cast<const FunctionDeclaration*>(stmt)) return 1 + countNodes(funcDecl->body);
+    if (auto ifStmt = dynamic_cast<const IfStatement*>(stmt)) {
+        return 1 + countNodes(ifStmt->condition.get()) + countNodes(ifStmt->thenBranch) +
+               countNodes(ifStmt->elseBranch);
+    }
+    if (auto loopStmt = dynamic_cast<const LoopStatement*>(stmt)) {
+        return 1 + countNodes(loopStmt->condition.get()) + countNodes(loopStmt->body);
+    }
+    if (auto retStmt = dynamic_cast<const ReturnStatement*>(stmt)) return 1 + countNodes(retStmt->value.get());
+    if (auto exprStmt = dynamic_cast<const ExpressionStatement*>(stmt)) return 1 + countNodes(exprStmt->expr.get());
+    return 1;
+}
+
+int countNodes(const std::vector<std::unique_ptr<Statement>>& stmts) {
+    int count = 0;
+    for (auto& stmt : stmts) count += countNodes(stmt.get());
+    return count;
+}
+
+// Calls `visit` on the expression and every subexpression, parents first.
+void forEachExpression(const Expression* expr, const std::function<void(const Expression*)>& visit) {
+    if (!expr) return;
+    visit(expr);
+    if (auto binOp = dynamic_cast<const BinaryOp*>(expr)) {
+        forEachExpression(binOp->left.get(), visit);
+        forEachExpression(binOp->right.get(), visit);
+    } else if (auto unaryOp = dynamic_cast<const UnaryOp*>(expr)) {
+        forEachExpression(unaryOp->operand.get(), visit);
+    } else if (auto assign = dynamic_cast<const Assignment*>(expr)) {
+        forEachExpression(assign->value.get(), visit);
+    } else if (auto funcCall = dynamic_cast<const FunctionCall*>(expr)) {
+        for (auto& arg : funcCall->args) forEachExpression(arg.get(), visit);
+    } else if (auto arrayLit = dynamic_cast<const ArrayLiteral*>(expr)) {
+        for (auto& element : arrayLit->elements) forEachExpression(element.get(), visit);
+    } else if (auto objLit = dynamic_cast<const ObjectLiteral*>(expr)) {
+        for (auto& member : objLit->members) forEachExpression(member.second.get(), visit);
+    } else if (auto arrAccess = dynamic_cast<const ArrayAccess*>(expr)) {
+        forEachExpression(arrAccess->index.get(), visit);
+    } else if (auto indexAssign = dynamic_cast<const IndexAssignment*>(expr)) {
+        forEachExpression(indexAssign->index.get(), visit);
+        forEachExpression(indexAssign->value.get(), visit);
+    } else if (auto memberAssign = dynamic_cast<const MemberAssignment*>(expr)) {
+        forEachExpression(memberAssign->value.get(), visit);
+    }
+}
+
+// Calls `visit` on every expression the statements evaluate. Nested kaam
+// bodies are skipped: declaring a function runs none of its code.
+void forEachExpression(const std::vector<std::unique_ptr<Statement>>& stmts,
+                       const std::function<void(const Expression*)>& visit) {
+    for (auto& stmt : stmts) {
+        if (auto varDecl = dynamic_cast<const VariableDeclaration*>(stmt.get())) {
+            forEachExpression(varDecl->initializer.get(), visit);
+        } else if (auto ifStmt = dynamic_cast<const IfStatement*>(stmt.get())) {
+            forEachExpression(ifStmt->condition.get(), visit);
+            forEachExpression(ifStmt->thenBranch, visit);
+            forEachExpression(ifStmt->elseBranch, visit);
+        } else if (auto loopStmt = dynamic_cast<const LoopStatement*>(stmt.get())) {
+            forEachExpression(loopStmt->condition.get(), visit);
+            forEachExpression(loopStmt->body, visit);
+        } else if (auto retStmt = dynamic_cast<const ReturnStatement*>(stmt.get())) {
+            forEachExpression(retStmt->value.get(), visit);
+        } else if (auto exprStmt = dynamic_cast<const ExpressionStatement*>(stmt.get())) {
+            forEachExpression(exprStmt->expr.get(), visit);
+        }
+    }
+}
+
+// Adds every variable, parameter and function name the statements declare,
+// nested functions included. A name outside this set is free for a pass to
+// introduce.
+void collectDeclaredNames(const std::vector<std::unique_ptr<Statement>>& stmts,
+                          std::unordered_set<std::string>& names) {
+    for (auto& stmt : stmts) {
+        if (auto varDecl = dynamic_cast<const VariableDeclaration*>(stmt.get())) {
+            names.insert(varDecl->name);
+        } else if (auto funcDecl = dynamic_cast<const FunctionDeclaration*>(stmt.get())) {
+            names.insert(funcDecl->name);
+            names.insert(funcDecl->params.begin(), funcDecl->params.end());
+            collectDeclaredNames(funcDecl->body, names);
+        } else if (auto ifStmt = dynamic_cast<const IfStatement*>(stmt.get())) {
+            collectDeclaredNames(ifStmt->thenBranch, names);
+            collectDeclaredNames(ifStmt->elseBranch, names);
+        } else if (auto loopStmt = dynamic_cast<const LoopStatement*>(stmt.get())) {
+            collectDeclaredNames(loopStmt->body, names);
+        }
+    }
+}
+
+// Source-like text of an expression, for optimization reports.
+std::string describeExpression(const Expression* expr) {
+    if (!expr) return "";
+    // Operators nest without precedence information, so bracket them
+    auto operand = [](const Expression* e) {
+        std::string text = describeExpression(e);
+        bool bracket = dynamic_cast<const BinaryOp*>(e) || dynamic_cast<const Assignment*>(e) ||
+                       dynamic_cast<const IndexAssignment*>(e) || dynamic_cast<const MemberAssignment*>(e);
+        return bracket ? "(" + text + ")" : text;
+    };
+    if (auto numLit = dynamic_cast<const NumberLiteral*>(expr)) return formatNumber(numLit->value);
+    if (auto strLit = dynamic_cast<const StringLiteral*>(expr)) return "\"" + strLit->value + "\"";
+    if (auto boolLit = dynamic_cast<const BooleanLiteral*>(expr)) return boolLit->value ? "haan" : "na";
+    if (auto id = dynamic_cast<const Identifier*>(expr)) return id->name;
+    if (auto binOp = dynamic_cast<const BinaryOp*>(expr)) {
+        return operand(binOp->left.get()) + " " + binOp->op + " " + operand(binOp->right.get());
+    }
+    if (auto unaryOp = dynamic_cast<const UnaryOp*>(expr)) return unaryOp->op + operand(unaryOp->operand.get());
+    if (auto assign = dynamic_cast<const Assignment*>(expr)) {
+        return assign->name + " = " + describeExpression(assign->value.get());
+    }
+    if (auto funcCall = dynamic_cast<const FunctionCall*>(expr)) {
+        std::string text = funcCall->name + "(";
+        for (size_t i = 0; i < funcCall->args.size(); i++) {
+            if (i > 0) text += ", ";
+            text += describeExpression(funcCall->args[i].get());
+        }
+        return text + ")";
+    }
+    if (auto arrayLit = dynamic_cast<const ArrayLiteral*>(expr)) {
+        std::string text = "[";
+        if (arrayLit->packed) {
+            // Packed literals may be data tables; the first values identify them
+            const PackedElements& packed = *arrayLit->packed;
+            for (size_t i = 0; i < std::min<size_t>(packed.size(), 4); i++) {
+                if (i > 0) text += ", ";
+                text += packed.strings.empty() ? formatNumber(packed.numbers[i]) : "\"" + packed.strings[i] + "\"";
+            }
+            return text + (packed.size() > 4 ? ", ...]" : "]");
+        }
+        for (size_t i = 0; i < arrayLit->elements.size(); i++) {
+            if (i > 0) text += ", ";
+            text += describeExpression(arrayLit->elements[i].get());
+        }
+        return text + "]";
+    }
+    if (auto objLit = dynamic_cast<const ObjectLiteral*>(expr)) {
+        std::string text = "{";
+        for (size_t i = 0; i < objLit->members.size(); i++) {
+            if (i > 0) text += ", ";
+            text += objLit->members[i].first + ": " + describeExpression(objLit->members[i].second.get());
+        }
+        return text + "}";
+    }
+    if (auto arrAccess = dynamic_cast<const ArrayAccess*>(expr)) {
+        return arrAccess->arrayName + "[" + describeExpression(arrAccess->index.get()) + "]";
+    }
+    if (auto indexAssign = dynamic_cast<const IndexAssignment*>(expr)) {
+        return indexAssign->arrayName + "[" + describeExpression(indexAssign->index.get()) + "] = " +
+               describeExpression(indexAssign->value.get());
+    }
+    if (auto memberAccess = dynamic_cast<const MemberAccess*>(expr)) {
+        return memberAccess->objectName + "." + memberAccess->member;
+    }
+    if (auto memberAssign = dynamic_cast<const MemberAssignment*>(expr)) {
+        return memberAssign->objectName + "." + memberAssign->member + " = " +
+               describeExpression(memberAssign->value.get());
+    }
+    return "?";
+}
+
+// True when evaluating the expression may reassign a variable.
+bool containsAssignment(Expression* expr) {
+    if (!expr) return false;
+    if (dynamic_cast<Assignment*>(expr)) return true;
+    if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+        return containsAssignment(binOp->left.get()) || containsAssignment(binOp->right.get());
+    }
+    if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) return containsAssignment(unaryOp->operand.get());
+    if (auto funcCall = dynamic_cast<FunctionCall*>(expr)) {
+        for (auto& arg : funcCall->args) {
+            if (containsAssignment(arg.get())) return true;
+        }
+    }
+    if (auto arrayLit = dynamic_cast<ArrayLiteral*>(expr)) {
+        for (auto& element : arrayLit->elements) {
+            if (containsAssignment(element.get())) return true;
+        }
+    }
+    if (auto objLit = dynamic_cast<ObjectLiteral*>(expr)) {
+        for (auto& member : objLit->members) {
+            if (containsAssignment(member.second.get())) return true;
+        }
+    }
+    if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr)) return containsAssignment(arrAccess->index.get());
+    if (auto indexAssign = dynamic_cast<IndexAssignment*>(expr)) {
+        return containsAssignment(indexAssign->index.get()) || containsAssignment(indexAssign->value.get());
+    }
+    if (auto memberAssign = dynamic_cast<MemberAssignment*>(expr)) {
+        return containsAssignment(memberAssign->value.get());
+    }
+    return false;
+}
+
+// True when evaluating the expression calls a function, and so may reach a
+// safepoint where the collector moves objects.
+bool containsCall(Expression* expr) {
+    if (!expr) return false;
+    if (dynamic_cast<FunctionCall*>(expr)) return true;
+    if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+        return containsCall(binOp->left.get()) || containsCall(binOp->right.get());
+    }
+    if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) return containsCall(unaryOp->operand.get());
+    if (auto assign = dynamic_cast<Assignment*>(expr)) return containsCall(assign->value.get());
+    if (auto arrayLit = dynamic_cast<ArrayLiteral*>(expr)) {
+        for (auto& element : arrayLit->elements) {
+            if (containsCall(element.get())) return true;
+        }
+    }
+    if (auto objLit = dynamic_cast<ObjectLiteral*>(expr)) {
+        for (auto& member : objLit->members) {
+            if (containsCall(member.second.get())) return true;
+        }
+    }
+    if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr)) return containsCall(arrAccess->index.get());
+    if (auto indexAssign = dynamic_cast<IndexAssignment*>(expr)) {
+        return containsCall(indexAssign->index.get()) || containsCall(indexAssign->value.get());
+    }
+    if (auto memberAssign = dynamic_cast<MemberAssignment*>(expr)) return containsCall(memberAssign->value.get());
+    return false;
+}
+
+// True when evaluating the expression has no effect: no assignment, no
+// allocation and only calls to pure builtins. Such an expression may be
+// evaluated earlier, later, fewer or more times without changing the output
+// (a type error it raises may surface at a different point).
+bool isPureExpression(const Expression* expr) {
+    if (!expr) return true;
+    if (auto binOp = dynamic_cast<const BinaryOp*>(expr)) {
+        return isPureExpression(binOp->left.get()) && isPureExpression(binOp->right.get());
+    }
+    if (auto unaryOp = dynamic_cast<const UnaryOp*>(expr)) return isPureExpression(unaryOp->operand.get());
+    if (auto funcCall = dynamic_cast<const FunctionCall*>(expr)) {
+        BuiltinId builtin = builtinIdFor(funcCall->name);
+        if (builtin == BuiltinId::NONE || !builtinInfo(builtin).pure) return false;
+        for (auto& arg : funcCall->args) {
+            if (!isPureExpression(arg.get())) return false;
+        }
+        return true;
+    }
+    if (auto arrAccess = dynamic_cast<const ArrayAccess*>(expr)) return isPureExpression(arrAccess->index.get());
+    return dynamic_cast<const NumberLiteral*>(expr) || dynamic_cast<const StringLiteral*>(expr) ||
+           dynamic_cast<const BooleanLiteral*>(expr) || dynamic_cast<const Identifier*>(expr) ||
+           dynamic_cast<const MemberAccess*>(expr);
+}
+
+// Surely evaluates to a number without a runtime error: number literals,
+// integral variables, and arithmetic and numeric builtins over those.
+bool isSafeNumber(const Expression* expr) {
+    if (dynamic_cast<const NumberLiteral*>(expr)) return true;
+    if (auto id = dynamic_cast<const Identifier*>(expr)) return id->integral;
+    if (auto binOp = dynamic_cast<const BinaryOp*>(expr)) {
+        const std::string& op = binOp->op;
+        return (op == "+" || op == "-" || op == "*" || op == "/" || op == "%") &&
+               isSafeNumber(binOp->left.get()) && isSafeNumber(binOp->right.get());
+    }
+    if (auto unaryOp = dynamic_cast<const UnaryOp*>(expr)) {
+        return unaryOp->op == "-" && isSafeNumber(unaryOp->operand.get());
+    }
+    if (auto funcCall = dynamic_cast<const FunctionCall*>(expr)) {
+        BuiltinId builtin = builtinIdFor(funcCall->name);
+        if (builtin == BuiltinId::NONE || !NumericFunctionAnalysis::isNumericBuiltin(builtin) ||
+            funcCall->args.size() != static_cast<size_t>(builtinInfo(builtin).arity)) {
+            return false;
+        }
+        for (auto& arg : funcCall->args) {
+            if (!isSafeNumber(arg.get())) return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+// Evaluates to a number whenever it evaluates at all: - * / % and unary
+// minus raise an error on anything else, + does when both sides are numbers,
+// and numeric builtins and nikal return numbers.
+bool yieldsNumber(const Expression* expr) {
+    if (dynamic_cast<const NumberLiteral*>(expr)) return true;
+    if (auto id = dynamic_cast<const Identifier*>(expr)) return id->integral;
+    if (auto assign = dynamic_cast<const Assignment*>(expr)) return yieldsNumber(assign->value.get());
+    if (auto binOp = dynamic_cast<const BinaryOp*>(expr)) {
+        const std::string& op = binOp->op;
+        if (op == "+") return yieldsNumber(binOp->left.get()) && yieldsNumber(binOp->right.get());
+        return op == "-" || op == "*" || op == "/" || op == "%";
+    }
+    if (auto unaryOp = dynamic_cast<const UnaryOp*>(expr)) return unaryOp->op == "-";
+    if (auto funcCall = dynamic_cast<const FunctionCall*>(expr)) {
+        BuiltinId builtin = builtinIdFor(funcCall->name);
+        return NumericFunctionAnalysis::isNumericBuiltin(builtin) || builtin == BuiltinId::NIKAL;
+    }
+    return false;
+}
+
+// Copies an expression with its annotations. Variable names go through
+// `rename`; `substitute` may return a replacement for an Identifier.
+using NameMapper = std::function<std::string(const std::string&)>;
+using IdentifierSubstitution = std::function<std::unique_ptr<Expression>(const Identifier*)>;
+
+// The sourceName of a copy whose variable is now `name`.
+inline std::string keepSourceName(const std::string& name, const std::string& shown) {
+    return name == shown ? std::string() : shown;
+}
+
+std::unique_ptr<Expression> cloneExpression(const Expression* expr, const NameMapper& rename,
+                                            const IdentifierSubstitution& substitute = nullptr) {
+    if (!expr) return nullptr;
+    std::unique_ptr<Expression> copy;
+    if (auto numLit = dynamic_cast<const NumberLiteral*>(expr)) {
+        copy = std::make_unique<NumberLiteral>(numLit->value, numLit->integral);
+    } else if (auto strLit = dynamic_cast<const StringLiteral*>(expr)) {
+        copy = std::make_unique<StringLiteral>(strLit->value);
+    } else if (auto boolLit = dynamic_cast<const BooleanLiteral*>(expr)) {
+        copy = std::make_unique<BooleanLiteral>(boolLit->value);
+    } else if (auto id = dynamic_cast<const Identifier*>(expr)) {
+        if (substitute) {
+            if (auto replacement = substitute(id)) return replacement;
+        }
+        copy = std::make_unique<Identifier>(rename(id->name));
+    } else if (auto binOp = dynamic_cast<const BinaryOp*>(expr)) {
+        copy = std::make_unique<BinaryOp>(cloneExpression(binOp->left.get(), rename, substitute), binOp->op,
+                                          cloneExpression(binOp->right.get(), rename, substitute));
+    } else if (auto unaryOp = dynamic_cast<const UnaryOp*>(expr)) {
+        copy = std::make_unique<UnaryOp>(unaryOp->op, cloneExpression(unaryOp->operand.get(), rename, substitute));
+    } else if (auto assign = dynamic_cast<const Assignment*>(expr)) {
+        copy = std::make_unique<Assignment>(rename(assign->name),
+                                            cloneExpression(assign->value.get(), rename, substitute));
+    } else if (auto funcCall = dynamic_cast<const FunctionCall*>(expr)) {
+        auto call = std::make_unique<FunctionCall>(funcCall->name);
+        for (auto& arg : funcCall->args) {
+            call->args.push_back(cloneExpression(arg.get(), rename, substitute));
+        }
+        copy = std::move(call);
+    } else if (auto arrayLit = dynamic_cast<const ArrayLiteral*>(expr)) {
+        auto array = std::make_unique<ArrayLiteral>();
+        for (auto& element : arrayLit->elements) {
+            array->elements.push_back(cloneExpression(element.get(), rename, substitute));
+        }
+        array->packed = arrayLit->packed;
+        array->inRegion = arrayLit->inRegion;
+        copy = std::move(array);
+    } else if (auto objLit = dynamic_cast<const ObjectLiteral*>(expr)) {
+        auto object = std::make_unique<ObjectLiteral>();
+        for (auto& member : objLit->members) {
+            object->members.push_back({member.first, cloneExpression(member.second.get(), rename, substitute)});
+        }
+        object->inRegion = objLit->inRegion;
+        copy = std::move(object);
+    } else if (auto arrAccess = dynamic_cast<const ArrayAccess*>(expr)) {
+        auto access = std::make_unique<ArrayAccess>(rename(arrAccess->arrayName),
+                                                    cloneExpression(arrAccess->index.get(), rename, substitute));
+        access->sourceName = keepSourceName(access->arrayName, arrAccess->shownName());
+        copy = std::move(access);
+    } else if (auto indexAssign = dynamic_cast<const IndexAssignment*>(expr)) {
+        auto store = std::make_unique<IndexAssignment>(rename(indexAssign->arrayName),
+                                                       cloneExpression(indexAssign->index.get(), rename, substitute),
+                                                       cloneExpression(indexAssign->value.get(), rename, substitute));
+        store->sourceName = keepSourceName(store->arrayName, indexAssign->shownName());
+        copy = std::move(store);
+    } else if (auto memberAccess = dynamic_cast<const MemberAccess*>(expr)) {
+        auto access = std::make_unique<MemberAccess>(rename(memberAccess->objectName), memberAccess->member);
+        access->sourceName = keepSourceName(access->objectName, memberAccess->shownName());
+        copy = std::move(access);
+    } else if (auto memberAssign = dynamic_cast<const MemberAssignment*>(expr)) {
+        auto store = std::make_unique<MemberAssignment>(rename(memberAssign->objectName), memberAssign->member,
+                                                        cloneExpression(memberAssign->value.get(), rename, substitute));
+        store->sourceName = keepSourceName(store->objectName, memberAssign->shownName());
+        copy = std::move(store);
+    } else {
+        throw std::runtime_error("Optimizer error: unsupported expression");
+    }
+    copy->type = expr->type;
+    copy->integral = expr->integral;
+    return copy;
+}
+
+// Copies statements with cloneExpression; declared names go through
+// `rename` too. Nested kaam declarations are not copied.
+std::vector<std::unique_ptr<Statement>> cloneStatements(const std::vector<std::unique_ptr<Statement>>& stmts,
+                                                        const NameMapper& rename) {
+    std::vector<std::unique_ptr<Statement>> out;
+    for (auto& stmt : stmts) {
+        std::unique_ptr<Statement> copy;
+        if (auto varDecl = dynamic_cast<const VariableDeclaration*>(stmt.get())) {
+            copy = std::make_unique<VariableDeclaration>(rename(varDecl->name),
+                                                         cloneExpression(varDecl->initializer.get(), rename));
+        } else if (auto ifStmt = dynamic_cast<const IfStatement*>(stmt.get())) {
+            auto branch = std::make_unique<IfStatement>(cloneExpression(ifStmt->condition.get(), rename));
+            branch->thenBranch = cloneStatements(ifStmt->thenBranch, rename);
+            branch->elseBranch = cloneStatements(ifStmt->elseBranch, rename);
+            copy = std::move(branch);
+        } else if (auto loopStmt = dynamic_cast<const LoopStatement*>(stmt.get())) {
+            auto loop = std::make_unique<LoopStatement>(cloneExpression(loopStmt->condition.get(), rename));
+            loop->body = cloneStatements(loopStmt->body, rename);
+            copy = std::move(loop);
+        } else if (auto retStmt = dynamic_cast<const ReturnStatement*>(stmt.get())) {
+            copy = std::make_unique<ReturnStatement>(cloneExpression(retStmt->value.get(), rename));
+        } else if (auto exprStmt = dynamic_cast<const ExpressionStatement*>(stmt.get())) {
+            copy = std::make_unique<ExpressionStatement>(cloneExpression(exprStmt->expr.get(), rename));
+        } else {
+            throw std::runtime_error("Optimizer error: cannot copy a function declaration");
+        }
+        copy->line = stmt->line;
+        out.push_back(std::move(copy));
+    }
+    return out;
+}
+
+// Replaces calls to small, non-recursive functions with their bodies.
+//
+// A function whose body is a single `wapas e` is substituted inside any
+// expression when its arguments can stand in for the parameters without
+// changing what is evaluated: literals, locals of the caller, or pure
+// arguments used at most once by a body that calls no user function. An
+// argument that may fail must be used exactly once, and such arguments
+// must be read in argument order before anything else in the body fails.
+// Other functions are expanded where the call is the whole statement
+// (`banao x = f(..)`, `x = f(..)`, `f(..)`, `wapas f(..)`): the arguments
+// are bound once to fresh locals, every local of the body is renamed, and
+// each `wapas` assigns the result. Code after an early `wapas` moves into
+// the other branch of its `agar`, or is guarded by a done flag when the
+// `wapas` sits in a loop.
+//
+// A site is inlined when the callee costs at most `threshold` nodes (twice
+// that inside a daura loop, where the call overhead repeats) and the
+// program grows by no more than its original size.
+class Inliner {
+public:
+    struct Site {
+        std::string caller;
+        std::string callee;
+        int line;
+        int cost;
+    };
+
+private:
+    static constexpr int MAX_CALLER_LOCALS = 192;  // the VM has 256 registers per frame
+
+    int threshold;
+    CallGraph graph;
+    std::unordered_set<std::string> usedNames;
+    std::unordered_set<std::string> globalNames;
+    std::vector<Site> inlined;
+    int nodesBefore = 0;
+    int growth = 0;
+
+    // Per-caller state
+    FunctionDeclaration* caller = nullptr;
+    std::unordered_set<std::string> callerLocals;
+    int localCount = 0;
+    int loopDepth = 0;
+    int statementLine = 0;  // of the statement being rewritten
+
+    // Per-expansion state
+    std::string calleeName;
+    std::vector<std::unordered_map<std::string, std::string>> renames;
+    std::string resultName;
+    std::string flagName;
+    bool freeNameConflict = false;
+
+public:
+    explicit Inliner(int costThreshold) : threshold(costThreshold) {}
+
+    void run(Program* program) {
+        graph.build(program);
+        nodesBefore = countNodes(program->statements);
+        collectDeclaredNames(program->statements, usedNames);
+        for (auto& stmt : program->statements) {
+            if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt.get())) globalNames.insert(varDecl->name);
+        }
+        // Callees first, so what they inlined is part of their cost
+        for (int id : graph.bottomUp()) {
+            caller = graph.function(id);
+            callerLocals.clear();
+            callerLocals.insert(caller->params.begin(), caller->params.end());
+            collectLocals(caller->body);
+            localCount = static_cast<int>(callerLocals.size());
+            loopDepth = 0;
+            rewriteBlock(caller->body);
+        }
+    }
+
+    const std::vector<Site>& sites() const { return inlined; }
+    int originalNodes() const { return nodesBefore; }
+
+private:
+    void collectLocals(const std::vector<std::unique_ptr<Statement>>& stmts) {
+        for (auto& stmt : stmts) {
+            if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt.get())) {
+                callerLocals.insert(varDecl->name);
+            } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                collectLocals(ifStmt->thenBranch);
+                collectLocals(ifStmt->elseBranch);
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                collectLocals(loopStmt->body);
+            }
+        }
+    }
+
+    // A name no variable or function of the program uses.
+    std::string freshName(const std::string& base) {
+        std::string name;
+        int suffix = static_cast<int>(inlined.size()) + 1;
+        do {
+            name = base + "_" + calleeName + std::to_string(suffix++);
+        } while (usedNames.count(name));
+        usedNames.insert(name);
+        return name;
+    }
+
+    static bool containsDeclaration(const std::vector<std::unique_ptr<Statement>>& stmts) {
+        for (auto& stmt : stmts) {
+            if (dynamic_cast<FunctionDeclaration*>(stmt.get())) return true;
+            if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                if (containsDeclaration(ifStmt->thenBranch) || containsDeclaration(ifStmt->elseBranch)) return true;
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                if (containsDeclaration(loopStmt->body)) return true;
+            }
+        }
+        return false;
+    }
+
+    // The callee's graph id when this call may be inlined, otherwise -1.
+    int inlinable(FunctionCall* funcCall) const {
+        int id = graph.lookup(funcCall->name);
+        if (id < 0 || graph.isRecursive(id)) return -1;
+        FunctionDeclaration* callee = graph.function(id);
+        if (callee->params.size() != funcCall->args.size() || containsDeclaration(callee->body)) return -1;
+        int cost = countNodes(callee->body);
+        int limit = loopDepth > 0 ? 2 * threshold : threshold;
+        if (cost > limit || !withinGrowth(cost)) return -1;
+        return id;
+    }
+
+    bool withinGrowth(int added) const {
+        return growth + added <= nodesBefore;
+    }
+
+    void record(FunctionCall* funcCall, int added) {
+        growth += added;
+        inlined.push_back({caller->name, funcCall->name, statementLine,
+                           countNodes(graph.function(graph.lookup(funcCall->name))->body)});
+    }
+
+    // ---- Caller traversal -------------------------------------------------
+
+    void rewriteBlock(std::vector<std::unique_ptr<Statement>>& stmts) {
+        std::vector<std::unique_ptr<Statement>> out;
+        for (auto& stmt : stmts) {
+            rewriteStatement(std::move(stmt), out);
+        }
+        stmts = std::move(out);
+    }
+
+    void rewriteStatement(std::unique_ptr<Statement> stmt, std::vector<std::unique_ptr<Statement>>& out) {
+        statementLine = stmt->line;
+        if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt.get())) {
+            if (varDecl->initializer) rewriteExpression(varDecl->initializer);
+            auto funcCall = dynamic_cast<FunctionCall*>(varDecl->initializer.get());
+            std::string result;
+            if (funcCall && expand(funcCall, statementLine, &result, out)) {
+                varDecl->initializer = std::make_unique<Identifier>(result);
+            }
+        } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+            rewriteExpression(ifStmt->condition);
+            rewriteBlock(ifStmt->thenBranch);
+            rewriteBlock(ifStmt->elseBranch);
+        } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+            rewriteExpression(loopStmt->condition);
+            loopDepth++;
+            rewriteBlock(loopStmt->body);
+            loopDepth--;
+        } else if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt.get())) {
+            if (retStmt->value) rewriteExpression(retStmt->value);
+            auto funcCall = dynamic_cast<FunctionCall*>(retStmt->value.get());
+            std::string result;
+            if (funcCall && funcCall->tailCall == TailCall::NONE && expand(funcCall, statementLine, &result, out)) {
+                retStmt->value = std::make_unique<Identifier>(result);
+            }
+        } else if (auto exprStmt = dynamic_cast<ExpressionStatement*>(stmt.get())) {
+            rewriteExpression(exprStmt->expr);
+            if (auto funcCall = dynamic_cast<FunctionCall*>(exprStmt->expr.get())) {
+                if (expand(funcCall, statementLine, nullptr, out)) return;
+            } else if (auto assign = dynamic_cast<Assignment*>(exprStmt->expr.get())) {
+                auto funcCall = dynamic_cast<FunctionCall*>(assign->value.get());
+                std::string result;
+                if (funcCall && expand(funcCall, statementLine, &result, out)) {
+                    assign->value = std::make_unique<Identifier>(result);
+                }
+            }
+        }
+        out.push_back(std::move(stmt));
+    }
+
+    // Substitutes single-expression functions, innermost calls first.
+    void rewriteExpression(std::unique_ptr<Expression>& slot) {
+        Expression* expr = slot.get();
+        if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            rewriteExpression(binOp->left);
+            rewriteExpression(binOp->right);
+        } else if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) {
+            rewriteExpression(unaryOp->operand);
+        } else if (auto assign = dynamic_cast<Assignment*>(expr)) {
+            rewriteExpression(assign->value);
+        } else if (auto funcCall = dynamic_cast<FunctionCall*>(expr)) {
+            for (auto& arg : funcCall->args) rewriteExpression(arg);
+            if (auto body = substitute(funcCall)) slot = std::move(body);
+        } else if (auto arrayLit = dynamic_cast<ArrayLiteral*>(expr)) {
+            for (auto& element : arrayLit->elements) rewriteExpression(element);
+        } else if (auto objLit = dynamic_cast<ObjectLiteral*>(expr)) {
+            for (auto& member : objLit->members) rewriteExpression(member.second);
+        } else if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr)) {
+            rewriteExpression(arrAccess->index);
+        } else if (auto indexAssign = dynamic_cast<IndexAssignment*>(expr)) {
+            rewriteExpression(indexAssign->index);
+            rewriteExpression(indexAssign->value);
+        } else if (auto memberAssign = dynamic_cast<MemberAssignment*>(expr)) {
+            rewriteExpression(memberAssign->value);
+        }
+    }
+
+    bool isCallerLocal(const Expression* expr) const {
+        auto id = dynamic_cast<const Identifier*>(expr);
+        return id && callerLocals.count(id->name) && !globalNames.count(id->name);
+    }
+
+    static bool isLiteral(const Expression* expr) {
+        return dynamic_cast<const NumberLiteral*>(expr) || dynamic_cast<const StringLiteral*>(expr) ||
+               dynamic_cast<const BooleanLiteral*>(expr);
+    }
+
+    static bool callsUserFunction(const Expression* expr) {
+        bool found = false;
+        forEachExpression(expr, [&](const Expression* e) {
+            auto funcCall = dynamic_cast<const FunctionCall*>(e);
+            if (funcCall && builtinIdFor(funcCall->name) == BuiltinId::NONE) found = true;
+        });
+        return found;
+    }
+
+    static int countUses(const Expression* expr, const std::string& name) {
+        int uses = 0;
+        forEachExpression(expr, [&](const Expression* e) {
+            auto id = dynamic_cast<const Identifier*>(e);
+            auto arrAccess = dynamic_cast<const ArrayAccess*>(e);
+            auto indexAssign = dynamic_cast<const IndexAssignment*>(e);
+            auto memberAccess = dynamic_cast<const MemberAccess*>(e);
+            auto memberAssign = dynamic_cast<const MemberAssignment*>(e);
+            if ((id && id->name == name) || (arrAccess && arrAccess->arrayName == name) ||
+                (indexAssign && indexAssign->arrayName == name) ||
+                (memberAccess && memberAccess->objectName == name) ||
+                (memberAssign && memberAssign->objectName == name)) {
+                uses++;
+            }
+        });
+        return uses;
+    }
+
+    // Whether a use of the parameter sits in the right operand of && or ||,
+    // where an argument substituted for it would only sometimes run.
+    static bool usedConditionally(const Expression* expr, const std::string& name) {
+        bool found = false;
+        forEachExpression(expr, [&](const Expression* e) {
+            auto binOp = dynamic_cast<const BinaryOp*>(e);
+            if (binOp && binOp->shortCircuit && countUses(binOp->right.get(), name) > 0) found = true;
+        });
+        return found;
+    }
+
+    // Appends the nodes of the expression in the order they finish
+    // evaluating: operands before the operation that uses them.
+    static void evaluationOrder(const Expression* expr, std::vector<const Expression*>& out) {
+        if (auto binOp = dynamic_cast<const BinaryOp*>(expr)) {
+            evaluationOrder(binOp->left.get(), out);
+            evaluationOrder(binOp->right.get(), out);
+        } else if (auto unaryOp = dynamic_cast<const UnaryOp*>(expr)) {
+            evaluationOrder(unaryOp->operand.get(), out);
+        } else if (auto funcCall = dynamic_cast<const FunctionCall*>(expr)) {
+            for (auto& arg : funcCall->args) evaluationOrder(arg.get(), out);
+        } else if (auto arrayLit = dynamic_cast<const ArrayLiteral*>(expr)) {
+            for (auto& element : arrayLit->elements) evaluationOrder(element.get(), out);
+        } else if (auto objLit = dynamic_cast<const ObjectLiteral*>(expr)) {
+            for (auto& member : objLit->members) evaluationOrder(member.second.get(), out);
+        } else if (auto arrAccess = dynamic_cast<const ArrayAccess*>(expr)) {
+            evaluationOrder(arrAccess->index.get(), out);
+        } else if (auto indexAssign = dynamic_cast<const IndexAssignment*>(expr)) {
+            evaluationOrder(indexAssign->index.get(), out);
+            evaluationOrder(indexAssign->value.get(), out);
+        } else if (auto memberAssign = dynamic_cast<const MemberAssignment*>(expr)) {
+            evaluationOrder(memberAssign->value.get(), out);
+        }
+        out.push_back(expr);
+    }
+
+    // Whether the body reads the parameters in `params` in that order before
+    // it does anything that may raise an error, as a call evaluates its
+    // arguments in order before the body runs.
+    static bool evaluatedFirst(const Expression* body, const std::vector<std::string>& params) {
+        std::vector<const Expression*> order;
+        evaluationOrder(body, order);
+        size_t next = 0;
+        for (const Expression* e : order) {
+            if (next == params.size()) return true;
+            auto id = dynamic_cast<const Identifier*>(e);
+            if (id) {
+                if (id->name == params[next]) {
+                    next++;
+                } else if (std::find(params.begin(), params.end(), id->name) != params.end()) {
+                    return false;
+                }
+            } else if (!isLiteral(e) && !dynamic_cast<const ArrayLiteral*>(e) &&
+                       !dynamic_cast<const ObjectLiteral*>(e) && !isSafeNumber(e)) {
+                return false;
+            }
+        }
+        return next == params.size();
+    }
+
+    std::unique_ptr<Expression> substitute(FunctionCall* funcCall) {
+        int id = inlinable(funcCall);
+        if (id < 0) return nullptr;
+        FunctionDeclaration* callee = graph.function(id);
+        if (callee->body.size() != 1) return nullptr;
+        auto retStmt = dynamic_cast<ReturnStatement*>(callee->body[0].get());
+        if (!retStmt || !retStmt->value || containsAssignment(retStmt->value.get())) return nullptr;
+        const Expression* body = retStmt->value.get();
+
+        bool callsUser = callsUserFunction(body);
+        std::unordered_map<std::string, const Expression*> arguments;
+        std::vector<std::string> failing;  // parameters whose arguments may raise an error
+        for (size_t i = 0; i < callee->params.size(); i++) {
+            const Expression* arg = funcCall->args[i].get();
+            const std::string& param = callee->params[i];
+            arguments[param] = arg;
+            if (isLiteral(arg) || isCallerLocal(arg)) continue;
+            if (callsUser || !isPureExpression(arg)) return nullptr;
+            int uses = countUses(body, param);
+            if (isSafeNumber(arg) || dynamic_cast<const Identifier*>(arg)) {
+                if (uses > 1) return nullptr;
+                continue;
+            }
+            // A computation that may fail must run exactly once, also when
+            // the callee would skip or short-circuit its parameter
+            if (uses != 1 || usedConditionally(body, param)) return nullptr;
+            failing.push_back(param);
+        }
+        if (!failing.empty() && !evaluatedFirst(body, failing)) return nullptr;
+
+        bool conflict = false;
+        auto rename = [&](const std::string& name) {
+            auto it = arguments.find(name);
+            if (it == arguments.end()) {
+                // A global of the callee must not be hidden by a caller local
+                if (callerLocals.count(name)) conflict = true;
+                return name;
+            }
+            auto id = dynamic_cast<const Identifier*>(it->second);
+            if (!id) conflict = true;  // indexing a parameter bound to a literal
+            return id ? id->name : name;
+        };
+        auto replace = [&](const Identifier* id) -> std::unique_ptr<Expression> {
+            auto it = arguments.find(id->name);
+            if (it == arguments.end()) return nullptr;
+            return cloneExpression(it->second, [](const std::string& name) { return name; });
+        };
+        auto result = cloneExpression(body, rename, replace);
+        int added = countNodes(result.get()) - countNodes(funcCall);
+        if (conflict || !withinGrowth(added)) return nullptr;
+        record(funcCall, added);
+        return result;
+    }
+
+    // ---- Statement expansion ----------------------------------------------
+
+    static bool hasValuelessReturn(const std::vector<std::unique_ptr<Statement>>& stmts) {
+        for (auto& stmt : stmts) {
+            if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt.get())) {
+                if (!retStmt->value) return true;
+            } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                if (hasValuelessReturn(ifStmt->thenBranch) || hasValuelessReturn(ifStmt->elseBranch)) return true;
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                if (hasValuelessReturn(loopStmt->body)) return true;
+            }
+        }
+        return false;
+    }
+
+    static bool mayReturn(const Statement* stmt) {
+        if (dynamic_cast<const ReturnStatement*>(stmt)) return true;
+        if (auto ifStmt = dynamic_cast<const IfStatement*>(stmt)) {
+            for (auto& s : ifStmt->thenBranch) if (mayReturn(s.get())) return true;
+            for (auto& s : ifStmt->elseBranch) if (mayReturn(s.get())) return true;
+        } else if (auto loopStmt = dynamic_cast<const LoopStatement*>(stmt)) {
+            for (auto& s : loopStmt->body) if (mayReturn(s.get())) return true;
+        }
+        return false;
+    }
+
+    static bool alwaysReturns(const std::vector<Statement*>& stmts) {
+        for (Statement* stmt : stmts) {
+            if (dynamic_cast<ReturnStatement*>(stmt)) return true;
+            if (auto ifStmt = dynamic_cast<IfStatement*>(stmt)) {
+                if (alwaysReturns(view(ifStmt->thenBranch)) && alwaysReturns(view(ifStmt->elseBranch))) return true;
+            }
+        }
+        return false;
+    }
+
+    static std::vector<Statement*> view(const std::vector<std::unique_ptr<Statement>>& stmts,
+                                        size_t from = 0) {
+        std::vector<Statement*> result;
+        for (size_t i = from; i < stmts.size(); i++) result.push_back(stmts[i].get());
+        return result;
+    }
+
+    // Appends the inlined body of a statement-level call to `out`. With a
+    // result, `*result` names the local holding the returned value.
+    bool expand(FunctionCall* funcCall, int line, std::string* result, std::vector<std::unique_ptr<Statement>>& out) {
+        int id = inlinable(funcCall);
+        if (id < 0) return false;
+        FunctionDeclaration* callee = graph.function(id);
+        if (result && hasValuelessReturn(callee->body)) return false;
+
+        int callNodes = countNodes(funcCall);
+        calleeName = callee->name;
+        renames.assign(1, {});
+        freeNameConflict = false;
+        std::vector<std::unique_ptr<Statement>> code;
+        auto emit = [&](std::unique_ptr<Statement> stmt) {
+            stmt->line = line;
+            code.push_back(std::move(stmt));
+        };
+
+        // Parameters are bound once, in argument order
+        std::vector<std::string> params;
+        for (size_t i = 0; i < callee->params.size(); i++) {
+            params.push_back(freshName(callee->params[i]));
+            emit(std::make_unique<VariableDeclaration>(params.back(), std::move(funcCall->args[i])));
+        }
+        for (size_t i = 0; i < callee->params.size(); i++) {
+            renames.back()[callee->params[i]] = params[i];
+        }
+
+        resultName = result ? freshName("result") : "";
+        if (result) {
+            // A body that always returns never exposes the initial value
+            bool returns = NumericFunctionAnalysis::alwaysReturns(callee->body);
+            emit(std::make_unique<VariableDeclaration>(resultName, returns ? std::make_unique<NumberLiteral>(0, true)
+                                                                            : nullptr));
+        }
+        flagName = freshName("done");
+        size_t flagAt = code.size();
+        bool flagUsed = false;
+        transformSequence(view(callee->body), false, code, flagUsed);
+        if (flagUsed) {
+            auto flag = std::make_unique<VariableDeclaration>(flagName, std::make_unique<NumberLiteral>(0, true));
+            flag->line = line;
+            code.insert(code.begin() + flagAt, std::move(flag));
+        }
+
+        int locals = static_cast<int>(params.size()) + (result ? 1 : 0) + (flagUsed ? 1 : 0);
+        int added = countNodes(code) - callNodes;
+        if (freeNameConflict || localCount + locals > MAX_CALLER_LOCALS || !withinGrowth(added)) {
+            // Give the arguments back; the call stays as it was
+            for (size_t i = 0; i < params.size(); i++) {
+                funcCall->args[i] = std::move(static_cast<VariableDeclaration*>(code[i].get())->initializer);
+            }
+            return false;
+        }
+        localCount += locals;
+        for (auto& stmt : code) out.push_back(std::move(stmt));
+        if (result) *result = resultName;
+        record(funcCall, added);
+        return true;
+    }
+
+    std::string renameInBody(const std::string& name) {
+        for (auto scope = renames.rbegin(); scope != renames.rend(); ++scope) {
+            auto it = scope->find(name);
+            if (it != scope->end()) return it->second;
+        }
+        // A global of the callee must not be hidden by a caller local
+        if (callerLocals.count(name)) freeNameConflict = true;
+        return name;
+    }
+
+    std::unique_ptr<Expression> cloneInBody(const Expression* expr) {
+        return cloneExpression(expr, [this](const std::string& name) { return renameInBody(name); });
+    }
+
+    std::unique_ptr<Expression> flagTest() const {
+        auto flag = std::make_unique<Identifier>(flagName);
+        flag->type = DataType::NUMBER;
+        auto test = std::make_unique<BinaryOp>(std::move(flag), "==", std::make_unique<NumberLiteral>(0, true));
+        test->type = DataType::BOOLEAN;
+        return test;
+    }
+
+    std::vector<std::unique_ptr<Statement>> transformBlock(const std::vector<Statement*>& stmts, bool setFlag,
+                                                           bool& flagUsed) {
+        std::vector<std::unique_ptr<Statement>> out;
+        renames.emplace_back();
+        transformSequence(stmts, setFlag, out, flagUsed);
+        renames.pop_back();
+        return out;
+    }
+
+    // Copies the callee statements. `setFlag` is set when some enclosing
+    // construct tests the done flag after a `wapas` here.
+    void transformSequence(const std::vector<Statement*>& stmts, bool setFlag,
+                           std::vector<std::unique_ptr<Statement>>& out, bool& flagUsed) {
+        for (size_t i = 0; i < stmts.size(); i++) {
+            Statement* stmt = stmts[i];
+            std::vector<Statement*> rest(stmts.begin() + i + 1, stmts.end());
+
+            if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt)) {
+                if (!resultName.empty()) {
+                    auto assign = std::make_unique<Assignment>(resultName, cloneInBody(retStmt->value.get()));
+                    push(out, std::make_unique<ExpressionStatement>(std::move(assign)), stmt->line);
+                } else if (retStmt->value && !isPureExpression(retStmt->value.get())) {
+                    push(out, std::make_unique<ExpressionStatement>(cloneInBody(retStmt->value.get())), stmt->line);
+                }
+                if (setFlag) {
+                    auto assign = std::make_unique<Assignment>(flagName, std::make_unique<NumberLiteral>(1, true));
+                    push(out, std::make_unique<ExpressionStatement>(std::move(assign)), stmt->line);
+                }
+                return;  // the rest of the block is unreachable
+            }
+
+            if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt)) {
+                auto init = cloneInBody(varDecl->initializer.get());
+                std::string name = freshName(varDecl->name);
+                renames.back()[varDecl->name] = name;
+                push(out, std::make_unique<VariableDeclaration>(name, std::move(init)), stmt->line);
+                continue;
+            }
+
+            if (auto exprStmt = dynamic_cast<ExpressionStatement*>(stmt)) {
+                push(out, std::make_unique<ExpressionStatement>(cloneInBody(exprStmt->expr.get())), stmt->line);
+                continue;
+            }
+
+            if (auto ifStmt = dynamic_cast<IfStatement*>(stmt)) {
+                auto cond = cloneInBody(ifStmt->condition.get());
+                std::vector<Statement*> thenBranch = view(ifStmt->thenBranch);
+                std::vector<Statement*> elseBranch = view(ifStmt->elseBranch);
+                if (mayReturn(stmt)) {
+                    // Code after a branch that always returns belongs to the other one
+                    if (alwaysReturns(thenBranch)) {
+                        elseBranch.insert(elseBranch.end(), rest.begin(), rest.end());
+                        rest.clear();
+                    } else if (alwaysReturns(elseBranch)) {
+                        thenBranch.insert(thenBranch.end(), rest.begin(), rest.end());
+                        rest.clear();
+                    }
+                }
+                bool guardRest = mayReturn(stmt) && !rest.empty();
+                auto copy = std::make_unique<IfStatement>(std::move(cond));
+                copy->thenBranch = transformBlock(thenBranch, setFlag || guardRest, flagUsed);
+                copy->elseBranch = transformBlock(elseBranch, setFlag || guardRest, flagUsed);
+                push(out, std::move(copy), stmt->line);
+                if (!mayReturn(stmt)) continue;
+                if (guardRest) guard(rest, setFlag, out, flagUsed, stmt->line);
+                return;
+            }
+
+            if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt)) {
+                auto cond = cloneInBody(loopStmt->condition.get());
+                if (!mayReturn(stmt)) {
+                    auto copy = std::make_unique<LoopStatement>(std::move(cond));
+                    copy->body = transformBlock(view(loopStmt->body), setFlag, flagUsed);
+                    push(out, std::move(copy), stmt->line);
+                    continue;
+                }
+                flagUsed = true;
+                auto test = std::make_unique<BinaryOp>(flagTest(), "&&", std::move(cond));
+                test->type = DataType::BOOLEAN;
+                auto copy = std::make_unique<LoopStatement>(std::move(test));
+                copy->body = transformBlock(view(loopStmt->body), true, flagUsed);
+                push(out, std::move(copy), stmt->line);
+                if (!rest.empty()) guard(rest, setFlag, out, flagUsed, stmt->line);
+                return;
+            }
+        }
+    }
+
+    // Runs `rest` only while no `wapas` has been taken.
+    void guard(const std::vector<Statement*>& rest, bool setFlag, std::vector<std::unique_ptr<Statement>>& out,
+               bool& flagUsed, int line) {
+        flagUsed = true;
+        auto check = std::make_unique<IfStatement>(flagTest());
+        check->thenBranch = transformBlock(rest, setFlag, flagUsed);
+        push(out, std::move(check), line);
+    }
+
+    static void push(std::vector<std::unique_ptr<Statement>>& out, std::unique_ptr<Statement> stmt, int line) {
+        stmt->line = line;
+        out.push_back(std::move(stmt));
+    }
+};
+
+// What a call to each user function may do, its callees included. A
+// function sees only its own locals and the globals, so the only way a call
+// changes its caller's variables is by writing a global. Arrays are shared
+// by reference, so an element store may change any array the caller sees.
+class EffectAnalysis {
+public:
+    struct Effects {
+        bool readsGlobals = false;
+        bool writesGlobals = false;
+        bool io = false;  // calls dekh, lou, band or random
+        bool writesElements = false;  // `arr[i] = v` on some array
+    };
+
+private:
+    CallGraph graph;
+    std::unordered_set<std::string> globals;
+    std::vector<Effects> effects;
+    Effects anything{true, true, true, true};
+
+public:
+    void analyze(Program* program) {
+        graph.build(program);
+        for (auto& stmt : program->statements) {
+            if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt.get())) globals.insert(varDecl->name);
+        }
+        effects.assign(graph.size(), Effects());
+        for (int id = 0; id < graph.size(); id++) {
+            FunctionDeclaration* func = graph.function(id);
+            std::unordered_set<std::string> params(func->params.begin(), func->params.end());
+            Effects& own = effects[id];
+            // Flow-insensitive: a global name the function also declares
+            // locally may still be read or written before the declaration.
+            forEachExpression(func->body, [&](const Expression* expr) {
+                std::string read;
+                if (auto ident = dynamic_cast<const Identifier*>(expr)) read = ident->name;
+                if (auto arrAccess = dynamic_cast<const ArrayAccess*>(expr)) read = arrAccess->arrayName;
+                if (auto indexAssign = dynamic_cast<const IndexAssignment*>(expr)) {
+                    read = indexAssign->arrayName;
+                    own.writesElements = true;
+                }
+                if (auto memberAccess = dynamic_cast<const MemberAccess*>(expr)) read = memberAccess->objectName;
+                if (auto memberAssign = dynamic_cast<const MemberAssignment*>(expr)) {
+                    read = memberAssign->objectName;
+                    own.writesElements = true;
+                }
+                if (!read.empty() && globals.count(read) && !params.count(read)) own.readsGlobals = true;
+                if (auto assign = dynamic_cast<const Assignment*>(expr)) {
+                    if (globals.count(assign->name) && !params.count(assign->name)) own.writesGlobals = true;
+                } else if (auto funcCall = dynamic_cast<const FunctionCall*>(expr)) {
+                    // Calls to known functions are merged below, once their
+                    // own effects are complete
+                    bool known = builtinIdFor(funcCall->name) == BuiltinId::NONE && graph.lookup(funcCall->name) >= 0;
+                    if (!known) merge(own, ofCall(funcCall->name));
+                }
+            });
+        }
+        // Callees first; repeat until cycles settle
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (int id : graph.bottomUp()) {
+                Effects before = effects[id];
+                for (int callee : graph.callees(id)) merge(effects[id], effects[callee]);
+                changed = changed || before.readsGlobals != effects[id].readsGlobals ||
+                          before.writesGlobals != effects[id].writesGlobals || before.io != effects[id].io ||
+                          before.writesElements != effects[id].writesElements;
+            }
+        }
+    }
+
+    bool isGlobal(const std::string& name) const { return globals.count(name) > 0; }
+    const std::unordered_set<std::string>& globalNames() const { return globals; }
+    const CallGraph& callGraph() const { return graph; }
+
+    // Effects of calling `name`. A builtin's follow from its BuiltinInfo; a
+    // function declared twice or not at all is assumed to do anything.
+    Effects ofCall(const std::string& name) const {
+        BuiltinId builtin = builtinIdFor(name);
+        if (builtin != BuiltinId::NONE) {
+            Effects result;
+            result.io = !builtinInfo(builtin).pure;
+            return result;
+        }
+        int id = graph.lookup(name);
+        return id >= 0 ? effects[id] : anything;
+    }
+
+private:
+    static void merge(Effects& into, const Effects& from) {
+        into.readsGlobals = into.readsGlobals || from.readsGlobals;
+        into.writesGlobals = into.writesGlobals || from.writesGlobals;
+        into.io = into.io || from.io;
+        into.writesElements = into.writesElements || from.writesElements;
+    }
+};
+
+// Functions whose result can be cached by their arguments (--memoize=auto):
+// recursive, so repeated subproblems are likely, taking one to
+// MemoTable::MAX_ARGS parameters, and neither reading nor writing a global
+// nor calling dekh, lou, random or band, directly or through any callee.
+// Such a call returns the same value for the same numbers every time; the
+// engines check at each call that the arguments are numbers, and a
+// function that only ever sees numbers cannot reach anything else.
+std::vector<FunctionDeclaration*> memoizableFunctions(Program* program) {
+    EffectAnalysis effects;
+    effects.analyze(program);
+    const CallGraph& graph = effects.callGraph();
+    std::vector<FunctionDeclaration*> result;
+    for (int id = 0; id < graph.size(); id++) {
+        FunctionDeclaration* func = graph.function(id);
+        if (graph.lookup(func->name) != id || !graph.isRecursive(id)) continue;
+        if (func->params.empty() || func->params.size() > static_cast<size_t>(MemoTable::MAX_ARGS)) continue;
+        EffectAnalysis::Effects own = effects.ofCall(func->name);
+        if (!own.readsGlobals && !own.writesGlobals && !own.io) result.push_back(func);
+    }
+    return result;
+}
+
+// Moves loop-invariant computations out of daura loops.
+//
+// An expression is invariant in a loop when it is pure (isPureExpression),
+// reads no variable the loop assigns or declares, reads no global if the
+// loop calls a function that may write one (EffectAnalysis), and indexes no
+// array if the loop may store an element of one. Each
+// largest invariant subexpression that does more than name a variable or a
+// constant is computed once into a fresh `banao` before the loop, and the
+// loop reads that temporary instead.
+//
+// Hoisting must not run a computation that can fail where the original
+// would not have, so an expression moves only when it
+//   - cannot fail: arithmetic, comparisons and numeric builtins over number
+//     literals and integral variables;
+//   - is in the loop condition outside the right operand of && or ||, and
+//     nothing with an effect runs before it: the first test evaluates it
+//     anyway; or
+//   - is in the body, reached on every first iteration before anything with
+//     an effect. The loop is then wrapped in `agar (condition)` so the value
+//     is only computed when the loop is entered, which needs a pure
+//     condition.
+// Inner loops are rewritten first, so a value invariant in several nested
+// loops moves out one loop at a time.
+class LoopInvariantMotion {
+public:
+    struct Loop {
+        std::string function;  // "top level" outside any kaam
+        int line;
+        std::vector<std::string> hoisted;
+    };
+
+private:
+    EffectAnalysis effects;
+    std::unordered_set<std::string> usedNames;
+    std::vector<Loop> rewritten;
+    std::string functionName = "top level";
+    int tempCount = 0;
+
+    // Per-loop state
+    std::unordered_set<std::string> variant;  // assigned or declared by the loop
+    bool globalsVariant = false;
+    bool elementsVariant = false;
+    bool guardable = false;
+    bool inCondition = false;
+    bool firstIteration = false;  // still before any effect of the first iteration
+    std::vector<std::unique_ptr<Statement>> hoisted;  // before the loop
+    std::vector<std::unique_ptr<Statement>> guarded;  // before the loop, once it is known to run
+    std::unordered_map<std::string, std::string> temps;  // description -> temporary
+    Loop* current = nullptr;
+
+public:
+    void run(Program* program) {
+        effects.analyze(program);
+        collectDeclaredNames(program->statements, usedNames);
+        rewriteBlock(program->statements);
+    }
+
+    const std::vector<Loop>& loops() const { return rewritten; }
+
+    int hoistedCount() const {
+        int count = 0;
+        for (const auto& loop : rewritten) count += static_cast<int>(loop.hoisted.size());
+        return count;
+    }
+
+private:
+    void rewriteBlock(std::vector<std::unique_ptr<Statement>>& stmts) {
+        std::vector<std::unique_ptr<Statement>> out;
+        for (auto& stmt : stmts) {
+            if (auto funcDecl = dynamic_cast<FunctionDeclaration*>(stmt.get())) {
+                std::string outer = functionName;
+                functionName = funcDecl->name;
+                rewriteBlock(funcDecl->body);
+                functionName = outer;
+            } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                rewriteBlock(ifStmt->thenBranch);
+                rewriteBlock(ifStmt->elseBranch);
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                rewriteBlock(loopStmt->body);
+                hoistFrom(std::unique_ptr<LoopStatement>(static_cast<LoopStatement*>(stmt.release())), out);
+                continue;
+            }
+            out.push_back(std::move(stmt));
+        }
+        stmts = std::move(out);
+    }
+
+    void hoistFrom(std::unique_ptr<LoopStatement> loop, std::vector<std::unique_ptr<Statement>>& out) {
+        variant.clear();
+        globalsVariant = false;
+        elementsVariant = false;
+        auto scan = [&](const Expression* expr) {
+            if (auto assign = dynamic_cast<const Assignment*>(expr)) variant.insert(assign->name);
+            if (dynamic_cast<const IndexAssignment*>(expr) || dynamic_cast<const MemberAssignment*>(expr)) {
+                elementsVariant = true;
+            }
+            if (auto funcCall = dynamic_cast<const FunctionCall*>(expr)) {
+                EffectAnalysis::Effects callee = effects.ofCall(funcCall->name);
+                if (callee.writesGlobals) globalsVariant = true;
+                if (callee.writesElements) elementsVariant = true;
+            }
+        };
+        forEachExpression(loop->condition.get(), scan);
+        forEachExpression(loop->body, scan);
+        std::unordered_set<std::string> declared;
+        collectDeclaredNames(loop->body, declared);
+        variant.insert(declared.begin(), declared.end());
+
+        guardable = isPureExpression(loop->condition.get());
+        hoisted.clear();
+        guarded.clear();
+        temps.clear();
+        Loop report{functionName, loop->line, {}};
+        current = &report;
+
+        firstIteration = true;
+        inCondition = true;
+        rewrite(loop->condition, false);
+        inCondition = false;
+        rewriteBody(loop->body);
+
+        if (report.hoisted.empty()) {
+            out.push_back(std::move(loop));
+            return;
+        }
+        rewritten.push_back(std::move(report));
+        for (auto& stmt : hoisted) out.push_back(std::move(stmt));
+        if (guarded.empty()) {
+            out.push_back(std::move(loop));
+            return;
+        }
+        auto guard = std::make_unique<IfStatement>(
+            cloneExpression(loop->condition.get(), [](const std::string& name) { return name; }));
+        guard->line = loop->line;
+        for (auto& stmt : guarded) guard->thenBranch.push_back(std::move(stmt));
+        guard->thenBranch.push_back(std::move(loop));
+        out.push_back(std::move(guard));
+    }
+
+    // Statements run in order while firstIteration holds; branches, nested
+    // loop bodies and everything after them may not run at all.
+    void rewriteBody(std::vector<std::unique_ptr<Statement>>& stmts) {
+        for (auto& stmt : stmts) {
+            if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt.get())) {
+                rewrite(varDecl->initializer, false);
+            } else if (auto exprStmt = dynamic_cast<ExpressionStatement*>(stmt.get())) {
+                rewrite(exprStmt->expr, false);
+            } else if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt.get())) {
+                rewrite(retStmt->value, false);
+                firstIteration = false;
+            } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                rewrite(ifStmt->condition, false);
+                firstIteration = false;
+                rewriteConditional(ifStmt->thenBranch);
+                rewriteConditional(ifStmt->elseBranch);
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                rewrite(loopStmt->condition, false);
+                firstIteration = false;
+                rewriteConditional(loopStmt->body);
+            }
+        }
+    }
+
+    void rewriteConditional(std::vector<std::unique_ptr<Statement>>& stmts) {
+        for (auto& stmt : stmts) {
+            if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt.get())) {
+                rewrite(varDecl->initializer, true);
+            } else if (auto exprStmt = dynamic_cast<ExpressionStatement*>(stmt.get())) {
+                rewrite(exprStmt->expr, true);
+            } else if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt.get())) {
+                rewrite(retStmt->value, true);
+            } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                rewrite(ifStmt->condition, true);
+                rewriteConditional(ifStmt->thenBranch);
+                rewriteConditional(ifStmt->elseBranch);
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                rewrite(loopStmt->condition, true);
+                rewriteConditional(loopStmt->body);
+            }
+        }
+    }
+
+    // Visits the expression in evaluation order, replacing what can move.
+    // `conditional` is set where evaluation depends on a value seen at run
+    // time.
+    void rewrite(std::unique_ptr<Expression>& expr, bool conditional) {
+        if (!expr) return;
+        if (tryHoist(expr, conditional)) return;
+        if (auto binOp = dynamic_cast<BinaryOp*>(expr.get())) {
+            rewrite(binOp->left, conditional);
+            rewrite(binOp->right, conditional || binOp->shortCircuit);
+        } else if (auto unaryOp = dynamic_cast<UnaryOp*>(expr.get())) {
+            rewrite(unaryOp->operand, conditional);
+        } else if (auto assign = dynamic_cast<Assignment*>(expr.get())) {
+            rewrite(assign->value, conditional);
+        } else if (auto funcCall = dynamic_cast<FunctionCall*>(expr.get())) {
+            for (auto& arg : funcCall->args) rewrite(arg, conditional);
+            BuiltinId builtin = builtinIdFor(funcCall->name);
+            if (builtin == BuiltinId::NONE || !builtinInfo(builtin).pure) firstIteration = false;
+        } else if (auto arrayLit = dynamic_cast<ArrayLiteral*>(expr.get())) {
+            for (auto& element : arrayLit->elements) rewrite(element, conditional);
+        } else if (auto objLit = dynamic_cast<ObjectLiteral*>(expr.get())) {
+            for (auto& member : objLit->members) rewrite(member.second, conditional);
+        } else if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr.get())) {
+            rewrite(arrAccess->index, conditional);
+        } else if (auto indexAssign = dynamic_cast<IndexAssignment*>(expr.get())) {
+            rewrite(indexAssign->index, conditional);
+            rewrite(indexAssign->value, conditional);
+        } else if (auto memberAssign = dynamic_cast<MemberAssignment*>(expr.get())) {
+            rewrite(memberAssign->value, conditional);
+        }
+    }
+
+    bool tryHoist(std::unique_ptr<Expression>& expr, bool conditional) {
+        Expression* e = expr.get();
+        if (dynamic_cast<NumberLiteral*>(e) || dynamic_cast<StringLiteral*>(e) ||
+            dynamic_cast<BooleanLiteral*>(e) || dynamic_cast<Identifier*>(e)) {
+            return false;
+        }
+        if (auto unaryOp = dynamic_cast<UnaryOp*>(e)) {
+            if (dynamic_cast<NumberLiteral*>(unaryOp->operand.get())) return false;
+        }
+        if (!isPureExpression(e) || !isInvariant(e)) return false;
+
+        bool safe = cannotFail(e);
+        bool needsGuard = false;
+        if (!safe) {
+            if (conditional || !firstIteration) return false;
+            if (!inCondition) {
+                if (!guardable) return false;
+                needsGuard = true;
+            }
+        }
+
+        std::string text = describeExpression(e);
+        auto found = temps.find(text);
+        std::string name;
+        if (found != temps.end()) {
+            name = found->second;
+        } else {
+            do {
+                name = "inv" + std::to_string(++tempCount);
+            } while (usedNames.count(name));
+            usedNames.insert(name);
+            temps[text] = name;
+            current->hoisted.push_back(text);
+            auto decl = std::make_unique<VariableDeclaration>(name, nullptr);
+            decl->line = current->line;
+            auto& target = needsGuard ? guarded : hoisted;
+            auto replacement = std::make_unique<Identifier>(name);
+            replacement->type = e->type;
+            decl->initializer = std::move(expr);
+            expr = std::move(replacement);
+            target.push_back(std::move(decl));
+            return true;
+        }
+        auto replacement = std::make_unique<Identifier>(name);
+        replacement->type = e->type;
+        expr = std::move(replacement);
+        return true;
+    }
+
+    bool isInvariant(const Expression* expr) const {
+        bool invariant = true;
+        forEachExpression(expr, [&](const Expression* e) {
+            std::string name;
+            if (auto id = dynamic_cast<const Identifier*>(e)) name = id->name;
+            if (auto arrAccess = dynamic_cast<const ArrayAccess*>(e)) {
+                if (elementsVariant) invariant = false;
+                name = arrAccess->arrayName;
+            }
+            if (auto memberAccess = dynamic_cast<const MemberAccess*>(e)) {
+                if (elementsVariant) invariant = false;
+                name = memberAccess->objectName;
+            }
+            if (auto funcCall = dynamic_cast<const FunctionCall*>(e)) {
+                BuiltinId builtin = builtinIdFor(funcCall->name);
+                if (builtin != BuiltinId::NONE && builtinInfo(builtin).readsElements && elementsVariant) {
+                    invariant = false;
+                }
+            }
+            if (name.empty()) return;
+            if (variant.count(name) || (globalsVariant && effects.isGlobal(name))) invariant = false;
+        });
+        return invariant;
+    }
+
+    static bool cannotFail(const Expression* expr) {
+        if (auto binOp = dynamic_cast<const BinaryOp*>(expr)) {
+            const std::string& op = binOp->op;
+            if (op == "<" || op == "<=" || op == ">" || op == ">=" || op == "==" || op == "!=") {
+                return isSafeNumber(binOp->left.get()) && isSafeNumber(binOp->right.get());
+            }
+        }
+        return isSafeNumber(expr);
+    }
+};
+
+// Unrolls counted daura loops inside functions:
+//
+//     daura (i < n) { body; i = i + c; }
+//
+// where i is an integral local that only the final statement changes, c is
+// a non-zero integer moving i towards the bound (<, <= with c > 0; >, >=
+// with c < 0), and n is a number literal or a local the loop does not
+// assign. Conditions and bounds are then side-effect free and the
+// arithmetic on i is exact.
+//
+// When i starts from a literal just before the loop and the trip count is
+// small, the loop is replaced by that many copies of its body. Otherwise
+// the body is repeated `factor` times under `i + (factor - 1) * c < n`,
+// which holds only when all of those iterations would run, and the
+// original loop follows to run the remaining ones. Locals the body declares
+// get fresh names in each extra copy. A loop is left alone when unrolling
+// would add more than MAX_GROWTH nodes or too many locals, and the factor
+// shrinks until it fits.
+class LoopUnroller {
+public:
+    struct Loop {
+        std::string function;
+        int line;
+        int factor;  // 0 when fully unrolled
+        int trips;   // of a fully unrolled loop
+    };
+
+private:
+    static constexpr int MAX_GROWTH = 240;      // AST nodes added per loop
+    static constexpr int MAX_FULL_TRIPS = 16;
+    static constexpr int MAX_FUNCTION_LOCALS = 160;  // the VM has 256 registers per frame
+
+    struct Shape {
+        std::string variable;
+        std::string comparison;  // <, <=, > or >= with the variable on the left
+        const Expression* bound;
+        double step;
+    };
+
+    int factor;
+    std::unordered_set<std::string> usedNames;
+    std::unordered_set<std::string> globalNames;
+    std::vector<Loop> unrolled;
+
+    // Per-function state; the body is being rebuilt, so declarations are
+    // counted up front and kept current as copies are added
+    FunctionDeclaration* function = nullptr;
+    std::unordered_map<std::string, int> declarations;
+
+public:
+    explicit LoopUnroller(int unrollFactor) : factor(unrollFactor) {}
+
+    void run(Program* program) {
+        collectDeclaredNames(program->statements, usedNames);
+        for (auto& stmt : program->statements) {
+            if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt.get())) globalNames.insert(varDecl->name);
+        }
+        CallGraph graph;
+        graph.build(program);
+        for (int id = 0; id < graph.size(); id++) {
+            function = graph.function(id);
+            declarations.clear();
+            countDeclarations(function->body, declarations, 1);
+            for (const auto& param : function->params) declarations[param]++;
+            rewriteBlock(function->body);
+        }
+    }
+
+    const std::vector<Loop>& loops() const { return unrolled; }
+
+private:
+    // Inner loops first, so an outer loop is costed with what they became.
+    void rewriteBlock(std::vector<std::unique_ptr<Statement>>& stmts) {
+        std::vector<std::unique_ptr<Statement>> out;
+        for (auto& stmt : stmts) {
+            if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                rewriteBlock(ifStmt->thenBranch);
+                rewriteBlock(ifStmt->elseBranch);
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                rewriteBlock(loopStmt->body);
+                Shape shape;
+                if (recognize(loopStmt, shape)) {
+                    int trips = constantTrips(out, shape);
+                    if (trips >= 0 && unrollFully(loopStmt, trips, out)) continue;
+                    // The original loop stays after the unrolled one to run the remainder
+                    unrollPartially(loopStmt, shape, out);
+                }
+            }
+            out.push_back(std::move(stmt));
+        }
+        stmts = std::move(out);
+    }
+
+    // ---- Recognition --------------------------------------------------------
+
+    bool recognize(LoopStatement* loop, Shape& shape) const {
+        auto condition = dynamic_cast<BinaryOp*>(loop->condition.get());
+        if (!condition || loop->body.empty()) return false;
+        static const std::unordered_map<std::string, std::string> mirrored = {
+            {"<", ">"}, {"<=", ">="}, {">", "<"}, {">=", "<="}};
+        auto op = mirrored.find(condition->op);
+        if (op == mirrored.end()) return false;
+        auto left = dynamic_cast<Identifier*>(condition->left.get());
+        auto right = dynamic_cast<Identifier*>(condition->right.get());
+        if (left && isLocal(left->name) && left->integral) {
+            shape.variable = left->name;
+            shape.comparison = condition->op;
+            shape.bound = condition->right.get();
+        } else if (right && isLocal(right->name) && right->integral) {
+            shape.variable = right->name;
+            shape.comparison = op->second;
+            shape.bound = condition->left.get();
+        } else {
+            return false;
+        }
+
+        // The last statement steps the variable by an integer literal
+        auto last = dynamic_cast<ExpressionStatement*>(loop->body.back().get());
+        auto step = last ? dynamic_cast<Assignment*>(last->expr.get()) : nullptr;
+        auto sum = step ? dynamic_cast<BinaryOp*>(step->value.get()) : nullptr;
+        if (!sum || step->name != shape.variable || (sum->op != "+" && sum->op != "-")) return false;
+        auto base = dynamic_cast<Identifier*>(sum->left.get());
+        auto amount = dynamic_cast<NumberLiteral*>(sum->right.get());
+        if (!base || !amount) {
+            // c + i
+            base = dynamic_cast<Identifier*>(sum->right.get());
+            amount = dynamic_cast<NumberLiteral*>(sum->left.get());
+            if (sum->op != "+") return false;
+        }
+        if (!base || !amount || base->name != shape.variable) return false;
+        double c = sum->op == "+" ? amount->value : -amount->value;
+        if (c == 0 || c != std::floor(c) || std::fabs(c) > 1 << 20) return false;
+        bool upward = shape.comparison[0] == '<';
+        if (upward != (c > 0)) return false;
+        shape.step = c;
+
+        // Nothing else writes the variable or the bound
+        std::string boundName;
+        if (auto boundId = dynamic_cast<const Identifier*>(shape.bound)) {
+            if (!isLocal(boundId->name) || boundId->name == shape.variable) return false;
+            boundName = boundId->name;
+        } else if (!dynamic_cast<const NumberLiteral*>(shape.bound)) {
+            return false;
+        }
+        int writes = 0;
+        bool boundWritten = false;
+        forEachExpression(loop->body, [&](const Expression* expr) {
+            if (auto assign = dynamic_cast<const Assignment*>(expr)) {
+                if (assign->name == shape.variable) writes++;
+                if (assign->name == boundName) boundWritten = true;
+            }
+        });
+        std::unordered_set<std::string> declared;
+        collectDeclaredNames(loop->body, declared);
+        if (writes != 1 || boundWritten || declared.count(shape.variable) || declared.count(boundName)) return false;
+        return !containsFunction(loop->body) && renamable(loop->body);
+    }
+
+    // A parameter or variable of the function, and not a global it could
+    // refer to before its declaration.
+    bool isLocal(const std::string& name) const {
+        auto it = declarations.find(name);
+        return !globalNames.count(name) && it != declarations.end() && it->second > 0;
+    }
+
+    static bool containsFunction(const std::vector<std::unique_ptr<Statement>>& stmts) {
+        for (auto& stmt : stmts) {
+            if (dynamic_cast<FunctionDeclaration*>(stmt.get())) return true;
+            if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                if (containsFunction(ifStmt->thenBranch) || containsFunction(ifStmt->elseBranch)) return true;
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                if (containsFunction(loopStmt->body)) return true;
+            }
+        }
+        return false;
+    }
+
+    // Names the body declares can be renamed in a copy when nothing outside
+    // the loop declares them as well.
+    bool renamable(const std::vector<std::unique_ptr<Statement>>& body) const {
+        std::unordered_map<std::string, int> inBody;
+        countDeclarations(body, inBody, 1);
+        for (const auto& entry : inBody) {
+            if (globalNames.count(entry.first) || declarations.at(entry.first) != entry.second) return false;
+        }
+        return true;
+    }
+
+    // Adds `delta` per declaration; nested functions are not visited.
+    static void countDeclarations(const std::vector<std::unique_ptr<Statement>>& stmts,
+                                  std::unordered_map<std::string, int>& counts, int delta) {
+        for (auto& stmt : stmts) {
+            if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt.get())) {
+                counts[varDecl->name] += delta;
+            } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                countDeclarations(ifStmt->thenBranch, counts, delta);
+                countDeclarations(ifStmt->elseBranch, counts, delta);
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                countDeclarations(loopStmt->body, counts, delta);
+            }
+        }
+    }
+
+    static bool holds(const std::string& comparison, double value, double bound) {
+        if (comparison == "<") return value < bound;
+        if (comparison == "<=") return value <= bound;
+        if (comparison == ">") return value > bound;
+        return value >= bound;
+    }
+
+    // The exact trip count when the variable starts from a literal assigned
+    // just before the loop (past declarations that cannot change it) and
+    // the bound is a literal; -1 otherwise or when it exceeds MAX_FULL_TRIPS.
+    static int constantTrips(const std::vector<std::unique_ptr<Statement>>& before, const Shape& shape) {
+        auto bound = dynamic_cast<const NumberLiteral*>(shape.bound);
+        if (!bound) return -1;
+        const NumberLiteral* start = nullptr;
+        for (auto it = before.rbegin(); it != before.rend() && !start; ++it) {
+            const Expression* value = nullptr;
+            if (auto varDecl = dynamic_cast<VariableDeclaration*>(it->get())) {
+                if (varDecl->name == shape.variable) {
+                    value = varDecl->initializer.get();
+                } else if (isPureExpression(varDecl->initializer.get())) {
+                    continue;
+                }
+            } else if (auto exprStmt = dynamic_cast<ExpressionStatement*>(it->get())) {
+                auto assign = dynamic_cast<Assignment*>(exprStmt->expr.get());
+                if (assign && assign->name == shape.variable) value = assign->value.get();
+            }
+            start = dynamic_cast<const NumberLiteral*>(value);
+            if (!start) return -1;
+        }
+        if (!start) return -1;
+        double value = start->value;
+        int trips = 0;
+        while (holds(shape.comparison, value, bound->value)) {
+            if (++trips > MAX_FULL_TRIPS) return -1;
+            value += shape.step;
+        }
+        return trips;
+    }
+
+    // ---- Rewriting ------------------------------------------------------------
+
+    // A copy of the body whose declared names are fresh.
+    std::vector<std::unique_ptr<Statement>> freshCopy(const std::vector<std::unique_ptr<Statement>>& body) {
+        std::unordered_set<std::string> declared;
+        collectDeclaredNames(body, declared);
+        std::unordered_map<std::string, std::string> renames;
+        for (const auto& name : declared) {
+            std::string fresh;
+            int suffix = 1;
+            do {
+                fresh = name + "_u" + std::to_string(suffix++);
+            } while (usedNames.count(fresh));
+            usedNames.insert(fresh);
+            renames[name] = fresh;
+            declarations[fresh] = 0;
+        }
+        auto copy = cloneStatements(body, [&renames](const std::string& name) {
+            auto it = renames.find(name);
+            return it != renames.end() ? it->second : name;
+        });
+        countDeclarations(copy, declarations, 1);
+        return copy;
+    }
+
+    bool withinLocals(const std::vector<std::unique_ptr<Statement>>& body, int copies) const {
+        std::unordered_set<std::string> inBody;
+        collectDeclaredNames(body, inBody);
+        return static_cast<int>(declarations.size() + inBody.size() * copies) <= MAX_FUNCTION_LOCALS;
+    }
+
+    bool unrollFully(LoopStatement* loop, int trips, std::vector<std::unique_ptr<Statement>>& out) {
+        int bodyNodes = countNodes(loop->body);
+        int loopNodes = bodyNodes + countNodes(loop->condition.get()) + 1;
+        if (trips * bodyNodes - loopNodes > MAX_GROWTH || !withinLocals(loop->body, trips)) return false;
+        for (int i = 0; i < trips; i++) {
+            for (auto& stmt : freshCopy(loop->body)) out.push_back(std::move(stmt));
+        }
+        countDeclarations(loop->body, declarations, -1);
+        unrolled.push_back({function->name, loop->line, 0, trips});
+        return true;
+    }
+
+    void unrollPartially(LoopStatement* loop, const Shape& shape, std::vector<std::unique_ptr<Statement>>& out) {
+        int bodyNodes = countNodes(loop->body);
+        int k = factor;
+        while (k > 1 && ((k - 1) * bodyNodes + countNodes(loop->condition.get()) + 4 > MAX_GROWTH ||
+                         !withinLocals(loop->body, k - 1))) {
+            k--;
+        }
+        if (k < 2) return;
+
+        // i + (k - 1) * c < n: all k iterations run
+        auto variable = std::make_unique<Identifier>(shape.variable);
+        variable->type = DataType::NUMBER;
+        variable->integral = true;
+        auto ahead = std::make_unique<NumberLiteral>((k - 1) * shape.step, true);
+        auto last = std::make_unique<BinaryOp>(std::move(variable), "+", std::move(ahead));
+        last->type = DataType::NUMBER;
+        last->integral = true;
+        auto condition = std::make_unique<BinaryOp>(
+            std::move(last), shape.comparison, cloneExpression(shape.bound, [](const std::string& name) { return name; }));
+        condition->type = DataType::BOOLEAN;
+
+        auto main = std::make_unique<LoopStatement>(std::move(condition));
+        main->line = loop->line;
+        main->body = cloneStatements(loop->body, [](const std::string& name) { return name; });
+        countDeclarations(main->body, declarations, 1);
+        for (int i = 1; i < k; i++) {
+            for (auto& stmt : freshCopy(loop->body)) main->body.push_back(std::move(stmt));
+        }
+        out.push_back(std::move(main));
+        unrolled.push_back({function->name, loop->line, k, 0});
+    }
+};
+
+// Dependence analysis for counted daura loops:
+//
+//     daura (i < n) { body; i = i + c; }
+//
+// with <= allowed for <, c a positive integer literal and n free of array
+// elements and of everything the loop writes. The iterations are proven
+// independent, so they may run in any order or at once, when the body
+//   - declares, assigns and reads only its own locals, i and variables it
+//     never assigns; a local lives for one iteration;
+//   - stores only elements X[i] of arrays named outside the loop, and reads
+//     those arrays only at [i];
+//   - reads other arrays at any index, calls only the pure builtins and
+//     contains no wapas, string, array or object literal.
+// Nested daura loops are allowed under the same rules. Names are resolved
+// with the body's scopes, so a local shadowing an outer variable is told
+// apart from it.
+//
+// What cannot be proven here is checked when the loop starts (see
+// ParallelLoopRunner): the stored arrays must not be among the arrays read
+// at other indices, and every value involved must be a number or boolean.
+class ParallelLoopAnalysis {
+public:
+    struct Shape {
+        std::string counter;
+        Expression* bound;
+        bool inclusive;  // i <= n
+        double step;
+        std::vector<std::string> scalars;       // read and never assigned
+        std::vector<std::string> storedArrays;  // X in X[i] = v, read only at [i]
+        std::vector<std::string> readArrays;    // read at any index, never stored
+    };
+
+    // Fills `shape`, or returns false with the reason in `reason`.
+    static bool analyze(LoopStatement* loop, Shape& shape, std::string& reason) {
+        ParallelLoopAnalysis analysis;
+        return analysis.run(loop, shape, reason);
+    }
+
+private:
+    // How a name from outside the loop is used
+    struct Use {
+        bool scalar = false;
+        bool stored = false;
+        bool readAtCounter = false;
+        bool readElsewhere = false;
+    };
+
+    std::string counter;
+    std::vector<std::unordered_set<std::string>> scopes;
+    std::vector<std::string> order;  // outside names, first use first
+    std::unordered_map<std::string, Use> uses;
+    std::string failure;
+
+    bool run(LoopStatement* loop, Shape& shape, std::string& reason) {
+        auto condition = dynamic_cast<BinaryOp*>(loop->condition.get());
+        auto variable = condition ? dynamic_cast<Identifier*>(condition->left.get()) : nullptr;
+        if (!variable || (condition->op != "<" && condition->op != "<=")) {
+            reason = "condition is not i < n or i <= n";
+            return false;
+        }
+        counter = variable->name;
+        if (!countsUp(loop, shape.step)) {
+            reason = "does not end with " + counter + " = " + counter + " + c";
+            return false;
+        }
+        if (!invariantBound(condition->right.get())) {
+            reason = "bound may change inside the loop";
+            return false;
+        }
+
+        scopes.emplace_back();
+        for (size_t s = 0; s + 1 < loop->body.size() && failure.empty(); s++) statement(loop->body[s].get());
+        if (failure.empty()) failure = conflicts();
+        if (!failure.empty()) {
+            reason = failure;
+            return false;
+        }
+
+        shape.counter = counter;
+        shape.bound = condition->right.get();
+        shape.inclusive = condition->op == "<=";
+        for (const auto& name : order) {
+            const Use& use = uses[name];
+            if (use.scalar) shape.scalars.push_back(name);
+            if (use.stored) shape.storedArrays.push_back(name);
+            if (!use.stored && (use.readAtCounter || use.readElsewhere)) shape.readArrays.push_back(name);
+        }
+        return true;
+    }
+
+    bool countsUp(LoopStatement* loop, double& step) const {
+        auto exprStmt = loop->body.empty() ? nullptr : dynamic_cast<ExpressionStatement*>(loop->body.back().get());
+        auto assign = exprStmt ? dynamic_cast<Assignment*>(exprStmt->expr.get()) : nullptr;
+        auto sum = assign && assign->name == counter ? dynamic_cast<BinaryOp*>(assign->value.get()) : nullptr;
+        if (!sum || sum->op != "+") return false;
+        auto left = dynamic_cast<Identifier*>(sum->left.get());
+        auto right = dynamic_cast<NumberLiteral*>(sum->right.get());
+        if (!left || left->name != counter || !right) return false;
+        step = right->value;
+        return step >= 1 && step <= 1e6 && step == std::floor(step);
+    }
+
+    // Literals, outside variables, arithmetic and nikal(): the loop writes
+    // no variable outside itself and arrays keep their length.
+    bool invariantBound(const Expression* expr) const {
+        if (dynamic_cast<const NumberLiteral*>(expr)) return true;
+        if (auto id = dynamic_cast<const Identifier*>(expr)) return id->name != counter;
+        if (auto binOp = dynamic_cast<const BinaryOp*>(expr)) {
+            return invariantBound(binOp->left.get()) && invariantBound(binOp->right.get());
+        }
+        if (auto unaryOp = dynamic_cast<const UnaryOp*>(expr)) return invariantBound(unaryOp->operand.get());
+        if (auto funcCall = dynamic_cast<const FunctionCall*>(expr)) {
+            if (!pureBuiltin(funcCall->name)) return false;
+            for (const auto& arg : funcCall->args) {
+                if (!invariantBound(arg.get())) return false;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    static bool pureBuiltin(const std::string& name) {
+        BuiltinId builtin = builtinIdFor(name);
+        return NumericFunctionAnalysis::isNumericBuiltin(builtin) || builtin == BuiltinId::NIKAL;
+    }
+
+    bool isLocal(const std::string& name) const {
+        for (const auto& scope : scopes) {
+            if (scope.count(name)) return true;
+        }
+        return false;
+    }
+
+    bool isCounter(const std::string& name) const {
+        return name == counter && !isLocal(name);
+    }
+
+    Use& outside(const std::string& name) {
+        if (!uses.count(name)) order.push_back(name);
+        return uses[name];
+    }
+
+    void fail(const std::string& why) {
+        if (failure.empty()) failure = why;
+    }
+
+    void block(const std::vector<std::unique_ptr<Statement>>& stmts) {
+        scopes.emplace_back();
+        for (const auto& stmt : stmts) statement(stmt.get());
+        scopes.pop_back();
+    }
+
+    void statement(Statement* stmt) {
+        if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt)) {
+            if (varDecl->initializer) expression(varDecl->initializer.get());
+            if (varDecl->name == counter) fail("redeclares " + counter);
+            scopes.back().insert(varDecl->name);
+        } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt)) {
+            expression(ifStmt->condition.get());
+            block(ifStmt->thenBranch);
+            block(ifStmt->elseBranch);
+        } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt)) {
+            expression(loopStmt->condition.get());
+            block(loopStmt->body);
+        } else if (auto exprStmt = dynamic_cast<ExpressionStatement*>(stmt)) {
+            expression(exprStmt->expr.get());
+        } else if (dynamic_cast<ReturnStatement*>(stmt)) {
+            fail("returns from inside the loop");
+        } else {
+            fail("declares a function");
+        }
+    }
+
+    void expression(Expression* expr) {
+        if (dynamic_cast<NumberLiteral*>(expr) || dynamic_cast<BooleanLiteral*>(expr)) return;
+        if (auto id = dynamic_cast<Identifier*>(expr)) {
+            if (!isLocal(id->name) && id->name != counter) outside(id->name).scalar = true;
+        } else if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            expression(binOp->left.get());
+            expression(binOp->right.get());
+        } else if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) {
+            expression(unaryOp->operand.get());
+        } else if (auto assign = dynamic_cast<Assignment*>(expr)) {
+            expression(assign->value.get());
+            if (isCounter(assign->name)) {
+                fail("assigns " + counter + " before the end of the body");
+            } else if (!isLocal(assign->name)) {
+                fail("assigns '" + assign->name + "', which outlives an iteration");
+            }
+        } else if (auto funcCall = dynamic_cast<FunctionCall*>(expr)) {
+            if (!pureBuiltin(funcCall->name)) {
+                fail("calls " + funcCall->name + "()");
+                return;
+            }
+            // nikal(x) reads only the length, which never changes
+            auto id = funcCall->args.size() == 1 ? dynamic_cast<Identifier*>(funcCall->args[0].get()) : nullptr;
+            if (builtinIdFor(funcCall->name) == BuiltinId::NIKAL && id) return;
+            for (auto& arg : funcCall->args) expression(arg.get());
+        } else if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr)) {
+            expression(arrAccess->index.get());
+            if (!arrayName(arrAccess->arrayName, arrAccess->shownName())) return;
+            Use& use = outside(arrAccess->arrayName);
+            (atCounter(arrAccess->index.get()) ? use.readAtCounter : use.readElsewhere) = true;
+        } else if (auto indexAssign = dynamic_cast<IndexAssignment*>(expr)) {
+            expression(indexAssign->index.get());
+            expression(indexAssign->value.get());
+            if (!arrayName(indexAssign->arrayName, indexAssign->shownName())) return;
+            if (!atCounter(indexAssign->index.get())) {
+                fail("stores " + indexAssign->shownName() + "[" + describeExpression(indexAssign->index.get()) +
+                     "], not " + indexAssign->shownName() + "[" + counter + "]");
+            }
+            outside(indexAssign->arrayName).stored = true;
+        } else if (auto memberAccess = dynamic_cast<MemberAccess*>(expr)) {
+            fail("reads " + memberAccess->shownName() + "." + memberAccess->member);
+        } else if (auto memberAssign = dynamic_cast<MemberAssignment*>(expr)) {
+            fail("stores " + memberAssign->shownName() + "." + memberAssign->member);
+        } else if (dynamic_cast<StringLiteral*>(expr)) {
+            fail("uses a string");
+        } else {
+            fail("builds an array or object");
+        }
+    }
+
+    bool arrayName(const std::string& name, const std::string& shown) {
+        if (isLocal(name) || name == counter) {
+            fail("indexes '" + shown + "', which is not an array from outside the loop");
+            return false;
+        }
+        return true;
+    }
+
+    bool atCounter(const Expression* index) const {
+        auto id = dynamic_cast<const Identifier*>(index);
+        return id && isCounter(id->name);
+    }
+
+    std::string conflicts() {
+        bool stores = false;
+        for (const auto& name : order) {
+            const Use& use = uses[name];
+            bool indexed = use.stored || use.readAtCounter || use.readElsewhere;
+            if (use.scalar && indexed) return "uses '" + name + "' both as an array and as a value";
+            if (use.stored && use.readElsewhere) return "reads " + name + " at an index other than " + counter;
+            stores = stores || use.stored;
+        }
+        return stores ? "" : "stores no array element";
+    }
+};
+
+// Local value numbering over the statement sequences of each function.
+//
+// Every variable carries a version that changes when it is assigned or
+// redeclared and, for globals, when a call may write them; array accesses
+// also carry one that changes on every element store. Two arithmetic,
+// unary-minus or pure builtin computations with the same operator and the
+// same operand values (literals and variable versions) compute the same
+// value, so the later one reads the earlier result: the first occurrence
+// becomes `(cseN = ...)`, with `banao cseN = 0` at the top of the function,
+// or, when it is the whole right-hand side of `banao x = e` or `x = e`, x
+// is read for as long as it keeps that value.
+//
+// A value is available in the rest of its block and in the blocks nested
+// in it, but not after an agar or daura that may change an operand, and
+// not from a position that does not always run (the right of && and ||).
+// Nothing is evaluated earlier than before, so errors stay where they were.
+// Comparisons and logical operators are left alone: their results are
+// booleans, and a boolean variable keeps a function off the numeric kernels.
+class ValueNumbering {
+public:
+    struct Function {
+        std::string name;
+        std::vector<std::pair<std::string, int>> eliminated;  // computation, times reused
+    };
+
+private:
+    struct Available {
+        std::string holder;  // variable holding the value; empty until it is reused
+        int holderVersion = 0;
+        std::unique_ptr<Expression>* site = nullptr;  // first occurrence
+    };
+
+    EffectAnalysis effects;
+    std::unordered_set<std::string> usedNames;
+    std::vector<Function> functions;
+    int tempCount = 0;
+
+    // Per-function state
+    std::unordered_map<std::string, int> versions;
+    int lastVersion = 0;
+    // Pseudo-variable versioned on every element store: arrays are shared,
+    // so a store may change what any array access reads.
+    static constexpr const char* ELEMENTS = "[]";
+    std::unordered_map<std::string, Available> table;
+    std::vector<std::unique_ptr<Statement>> temporaries;
+    Function* current = nullptr;
+
+public:
+    void run(Program* program) {
+        effects.analyze(program);
+        collectDeclaredNames(program->statements, usedNames);
+        CallGraph graph;
+        graph.build(program);
+        for (int id = 0; id < graph.size(); id++) {
+            FunctionDeclaration* func = graph.function(id);
+            Function report{func->name, {}};
+            current = &report;
+            versions.clear();
+            lastVersion = 0;
+            table.clear();
+            rewriteBlock(func->body);
+            func->body.insert(func->body.begin(), std::make_move_iterator(temporaries.begin()),
+                              std::make_move_iterator(temporaries.end()));
+            temporaries.clear();
+            if (!report.eliminated.empty()) functions.push_back(std::move(report));
+        }
+    }
+
+    const std::vector<Function>& results() const { return functions; }
+
+    int eliminatedCount() const {
+        int count = 0;
+        for (const auto& func : functions) {
+            for (const auto& entry : func.eliminated) count += entry.second;
+        }
+        return count;
+    }
+
+private:
+    void rewriteBlock(std::vector<std::unique_ptr<Statement>>& stmts) {
+        for (auto& stmt : stmts) rewriteStatement(stmt.get());
+    }
+
+    void rewriteStatement(Statement* stmt) {
+        if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt)) {
+            std::string key = rewrite(varDecl->initializer, false);
+            assigned(varDecl->name);
+            holdIn(key, varDecl->name);
+        } else if (auto exprStmt = dynamic_cast<ExpressionStatement*>(stmt)) {
+            if (auto assign = dynamic_cast<Assignment*>(exprStmt->expr.get())) {
+                std::string key = rewrite(assign->value, false);
+                assigned(assign->name);
+                holdIn(key, assign->name);
+            } else {
+                rewrite(exprStmt->expr, false);
+            }
+        } else if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt)) {
+            rewrite(retStmt->value, false);
+        } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt)) {
+            rewrite(ifStmt->condition, false);
+            // Each branch starts from the state after the condition
+            auto before = table;
+            auto versionsBefore = versions;
+            rewriteBlock(ifStmt->thenBranch);
+            table = before;
+            versions = versionsBefore;
+            rewriteBlock(ifStmt->elseBranch);
+            table = std::move(before);
+            versions = std::move(versionsBefore);
+            invalidate(nullptr, ifStmt->thenBranch);
+            invalidate(nullptr, ifStmt->elseBranch);
+        } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt)) {
+            // Values from before the loop survive only if no iteration
+            // changes their operands
+            invalidate(loopStmt->condition.get(), loopStmt->body);
+            auto before = table;
+            rewrite(loopStmt->condition, false);
+            rewriteBlock(loopStmt->body);
+            table = std::move(before);
+            invalidate(loopStmt->condition.get(), loopStmt->body);
+        }
+    }
+
+    // Gives every variable the code may assign or declare a new version.
+    void invalidate(const Expression* condition, const std::vector<std::unique_ptr<Statement>>& body) {
+        auto visit = [&](const Expression* expr) {
+            if (auto assign = dynamic_cast<const Assignment*>(expr)) assigned(assign->name);
+            if (dynamic_cast<const IndexAssignment*>(expr) || dynamic_cast<const MemberAssignment*>(expr)) {
+                assigned(ELEMENTS);
+            }
+            if (auto funcCall = dynamic_cast<const FunctionCall*>(expr)) invalidateFor(funcCall->name);
+        };
+        forEachExpression(condition, visit);
+        forEachExpression(body, visit);
+        std::unordered_set<std::string> declared;
+        collectDeclaredNames(body, declared);
+        for (const auto& name : declared) assigned(name);
+    }
+
+    // Versions are never reused, so a key formed in one branch cannot match
+    // a value of the other.
+    void assigned(const std::string& name) { versions[name] = ++lastVersion; }
+
+    void invalidateGlobals() {
+        for (const auto& name : effects.globalNames()) assigned(name);
+    }
+
+    void invalidateFor(const std::string& callee) {
+        EffectAnalysis::Effects effect = effects.ofCall(callee);
+        if (effect.writesGlobals) invalidateGlobals();
+        if (effect.writesElements) assigned(ELEMENTS);
+    }
+
+    // After `name = e`: name holds the value of e until either changes.
+    void holdIn(const std::string& key, const std::string& name) {
+        if (key.empty()) return;
+        auto found = table.find(key);
+        if (found != table.end() && !found->second.holder.empty() && isValid(found->second)) return;
+        Available available;
+        available.holder = name;
+        available.holderVersion = versions[name];
+        table[key] = available;
+    }
+
+    bool isValid(const Available& available) {
+        return available.holder.empty() || versions[available.holder] == available.holderVersion;
+    }
+
+    // Rewrites the expression in evaluation order and returns its value
+    // key, or "" when it is not a computation value numbering tracks.
+    std::string rewrite(std::unique_ptr<Expression>& expr, bool conditional) {
+        if (!expr) return "";
+        Expression* e = expr.get();
+        std::string key = isCandidate(e) ? keyOf(e) : "";
+        if (!key.empty()) {
+            auto found = table.find(key);
+            if (found != table.end() && isValid(found->second)) {
+                reuse(found->second, expr);
+                return key;
+            }
+        }
+
+        if (auto binOp = dynamic_cast<BinaryOp*>(e)) {
+            rewrite(binOp->left, conditional);
+            rewrite(binOp->right, conditional || binOp->shortCircuit);
+        } else if (auto unaryOp = dynamic_cast<UnaryOp*>(e)) {
+            rewrite(unaryOp->operand, conditional);
+        } else if (auto assign = dynamic_cast<Assignment*>(e)) {
+            rewrite(assign->value, conditional);
+            assigned(assign->name);
+        } else if (auto funcCall = dynamic_cast<FunctionCall*>(e)) {
+            for (auto& arg : funcCall->args) rewrite(arg, conditional);
+            invalidateFor(funcCall->name);
+        } else if (auto arrayLit = dynamic_cast<ArrayLiteral*>(e)) {
+            for (auto& element : arrayLit->elements) rewrite(element, conditional);
+        } else if (auto objLit = dynamic_cast<ObjectLiteral*>(e)) {
+            for (auto& member : objLit->members) rewrite(member.second, conditional);
+        } else if (auto arrAccess = dynamic_cast<ArrayAccess*>(e)) {
+            rewrite(arrAccess->index, conditional);
+        } else if (auto indexAssign = dynamic_cast<IndexAssignment*>(e)) {
+            rewrite(indexAssign->index, conditional);
+            rewrite(indexAssign->value, conditional);
+            assigned(ELEMENTS);
+        } else if (auto memberAssign = dynamic_cast<MemberAssignment*>(e)) {
+            rewrite(memberAssign->value, conditional);
+            assigned(ELEMENTS);
+        }
+
+        if (!key.empty() && !conditional) {
+            Available available;
+            available.site = &expr;
+            table[key] = available;
+        }
+        return key;
+    }
+
+    // Replaces a recomputation with the variable holding the value, first
+    // storing the value at its earlier occurrence if nothing holds it yet.
+    void reuse(Available& available, std::unique_ptr<Expression>& expr) {
+        std::string text = describeExpression(expr.get());
+        if (available.holder.empty()) {
+            std::string name;
+            do {
+                name = "cse" + std::to_string(++tempCount);
+            } while (usedNames.count(name));
+            usedNames.insert(name);
+
+            std::unique_ptr<Expression>& site = *available.site;
+            DataType type = site->type;
+            bool integral = site->integral;
+            site = std::make_unique<Assignment>(name, std::move(site));
+            site->type = type;
+            site->integral = integral;
+            auto decl = std::make_unique<VariableDeclaration>(name, std::make_unique<NumberLiteral>(0, true));
+            temporaries.push_back(std::move(decl));
+            available.holder = name;
+            available.holderVersion = versions[name];
+        }
+        auto replacement = std::make_unique<Identifier>(available.holder);
+        replacement->type = expr->type;
+        expr = std::move(replacement);
+
+        auto& eliminated = current->eliminated;
+        auto found = std::find_if(eliminated.begin(), eliminated.end(),
+                                  [&](const std::pair<std::string, int>& entry) { return entry.first == text; });
+        if (found != eliminated.end()) {
+            found->second++;
+        } else {
+            eliminated.push_back({text, 1});
+        }
+    }
+
+    // Arithmetic, unary minus or a pure builtin call that reads a variable.
+    static bool isCandidate(const Expression* expr) {
+        if (auto binOp = dynamic_cast<const BinaryOp*>(expr)) {
+            const std::string& op = binOp->op;
+            if (op != "+" && op != "-" && op != "*" && op != "/" && op != "%") return false;
+        } else if (auto unaryOp = dynamic_cast<const UnaryOp*>(expr)) {
+            if (unaryOp->op != "-") return false;
+        } else if (auto funcCall = dynamic_cast<const FunctionCall*>(expr)) {
+            BuiltinId builtin = builtinIdFor(funcCall->name);
+            if (builtin == BuiltinId::NONE || !builtinInfo(builtin).pure) return false;
+        } else {
+            return false;
+        }
+        bool readsVariable = false;
+        forEachExpression(expr, [&](const Expression* e) {
+            if (dynamic_cast<const Identifier*>(e) || dynamic_cast<const ArrayAccess*>(e) ||
+                dynamic_cast<const MemberAccess*>(e)) {
+                readsVariable = true;
+            }
+        });
+        return readsVariable;
+    }
+
+    // Identifies the value of a pure expression at this point of the
+    // function, or "" for anything else.
+    std::string keyOf(const Expression* expr) {
+        if (auto numLit = dynamic_cast<const NumberLiteral*>(expr)) {
+            std::ostringstream text;
+            text << std::hexfloat << numLit->value;
+            return text.str();
+        }
+        if (auto strLit = dynamic_cast<const StringLiteral*>(expr)) {
+            return "\"" + std::to_string(strLit->value.size()) + ":" + strLit->value;
+        }
+        if (auto boolLit = dynamic_cast<const BooleanLiteral*>(expr)) return boolLit->value ? "haan" : "na";
+        if (auto id = dynamic_cast<const Identifier*>(expr)) {
+            return id->name + "@" + std::to_string(versions[id->name]);
+        }
+        if (auto arrAccess = dynamic_cast<const ArrayAccess*>(expr)) {
+            std::string index = keyOf(arrAccess->index.get());
+            if (index.empty()) return "";
+            return "(" + arrAccess->arrayName + "@" + std::to_string(versions[arrAccess->arrayName]) + "[]@" +
+                   std::to_string(versions[ELEMENTS]) + " " + index + ")";
+        }
+        if (auto memberAccess = dynamic_cast<const MemberAccess*>(expr)) {
+            return "(" + memberAccess->objectName + "@" + std::to_string(versions[memberAccess->objectName]) + "." +
+                   memberAccess->member + "@" + std::to_string(versions[ELEMENTS]) + ")";
+        }
+        if (!isCandidate(expr)) return "";
+        std::string key = "(";
+        std::vector<const Expression*> operands;
+        if (auto binOp = dynamic_cast<const BinaryOp*>(expr)) {
+            key += binOp->op;
+            operands = {binOp->left.get(), binOp->right.get()};
+        } else if (auto unaryOp = dynamic_cast<const UnaryOp*>(expr)) {
+            key += "neg";
+            operands = {unaryOp->operand.get()};
+        } else if (auto funcCall = dynamic_cast<const FunctionCall*>(expr)) {
+            key += funcCall->name;
+            if (builtinInfo(builtinIdFor(funcCall->name)).readsElements) {
+                key += "@" + std::to_string(versions[ELEMENTS]);
+            }
+            for (auto& arg : funcCall->args) operands.push_back(arg.get());
+        }
+        for (const Expression* operand : operands) {
+            std::string part = keyOf(operand);
+            if (part.empty()) return "";
+            key += " " + part;
+        }
+        return key + ")";
+    }
+};
+
+// Algebraic simplification and strength reduction.
+//
+// Rewrites operator and builtin nodes into cheaper ones that give the same
+// value for every input, IEEE special values and the sign of NaN included:
+//   - arithmetic on number literals is folded, unless the result is NaN,
+//     infinite or -0 (which the C++ backend cannot spell as a literal);
+//   - pow(x, 2) becomes x * x (pow is exact there too), and pow(x, 0) and
+//     pow(x, 1) become 1 and x where x is a number;
+//   - pow(x, 0.5) becomes sqrt(x) only when x is neither -0 nor -inf, where
+//     the two differ: abs(..), nikal(..) or y * y;
+//   - division by a power of two becomes multiplication by its exact
+//     reciprocal;
+//   - x * 1, x / 1 and x - 0 become x. x + 0 is kept: -0 + 0 is +0;
+//   - -(-x) and max/min(x, x) become x, and !(!b) becomes b when b is a
+//     boolean or only its truth is used.
+// Rules that drop an operation need x to be a number, or the original
+// would have raised a type error. A base used twice that is not a plain
+// variable is stored once in a `banao pwN = 0` temporary at the top of the
+// function.
+//
+// With `fast`, rules that may change the last bit of a result or the sign
+// of a NaN apply as well: pow with exponents 3, 4 and -2 becomes a
+// multiplication chain, pow(x, -1) becomes 1 / x, and multiplying or
+// dividing by -1 becomes a negation.
+class AlgebraicSimplifier {
+public:
+    enum Rule {
+        CONSTANT_FOLDING,
+        POW_ZERO,
+        POW_ONE,
+        POW_SQUARE,
+        POW_HALF,
+        DIV_POWER_OF_TWO,
+        MUL_ONE,
+        DIV_ONE,
+        SUB_ZERO,
+        DOUBLE_NEGATION,
+        DOUBLE_NOT,
+        MAX_MIN_SAME,
+        // Only with fast
+        POW_CHAIN,
+        POW_RECIPROCAL,
+        MUL_MINUS_ONE,
+        RULE_COUNT
+    };
+
+    static const char* ruleName(Rule rule) {
+        static const char* const names[RULE_COUNT] = {
+            "constant folding",
+            "pow(x, 0) -> 1",
+            "pow(x, 1) -> x",
+            "pow(x, 2) -> x * x",
+            "pow(x, 0.5) -> sqrt(x)",
+            "x / 2^k -> x * 2^-k",
+            "x * 1 -> x",
+            "x / 1 -> x",
+            "x - 0 -> x",
+            "-(-x) -> x",
+            "!(!b) -> b",
+            "max/min(x, x) -> x",
+            "pow(x, 3|4|-2) -> multiplications",
+            "pow(x, -1) -> 1 / x",
+            "x * -1 -> -x"};
+        return names[rule];
+    }
+
+    static bool isFastOnly(Rule rule) { return rule >= POW_CHAIN; }
+
+private:
+    bool fast;
+    int hitCounts[RULE_COUNT] = {};
+    std::unordered_set<std::string> usedNames;
+    int tempCount = 0;
+    bool inFunction = false;
+    std::vector<std::unique_ptr<Statement>> temporaries;  // of the function being rewritten
+
+public:
+    explicit AlgebraicSimplifier(bool fastMath) : fast(fastMath) {}
+
+    void run(Program* program) {
+        collectDeclaredNames(program->statements, usedNames);
+        simplifyBlock(program->statements);
+    }
+
+    int hits(Rule rule) const { return hitCounts[rule]; }
+
+    int total() const {
+        int count = 0;
+        for (int hit : hitCounts) count += hit;
+        return count;
+    }
+
+private:
+    void simplifyBlock(std::vector<std::unique_ptr<Statement>>& stmts) {
+        for (auto& stmt : stmts) {
+            if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt.get())) {
+                simplify(varDecl->initializer, false);
+            } else if (auto funcDecl = dynamic_cast<FunctionDeclaration*>(stmt.get())) {
+                bool outerInFunction = inFunction;
+                auto outerTemporaries = std::move(temporaries);
+                inFunction = true;
+                temporaries.clear();
+                simplifyBlock(funcDecl->body);
+                funcDecl->body.insert(funcDecl->body.begin(), std::make_move_iterator(temporaries.begin()),
+                                      std::make_move_iterator(temporaries.end()));
+                temporaries = std::move(outerTemporaries);
+                inFunction = outerInFunction;
+            } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                simplify(ifStmt->condition, true);
+                simplifyBlock(ifStmt->thenBranch);
+                simplifyBlock(ifStmt->elseBranch);
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                simplify(loopStmt->condition, true);
+                simplifyBlock(loopStmt->body);
+            } else if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt.get())) {
+                simplify(retStmt->value, false);
+            } else if (auto exprStmt = dynamic_cast<ExpressionStatement*>(stmt.get())) {
+                simplify(exprStmt->expr, false);
+            }
+        }
+    }
+
+    // Operands first, then the node itself until no rule applies.
+    // `truthOnly` is set where only the truth of the value is used.
+    void simplify(std::unique_ptr<Expression>& expr, bool truthOnly) {
+        if (!expr) return;
+        if (auto binOp = dynamic_cast<BinaryOp*>(expr.get())) {
+            simplify(binOp->left, binOp->shortCircuit);
+            simplify(binOp->right, binOp->shortCircuit);
+        } else if (auto unaryOp = dynamic_cast<UnaryOp*>(expr.get())) {
+            simplify(unaryOp->operand, unaryOp->op == "!");
+        } else if (auto assign = dynamic_cast<Assignment*>(expr.get())) {
+            simplify(assign->value, false);
+        } else if (auto funcCall = dynamic_cast<FunctionCall*>(expr.get())) {
+            for (auto& arg : funcCall->args) simplify(arg, false);
+        } else if (auto arrayLit = dynamic_cast<ArrayLiteral*>(expr.get())) {
+            for (auto& element : arrayLit->elements) simplify(element, false);
+        } else if (auto objLit = dynamic_cast<ObjectLiteral*>(expr.get())) {
+            for (auto& member : objLit->members) simplify(member.second, false);
+        } else if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr.get())) {
+            simplify(arrAccess->index, false);
+        } else if (auto indexAssign = dynamic_cast<IndexAssignment*>(expr.get())) {
+            simplify(indexAssign->index, false);
+            simplify(indexAssign->value, false);
+        } else if (auto memberAssign = dynamic_cast<MemberAssignment*>(expr.get())) {
+            simplify(memberAssign->value, false);
+        }
+        while (rewrite(expr, truthOnly)) {
+        }
+    }
+
+    bool rewrite(std::unique_ptr<Expression>& expr, bool truthOnly) {
+        if (auto binOp = dynamic_cast<BinaryOp*>(expr.get())) return rewriteBinary(expr, binOp);
+        if (auto unaryOp = dynamic_cast<UnaryOp*>(expr.get())) return rewriteUnary(expr, unaryOp, truthOnly);
+        if (auto funcCall = dynamic_cast<FunctionCall*>(expr.get())) return rewriteCall(expr, funcCall);
+        return false;
+    }
+
+    bool rewriteBinary(std::unique_ptr<Expression>& expr, BinaryOp* binOp) {
+        const std::string& op = binOp->op;
+        auto left = dynamic_cast<NumberLiteral*>(binOp->left.get());
+        auto right = dynamic_cast<NumberLiteral*>(binOp->right.get());
+        if (left && right && !binOp->shortCircuit) {
+            double x = left->value, y = right->value;
+            BinaryOpKind kind = binaryOpKind(op);
+            switch (kind) {
+                case BinaryOpKind::LT: return replace(expr, std::make_unique<BooleanLiteral>(x < y), CONSTANT_FOLDING);
+                case BinaryOpKind::LE: return replace(expr, std::make_unique<BooleanLiteral>(x <= y), CONSTANT_FOLDING);
+                case BinaryOpKind::GT: return replace(expr, std::make_unique<BooleanLiteral>(x > y), CONSTANT_FOLDING);
+                case BinaryOpKind::GE: return replace(expr, std::make_unique<BooleanLiteral>(x >= y), CONSTANT_FOLDING);
+                case BinaryOpKind::EQ: return replace(expr, std::make_unique<BooleanLiteral>(x == y), CONSTANT_FOLDING);
+                case BinaryOpKind::NE: return replace(expr, std::make_unique<BooleanLiteral>(x != y), CONSTANT_FOLDING);
+                default: break;
+            }
+            double value = kind == BinaryOpKind::ADD ? x + y
+                         : kind == BinaryOpKind::SUB ? x - y
+                         : kind == BinaryOpKind::MUL ? x * y
+                         : kind == BinaryOpKind::DIV ? x / y
+                         : numberModulo(x, y);
+            bool integral = left->integral && right->integral && kind != BinaryOpKind::DIV;
+            return fold(expr, value, integral);
+        }
+
+        if (op == "*") {
+            if (isLiteral(right, 1) && yieldsNumber(binOp->left.get())) {
+                return replace(expr, std::move(binOp->left), MUL_ONE);
+            }
+            if (isLiteral(left, 1) && yieldsNumber(binOp->right.get())) {
+                return replace(expr, std::move(binOp->right), MUL_ONE);
+            }
+            if (fast && isLiteral(right, -1)) return replace(expr, negation(std::move(binOp->left)), MUL_MINUS_ONE);
+            if (fast && isLiteral(left, -1)) return replace(expr, negation(std::move(binOp->right)), MUL_MINUS_ONE);
+        } else if (op == "/") {
+            if (isLiteral(right, 1) && yieldsNumber(binOp->left.get())) {
+                return replace(expr, std::move(binOp->left), DIV_ONE);
+            }
+            if (fast && isLiteral(right, -1)) return replace(expr, negation(std::move(binOp->left)), MUL_MINUS_ONE);
+            if (right && std::fabs(right->value) != 1 && hasExactReciprocal(right->value)) {
+                auto product = std::make_unique<BinaryOp>(std::move(binOp->left), "*",
+                                                          std::make_unique<NumberLiteral>(1 / right->value));
+                return replace(expr, std::move(product), DIV_POWER_OF_TWO);
+            }
+        } else if (op == "-") {
+            if (right && right->value == 0 && !std::signbit(right->value) && yieldsNumber(binOp->left.get())) {
+                return replace(expr, std::move(binOp->left), SUB_ZERO);
+            }
+        }
+        return false;
+    }
+
+    bool rewriteUnary(std::unique_ptr<Expression>& expr, UnaryOp* unaryOp, bool truthOnly) {
+        auto inner = dynamic_cast<UnaryOp*>(unaryOp->operand.get());
+        if (unaryOp->op == "-") {
+            if (auto numLit = dynamic_cast<NumberLiteral*>(unaryOp->operand.get())) {
+                return fold(expr, -numLit->value, numLit->integral);
+            }
+            if (inner && inner->op == "-" && yieldsNumber(inner->operand.get())) {
+                return replace(expr, std::move(inner->operand), DOUBLE_NEGATION);
+            }
+        } else if (unaryOp->op == "!" && inner && inner->op == "!") {
+            if (truthOnly || yieldsBoolean(inner->operand.get())) {
+                return replace(expr, std::move(inner->operand), DOUBLE_NOT);
+            }
+        }
+        return false;
+    }
+
+    bool rewriteCall(std::unique_ptr<Expression>& expr, FunctionCall* funcCall) {
+        BuiltinId builtin = builtinIdFor(funcCall->name);
+        if (!NumericFunctionAnalysis::isNumericBuiltin(builtin) ||
+            funcCall->args.size() != static_cast<size_t>(builtinInfo(builtin).arity)) {
+            return false;
+        }
+        auto& args = funcCall->args;
+        bool allLiterals = std::all_of(args.begin(), args.end(), [](const std::unique_ptr<Expression>& arg) {
+            return dynamic_cast<NumberLiteral*>(arg.get()) != nullptr;
+        });
+        if (allLiterals) {
+            double x = static_cast<NumberLiteral*>(args[0].get())->value;
+            double y = args.size() > 1 ? static_cast<NumberLiteral*>(args[1].get())->value : 0;
+            double value = builtin == BuiltinId::ABS    ? std::fabs(x)
+                         : builtin == BuiltinId::SQRT   ? std::sqrt(x)
+                         : builtin == BuiltinId::POW    ? std::pow(x, y)
+                         : builtin == BuiltinId::MAX    ? std::max(x, y)
+                         : builtin == BuiltinId::MIN    ? std::min(x, y)
+                         : std::round(x);
+            bool integral = builtin == BuiltinId::ROUND ||
+                            ((builtin == BuiltinId::ABS || builtin == BuiltinId::MAX || builtin == BuiltinId::MIN) &&
+                             std::all_of(args.begin(), args.end(), [](const std::unique_ptr<Expression>& arg) {
+                                 return static_cast<NumberLiteral*>(arg.get())->integral;
+                             }));
+            return fold(expr, value, integral);
+        }
+
+        if (builtin == BuiltinId::MAX || builtin == BuiltinId::MIN) {
+            if (isPureExpression(args[0].get()) && yieldsNumber(args[0].get()) &&
+                describeExpression(args[0].get()) == describeExpression(args[1].get())) {
+                return replace(expr, std::move(args[0]), MAX_MIN_SAME);
+            }
+            return false;
+        }
+        if (builtin != BuiltinId::POW) return false;
+
+        auto exponent = dynamic_cast<NumberLiteral*>(args[1].get());
+        if (!exponent) return false;
+        std::unique_ptr<Expression>& base = args[0];
+        double n = exponent->value;
+        if (n == 0 && isSafeNumber(base.get())) {
+            return replace(expr, std::make_unique<NumberLiteral>(1, true), POW_ZERO);
+        }
+        if (n == 1 && yieldsNumber(base.get())) return replace(expr, std::move(base), POW_ONE);
+        if (n == 2 && canRepeat(base.get())) return replace(expr, power(std::move(base), 2), POW_SQUARE);
+        if (n == 0.5 && agreesWithSqrt(base.get())) {
+            auto call = std::make_unique<FunctionCall>("sqrt");
+            call->args.push_back(std::move(base));
+            return replace(expr, std::move(call), POW_HALF);
+        }
+        if (fast && n == -1) return replace(expr, reciprocal(std::move(base)), POW_RECIPROCAL);
+        if (fast && n == 3 && canRepeat(base.get())) return replace(expr, power(std::move(base), 3), POW_CHAIN);
+        if (fast && n == 4 && inFunction) return replace(expr, power(std::move(base), 4), POW_CHAIN);
+        if (fast && n == -2 && canRepeat(base.get())) {
+            return replace(expr, reciprocal(power(std::move(base), 2)), POW_CHAIN);
+        }
+        return false;
+    }
+
+    bool replace(std::unique_ptr<Expression>& expr, std::unique_ptr<Expression> replacement, Rule rule) {
+        if (replacement->type == DataType::UNKNOWN && rule != DOUBLE_NOT) replacement->type = expr->type;
+        expr = std::move(replacement);
+        hitCounts[rule]++;
+        return true;
+    }
+
+    bool fold(std::unique_ptr<Expression>& expr, double value, bool integral) {
+        if (!std::isfinite(value) || (value == 0 && std::signbit(value))) return false;
+        integral = integral && value == std::floor(value);
+        return replace(expr, std::make_unique<NumberLiteral>(value, integral), CONSTANT_FOLDING);
+    }
+
+    // +-2^k for k in [-1022, 1023]: the reciprocal is a normal double, so
+    // multiplying by it rounds exactly like dividing.
+    static bool hasExactReciprocal(double value) {
+        int exponent = 0;
+        double mantissa = std::frexp(std::fabs(value), &exponent);
+        return mantissa == 0.5 && exponent >= -1021 && exponent <= 1024;
+    }
+
+    static bool isLiteral(const NumberLiteral* numLit, double value) {
+        return numLit && numLit->value == value;
+    }
+
+    static bool yieldsBoolean(const Expression* expr) {
+        if (dynamic_cast<const BooleanLiteral*>(expr)) return true;
+        if (auto unaryOp = dynamic_cast<const UnaryOp*>(expr)) return unaryOp->op == "!";
+        if (auto binOp = dynamic_cast<const BinaryOp*>(expr)) {
+            const std::string& op = binOp->op;
+            return op == "&&" || op == "||" || op == "<" || op == "<=" || op == ">" || op == ">=" ||
+                   op == "==" || op == "!=";
+        }
+        return false;
+    }
+
+    // sqrt(x) == pow(x, 0.5) unless x is -0 or -inf.
+    static bool agreesWithSqrt(const Expression* expr) {
+        if (auto funcCall = dynamic_cast<const FunctionCall*>(expr)) {
+            return funcCall->args.size() == 1 && (funcCall->name == "abs" || funcCall->name == "nikal");
+        }
+        if (auto binOp = dynamic_cast<const BinaryOp*>(expr)) {
+            auto left = dynamic_cast<const Identifier*>(binOp->left.get());
+            auto right = dynamic_cast<const Identifier*>(binOp->right.get());
+            return binOp->op == "*" && left && right && left->name == right->name;
+        }
+        return false;
+    }
+
+    // A base read more than once: a variable, or anything else once stored
+    // in a function-local temporary.
+    bool canRepeat(const Expression* base) const {
+        return dynamic_cast<const Identifier*>(base) || inFunction;
+    }
+
+    // base * base [* base [* base]], evaluating base once.
+    std::unique_ptr<Expression> power(std::unique_ptr<Expression> base, int n) {
+        // (x * x) * (x * x) with the square computed once
+        if (n == 4) return power(power(std::move(base), 2), 2);
+        std::unique_ptr<Expression> first;
+        std::string name;
+        if (auto id = dynamic_cast<Identifier*>(base.get())) {
+            name = id->name;
+            first = std::move(base);
+        } else {
+            do {
+                name = "pw" + std::to_string(++tempCount);
+            } while (usedNames.count(name));
+            usedNames.insert(name);
+            temporaries.push_back(std::make_unique<VariableDeclaration>(name, std::make_unique<NumberLiteral>(0, true)));
+            first = std::make_unique<Assignment>(name, std::move(base));
+        }
+        std::unique_ptr<Expression> product = std::move(first);
+        for (int i = 1; i < n; i++) {
+            product = std::make_unique<BinaryOp>(std::move(product), "*", std::make_unique<Identifier>(name));
+            product->type = DataType::NUMBER;
+        }
+        return product;
+    }
+
+    static std::unique_ptr<Expression> reciprocal(std::unique_ptr<Expression> value) {
+        auto quotient = std::make_unique<BinaryOp>(std::make_unique<NumberLiteral>(1, true), "/", std::move(value));
+        quotient->type = DataType::NUMBER;
+        return quotient;
+    }
+
+    static std::unique_ptr<Expression> negation(std::unique_ptr<Expression> value) {
+        auto negated = std::make_unique<UnaryOp>("-", std::move(value));
+        negated->type = DataType::NUMBER;
+        return negated;
+    }
+};
+
+// Which AST passes run before execution, and how they report.
+// Parameters of the optimization passes, and the passes the individual
+// flags (--inline, --simplify, ...) add to the pipeline.
+struct OptimizationOptions {
+    bool inlining = false;
+    int inlineThreshold = 40;  // callee size in AST nodes
+    bool simplify = false;
+    bool fastMath = false;  // let simplification change results in the last bit
+    bool licm = false;
+    bool unroll = false;
+    int unrollFactor = 4;
+    bool cse = false;
+};
+
+// Runs an ordered pipeline of AST passes: semantic analysis first, then the
+// optimizations of the -O level or of --passes, then the annotations the
+// engines read (integral kinds, tail calls, escaping allocations). A stage
+// is a single pass or a fixpoint group, rerun as a whole until none of its
+// passes changes the tree or MAX_FIXPOINT_ITERATIONS is reached. Every run
+// is recorded with its wall time, the AST size before and after, and
+// whether the pass changed anything, for --time-passes.
+//
+// A pass that changes the tree is followed by IntegralInference, since
+// later passes read the integral annotations of the nodes it created.
+class PassManager {
+public:
+    struct Record {
+        std::string pass;
+        int stage;      // 1-based position in the pipeline
+        int iteration;  // of a fixpoint group, else 0
+        double milliseconds;
+        int nodesBefore;
+        int nodesAfter;
+        bool changed;
+    };
+
+    static constexpr int MAX_FIXPOINT_ITERATIONS = 8;
+
+    explicit PassManager(const OptimizationOptions& passOptions) : options(passOptions) {}
+
+    static bool isOptimization(const std::string& name) {
+        for (const char* pass : OPTIMIZATIONS) {
+            if (name == pass) return true;
+        }
+        return false;
+    }
+
+    // -O0: analysis only. -O1: the local, exact rewrites. -O2: inlining,
+    // then simplification and CSE to a fixpoint around the loop passes.
+    void addLevel(int level) {
+        if (level >= 2) addStage({"inline"});
+        if (level >= 1) addStage({"simplify", "cse"});
+        if (level >= 2) {
+            addStage({"licm"});
+            addStage({"unroll"});
+            addStage({"simplify", "cse"});
+        }
+    }
+
+    // The passes requested by individual flags that the pipeline lacks,
+    // in the order the flags have always run them.
+    void addRequested() {
+        const std::pair<bool, const char*> requested[] = {
+            {options.inlining, "inline"}, {options.simplify, "simplify"}, {options.licm, "licm"},
+            {options.unroll, "unroll"}, {options.cse, "cse"}};
+        for (const auto& request : requested) {
+            if (request.first && !contains(request.second)) addStage({request.second});
+        }
+    }
+
+    // --passes=a,b+c,d: stages separated by commas, fixpoint group members
+    // joined by +.
+    bool addList(const std::string& list, std::string& error) {
+        std::stringstream stages(list);
+        std::string stage;
+        while (std::getline(stages, stage, ',')) {
+            std::vector<std::string> passes;
+            std::stringstream members(stage);
+            std::string pass;
+            while (std::getline(members, pass, '+')) {
+                if (!isOptimization(pass)) {
+                    error = "unknown pass '" + pass + "'";
+                    return false;
+                }
+                passes.push_back(pass);
+            }
+            if (passes.empty()) {
+                error = "empty stage in '" + list + "'";
+                return false;
+            }
+            addStage(passes);
+        }
+        return true;
+    }
+
+    bool optimizes() const { return !pipeline.empty(); }
+
+    // The pipeline and the parameters its passes read, as text; .olc files
+    // keep a hash of it to tell when a run asks for other optimizations.
+    std::string fingerprint() const {
+        std::string text;
+        for (const auto& stage : pipeline) text += stageName(stage) + ",";
+        text += "inline=" + std::to_string(options.inlineThreshold) + ",unroll=" + std::to_string(options.unrollFactor);
+        if (options.fastMath) text += ",fast-math";
+        return text;
+    }
+
+    // Semantic analysis, the optimization pipeline (reporting to `report`)
+    // and the annotations. Returns false, with errors(), when semantic
+    // analysis fails; nothing else runs then.
+    bool run(Program* program, std::ostream& report) {
+        if (!runPass("semantic", program, report, 0, 0)) return false;
+        for (size_t s = 0; s < pipeline.size(); s++) {
+            const Stage& stage = pipeline[s];
+            int number = static_cast<int>(s) + 1;
+            if (stage.size() == 1) {
+                runPass(stage[0], program, report, number, 0);
+                continue;
+            }
+            int iteration = 1;
+            bool changed = true;
+            for (; changed && iteration <= MAX_FIXPOINT_ITERATIONS; iteration++) {
+                changed = false;
+                for (const auto& pass : stage) changed = runPass(pass, program, report, number, iteration) || changed;
+            }
+            report << "Fixpoint " << stageName(stage) << ": "
+                   << (changed ? "stopped after " : "stable after ") << iteration - 1 << " iteration(s)" << std::endl;
+        }
+        for (const char* pass : {"integral", "tail-calls", "escape"}) runPass(pass, program, report, 0, 0);
+        return true;
+    }
+
+    const std::vector<std::string>& errors() const { return semanticErrors; }
+    const std::vector<Record>& records() const { return history; }
+
+    void printTiming(std::ostream& out) const {
+        out << "\n--- Pass Timing ---" << std::endl;
+        double total = 0;
+        for (const auto& record : history) {
+            out << "  " << record.pass;
+            if (record.stage > 0) {
+                out << " [" << record.stage;
+                if (record.iteration > 0) out << "." << record.iteration;
+                out << "]";
+            }
+            out << ": " << record.milliseconds << " ms, " << record.nodesBefore << " -> " << record.nodesAfter
+                << " nodes, " << (record.changed ? "changed" : "unchanged") << std::endl;
+            total += record.milliseconds;
+        }
+        out << "Total: " << total << " ms over " << history.size() << " pass run(s)" << std::endl;
+    }
+
+private:
+    using Stage = std::vector<std::string>;
+
+    static constexpr const char* OPTIMIZATIONS[] = {"inline", "simplify", "licm", "unroll", "cse"};
+
+    OptimizationOptions options;
+    std::vector<Stage> pipeline;
+    std::vector<std::string> semanticErrors;
+    std::vector<Record> history;
+
+    void addStage(Stage stage) {
+        pipeline.push_back(std::move(stage));
+    }
+
+    bool contains(const std::string& pass) const {
+        for (const auto& stage : pipeline) {
+            if (std::find(stage.begin(), stage.end(), pass) != stage.end()) return true;
+        }
+        return false;
+    }
+
+    static std::string stageName(const Stage& stage) {
+        std::string name;
+        for (const auto& pass : stage) name += (name.empty() ? "" : "+") + pass;
+        return name;
+    }
+
+    // Runs one pass and records it. Returns whether it changed the tree;
+    // for "semantic", whether the program is valid.
+    bool runPass(const std::string& pass, Program* program, std::ostream& report, int stage, int iteration) {
+        int before = countNodes(program->statements);
+        auto start = std::chrono::steady_clock::now();
+        bool result = dispatch(pass, program, report);
+        double milliseconds =
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        bool changed = pass != "semantic" && result;
+        history.push_back({pass, stage, iteration, milliseconds, before, countNodes(program->statements), changed});
+        if (changed) {
+            auto refresh = std::chrono::steady_clock::now();
+            IntegralInference().analyze(program);
+            int nodes = countNodes(program->statements);
+            history.push_back({"integral", stage, iteration,
+                               std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - refresh)
+                                   .count(),
+                               nodes, nodes, false});
+        }
+        return result;
+    }
+
+    bool dispatch(const std::string& pass, Program* program, std::ostream& report) {
+        if (pass == "semantic") {
+            SemanticAnalyzer analyzer;
+            bool valid = analyzer.analyze(program);
+            semanticErrors = analyzer.getErrors();
+            return valid;
+        }
+        if (pass == "integral") {
+            IntegralInference().analyze(program);
+            return false;
+        }
+        if (pass == "tail-calls") {
+            TailCallAnalysis().analyze(program);
+            return false;
+        }
+        if (pass == "escape") {
+            EscapeAnalysis().analyze(program);
+            return false;
+        }
+        if (pass == "inline") {
+            Inliner inliner(options.inlineThreshold);
+            inliner.run(program);
+            int after = countNodes(program->statements);
+            report << "Inlining (threshold " << options.inlineThreshold << " nodes): "
+                   << inliner.sites().size() << " call site(s), " << inliner.originalNodes() << " -> " << after
+                   << " nodes (" << (after >= inliner.originalNodes() ? "+" : "") << after - inliner.originalNodes()
+                   << ")" << std::endl;
+            for (const auto& site : inliner.sites()) {
+                report << "  " << site.caller << ": " << site.callee << " at line " << site.line
+                       << ", cost " << site.cost << std::endl;
+            }
+            return !inliner.sites().empty();
+        }
+        if (pass == "simplify") {
+            AlgebraicSimplifier simplifier(options.fastMath);
+            simplifier.run(program);
+            report << "Algebraic simplification" << (options.fastMath ? " (fast)" : "") << ": " << simplifier.total()
+                   << " rewrite(s)" << std::endl;
+            for (int rule = 0; rule < AlgebraicSimplifier::RULE_COUNT; rule++) {
+                auto id = static_cast<AlgebraicSimplifier::Rule>(rule);
+                if (AlgebraicSimplifier::isFastOnly(id) && !options.fastMath) continue;
+                report << "  " << AlgebraicSimplifier::ruleName(id) << ": " << simplifier.hits(id) << std::endl;
+            }
+            return simplifier.total() > 0;
+        }
+        if (pass == "licm") {
+            LoopInvariantMotion motion;
+            motion.run(program);
+            report << "Loop-invariant code motion: " << motion.hoistedCount() << " expression(s) hoisted from "
+                   << motion.loops().size() << " loop(s)" << std::endl;
+            for (const auto& loop : motion.loops()) {
+                report << "  " << loop.function << ", loop at line " << loop.line << ":";
+                for (size_t i = 0; i < loop.hoisted.size(); i++) {
+                    report << (i > 0 ? ", " : " ") << loop.hoisted[i];
+                }
+                report << std::endl;
+            }
+            return motion.hoistedCount() > 0;
+        }
+        if (pass == "unroll") {
+            LoopUnroller unroller(options.unrollFactor);
+            unroller.run(program);
+            report << "Loop unrolling (factor " << options.unrollFactor << "): " << unroller.loops().size()
+                   << " loop(s)" << std::endl;
+            for (const auto& loop : unroller.loops()) {
+                report << "  " << loop.function << ", loop at line " << loop.line << ": ";
+                if (loop.factor == 0) {
+                    report << "fully unrolled, " << loop.trips << " iteration(s)" << std::endl;
+                } else {
+                    report << "unrolled x" << loop.factor << " with a remainder loop" << std::endl;
+                }
+            }
+            return !unroller.loops().empty();
+        }
+        ValueNumbering numbering;
+        numbering.run(program);
+        report << "Common subexpression elimination: " << numbering.eliminatedCount()
+               << " computation(s) eliminated" << std::endl;
+        for (const auto& func : numbering.results()) {
+            report << "  " << func.name << ":";
+            for (size_t i = 0; i < func.eliminated.size(); i++) {
+                report << (i > 0 ? ", " : " ") << func.eliminated[i].first;
+                if (func.eliminated[i].second > 1) report << " (x" << func.eliminated[i].second << ")";
+            }
+            report << std::endl;
+        }
+        return numbering.eliminatedCount() > 0;
+    }
+};
+
+// ============================================================================
+// SSA IR
+// ============================================================================
+
+// Each function as a control-flow graph of basic blocks in SSA form: every
+// value is defined by exactly one instruction, locals become values joined
+// by phi nodes where agar, daura and && / || merge control flow, and
+// globals stay in memory (LOADGLOBAL / STOREGLOBAL) since calls may change
+// them. A function is a handful of flat arrays indexed by 32-bit ids:
+// instructions (the value ids), their operands, the per-block schedule and
+// the predecessor lists.
+#define OURLANG_IR_OPCODES(X) \
+    X(CONST)        /* K[imm]                                   */ \
+    X(PARAM)        /* parameter imm                            */ \
+    X(LOADGLOBAL)   /* global names[imm]                        */ \
+    X(STOREGLOBAL)  /* global names[imm] = op0                  */ \
+    X(PHI)          /* one operand per predecessor; imm = name  */ \
+    X(ADD)          /* op0 + op1                                */ \
+    X(SUB)          /* op0 - op1                                */ \
+    X(MUL)          /* op0 * op1                                */ \
+    X(DIV)          /* op0 / op1                                */ \
+    X(MOD)          /* op0 % op1                                */ \
+    X(EQ)           /* op0 == op1                               */ \
+    X(NE)           /* op0 != op1                               */ \
+    X(LT)           /* op0 < op1                                */ \
+    X(LE)           /* op0 <= op1                               */ \
+    X(GT)           /* op0 > op1                                */ \
+    X(GE)           /* op0 >= op1                               */ \
+    X(NEG)          /* -op0                                     */ \
+    X(NOT)          /* !op0                                     */ \
+    X(TRUTH)        /* op0 as a boolean, for && and ||          */ \
+    X(CALL)         /* names[imm](operands...)                  */ \
+    X(NEWARRAY)     /* [operands...]                            */ \
+    X(NEWOBJECT)    /* {keys[imm + i]: operand i}               */ \
+    X(INDEX)        /* op0[op1]                                 */ \
+    X(SETINDEX)     /* op0[op1] = op2, the value is op2         */ \
+    X(GETMEMBER)    /* op0.keys[imm]                            */ \
+    X(SETMEMBER)    /* op0.keys[imm] = op1, the value is op1    */
+
+enum class IrOp : uint8_t {
+#define OURLANG_IR_OPCODE_ENUM(name) name,
+    OURLANG_IR_OPCODES(OURLANG_IR_OPCODE_ENUM)
+#undef OURLANG_IR_OPCODE_ENUM
+};
+
+const char* irOpName(IrOp op) {
+    static const char* names[] = {
+#define OURLANG_IR_OPCODE_NAME(name) #name,
+        OURLANG_IR_OPCODES(OURLANG_IR_OPCODE_NAME)
+#undef OURLANG_IR_OPCODE_NAME
+    };
+    return names[static_cast<int>(op)];
+}
+
+using IrValueId = int32_t;
+using IrBlockId = int32_t;
+
+struct IrInstruction {
+    IrOp op;
+    IrBlockId block;
+    int32_t imm;  // see OURLANG_IR_OPCODES
+    int32_t firstOperand;
+    int32_t operandCount;
+};
+
+enum class IrTerminator : uint8_t {
+    JUMP,    // to successors[0]
+    BRANCH,  // to successors[0] when value is truthy, else successors[1]
+    RETURN   // value
+};
+
+struct IrBlock {
+    int32_t firstInstruction;  // into IrFunction::schedule, phis first
+    int32_t instructionCount;
+    int32_t firstPredecessor;  // into IrFunction::predecessors
+    int32_t predecessorCount;
+    IrTerminator terminator;
+    IrValueId value;
+    IrBlockId successors[2];
+};
+
+struct IrConstant {
+    enum Kind : uint8_t { NIL, NUMBER, BOOLEAN, STRING } kind;
+    double number;
+    int32_t string;  // into IrFunction::names
+};
+
+struct IrFunction {
+    std::string name;
+    std::vector<std::string> params;
+    std::vector<IrInstruction> instructions;  // indexed by IrValueId
+    std::vector<IrValueId> operands;
+    std::vector<IrValueId> schedule;
+    std::vector<IrBlockId> predecessors;
+    std::vector<IrBlock> blocks;               // blocks[0] is the entry
+    std::vector<IrConstant> constants;
+    std::vector<std::string> names;            // globals, callees, variables, strings
+    std::vector<std::string> keys;             // object literal and member access keys
+
+    const IrValueId* operandsOf(IrValueId value) const {
+        return operands.data() + instructions[value].firstOperand;
+    }
+    const IrBlockId* predecessorsOf(IrBlockId block) const {
+        return predecessors.data() + blocks[block].firstPredecessor;
+    }
+    int successorCount(IrBlockId block) const {
+        IrTerminator terminator = blocks[block].terminator;
+        return terminator == IrTerminator::BRANCH ? 2 : terminator == IrTerminator::JUMP ? 1 : 0;
+    }
+};
+
+// Lowers one function body to SSA with the on-the-fly construction of
+// Braun et al. ("Simple and Efficient Construction of Static Single
+// Assignment Form"): a variable read looks up the definition in the current
+// block, then in its predecessors, placing a phi where they may disagree. A
+// loop header stays unsealed until its back edge is known, with
+// placeholder phis completed when it is sealed. Phis whose operands are all
+// the same value are removed, and the result is compacted into the flat
+// arrays of IrFunction.
+class IrBuilder {
+private:
+    struct BlockState {
+        std::vector<IrValueId> phis;
+        std::vector<IrValueId> code;
+        std::vector<IrBlockId> preds;
+        std::vector<std::pair<int, IrValueId>> incompletePhis;  // variable, phi
+        bool sealed = false;
+        bool terminated = false;
+        IrTerminator terminator = IrTerminator::RETURN;
+        IrValueId value = -1;
+        IrBlockId successors[2] = {-1, -1};
+    };
+
+    IrFunction fn;
+    std::vector<BlockState> states;
+    std::vector<std::vector<IrValueId>> operandLists;  // by value id
+    std::vector<IrValueId> forward;                    // removed phi -> its replacement
+    std::vector<std::unordered_map<IrBlockId, IrValueId>> definitions;  // by variable
+    std::vector<int32_t> variableNames;
+    std::vector<std::vector<std::pair<std::string, int>>> scopes;
+    std::unordered_map<std::string, int32_t> nameIndex;
+    IrBlockId current = -1;  // -1 after a wapas, until control flow merges again
+    IrValueId undefined = -1;
+    bool globalScope = false;  // declarations of the outermost scope are globals
+
+public:
+    IrFunction lowerFunction(FunctionDeclaration* func) {
+        fn.name = func->name;
+        fn.params = func->params;
+        current = newBlock();
+        seal(current);
+        scopes.emplace_back();
+        for (size_t i = 0; i < func->params.size(); i++) {
+            int variable = declare(func->params[i]);
+            writeVariable(variable, current, emit(IrOp::PARAM, static_cast<int32_t>(i), {}));
+        }
+        lowerStatements(func->body);
+        return finish();
+    }
+
+    // The top-level statements, whose own declarations are globals.
+    IrFunction lowerTopLevel(Program* program) {
+        fn.name = "top level";
+        current = newBlock();
+        seal(current);
+        globalScope = true;
+        scopes.emplace_back();
+        lowerStatements(program->statements);
+        return finish();
+    }
+
+private:
+    // ---- Blocks and SSA construction ----------------------------------------
+
+    IrBlockId newBlock() {
+        states.emplace_back();
+        return static_cast<IrBlockId>(states.size() - 1);
+    }
+
+    void terminate(IrTerminator terminator, IrValueId value, IrBlockId first = -1, IrBlockId second = -1) {
+        BlockState& state = states[current];
+        state.terminated = true;
+        state.terminator = terminator;
+        state.value = value;
+        state.successors[0] = first;
+        state.successors[1] = second;
+        if (first >= 0) states[first].preds.push_back(current);
+        if (second >= 0) states[second].preds.push_back(current);
+    }
+
+    void jumpTo(IrBlockId target) {
+        if (current >= 0) terminate(IrTerminator::JUMP, -1, target);
+    }
+
+    void seal(IrBlockId block) {
+        // Completing a phi may read other variables of this block; index so
+        // the list may grow meanwhile
+        for (size_t i = 0; i < states[block].incompletePhis.size(); i++) {
+            auto incomplete = states[block].incompletePhis[i];
+            addPhiOperands(incomplete.first, incomplete.second);
+        }
+        states[block].incompletePhis.clear();
+        states[block].sealed = true;
+    }
+
+    IrValueId emit(IrOp op, int32_t imm, std::vector<IrValueId> operands, IrBlockId block = -1) {
+        if (block < 0) block = current;
+        auto id = static_cast<IrValueId>(fn.instructions.size());
+        fn.instructions.push_back({op, block, imm, 0, 0});
+        operandLists.push_back(std::move(operands));
+        forward.push_back(id);
+        if (op == IrOp::PHI) {
+            states[block].phis.push_back(id);
+        } else {
+            states[block].code.push_back(id);
+        }
+        return id;
+    }
+
+    IrValueId resolve(IrValueId value) {
+        while (forward[value] != value) {
+            forward[value] = forward[forward[value]];
+            value = forward[value];
+        }
+        return value;
+    }
+
+    void writeVariable(int variable, IrBlockId block, IrValueId value) {
+        definitions[variable][block] = value;
+    }
+
+    IrValueId readVariable(int variable, IrBlockId block) {
+        auto found = definitions[variable].find(block);
+        if (found != definitions[variable].end()) return resolve(found->second);
+
+        BlockState& state = states[block];
+        IrValueId value;
+        if (!state.sealed) {
+            value = emit(IrOp::PHI, variableNames[variable], {}, block);
+            states[block].incompletePhis.push_back({variable, value});
+        } else if (state.preds.size() == 1) {
+            value = readVariable(variable, state.preds[0]);
+        } else if (state.preds.empty()) {
+            value = undefinedValue();
+        } else {
+            // Break cycles through loops with the phi before the operands
+            IrValueId phi = emit(IrOp::PHI, variableNames[variable], {}, block);
+            writeVariable(variable, block, phi);
+            value = addPhiOperands(variable, phi);
+        }
+        writeVariable(variable, block, value);
+        return value;
+    }
+
+    IrValueId addPhiOperands(int variable, IrValueId phi) {
+        IrBlockId block = fn.instructions[phi].block;
+        for (size_t i = 0; i < states[block].preds.size(); i++) {
+            IrValueId operand = readVariable(variable, states[block].preds[i]);
+            operandLists[phi].push_back(operand);
+        }
+        return removeTrivialPhi(phi);
+    }
+
+    // A phi that only merges one value (and itself) is that value.
+    IrValueId removeTrivialPhi(IrValueId phi) {
+        IrValueId same = -1;
+        for (IrValueId operand : operandLists[phi]) {
+            operand = resolve(operand);
+            if (operand == same || operand == phi) continue;
+            if (same >= 0) return phi;
+            same = operand;
+        }
+        if (same < 0) same = undefinedValue();
+        forward[phi] = same;
+        return same;
+    }
+
+    // nil, for reads no definition reaches (only in code after a wapas)
+    IrValueId undefinedValue() {
+        if (undefined < 0) undefined = emit(IrOp::CONST, constant({IrConstant::NIL, 0, -1}), {}, 0);
+        return undefined;
+    }
+
+    // ---- Names ----------------------------------------------------------------
+
+    int32_t name(const std::string& text) {
+        auto inserted = nameIndex.insert({text, static_cast<int32_t>(fn.names.size())});
+        if (inserted.second) fn.names.push_back(text);
+        return inserted.first->second;
+    }
+
+    int32_t constant(IrConstant value) {
+        fn.constants.push_back(value);
+        return static_cast<int32_t>(fn.constants.size() - 1);
+    }
+
+    int declare(const std::string& variableName) {
+        int variable = static_cast<int>(definitions.size());
+        definitions.emplace_back();
+        variableNames.push_back(name(variableName));
+        scopes.back().push_back({variableName, variable});
+        return variable;
+    }
+
+    int lookup(const std::string& variableName) const {
+        for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+            for (auto it = scope->rbegin(); it != scope->rend(); ++it) {
+                if (it->first == variableName) return it->second;
+            }
+        }
+        return -1;
+    }
+
+    // ---- Statements ---------------------------------------------------------
+
+    void lowerBlock(const std::vector<std::unique_ptr<Statement>>& stmts) {
+        scopes.emplace_back();
+        bool outerGlobalScope = globalScope;
+        globalScope = false;
+        lowerStatements(stmts);
+        globalScope = outerGlobalScope;
+        scopes.pop_back();
+    }
+
+    void lowerStatements(const std::vector<std::unique_ptr<Statement>>& stmts) {
+        for (auto& stmt : stmts) {
+            if (current < 0) break;  // unreachable after wapas
+            lowerStatement(stmt.get());
+        }
+        if (current >= 0 && scopes.size() == 1) {
+            terminate(IrTerminator::RETURN, emit(IrOp::CONST, constant({IrConstant::NIL, 0, -1}), {}));
+            current = -1;
+        }
+    }
+
+    void lowerStatement(Statement* stmt) {
+        if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt)) {
+            IrValueId value = varDecl->initializer ? lower(varDecl->initializer.get()) : nilConstant();
+            if (globalScope) {
+                emit(IrOp::STOREGLOBAL, name(varDecl->name), {value});
+            } else {
+                writeVariable(declare(varDecl->name), current, value);
+            }
+        } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt)) {
+            IrValueId condition = lower(ifStmt->condition.get());
+            IrBlockId thenBlock = newBlock();
+            IrBlockId elseBlock = ifStmt->elseBranch.empty() ? -1 : newBlock();
+            IrBlockId join = newBlock();
+            terminate(IrTerminator::BRANCH, condition, thenBlock, elseBlock >= 0 ? elseBlock : join);
+            seal(thenBlock);
+            current = thenBlock;
+            lowerBlock(ifStmt->thenBranch);
+            jumpTo(join);
+            if (elseBlock >= 0) {
+                seal(elseBlock);
+                current = elseBlock;
+                lowerBlock(ifStmt->elseBranch);
+                jumpTo(join);
+            }
+            seal(join);
+            current = states[join].preds.empty() ? -1 : join;
+        } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt)) {
+            IrBlockId header = newBlock();
+            jumpTo(header);
+            current = header;
+            IrValueId condition = lower(loopStmt->condition.get());
+            IrBlockId body = newBlock();
+            IrBlockId exit = newBlock();
+            terminate(IrTerminator::BRANCH, condition, body, exit);
+            seal(body);
+            current = body;
+            lowerBlock(loopStmt->body);
+            jumpTo(header);
+            seal(header);
+            seal(exit);
+            current = exit;
+        } else if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt)) {
+            IrValueId value = retStmt->value ? lower(retStmt->value.get()) : nilConstant();
+            terminate(IrTerminator::RETURN, value);
+            current = -1;
+        } else if (auto exprStmt = dynamic_cast<ExpressionStatement*>(stmt)) {
+            lower(exprStmt->expr.get());
+        }
+        // Nested kaam declarations are lowered as functions of their own
+    }
+
+    // ---- Expressions --------------------------------------------------------
+
+    IrValueId nilConstant() {
+        return emit(IrOp::CONST, constant({IrConstant::NIL, 0, -1}), {});
+    }
+
+    IrValueId lower(Expression* expr) {
+        if (auto numLit = dynamic_cast<NumberLiteral*>(expr)) {
+            return emit(IrOp::CONST, constant({IrConstant::NUMBER, numLit->value, -1}), {});
+        }
+        if (auto strLit = dynamic_cast<StringLiteral*>(expr)) {
+            return emit(IrOp::CONST, constant({IrConstant::STRING, 0, name(strLit->value)}), {});
+        }
+        if (auto boolLit = dynamic_cast<BooleanLiteral*>(expr)) {
+            return emit(IrOp::CONST, constant({IrConstant::BOOLEAN, boolLit->value ? 1.0 : 0.0, -1}), {});
+        }
+        if (auto id = dynamic_cast<Identifier*>(expr)) return read(id->name);
+        if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            BinaryOpKind kind = binaryOpKind(binOp->op);
+            if (kind == BinaryOpKind::AND || kind == BinaryOpKind::OR) return lowerLogical(binOp, kind);
+            IrValueId left = lower(binOp->left.get());
+            IrValueId right = lower(binOp->right.get());
+            return emit(binaryIrOp(kind), 0, {left, right});
+        }
+        if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) {
+            IrValueId operand = lower(unaryOp->operand.get());
+            return emit(unaryOp->op == "!" ? IrOp::NOT : IrOp::NEG, 0, {operand});
+        }
+        if (auto assign = dynamic_cast<Assignment*>(expr)) {
+            IrValueId value = lower(assign->value.get());
+            int variable = lookup(assign->name);
+            if (variable >= 0) {
+                writeVariable(variable, current, value);
+            } else {
+                emit(IrOp::STOREGLOBAL, name(assign->name), {value});
+            }
+            return value;
+        }
+        if (auto funcCall = dynamic_cast<FunctionCall*>(expr)) {
+            std::vector<IrValueId> args;
+            for (auto& arg : funcCall->args) args.push_back(lower(arg.get()));
+            return emit(IrOp::CALL, name(funcCall->name), std::move(args));
+        }
+        if (auto arrayLit = dynamic_cast<ArrayLiteral*>(expr)) {
+            std::vector<IrValueId> elements;
+            for (auto& element : arrayLit->elements) elements.push_back(lower(element.get()));
+            if (arrayLit->packed) {
+                for (double d : arrayLit->packed->numbers) {
+                    elements.push_back(emit(IrOp::CONST, constant({IrConstant::NUMBER, d, -1}), {}));
+                }
+                for (const auto& str : arrayLit->packed->strings) {
+                    elements.push_back(emit(IrOp::CONST, constant({IrConstant::STRING, 0, name(str)}), {}));
+                }
+            }
+            return emit(IrOp::NEWARRAY, 0, std::move(elements));
+        }
+        if (auto objLit = dynamic_cast<ObjectLiteral*>(expr)) {
+            std::vector<IrValueId> values;
+            for (auto& member : objLit->members) values.push_back(lower(member.second.get()));
+            auto firstKey = static_cast<int32_t>(fn.keys.size());
+            for (auto& member : objLit->members) fn.keys.push_back(member.first);
+            return emit(IrOp::NEWOBJECT, firstKey, std::move(values));
+        }
+        if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr)) {
+            IrValueId array = read(arrAccess->arrayName);
+            IrValueId index = lower(arrAccess->index.get());
+            return emit(IrOp::INDEX, 0, {array, index});
+        }
+        if (auto indexAssign = dynamic_cast<IndexAssignment*>(expr)) {
+            IrValueId index = lower(indexAssign->index.get());
+            IrValueId value = lower(indexAssign->value.get());
+            IrValueId array = read(indexAssign->arrayName);
+            return emit(IrOp::SETINDEX, 0, {array, index, value});
+        }
+        if (auto memberAccess = dynamic_cast<MemberAccess*>(expr)) {
+            IrValueId object = read(memberAccess->objectName);
+            auto key = static_cast<int32_t>(fn.keys.size());
+            fn.keys.push_back(memberAccess->member);
+            return emit(IrOp::GETMEMBER, key, {object});
+        }
+        if (auto memberAssign = dynamic_cast<MemberAssignment*>(expr)) {
+            IrValueId value = lower(memberAssign->value.get());
+            IrValueId object = read(memberAssign->objectName);
+            auto key = static_cast<int32_t>(fn.keys.size());
+            fn.keys.push_back(memberAssign->member);
+            return emit(IrOp::SETMEMBER, key, {object, value});
+        }
+        throw std::runtime_error("IR error: unsupported expression");
+    }
+
+    IrValueId read(const std::string& variableName) {
+        int variable = lookup(variableName);
+        if (variable >= 0) return readVariable(variable, current);
+        return emit(IrOp::LOADGLOBAL, name(variableName), {});
+    }
+
+    // a && b: if a is falsy the result is false without evaluating b, so
+    // the join merges a constant with the truth of b.
+    IrValueId lowerLogical(BinaryOp* binOp, BinaryOpKind kind) {
+        bool isAnd = kind == BinaryOpKind::AND;
+        IrValueId left = lower(binOp->left.get());
+        IrValueId shortCircuit = emit(IrOp::CONST, constant({IrConstant::BOOLEAN, isAnd ? 0.0 : 1.0, -1}), {});
+        IrBlockId leftBlock = current;
+        IrBlockId rightBlock = newBlock();
+        IrBlockId join = newBlock();
+        if (isAnd) {
+            terminate(IrTerminator::BRANCH, left, rightBlock, join);
+        } else {
+            terminate(IrTerminator::BRANCH, left, join, rightBlock);
+        }
+        seal(rightBlock);
+        current = rightBlock;
+        IrValueId right = emit(IrOp::TRUTH, 0, {lower(binOp->right.get())});
+        jumpTo(join);
+        seal(join);
+        current = join;
+        // Operands in predecessor order: the branch came first
+        std::vector<IrValueId> incoming(2);
+        incoming[states[join].preds[0] == leftBlock ? 0 : 1] = shortCircuit;
+        incoming[states[join].preds[0] == leftBlock ? 1 : 0] = right;
+        return emit(IrOp::PHI, name(isAnd ? "&&" : "||"), std::move(incoming));
+    }
+
+    static IrOp binaryIrOp(BinaryOpKind kind) {
+        switch (kind) {
+            case BinaryOpKind::ADD: return IrOp::ADD;
+            case BinaryOpKind::SUB: return IrOp::SUB;
+            case BinaryOpKind::MUL: return IrOp::MUL;
+            case BinaryOpKind::DIV: return IrOp::DIV;
+            case BinaryOpKind::MOD: return IrOp::MOD;
+            case BinaryOpKind::EQ: return IrOp::EQ;
+            case BinaryOpKind::NE: return IrOp::NE;
+            case BinaryOpKind::LT: return IrOp::LT;
+            case BinaryOpKind::LE: return IrOp::LE;
+            case BinaryOpKind::GT: return IrOp::GT;
+            default: return IrOp::GE;
+        }
+    }
+
+    // ---- Compaction -----------------------------------------------------------
+
+    // Drops removed phis and blocks no edge reaches, renumbers values in
+    // block order with phis first, and flattens everything into fn.
+    IrFunction finish() {
+        // Phis can become trivial after their operands were simplified
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (auto& state : states) {
+                for (IrValueId phi : state.phis) {
+                    if (forward[phi] == phi && removeTrivialPhi(phi) != phi) changed = true;
+                }
+            }
+        }
+
+        std::vector<IrBlockId> blockIds(states.size(), -1);
+        IrBlockId blockCount = 0;
+        for (size_t b = 0; b < states.size(); b++) {
+            if (b == 0 || !states[b].preds.empty()) blockIds[b] = blockCount++;
+        }
+
+        std::vector<IrValueId> valueIds(fn.instructions.size(), -1);
+        IrValueId valueCount = 0;
+        for (size_t b = 0; b < states.size(); b++) {
+            if (blockIds[b] < 0) continue;
+            for (IrValueId phi : states[b].phis) {
+                if (forward[phi] == phi) valueIds[phi] = valueCount++;
+            }
+            for (IrValueId value : states[b].code) valueIds[value] = valueCount++;
+        }
+
+        IrFunction out;
+        out.name = std::move(fn.name);
+        out.params = std::move(fn.params);
+        out.constants = std::move(fn.constants);
+        out.names = std::move(fn.names);
+        out.keys = std::move(fn.keys);
+        out.instructions.resize(valueCount);
+        auto mapValue = [&](IrValueId value) { return valueIds[resolve(value)]; };
+        for (size_t b = 0; b < states.size(); b++) {
+            if (blockIds[b] < 0) continue;
+            BlockState& state = states[b];
+            IrBlock block;
+            block.firstInstruction = static_cast<int32_t>(out.schedule.size());
+            block.firstPredecessor = static_cast<int32_t>(out.predecessors.size());
+            for (IrBlockId pred : state.preds) out.predecessors.push_back(blockIds[pred]);
+            block.predecessorCount = static_cast<int32_t>(state.preds.size());
+
+            std::vector<IrValueId> members;
+            for (IrValueId phi : state.phis) {
+                if (forward[phi] == phi) members.push_back(phi);
+            }
+            members.insert(members.end(), state.code.begin(), state.code.end());
+            for (IrValueId old : members) {
+                IrInstruction instruction = fn.instructions[old];
+                instruction.block = blockIds[b];
+                instruction.firstOperand = static_cast<int32_t>(out.operands.size());
+                instruction.operandCount = static_cast<int32_t>(operandLists[old].size());
+                for (IrValueId operand : operandLists[old]) out.operands.push_back(mapValue(operand));
+                out.instructions[valueIds[old]] = instruction;
+                out.schedule.push_back(valueIds[old]);
+            }
+            block.instructionCount = static_cast<int32_t>(members.size());
+
+            block.terminator = state.terminator;
+            block.value = state.value >= 0 ? mapValue(state.value) : -1;
+            block.successors[0] = state.successors[0] >= 0 ? blockIds[state.successors[0]] : -1;
+            block.successors[1] = state.successors[1] >= 0 ? blockIds[state.successors[1]] : -1;
+            out.blocks.push_back(block);
+        }
+        return out;
+    }
+};
+
+// Every function of the program, the top-level statements first.
+std::vector<IrFunction> lowerProgramToIr(Program* program) {
+    std::vector<IrFunction> functions;
+    functions.push_back(IrBuilder().lowerTopLevel(program));
+    CallGraph graph;
+    graph.build(program);
+    for (int id = 0; id < graph.size(); id++) {
+        functions.push_back(IrBuilder().lowerFunction(graph.function(id)));
+    }
+    return functions;
+}
+
+// Immediate dominator of each block (the entry's is itself), by the
+// iterative algorithm of Cooper, Harvey and Kennedy over reverse postorder.
+std::vector<IrBlockId> computeDominators(const IrFunction& fn) {
+    int count = static_cast<int>(fn.blocks.size());
+    std::vector<IrBlockId> order;  // postorder
+    std::vector<int> position(count, -1);
+    std::vector<std::pair<IrBlockId, int>> stack{{0, 0}};
+    std::vector<bool> visited(count, false);
+    visited[0] = true;
+    while (!stack.empty()) {
+        auto& top = stack.back();
+        if (top.second < fn.successorCount(top.first)) {
+            IrBlockId next = fn.blocks[top.first].successors[top.second++];
+            if (!visited[next]) {
+                visited[next] = true;
+                stack.push_back({next, 0});
+            }
+        } else {
+            position[top.first] = static_cast<int>(order.size());
+            order.push_back(top.first);
+            stack.pop_back();
+        }
+    }
+
+    std::vector<IrBlockId> idom(count, -1);
+    idom[0] = 0;
+    auto intersect = [&](IrBlockId a, IrBlockId b) {
+        while (a != b) {
+            while (position[a] < position[b]) a = idom[a];
+            while (position[b] < position[a]) b = idom[b];
+        }
+        return a;
+    };
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto it = order.rbegin(); it != order.rend(); ++it) {
+            IrBlockId block = *it;
+            if (block == 0) continue;
+            IrBlockId dominator = -1;
+            const IrBlockId* preds = fn.predecessorsOf(block);
+            for (int i = 0; i < fn.blocks[block].predecessorCount; i++) {
+                if (idom[preds[i]] < 0) continue;
+                dominator = dominator < 0 ? preds[i] : intersect(preds[i], dominator);
+            }
+            if (dominator != idom[block]) {
+                idom[block] = dominator;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+// Checks the structural SSA invariants; returns one message per violation.
+std::vector<std::string> verifyIr(const IrFunction& fn) {
+    std::vector<std::string> errors;
+    auto fail = [&](const std::string& message) { errors.push_back(fn.name + ": " + message); };
+    int blockCount = static_cast<int>(fn.blocks.size());
+    int valueCount = static_cast<int>(fn.instructions.size());
+    if (blockCount == 0) {
+        fail("no entry block");
+        return errors;
+    }
+    if (fn.blocks[0].predecessorCount != 0) fail("entry block b0 has predecessors");
+
+    // Edges: every successor lists the block as a predecessor as often as
+    // the block branches to it, and the other way around
+    std::vector<int> incoming(blockCount, 0);
+    for (IrBlockId b = 0; b < blockCount; b++) {
+        for (int s = 0; s < fn.successorCount(b); s++) {
+            IrBlockId successor = fn.blocks[b].successors[s];
+            if (successor <= 0 || successor >= blockCount) {
+                fail("b" + std::to_string(b) + " branches to invalid block " + std::to_string(successor));
+                return errors;
+            }
+            incoming[successor]++;
+            const IrBlockId* preds = fn.predecessorsOf(successor);
+            int listed = static_cast<int>(std::count(preds, preds + fn.blocks[successor].predecessorCount, b));
+            int taken = static_cast<int>(std::count(fn.blocks[b].successors, fn.blocks[b].successors + fn.successorCount(b),
+                                                    successor));
+            if (listed != taken) {
+                fail("b" + std::to_string(successor) + " does not list b" + std::to_string(b) + " as a predecessor");
+            }
+        }
+    }
+    for (IrBlockId b = 0; b < blockCount; b++) {
+        if (incoming[b] != fn.blocks[b].predecessorCount) {
+            fail("b" + std::to_string(b) + " lists " + std::to_string(fn.blocks[b].predecessorCount) +
+                 " predecessors but has " + std::to_string(incoming[b]) + " incoming edges");
+        }
+    }
+    if (!errors.empty()) return errors;
+
+    // Each value is scheduled once, in the block it names
+    std::vector<int> indexInBlock(valueCount, -1);
+    std::vector<int> scheduled(valueCount, 0);
+    for (IrBlockId b = 0; b < blockCount; b++) {
+        const IrBlock& block = fn.blocks[b];
+        bool pastPhis = false;
+        for (int i = 0; i < block.instructionCount; i++) {
+            IrValueId value = fn.schedule[block.firstInstruction + i];
+            if (value < 0 || value >= valueCount) {
+                fail("b" + std::to_string(b) + " schedules invalid value " + std::to_string(value));
+                return errors;
+            }
+            scheduled[value]++;
+            indexInBlock[value] = i;
+            const IrInstruction& instruction = fn.instructions[value];
+            if (instruction.block != b) fail("v" + std::to_string(value) + " is scheduled outside its block");
+            if (instruction.op == IrOp::PHI) {
+                if (pastPhis) fail("phi v" + std::to_string(value) + " follows a non-phi in b" + std::to_string(b));
+                if (instruction.operandCount != block.predecessorCount) {
+                    fail("phi v" + std::to_string(value) + " has " + std::to_string(instruction.operandCount) +
+                         " operands for " + std::to_string(block.predecessorCount) + " predecessors");
+                }
+            } else {
+                pastPhis = true;
+            }
+        }
+    }
+    for (IrValueId v = 0; v < valueCount; v++) {
+        if (scheduled[v] != 1) fail("v" + std::to_string(v) + " is scheduled " + std::to_string(scheduled[v]) + " times");
+    }
+    if (!errors.empty()) return errors;
+
+    // Definitions dominate uses; a phi's operand must reach the end of the
+    // matching predecessor
+    std::vector<IrBlockId> idom = computeDominators(fn);
+    auto dominates = [&](IrBlockId a, IrBlockId b) {
+        if (idom[b] < 0) return true;  // unreachable uses constrain nothing
+        for (;;) {
+            if (a == b) return true;
+            if (b == 0) return false;
+            b = idom[b];
+        }
+    };
+    auto checkUse = [&](IrValueId user, IrValueId operand, IrBlockId block, int index) {
+        if (operand < 0 || operand >= valueCount) {
+            fail("v" + std::to_string(user) + " uses invalid value " + std::to_string(operand));
+            return;
+        }
+        IrBlockId definedIn = fn.instructions[operand].block;
+        bool ok = definedIn == block ? indexInBlock[operand] < index : dominates(definedIn, block);
+        if (!ok) fail("v" + std::to_string(operand) + " does not dominate its use in v" + std::to_string(user));
+    };
+    for (IrBlockId b = 0; b < blockCount; b++) {
+        const IrBlock& block = fn.blocks[b];
+        for (int i = 0; i < block.instructionCount; i++) {
+            IrValueId value = fn.schedule[block.firstInstruction + i];
+            const IrInstruction& instruction = fn.instructions[value];
+            const IrValueId* operands = fn.operandsOf(value);
+            for (int k = 0; k < instruction.operandCount; k++) {
+                if (instruction.op == IrOp::PHI) {
+                    IrBlockId pred = fn.predecessorsOf(b)[k];
+                    checkUse(value, operands[k], pred, fn.blocks[pred].instructionCount);
+                } else {
+                    checkUse(value, operands[k], b, i);
+                }
+            }
+        }
+        if (block.terminator != IrTerminator::JUMP) {
+            if (block.value < 0) {
+                fail("b" + std::to_string(b) + " terminator has no value");
+            } else {
+                checkUse(block.value, block.value, b, block.instructionCount);
+            }
+        }
+    }
+    return errors;
+}
+
+// Text form for --dump-ir.
+void dumpIr(const IrFunction& fn, std::ostream& out) {
+    int phis = 0;
+    for (const auto& instruction : fn.instructions) phis += instruction.op == IrOp::PHI;
+    out << (fn.name == "top level" ? fn.name : "kaam " + fn.name) << "(";
+    for (size_t i = 0; i < fn.params.size(); i++) out << (i > 0 ? ", " : "") << fn.params[i];
+    out << "): " << fn.blocks.size() << " block(s), " << fn.instructions.size() << " value(s), " << phis
+        << " phi(s)" << std::endl;
+
+    auto list = [](const IrValueId* values, int count) {
+        std::string text;
+        for (int i = 0; i < count; i++) text += (i > 0 ? ", v" : "v") + std::to_string(values[i]);
+        return text;
+    };
+    for (IrBlockId b = 0; b < static_cast<IrBlockId>(fn.blocks.size()); b++) {
+        const IrBlock& block = fn.blocks[b];
+        out << "  b" << b;
+        if (block.predecessorCount > 0) {
+            out << " (preds";
+            for (int i = 0; i < block.predecessorCount; i++) out << (i > 0 ? ", b" : " b") << fn.predecessorsOf(b)[i];
+            out << ")";
+        }
+        out << ":" << std::endl;
+        for (int i = 0; i < block.instructionCount; i++) {
+            IrValueId value = fn.schedule[block.firstInstruction + i];
+            const IrInstruction& instruction = fn.instructions[value];
+            const IrValueId* operands = fn.operandsOf(value);
+            out << "    v" << value << " = ";
+            std::string op = irOpName(instruction.op);
+            std::transform(op.begin(), op.end(), op.begin(), [](unsigned char c) { return std::tolower(c); });
+            switch (instruction.op) {
+                case IrOp::CONST: {
+                    const IrConstant& k = fn.constants[instruction.imm];
+                    out << "const ";
+                    if (k.kind == IrConstant::NUMBER) out << formatNumber(k.number);
+                    if (k.kind == IrConstant::STRING) out << "\"" << fn.names[k.string] << "\"";
+                    if (k.kind == IrConstant::BOOLEAN) out << (k.number != 0 ? "haan" : "na");
+                    if (k.kind == IrConstant::NIL) out << "nil";
+                    break;
+                }
+                case IrOp::PARAM:
+                    out << "param " << fn.params[instruction.imm];
+                    break;
+                case IrOp::LOADGLOBAL:
+                    out << "loadglobal " << fn.names[instruction.imm];
+                    break;
+                case IrOp::STOREGLOBAL:
+                    out << "storeglobal " << fn.names[instruction.imm] << ", v" << operands[0];
+                    break;
+                case IrOp::PHI:
+                    out << "phi " << fn.names[instruction.imm] << " [";
+                    for (int k = 0; k < instruction.operandCount; k++) {
+                        out << (k > 0 ? ", b" : "b") << fn.predecessorsOf(b)[k] << ": v" << operands[k];
+                    }
+                    out << "]";
+                    break;
+                case IrOp::CALL:
+                    out << "call " << fn.names[instruction.imm] << "(" << list(operands, instruction.operandCount)
+                        << ")";
+                    break;
+                case IrOp::NEWARRAY:
+                    out << "newarray [" << list(operands, instruction.operandCount) << "]";
+                    break;
+                case IrOp::NEWOBJECT:
+                    out << "newobject {";
+                    for (int k = 0; k < instruction.operandCount; k++) {
+                        out << (k > 0 ? ", " : "") << fn.keys[instruction.imm + k] << ": v" << operands[k];
+                    }
+                    out << "}";
+                    break;
+                case IrOp::INDEX:
+                    out << "index v" << operands[0] << "[v" << operands[1] << "]";
+                    break;
+                case IrOp::SETINDEX:
+                    out << "setindex v" << operands[0] << "[v" << operands[1] << "], v" << operands[2];
+                    break;
+                case IrOp::GETMEMBER:
+                    out << "getmember v" << operands[0] << "." << fn.keys[instruction.imm];
+                    break;
+                case IrOp::SETMEMBER:
+                    out << "setmember v" << operands[0] << "." << fn.keys[instruction.imm] << ", v" << operands[1];
+                    break;
+                default:
+                    out << op << " " << list(operands, instruction.operandCount);
+                    break;
+            }
+            out << std::endl;
+        }
+        switch (block.terminator) {
+            case IrTerminator::JUMP:
+                out << "    jump b" << block.successors[0] << std::endl;
+                break;
+            case IrTerminator::BRANCH:
+                out << "    branch v" << block.value << ", b" << block.successors[0] << ", b" << block.successors[1]
+                    << std::endl;
+                break;
+            case IrTerminator::RETURN:
+                out << "    return v" << block.value << std::endl;
+                break;
+        }
+    }
+}
+
+// ============================================================================
+// Bytecode (register-based)
+// ============================================================================
+
+// Instructions are 32-bit words: opcode in the low byte, then A, B, C (8 bits
+// each). Bx is the unsigned 16-bit field formed by B and C; sBx is Bx biased by
+// BYTECODE_SBX_BIAS and sAx is the signed 24-bit field formed by A, B and C.
+#define OURLANG_OPCODES(X) \
+    X(LOADK)      /* R[A] = K[Bx]                                 */ \
+    X(LOADKX)     /* R[A] = K[next word]                          */ \
+    X(LOADNIL)    /* R[A] = nil                                   */ \
+    X(LOADBOOL)   /* R[A] = (B != 0)                              */ \
+    X(MOVE)       /* R[A] = R[B]                                  */ \
+    X(GETGLOBAL)  /* R[A] = G[Bx]                                 */ \
+    X(SETGLOBAL)  /* G[Bx] = R[A]                                 */ \
+    X(ADD)        /* R[A] = R[B] + R[C]                           */ \
+    X(SUB)        /* R[A] = R[B] - R[C]                           */ \
+    X(MUL)        /* R[A] = R[B] * R[C]                           */ \
+    X(DIV)        /* R[A] = R[B] / R[C]                           */ \
+    X(MOD)        /* R[A] = R[B] % R[C]                           */ \
+    X(EQ)         /* R[A] = R[B] == R[C]                          */ \
+    X(NE)         /* R[A] = R[B] != R[C]                          */ \
+    X(LT)         /* R[A] = R[B] < R[C]                           */ \
+    X(LE)         /* R[A] = R[B] <= R[C]                          */ \
+    X(GT)         /* R[A] = R[B] > R[C]                           */ \
+    X(GE)         /* R[A] = R[B] >= R[C]                          */ \
+    X(NOT)        /* R[A] = !R[B]                                 */ \
+    X(NEG)        /* R[A] = -R[B]                                 */ \
+    X(JMP)        /* pc += sAx                                    */ \
+    X(JMPIFNOT)   /* if !R[A] then pc += sBx                      */ \
+    X(JMPIF)      /* if R[A] then pc += sBx                       */ \
+    X(PARLOOP)    /* run parallelLoops[Bx] up to bound R[A]       */ \
+    X(CALL)       /* R[A] = F[Bx](R[A+1] .. R[A+arity])           */ \
+    X(TAILCALL)   /* return F[Bx](R[A+1] .. R[A+arity]) in place  */ \
+    X(RESTART)    /* release the call region, pc = 0              */ \
+    X(BUILTIN)    /* R[A] = builtin B (R[A+1] .. R[A+C])          */ \
+    X(NEWARRAY)   /* R[A] = [] with capacity Bx                   */ \
+    X(NEWARRAYR)  /* R[A] = [] with capacity Bx, in the region    */ \
+    X(APPEND)     /* R[A].push(R[B])                              */ \
+    X(NEWARRAYK)  /* R[A] = copy of packed literal P[Bx]          */ \
+    X(NEWARRAYKR) /* R[A] = copy of packed literal P[Bx], in region */ \
+    X(NEWOBJECT)  /* R[A] = {} with shape S[Bx]                   */ \
+    X(NEWOBJECTR) /* R[A] = {} with shape S[Bx], in the region    */ \
+    X(INITMEMBER) /* R[A].slot[next word] = R[B]                  */ \
+    X(GETMEMBER)  /* R[A] = R[B].(M[next word])                   */ \
+    X(SETMEMBER)  /* R[A].(M[next word]) = R[B]                   */ \
+    X(INDEX)      /* R[A] = R[B][R[C]], named N[next word]        */ \
+    X(SETINDEX)   /* R[A][R[B]] = R[C], named N[next word]        */ \
+    X(RETURN)     /* return R[A]                                  */ \
+    X(RETURNNIL)  /* return nil                                   */ \
+    X(ADDN)       /* R[A] = R[B] + R[C], both numbers             */ \
+    X(SUBN)       /* R[A] = R[B] - R[C], both numbers             */ \
+    X(MULN)       /* R[A] = R[B] * R[C], both numbers             */ \
+    X(DIVN)       /* R[A] = R[B] / R[C], both numbers             */ \
+    X(MODN)       /* R[A] = R[B] % R[C], both numbers             */ \
+    X(NEGN)       /* R[A] = -R[B], a number                       */ \
+    X(EQN)        /* if (R[A] == R[B]) == C then skip next        */ \
+    X(LTN)        /* if (R[A] < R[B]) == C then skip next         */ \
+    X(LEN)        /* if (R[A] <= R[B]) == C then skip next        */ \
+    X(ADDNK)      /* R[A] = R[B] + K[C], numbers                  */ \
+    X(SUBNK)      /* R[A] = R[B] - K[C], numbers                  */ \
+    X(MULNK)      /* R[A] = R[B] * K[C], numbers                  */ \
+    X(DIVNK)      /* R[A] = R[B] / K[C], numbers                  */ \
+    X(MODNK)      /* R[A] = R[B] % K[C], numbers                  */ \
+    X(EQNK)       /* if (R[A] == K[B]) == C then skip next        */ \
+    X(LTNK)       /* if (R[A] < K[B]) == C then skip next         */ \
+    X(LENK)       /* if (R[A] <= K[B]) == C then skip next        */ \
+    X(GTNK)       /* if (R[A] > K[B]) == C then skip next         */ \
+    X(GENK)       /* if (R[A] >= K[B]) == C then skip next        */ \
+    X(ADDI)       /* R[A] = R[B] + R[C], int64                    */ \
+    X(SUBI)       /* R[A] = R[B] - R[C], int64                    */ \
+    X(MULI)       /* R[A] = R[B] * R[C], int64                    */ \
+    X(MODI)       /* R[A] = R[B] % R[C], int64                    */ \
+    X(ADDIK)      /* R[A] = R[B] + K[C], int64                    */ \
+    X(SUBIK)      /* R[A] = R[B] - K[C], int64                    */ \
+    X(MULIK)      /* R[A] = R[B] * K[C], int64                    */ \
+    X(MODIK)      /* R[A] = R[B] % K[C], int64                    */ \
+    X(NEGI)       /* R[A] = -R[B], int64                          */ \
+    X(ITOF)       /* R[A] = double(R[B])                          */ \
+    X(FTOI)       /* R[A] = int64(R[B]) when exact                */ \
+    X(EQI)        /* if (R[A] == R[B]) == C then skip next, int64 */ \
+    X(LTI)        /* if (R[A] < R[B]) == C then skip next, int64  */ \
+    X(LEI)        /* if (R[A] <= R[B]) == C then skip next, int64 */ \
+    X(EQIK)       /* if (R[A] == K[B]) == C then skip next, int64 */ \
+    X(LTIK)       /* if (R[A] < K[B]) == C then skip next, int64  */ \
+    X(LEIK)       /* if (R[A] <= K[B]) == C then skip next, int64 */ \
+    X(GTIK)       /* if (R[A] > K[B]) == C then skip next, int64  */ \
+    X(GEIK)       /* if (R[A] >= K[B]) == C then skip next, int64 */
+
+enum class OpCode : uint8_t {
+#define OURLANG_OPCODE_ENUM(name) name,
+    OURLANG_OPCODES(OURLANG_OPCODE_ENUM)
+#undef OURLANG_OPCODE_ENUM
+};
+
+const char* opCodeName(OpCode op) {
+    static const char* names[] = {
+#define OURLANG_OPCODE_NAME(name) #name,
+        OURLANG_OPCODES(OURLANG_OPCODE_NAME)
+#undef OURLANG_OPCODE_NAME
+    };
+    return names[static_cast<int>(op)];
+}
+
+const int BYTECODE_MAX_REGISTERS = 256;
+const int BYTECODE_SBX_BIAS = 32767;
+const int BYTECODE_SAX_BIAS = 1 << 23;
+
+inline OpCode instrOp(uint32_t i) { return static_cast<OpCode>(i & 0xff); }
+inline int instrA(uint32_t i) { return (i >> 8) & 0xff; }
+inline int instrB(uint32_t i) { return (i >> 16) & 0xff; }
+inline int instrC(uint32_t i) { return (i >> 24) & 0xff; }
+inline int instrBx(uint32_t i) { return static_cast<int>(i >> 16); }
+inline int instrSBx(uint32_t i) { return static_cast<int>(i >> 16) - BYTECODE_SBX_BIAS; }
+inline int instrSAx(uint32_t i) { return static_cast<int>(i >> 8) - BYTECODE_SAX_BIAS; }
+
+inline uint32_t encodeABC(OpCode op, int a, int b, int c) {
+    return static_cast<uint32_t>(op) | (static_cast<uint32_t>(a) << 8) |
+           (static_cast<uint32_t>(b) << 16) | (static_cast<uint32_t>(c) << 24);
+}
+
+inline uint32_t encodeABx(OpCode op, int a, int bx) {
+    return static_cast<uint32_t>(op) | (static_cast<uint32_t>(a) << 8) | (static_cast<uint32_t>(bx) << 16);
+}
+
+inline uint32_t encodeSAx(OpCode op, int sax) {
+    return static_cast<uint32_t>(op) | (static_cast<uint32_t>(sax + BYTECODE_SAX_BIAS) << 8);
+}
+
+// Integer kernels keep integral numbers as int64 while they stay within
+// +-2^53 (see EXACT_INTEGER_LIMIT). A result outside that range, or one the
+// double would give as -0, fails the check and the call is rerun with
+// doubles.
+inline bool kernelIntegerInRange(int64_t r) {
+    return r >= -EXACT_INTEGER_LIMIT && r <= EXACT_INTEGER_LIMIT;
+}
+
+inline bool kernelAdd(int64_t x, int64_t y, int64_t& r) {
+    r = x + y;
+    return kernelIntegerInRange(r);
+}
+
+inline bool kernelSubtract(int64_t x, int64_t y, int64_t& r) {
+    r = x - y;
+    return kernelIntegerInRange(r);
+}
+
+inline bool kernelMultiply(int64_t x, int64_t y, int64_t& r) {
+    // Operands are within 2^53, so the double product bounds the exact one
+    double estimate = static_cast<double>(x) * static_cast<double>(y);
+    if (estimate > static_cast<double>(EXACT_INTEGER_LIMIT) || estimate < -static_cast<double>(EXACT_INTEGER_LIMIT)) {
+        return false;
+    }
+    r = x * y;
+    return kernelIntegerInRange(r) && (r != 0 || (x >= 0 && y >= 0));
+}
+
+inline bool kernelModulo(int64_t x, int64_t y, int64_t& r) {
+    if (y == 0) return false;
+    r = x % y;  // truncates like fmod
+    return r != 0 || x >= 0;
+}
+
+inline bool kernelNegate(int64_t x, int64_t& r) {
+    r = -x;
+    return x != 0;
+}
+
+// Native entry for a numeric function: arguments are read from an array of
+// doubles (a run of VM registers holding numbers) and the result is returned
+// in xmm0.
+using JitFunction = double (*)(const double*);
+
+// Debug line table entry: instructions from `pc` up to the next entry belong
+// to source line `line`.
+struct LineInfo {
+    uint32_t pc;
+    int line;
+};
+
+// A register of the running frame or, when `global`, a global slot.
+struct LoopOperand {
+    bool global;
+    int slot;
+};
+
+// A daura loop proven free of dependences between iterations
+// (ParallelLoopAnalysis). PARLOOP, emitted before the loop, runs iterations
+// 0 .. trips-1 of code[bodyStart, bodyEnd) with the counter register set to
+// start + k * step, then continues at `exit`; when ParallelLoopRunner
+// declines, the ordinary loop after it runs instead.
+struct ParallelLoop {
+    int line;
+    int counter;
+    double step;
+    bool inclusive;  // i <= bound
+    uint32_t bodyStart;
+    uint32_t bodyEnd;
+    uint32_t exit;
+    std::vector<LoopOperand> scalars;       // must not hold objects
+    std::vector<LoopOperand> storedArrays;  // written and read at [i] only
+    std::vector<LoopOperand> readArrays;    // read anywhere; must not be a stored array
+    int statsIndex;                         // into ParallelStats::loops
+};
+
+struct ParallelStats {
+    struct Loop {
+        std::string function;
+        int line;
+        long long parallelRuns = 0;
+        long long sequentialRuns = 0;  // declined: too few trips or a failed check
+        long long iterations = 0;      // run in parallel
+    };
+    std::vector<Loop> loops;
+    std::vector<std::pair<std::string, std::string>> rejected;  // "function:line", reason
+    int threads = 0;
+    long long chunks = 0;
+    long long steals = 0;
+};
+
+// A GETMEMBER / SETMEMBER site: the key, the variable named in errors and
+// the shapes the site has seen.
+struct MemberSite {
+    std::string key;
+    std::string objectName;
+    mutable InlineCache cache;
+};
+
+struct FunctionProto {
+    std::string name;
+    int arity;
+    int frameSize;
+    std::vector<uint32_t> code;
+    std::vector<Value> constants;
+    std::vector<bool> integerConstants;  // per constant: a raw int64 of an integer kernel, not a boxed Value
+    std::vector<LineInfo> lines;
+    const uint32_t* mappedCode;  // code inside a loaded .olc image, used instead of `code`
+    int kernelIndex;             // numeric kernel entered when all arguments are numbers, or -1
+    int integerKernelIndex;      // integer kernel entered when all arguments are exact integers, or -1
+    int deoptIndex;              // for an integer kernel: the numeric kernel it falls back to
+    bool memoizable;             // result depends only on the number arguments (--memoize=auto)
+    JitFunction jitEntry;        // set by the JIT when the function runs natively
+    std::vector<ParallelLoop> parallelLoops;  // PARLOOP operands (--parallel)
+    std::vector<const Shape*> shapes;         // S: NEWOBJECT operands
+    std::vector<MemberSite> memberSites;      // M: GETMEMBER / SETMEMBER operands
+    std::vector<std::string> indexNames;      // N: INDEX / SETINDEX operands, the variable named in errors
+    std::vector<std::shared_ptr<const PackedElements>> packedArrays;  // P: NEWARRAYK operands
+
+    FunctionProto(const std::string& n = "", int a = 0)
+        : name(n), arity(a), frameSize(0), mappedCode(nullptr), kernelIndex(-1), integerKernelIndex(-1),
+          deoptIndex(-1), memoizable(false), jitEntry(nullptr) {}
+
+    const uint32_t* instructions() const {
+        return mappedCode ? mappedCode : code.data();
+    }
+
+    int lineAt(size_t pc) const {
+        int line = 0;
+        for (const auto& entry : lines) {
+            if (entry.pc > pc) break;
+            line = entry.line;
+        }
+        return line;
+    }
+};
+
+struct BytecodeModule {
+    std::vector<FunctionProto> functions;
+    std::vector<std::string> globalNames;
+    int topLevelIndex = -1;
+    int mainIndex = -1;
+};
+
+// ============================================================================
+// Parallel Loops
+// ============================================================================
+
+// Persistent threads that share out the chunks of one loop at a time. Each
+// worker owns a deque of chunk numbers seeded with a contiguous range; it
+// takes from the front of its own and, once that is empty, steals from the
+// back of another's, so neighbouring chunks tend to stay on one thread.
+class WorkStealingPool {
+public:
+    using Task = std::function<void(int worker, int64_t chunk)>;
+
+    explicit WorkStealingPool(int threadCount) {
+        for (int w = 0; w < threadCount; w++) queues.push_back(std::make_unique<Queue>());
+        for (int w = 1; w < threadCount; w++) threads.emplace_back([this, w] { workerLoop(w); });
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) thread.join();
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    int size() const { return static_cast<int>(queues.size()); }
+    long long steals() const { return stolen.load(); }
+
+    // Runs `task` for chunks 0 .. count-1, the calling thread being worker
+    // 0, and returns once every chunk is done. `task` must not throw.
+    void run(int64_t count, const Task& task) {
+        int64_t n = size();
+        for (int64_t w = 0; w < n; w++) {
+            std::lock_guard<std::mutex> guard(queues[w]->lock);
+            for (int64_t chunk = count * w / n; chunk < count * (w + 1) / n; chunk++) {
+                queues[w]->chunks.push_back(chunk);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            current = &task;
+            busy = size() - 1;
+            generation++;
+        }
+        wake.notify_all();
+        drain(0, task);
+        std::unique_lock<std::mutex> guard(lock);
+        finished.wait(guard, [this] { return busy == 0; });
+        current = nullptr;
+    }
+
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<int64_t> chunks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex lock;  // guards everything below but `stolen`
+    std::condition_variable wake;
+    std::condition_variable finished;
+    const Task* current = nullptr;
+    uint64_t generation = 0;
+    int busy = 0;
+    bool stopping = false;
+    std::atomic<long long> stolen{0};
+
+    bool take(int worker, int64_t& chunk) {
+        {
+            Queue& own = *queues[worker];
+            std::lock_guard<std::mutex> guard(own.lock);
+            if (!own.chunks.empty()) {
+                chunk = own.chunks.front();
+                own.chunks.pop_front();
+                return true;
+            }
+        }
+        for (int k = 1; k < size(); k++) {
+            Queue& victim = *queues[(worker + k) % size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.chunks.empty()) {
+                chunk = victim.chunks.back();
+                victim.chunks.pop_back();
+                stolen++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void drain(int worker, const Task& task) {
+        int64_t chunk;
+        while (take(worker, chunk)) task(worker, chunk);
+    }
+
+    void workerLoop(int worker) {
+        uint64_t seen = 0;
+        for (;;) {
+            const Task* task;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+                task = current;
+            }
+            drain(worker, *task);
+            std::lock_guard<std::mutex> guard(lock);
+            if (--busy == 0) finished.notify_one();
+        }
+    }
+};
+
+// Runs PARLOOP loops on a WorkStealingPool. Each worker interprets the loop
+// body on a private copy of the frame's registers, so body locals and
+// temporaries never meet. The checks in run() leave the body nothing but
+// numbers and booleans to compute with, so the shared Runtime is only asked
+// for things that do not allocate, and stored elements are at distinct
+// indices. An iteration that fails stops nothing below it: the error of the
+// lowest failing iteration is the one a sequential run would have raised.
+class ParallelLoopRunner {
+public:
+    static constexpr int64_t MIN_TRIPS = 4096;  // shorter loops run sequentially
+    static constexpr int64_t CHUNKS_PER_WORKER = 8;
+
+    ParallelLoopRunner(Runtime& rt, int threads, ParallelStats& counters)
+        : runtime(rt), pool(threads), stats(counters) {
+        stats.threads = threads;
+    }
+
+    // The opcodes a worker executes: those of an accepted body in a
+    // function that is not a kernel.
+    static bool supports(OpCode op) {
+        switch (op) {
+            case OpCode::LOADK: case OpCode::LOADKX: case OpCode::LOADNIL: case OpCode::LOADBOOL:
+            case OpCode::MOVE: case OpCode::GETGLOBAL:
+            case OpCode::ADD: case OpCode::SUB: case OpCode::MUL: case OpCode::DIV: case OpCode::MOD:
+            case OpCode::EQ: case OpCode::NE: case OpCode::LT: case OpCode::LE: case OpCode::GT: case OpCode::GE:
+            case OpCode::NOT: case OpCode::NEG: case OpCode::JMP: case OpCode::JMPIFNOT: case OpCode::JMPIF:
+            case OpCode::BUILTIN: case OpCode::INDEX: case OpCode::SETINDEX:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // Runs every iteration of the loop and leaves the counter at its final
+    // value. Returns false, having done nothing, when the loop is too short
+    // or its inputs fail the checks; the sequential loop then runs.
+    bool run(const ParallelLoop& loop, const FunctionProto* proto, Value* R, Value bound,
+             const std::vector<Value>& globals) {
+        ParallelStats::Loop& counts = stats.loops[loop.statsIndex];
+        int64_t trips;
+        if (pool.size() < 2 || !tripCount(loop, R[loop.counter], bound, trips) || trips < MIN_TRIPS ||
+            !inputsQualify(loop, R, globals)) {
+            counts.sequentialRuns++;
+            return false;
+        }
+
+        double start = R[loop.counter].asNumber();
+        size_t frameSize = static_cast<size_t>(proto->frameSize);
+        registers.resize(frameSize * pool.size());
+        for (int w = 0; w < pool.size(); w++) std::copy(R, R + frameSize, registers.begin() + w * frameSize);
+
+        int64_t chunkSize = std::max<int64_t>(1, trips / (pool.size() * CHUNKS_PER_WORKER));
+        int64_t chunks = (trips + chunkSize - 1) / chunkSize;
+        std::atomic<int64_t> firstFailure{trips};
+        std::mutex failureLock;
+        std::string failure;
+        pool.run(chunks, [&](int worker, int64_t chunk) {
+            Value* regs = registers.data() + worker * frameSize;
+            int64_t end = std::min(trips, (chunk + 1) * chunkSize);
+            for (int64_t k = chunk * chunkSize; k < end && k < firstFailure.load(); k++) {
+                regs[loop.counter] = Value::number(start + static_cast<double>(k) * loop.step);
+                try {
+                    execute(loop, proto, regs, globals);
+                } catch (const std::exception& e) {
+                    std::lock_guard<std::mutex> guard(failureLock);
+                    if (k < firstFailure.load()) {
+                        firstFailure = k;
+                        failure = e.what();
+                    }
+                    return;
+                }
+            }
+        });
+
+        counts.parallelRuns++;
+        counts.iterations += trips;
+        stats.chunks += chunks;
+        stats.steals = pool.steals();
+        if (firstFailure.load() < trips) throw LocatedRuntimeError(failure);
+        R[loop.counter] = Value::number(start + static_cast<double>(trips) * loop.step);
+        return true;
+    }
+
+private:
+    Runtime& runtime;
+    WorkStealingPool pool;
+    ParallelStats& stats;
+    std::vector<Value> registers;  // frameSize per worker
+
+    // Iterations the condition admits from an exact integer start. The
+    // counter must stay exact up to its final value.
+    static bool tripCount(const ParallelLoop& loop, Value start, Value bound, int64_t& trips) {
+        if (!start.isNumber() || !bound.isNumber()) return false;
+        double first = start.asNumber(), limit = bound.asNumber();
+        if (!isExactInteger(first) || std::isnan(limit)) return false;
+        double span = (limit - first) / loop.step;
+        double count = loop.inclusive ? (span >= 0 ? std::floor(span) + 1 : 0) : (span > 0 ? std::ceil(span) : 0);
+        if (!(std::fabs(first) + count * loop.step < static_cast<double>(EXACT_INTEGER_LIMIT))) return false;
+        trips = static_cast<int64_t>(count);
+        return true;
+    }
+
+    static bool inputsQualify(const ParallelLoop& loop, const Value* R, const std::vector<Value>& globals) {
+        auto read = [&](const LoopOperand& operand) { return operand.global ? globals[operand.slot] : R[operand.slot]; };
+        auto plainArray = [](Value v) {
+            if (!v.isArray()) return false;
+            for (Value element : static_cast<ArrayObject*>(v.asObject())->elements) {
+                if (element.isObject()) return false;
+            }
+            return true;
+        };
+        for (const auto& scalar : loop.scalars) {
+            if (read(scalar).isObject()) return false;
+        }
+        for (const auto& array : loop.storedArrays) {
+            if (!plainArray(read(array))) return false;
+        }
+        for (const auto& array : loop.readArrays) {
+            Value v = read(array);
+            if (!plainArray(v)) return false;
+            for (const auto& stored : loop.storedArrays) {
+                if (read(stored).raw() == v.raw()) return false;
+            }
+        }
+        return true;
+    }
+
+    // One iteration; errors name the line of the failing instruction.
+    void execute(const ParallelLoop& loop, const FunctionProto* proto, Value* R,
+                 const std::vector<Value>& globals) const {
+        const uint32_t* code = proto->instructions();
+        const Value* K = proto->constants.data();
+        const uint32_t* pc = code + loop.bodyStart;
+        const uint32_t* end = code + loop.bodyEnd;
+        try {
+            while (pc != end) {
+                uint32_t instr = *pc++;
+                switch (instrOp(instr)) {
+                    case OpCode::LOADK: R[instrA(instr)] = K[instrBx(instr)]; break;
+                    case OpCode::LOADKX: R[instrA(instr)] = K[*pc++]; break;
+                    case OpCode::LOADNIL: R[instrA(instr)] = Value::nil(); break;
+                    case OpCode::LOADBOOL: R[instrA(instr)] = Value::boolean(instrB(instr) != 0); break;
+                    case OpCode::MOVE: R[instrA(instr)] = R[instrB(instr)]; break;
+                    case OpCode::GETGLOBAL: R[instrA(instr)] = globals[instrBx(instr)]; break;
+#define PARALLEL_ARITH(name, expr)                                                      \
+                    case OpCode::name: {                                                \
+                        Value b = R[instrB(instr)], c = R[instrC(instr)];               \
+                        if (b.isNumber() && c.isNumber()) {                             \
+                            double x = b.asNumber(), y = c.asNumber();                  \
+                            R[instrA(instr)] = expr;                                    \
+                        } else {                                                        \
+                            R[instrA(instr)] = runtime.binary(BinaryOpKind::name, b, c); \
+                        }                                                               \
+                        break;                                                          \
+                    }
+                    PARALLEL_ARITH(ADD, Value::number(x + y))
+                    PARALLEL_ARITH(SUB, Value::number(x - y))
+                    PARALLEL_ARITH(MUL, Value::number(x * y))
+                    PARALLEL_ARITH(DIV, Value::number(x / y))
+                    PARALLEL_ARITH(MOD, Value::number(numberModulo(x, y)))
+                    PARALLEL_ARITH(EQ, Value::boolean(x == y))
+                    PARALLEL_ARITH(NE, Value::boolean(x != y))
+                    PARALLEL_ARITH(LT, Value::boolean(x < y))
+                    PARALLEL_ARITH(LE, Value::boolean(x <= y))
+                    PARALLEL_ARITH(GT, Value::boolean(x > y))
+                    PARALLEL_ARITH(GE, Value::boolean(x >= y))
+#undef PARALLEL_ARITH
+                    case OpCode::NOT: R[instrA(instr)] = Value::boolean(!runtime.isTruthy(R[instrB(instr)])); break;
+                    case OpCode::NEG: R[instrA(instr)] = runtime.negate(R[instrB(instr)]); break;
+                    case OpCode::JMP: pc += instrSAx(instr); break;
+                    case OpCode::JMPIFNOT:
+                        if (!runtime.isTruthy(R[instrA(instr)])) pc += instrSBx(instr);
+                        break;
+                    case OpCode::JMPIF:
+                        if (runtime.isTruthy(R[instrA(instr)])) pc += instrSBx(instr);
+                        break;
+                    case OpCode::BUILTIN: {
+                        int a = instrA(instr);
+                        R[a] = runtime.callBuiltin(static_cast<BuiltinId>(instrB(instr)), &R[a + 1], instrC(instr));
+                        break;
+                    }
+                    case OpCode::INDEX:
+                        R[instrA(instr)] = runtime.index(R[instrB(instr)], R[instrC(instr)], proto->indexNames[*pc++]);
+                        break;
+                    case OpCode::SETINDEX:
+                        runtime.setIndex(R[instrA(instr)], R[instrB(instr)], R[instrC(instr)], proto->indexNames[*pc++]);
+                        break;
+                    default:
+                        throw std::runtime_error("Runtime error: invalid opcode in a parallel loop");
+                }
+            }
+        } catch (const std::runtime_error& e) {
+            int line = proto->lineAt(static_cast<size_t>(pc - 1 - code));
+            if (line <= 0) throw;
+            throw locatedAt(e, line);
+        }
+    }
+};
+
+// ============================================================================
+// Bytecode Compiler
+// ============================================================================
+
+class BytecodeCompiler {
+private:
+    Runtime& runtime;
+    BytecodeModule& module;
+    std::unordered_map<std::string, int> functionIndex;
+    std::unordered_map<std::string, int> globalIndex;
+
+    // Per-function state
+    FunctionProto* proto;
+    std::vector<std::vector<std::pair<std::string, int>>> scopes;
+    std::unordered_map<uint64_t, int> numberConstants;
+    std::unordered_map<int64_t, int> integerConstants;
+    std::unordered_map<std::string, int> stringConstants;
+    int freeReg;
+    bool atTopLevel;
+    bool kernelMode;  // compiling a numeric kernel: every operand is a number
+    const IntegralInference* integers;  // compiling an integer kernel: integral values are int64
+
+    struct Kernel {
+        FunctionDeclaration* func;
+        int index;
+        std::unique_ptr<IntegralInference> integers;  // set for an integer kernel
+    };
+
+    bool buildKernels;
+    std::unordered_map<std::string, int> kernelIndex;
+    std::unordered_map<std::string, int> integerKernelIndex;
+
+    ParallelStats* parallel;  // set when loops may run in parallel (--parallel)
+    bool inParallelBody;      // the body of a PARLOOP runs on worker threads
+
+public:
+    BytecodeCompiler(Runtime& rt, BytecodeModule& mod, bool numericKernels = true,
+                     ParallelStats* parallelLoops = nullptr)
+        : runtime(rt), module(mod), proto(nullptr), freeReg(0), atTopLevel(false), kernelMode(false),
+          integers(nullptr), buildKernels(numericKernels), parallel(parallelLoops), inParallelBody(false) {}
+
+    void compile(Program* program) {
+        std::vector<FunctionDeclaration*> functions;
+        collectFunctions(program->statements, functions);
+        for (auto* func : functions) {
+            functionIndex[func->name] = static_cast<int>(module.functions.size());
+            module.functions.emplace_back(func->name, static_cast<int>(func->params.size()));
+        }
+        for (FunctionDeclaration* func : memoizableFunctions(program)) {
+            module.functions[functionIndex.at(func->name)].memoizable = true;
+        }
+
+        // Functions that provably compute only with numbers get a second,
+        // unchecked body. CALL enters it when every argument is a number.
+        // Those doing integer arithmetic also get an integer kernel, entered
+        // when every argument is an exact integer; it never assigns its
+        // parameters, so it can be rerun with doubles when a result leaves
+        // the exact range.
+        NumericFunctionAnalysis numeric;
+        std::vector<Kernel> kernels;
+        if (buildKernels) {
+            numeric.analyze(program);
+            for (const auto& name : numeric.functionNames()) {
+                if (!numeric.isNumeric(name)) continue;
+                FunctionDeclaration* func = numeric.getFunction(name);
+                int arity = static_cast<int>(func->params.size());
+                FunctionProto& generic = module.functions[functionIndex.at(name)];
+                int index = static_cast<int>(module.functions.size());
+                generic.kernelIndex = index;
+                kernelIndex[name] = index;
+                kernels.push_back({func, index, nullptr});
+
+                auto inference = std::make_unique<IntegralInference>();
+                inference->analyzeFunction(func);
+                if (inference->assignsParameter() || inference->integerOperations() == 0) {
+                    module.functions.emplace_back(name, arity);
+                    continue;
+                }
+                generic.integerKernelIndex = index + 1;
+                integerKernelIndex[name] = index + 1;
+                module.functions.emplace_back(name, arity);
+                module.functions.emplace_back(name, arity);
+                module.functions[index + 1].deoptIndex = index;
+                kernels.push_back({func, index + 1, std::move(inference)});
+            }
+        }
+        for (auto& stmt : program->statements) {
+            if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt.get())) {
+                globalSlot(varDecl->name);
+            }
+        }
+
+        module.topLevelIndex = static_cast<int>(module.functions.size());
+        module.functions.emplace_back("<toplevel>", 0);
+        beginFunction(&module.functions[module.topLevelIndex], true);
+        for (auto& stmt : program->statements) {
+            compileStatement(stmt.get());
+        }
+        emitABC(OpCode::RETURNNIL, 0, 0, 0);
+        endFunction();
+
+        for (size_t i = 0; i < functions.size(); i++) {
+            compileFunction(functions[i], &module.functions[i], false);
+        }
+        for (const auto& kernel : kernels) {
+            compileFunction(kernel.func, &module.functions[kernel.index], true, kernel.integers.get());
+        }
+
+        auto mainIt = functionIndex.find("main");
+        module.mainIndex = mainIt != functionIndex.end() ? mainIt->second : -1;
+    }
+
+private:
+    void collectFunctions(const std::vector<std::unique_ptr<Statement>>& stmts,
+                          std::vector<FunctionDeclaration*>& out) {
+        for (auto& stmt : stmts) {
+            if (auto funcDecl = dynamic_cast<FunctionDeclaration*>(stmt.get())) {
+                out.push_back(funcDecl);
+                collectFunctions(funcDecl->body, out);
+            } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                collectFunctions(ifStmt->thenBranch, out);
+                collectFunctions(ifStmt->elseBranch, out);
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                collectFunctions(loopStmt->body, out);
+            }
+        }
+    }
+
+    int globalSlot(const std::string& name) {
+        auto it = globalIndex.find(name);
+        if (it != globalIndex.end()) return it->second;
+        int slot = static_cast<int>(module.globalNames.size());
+        module.globalNames.push_back(name);
+        globalIndex[name] = slot;
+        return slot;
+    }
+
+    void beginFunction(FunctionProto* target, bool topLevel) {
+        proto = target;
+        atTopLevel = topLevel;
+        scopes.clear();
+        scopes.emplace_back();
+        numberConstants.clear();
+        integerConstants.clear();
+        stringConstants.clear();
+        freeReg = 0;
+        proto->frameSize = 0;
+    }
+
+    void endFunction() {
+        proto = nullptr;
+    }
+
+    void compileFunction(FunctionDeclaration* func, FunctionProto* target, bool kernel,
+                         const IntegralInference* integerKinds = nullptr) {
+        beginFunction(target, false);
+        kernelMode = kernel;
+        integers = integerKinds;
+        for (const auto& param : func->params) {
+            declareLocal(param);
+        }
+        for (auto& stmt : func->body) {
+            compileStatement(stmt.get());
+        }
+        emitABC(OpCode::RETURNNIL, 0, 0, 0);
+        kernelMode = false;
+        integers = nullptr;
+        endFunction();
+    }
+
+    // ---- Registers and scopes -------------------------------------------
+
+    int allocReg() {
+        if (freeReg >= BYTECODE_MAX_REGISTERS) {
+            throw std::runtime_error("Compile error: function '" + proto->name +
+                                     "' needs more than 256 registers");
+        }
+        int reg = freeReg++;
+        if (freeReg > proto->frameSize) proto->frameSize = freeReg;
+        return reg;
+    }
+
+    int declareLocal(const std::string& name) {
+        int reg = allocReg();
+        scopes.back().push_back({name, reg});
+        return reg;
+    }
+
+    bool isGlobalScope() const {
+        return atTopLevel && scopes.size() == 1;
+    }
+
+    int resolveLocal(const std::string& name) const {
+        for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+            for (auto it = scope->rbegin(); it != scope->rend(); ++it) {
+                if (it->first == name) return it->second;
+            }
+        }
+        return -1;
+    }
+
+    int resolveGlobal(const std::string& name) const {
+        auto it = globalIndex.find(name);
+        if (it == globalIndex.end()) {
+            throw std::runtime_error("Compile error: Undefined variable '" + name + "'");
+        }
+        return it->second;
+    }
+
+    void compileBlock(const std::vector<std::unique_ptr<Statement>>& stmts) {
+        int savedFree = freeReg;
+        scopes.emplace_back();
+        for (auto& stmt : stmts) {
+            compileStatement(stmt.get());
+        }
+        scopes.pop_back();
+        freeReg = savedFree;
+    }
+
+    // ---- Emission ---------------------------------------------------------
+
+    int emit(uint32_t instr) {
+        proto->code.push_back(instr);
+        return static_cast<int>(proto->code.size()) - 1;
+    }
+
+    int emitABC(OpCode op, int a, int b, int c) { return emit(encodeABC(op, a, b, c)); }
+    int emitABx(OpCode op, int a, int bx) { return emit(encodeABx(op, a, bx)); }
+
+    int emitJump(OpCode op, int a = 0) {
+        return op == OpCode::JMP ? emit(encodeSAx(OpCode::JMP, 0)) : emitABx(op, a, BYTECODE_SBX_BIAS);
+    }
+
+    int currentOffset() const {
+        return static_cast<int>(proto->code.size());
+    }
+
+    void patchJump(int at, int target) {
+        int offset = target - (at + 1);
+        uint32_t instr = proto->code[at];
+        if (instrOp(instr) == OpCode::JMP) {
+            if (offset < -BYTECODE_SAX_BIAS || offset >= BYTECODE_SAX_BIAS) {
+                throw std::runtime_error("Compile error: jump too far in '" + proto->name + "'");
+            }
+            proto->code[at] = encodeSAx(OpCode::JMP, offset);
+        } else {
+            if (offset < -BYTECODE_SBX_BIAS || offset > 65535 - BYTECODE_SBX_BIAS) {
+                throw std::runtime_error("Compile error: branch too far in '" + proto->name + "'");
+            }
+            proto->code[at] = encodeABx(instrOp(instr), instrA(instr), offset + BYTECODE_SBX_BIAS);
+        }
+    }
+
+    void patchJumpsHere(const std::vector<int>& jumps) {
+        for (int at : jumps) {
+            patchJump(at, currentOffset());
+        }
+    }
+
+    int addConstant(Value v, bool integer = false) {
+        proto->constants.push_back(v);
+        proto->integerConstants.push_back(integer);
+        return static_cast<int>(proto->constants.size()) - 1;
+    }
+
+    int numberConstant(double d) {
+        Value v = Value::number(d);
+        auto it = numberConstants.find(v.raw());
+        if (it != numberConstants.end()) return it->second;
+        int index = addConstant(v);
+        numberConstants[v.raw()] = index;
+        return index;
+    }
+
+    // Integer kernel constants hold raw int64 values.
+    int integerConstant(int64_t i) {
+        auto it = integerConstants.find(i);
+        if (it != integerConstants.end()) return it->second;
+        int index = addConstant(Value::integer(i), true);
+        integerConstants[i] = index;
+        return index;
+    }
+
+    int stringConstant(const std::string& s) {
+        auto it = stringConstants.find(s);
+        if (it != stringConstants.end()) return it->second;
+        int index = addConstant(runtime.intern(s));
+        stringConstants[s] = index;
+        return index;
+    }
+
+    int shapeIndex(const Shape* shape) {
+        auto& shapes = proto->shapes;
+        auto found = std::find(shapes.begin(), shapes.end(), shape);
+        if (found != shapes.end()) return static_cast<int>(found - shapes.begin());
+        if (shapes.size() > 0xffff) {
+            throw std::runtime_error("Compile error: function '" + proto->name +
+                                     "' builds more than 65536 kinds of object");
+        }
+        shapes.push_back(shape);
+        return static_cast<int>(shapes.size() - 1);
+    }
+
+    int packedIndex(const std::shared_ptr<const PackedElements>& packed) {
+        auto& arrays = proto->packedArrays;
+        auto found = std::find(arrays.begin(), arrays.end(), packed);
+        if (found != arrays.end()) return static_cast<int>(found - arrays.begin());
+        if (arrays.size() > 0xffff) {
+            throw std::runtime_error("Compile error: function '" + proto->name +
+                                     "' has more than 65536 literal data arrays");
+        }
+        arrays.push_back(packed);
+        return static_cast<int>(arrays.size() - 1);
+    }
+
+    // Every site gets its own inline cache.
+    uint32_t memberSite(const std::string& key, const std::string& objectName) {
+        proto->memberSites.push_back({key, objectName, InlineCache()});
+        return static_cast<uint32_t>(proto->memberSites.size() - 1);
+    }
+
+    // Sites indexing the same variable share its entry.
+    uint32_t indexName(const std::string& name) {
+        auto& names = proto->indexNames;
+        auto found = std::find(names.begin(), names.end(), name);
+        if (found == names.end()) found = names.insert(names.end(), name);
+        return static_cast<uint32_t>(found - names.begin());
+    }
+
+    void emitLoadConstant(int dst, int index) {
+        if (index <= 0xffff) {
+            emitABx(OpCode::LOADK, dst, index);
+        } else {
+            emitABC(OpCode::LOADKX, dst, 0, 0);
+            emit(static_cast<uint32_t>(index));
+        }
+    }
+
+    // ---- Statements -------------------------------------------------------
+
+    void markLine(int line) {
+        if (line <= 0) return;
+        uint32_t pc = static_cast<uint32_t>(currentOffset());
+        auto& lines = proto->lines;
+        if (!lines.empty() && lines.back().line == line) return;
+        if (!lines.empty() && lines.back().pc == pc) {
+            lines.back().line = line;
+        } else {
+            lines.push_back({pc, line});
+        }
+    }
+
+    void compileStatement(Statement* stmt) {
+        markLine(stmt->line);
+        if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt)) {
+            if (isGlobalScope()) {
+                int savedFree = freeReg;
+                int tmp = allocReg();
+                compileOptional(varDecl->initializer.get(), tmp);
+                emitABx(OpCode::SETGLOBAL, tmp, globalSlot(varDecl->name));
+                freeReg = savedFree;
+            } else {
+                int reg = allocReg();
+                compileOptional(varDecl->initializer.get(), reg);
+                if (isInteger(varDecl->initializer.get()) && !integers->isIntegral(varDecl)) {
+                    emitABC(OpCode::ITOF, reg, reg, 0);
+                }
+                scopes.back().push_back({varDecl->name, reg});
+            }
+        } else if (dynamic_cast<FunctionDeclaration*>(stmt)) {
+            // Compiled separately; declarations have no runtime effect
+        } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt)) {
+            std::vector<int> falseJumps;
+            compileCondition(ifStmt->condition.get(), falseJumps);
+            compileBlock(ifStmt->thenBranch);
+            if (ifStmt->elseBranch.empty()) {
+                patchJumpsHere(falseJumps);
+            } else {
+                int skipElse = emitJump(OpCode::JMP);
+                patchJumpsHere(falseJumps);
+                compileBlock(ifStmt->elseBranch);
+                patchJump(skipElse, currentOffset());
+            }
+        } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt)) {
+            int parallelLoop = parallel && !atTopLevel && !kernelMode && !inParallelBody
+                                   ? emitParallelLoop(loopStmt) : -1;
+            int loopStart = currentOffset();
+            std::vector<int> exitJumps;
+            compileCondition(loopStmt->condition.get(), exitJumps);
+            int bodyStart = currentOffset();
+            inParallelBody = parallelLoop >= 0;
+            compileBlock(loopStmt->body);
+            inParallelBody = false;
+            int bodyEnd = currentOffset();
+            patchJump(emitJump(OpCode::JMP), loopStart);
+            patchJumpsHere(exitJumps);
+            if (parallelLoop >= 0) finishParallelLoop(parallelLoop, bodyStart, bodyEnd);
+        } else if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt)) {
+            auto funcCall = dynamic_cast<FunctionCall*>(retStmt->value.get());
+            if (funcCall && funcCall->tailCall != TailCall::NONE) {
+                compileTailCall(funcCall);
+            } else if (!retStmt->value) {
+                emitABC(OpCode::RETURNNIL, 0, 0, 0);
+            } else {
+                int savedFree = freeReg;
+                emitABC(OpCode::RETURN, compileNumberToReg(retStmt->value.get()), 0, 0);
+                freeReg = savedFree;
+            }
+        } else if (auto exprStmt = dynamic_cast<ExpressionStatement*>(stmt)) {
+            int savedFree = freeReg;
+            if (auto assign = dynamic_cast<Assignment*>(exprStmt->expr.get())) {
+                compileAssignment(assign, -1);
+            } else {
+                compileInto(exprStmt->expr.get(), allocReg());
+            }
+            freeReg = savedFree;
+        }
+    }
+
+    // For a loop ParallelLoopAnalysis accepts, evaluates the bound and
+    // emits PARLOOP. Returns the PARLOOP's offset, or -1.
+    int emitParallelLoop(LoopStatement* loop) {
+        std::string where = proto->name + ":" + std::to_string(loop->line);
+        ParallelLoopAnalysis::Shape shape;
+        std::string reason;
+        if (!ParallelLoopAnalysis::analyze(loop, shape, reason)) {
+            parallel->rejected.push_back({where, reason});
+            return -1;
+        }
+        int counter = resolveLocal(shape.counter);
+        if (counter < 0) {
+            parallel->rejected.push_back({where, "counter " + shape.counter + " is a global"});
+            return -1;
+        }
+
+        ParallelLoop plan;
+        plan.line = loop->line;
+        plan.counter = counter;
+        plan.step = shape.step;
+        plan.inclusive = shape.inclusive;
+        plan.bodyStart = plan.bodyEnd = plan.exit = 0;
+        auto operands = [&](const std::vector<std::string>& names, std::vector<LoopOperand>& out) {
+            for (const auto& name : names) {
+                int local = resolveLocal(name);
+                out.push_back(local >= 0 ? LoopOperand{false, local} : LoopOperand{true, resolveGlobal(name)});
+            }
+        };
+        operands(shape.scalars, plan.scalars);
+        operands(shape.storedArrays, plan.storedArrays);
+        operands(shape.readArrays, plan.readArrays);
+        plan.statsIndex = static_cast<int>(parallel->loops.size());
+        parallel->loops.push_back({proto->name, loop->line});
+
+        int savedFree = freeReg;
+        int bound = compileToReg(shape.bound);
+        int at = emitABx(OpCode::PARLOOP, bound, static_cast<int>(proto->parallelLoops.size()));
+        freeReg = savedFree;
+        proto->parallelLoops.push_back(std::move(plan));
+        return at;
+    }
+
+    // Workers run the body with only the opcodes below; anything else (none
+    // is expected for an accepted loop) turns the PARLOOP into a no-op.
+    void finishParallelLoop(int at, int bodyStart, int bodyEnd) {
+        ParallelLoop& plan = proto->parallelLoops[instrBx(proto->code[at])];
+        plan.bodyStart = static_cast<uint32_t>(bodyStart);
+        plan.bodyEnd = static_cast<uint32_t>(bodyEnd);
+        plan.exit = static_cast<uint32_t>(currentOffset());
+        for (int pc = bodyStart; pc < bodyEnd; pc++) {
+            OpCode op = instrOp(proto->code[pc]);
+            if (ParallelLoopRunner::supports(op)) {
+                if (op == OpCode::LOADKX || op == OpCode::INDEX || op == OpCode::SETINDEX) pc++;
+                continue;
+            }
+            parallel->loops.pop_back();
+            parallel->rejected.push_back({proto->name + ":" + std::to_string(plan.line),
+                                          std::string("body compiles to ") + opCodeName(op)});
+            proto->code[at] = encodeSAx(OpCode::JMP, 0);
+            return;
+        }
+    }
+
+    void compileOptional(Expression* expr, int dst) {
+        if (expr) {
+            compileInto(expr, dst);
+        } else {
+            emitABC(OpCode::LOADNIL, dst, 0, 0);
+        }
+    }
+
+    // Emits jumps taken when the condition is false. && and || become chains
+    // of conditional jumps so the right operand is skipped when possible.
+    void compileCondition(Expression* cond, std::vector<int>& falseJumps) {
+        if (auto binOp = dynamic_cast<BinaryOp*>(cond)) {
+            BinaryOpKind kind = binaryOpKind(binOp->op);
+            if (kind == BinaryOpKind::AND) {
+                compileCondition(binOp->left.get(), falseJumps);
+                compileCondition(binOp->right.get(), falseJumps);
+                return;
+            }
+            if (kind == BinaryOpKind::OR) {
+                std::vector<int> trueJumps;
+                compileConditionTrue(binOp->left.get(), trueJumps);
+                compileCondition(binOp->right.get(), falseJumps);
+                patchJumpsHere(trueJumps);
+                return;
+            }
+        }
+        if (auto unaryOp = dynamic_cast<UnaryOp*>(cond)) {
+            if (unaryOp->op == "!") {
+                compileConditionTrue(unaryOp->operand.get(), falseJumps);
+                return;
+            }
+        }
+        if (kernelMode && compileNumericTest(cond, true)) {
+            falseJumps.push_back(emitJump(OpCode::JMP));
+            return;
+        }
+        int savedFree = freeReg;
+        falseJumps.push_back(emitJump(OpCode::JMPIFNOT, compileToReg(cond)));
+        freeReg = savedFree;
+    }
+
+    // Emits jumps taken when the condition is true.
+    void compileConditionTrue(Expression* cond, std::vector<int>& trueJumps) {
+        if (auto binOp = dynamic_cast<BinaryOp*>(cond)) {
+            BinaryOpKind kind = binaryOpKind(binOp->op);
+            if (kind == BinaryOpKind::OR) {
+                compileConditionTrue(binOp->left.get(), trueJumps);
+                compileConditionTrue(binOp->right.get(), trueJumps);
+                return;
+            }
+            if (kind == BinaryOpKind::AND) {
+                std::vector<int> falseJumps;
+                compileCondition(binOp->left.get(), falseJumps);
+                compileConditionTrue(binOp->right.get(), trueJumps);
+                patchJumpsHere(falseJumps);
+                return;
+            }
+        }
+        if (auto unaryOp = dynamic_cast<UnaryOp*>(cond)) {
+            if (unaryOp->op == "!") {
+                compileCondition(unaryOp->operand.get(), trueJumps);
+                return;
+            }
+        }
+        if (kernelMode && compileNumericTest(cond, false)) {
+            trueJumps.push_back(emitJump(OpCode::JMP));
+            return;
+        }
+        int savedFree = freeReg;
+        trueJumps.push_back(emitJump(OpCode::JMPIF, compileToReg(cond)));
+        freeReg = savedFree;
+    }
+
+    // In a kernel, emits an EQN/LTN/LEN that skips the jump emitted next
+    // when the comparison equals `skipWhen`. Returns false for conditions
+    // that are not comparisons.
+    bool compileNumericTest(Expression* cond, bool skipWhen) {
+        auto binOp = dynamic_cast<BinaryOp*>(cond);
+        if (!binOp) return false;
+
+        int form;
+        bool negate = false;
+        switch (binaryOpKind(binOp->op)) {
+            case BinaryOpKind::EQ: form = 0; break;
+            case BinaryOpKind::NE: form = 0; negate = true; break;
+            case BinaryOpKind::LT: form = 1; break;
+            case BinaryOpKind::LE: form = 2; break;
+            case BinaryOpKind::GT: form = 3; break;
+            case BinaryOpKind::GE: form = 4; break;
+            default: return false;
+        }
+        int c = skipWhen != negate ? 1 : 0;
+        bool integer = isInteger(binOp->left.get()) && isInteger(binOp->right.get());
+
+        int savedFree = freeReg;
+        int constant = integer ? integerConstantOperand(binOp->right.get()) : kernelConstant(binOp->right.get());
+        if (constant >= 0) {
+            static const OpCode numberForms[] = {OpCode::EQNK, OpCode::LTNK, OpCode::LENK, OpCode::GTNK, OpCode::GENK};
+            static const OpCode integerForms[] = {OpCode::EQIK, OpCode::LTIK, OpCode::LEIK, OpCode::GTIK, OpCode::GEIK};
+            int left = integer ? compileToReg(binOp->left.get()) : compileNumberToReg(binOp->left.get());
+            emitABC((integer ? integerForms : numberForms)[form], left, constant, c);
+            freeReg = savedFree;
+            return true;
+        }
+
+        // a > b is tested as b < a, and a >= b as b <= a
+        static const OpCode numberForms[] = {OpCode::EQN, OpCode::LTN, OpCode::LEN, OpCode::LTN, OpCode::LEN};
+        static const OpCode integerForms[] = {OpCode::EQI, OpCode::LTI, OpCode::LEI, OpCode::LTI, OpCode::LEI};
+        int left, right;
+        compileOperandPair(binOp, left, right, !integer);
+        if (form >= 3) std::swap(left, right);
+        emitABC((integer ? integerForms : numberForms)[form], left, right, c);
+        freeReg = savedFree;
+        return true;
+    }
+
+    // Index of a number literal operand usable as the K operand of a kernel
+    // instruction, or -1.
+    int kernelConstant(Expression* expr) {
+        auto numLit = dynamic_cast<NumberLiteral*>(expr);
+        if (!numLit) return -1;
+        int index = numberConstant(numLit->value);
+        return index <= 0xff ? index : -1;
+    }
+
+    // The same for an integral literal in an integer kernel.
+    int integerConstantOperand(Expression* expr) {
+        auto numLit = dynamic_cast<NumberLiteral*>(expr);
+        if (!numLit || !isInteger(numLit) || !isExactInteger(numLit->value)) return -1;
+        int index = integerConstant(static_cast<int64_t>(numLit->value));
+        return index <= 0xff ? index : -1;
+    }
+
+    // Evaluates both operands of a binary operator, left first. With
+    // `numbers`, integer kernel operands are converted to doubles.
+    void compileOperandPair(BinaryOp* binOp, int& left, int& right, bool numbers = false) {
+        left = numbers ? compileNumberToReg(binOp->left.get()) : compileToReg(binOp->left.get());
+        if (resolvesToLocal(binOp->left.get()) && containsAssignment(binOp->right.get())) {
+            // The right operand may reassign the local; evaluate the left side first
+            int copy = allocReg();
+            emitABC(OpCode::MOVE, copy, left, 0);
+            left = copy;
+        }
+        right = numbers ? compileNumberToReg(binOp->right.get()) : compileToReg(binOp->right.get());
+    }
+
+    // In an integer kernel, whether the expression's register holds an int64.
+    bool isInteger(const Expression* expr) const {
+        return integers && integers->isIntegral(expr);
+    }
+
+    // ---- Expressions ------------------------------------------------------
+
+    // Returns a register holding the value: locals are used in place, anything
+    // else is evaluated into a fresh temporary.
+    int compileToReg(Expression* expr) {
+        if (auto id = dynamic_cast<Identifier*>(expr)) {
+            int local = resolveLocal(id->name);
+            if (local >= 0) return local;
+        }
+        if (auto assign = dynamic_cast<Assignment*>(expr)) {
+            int local = resolveLocal(assign->name);
+            if (local >= 0) {
+                compileAssignment(assign, -1);
+                return local;
+            }
+        }
+        int reg = allocReg();
+        compileInto(expr, reg);
+        return reg;
+    }
+
+    // As compileToReg, but an integer kernel's int64 result is converted to
+    // a double first.
+    int compileNumberToReg(Expression* expr) {
+        int reg = compileToReg(expr);
+        if (!isInteger(expr)) return reg;
+        int number = allocReg();
+        emitABC(OpCode::ITOF, number, reg, 0);
+        return number;
+    }
+
+    void compileNumberInto(Expression* expr, int dst) {
+        compileInto(expr, dst);
+        if (isInteger(expr)) emitABC(OpCode::ITOF, dst, dst, 0);
+    }
+
+    void compileInto(Expression* expr, int dst) {
+        int savedFree = freeReg;
+
+        if (auto numLit = dynamic_cast<NumberLiteral*>(expr)) {
+            if (!isInteger(numLit)) {
+                emitLoadConstant(dst, numberConstant(numLit->value));
+            } else if (isExactInteger(numLit->value)) {
+                emitLoadConstant(dst, integerConstant(static_cast<int64_t>(numLit->value)));
+            } else {
+                // Too large to be exact as int64 in a kernel: always falls back
+                emitLoadConstant(dst, numberConstant(numLit->value));
+                emitABC(OpCode::FTOI, dst, dst, 0);
+            }
+        } else if (auto strLit = dynamic_cast<StringLiteral*>(expr)) {
+            emitLoadConstant(dst, stringConstant(strLit->value));
+        } else if (auto boolLit = dynamic_cast<BooleanLiteral*>(expr)) {
+            emitABC(OpCode::LOADBOOL, dst, boolLit->value ? 1 : 0, 0);
+        } else if (auto id = dynamic_cast<Identifier*>(expr)) {
+            int local = resolveLocal(id->name);
+            if (local >= 0) {
+                if (local != dst) emitABC(OpCode::MOVE, dst, local, 0);
+            } else {
+                emitABx(OpCode::GETGLOBAL, dst, resolveGlobal(id->name));
+            }
+        } else if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            compileBinary(binOp, dst);
+        } else if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) {
+            if (unaryOp->op == "!") {
+                emitABC(OpCode::NOT, dst, compileToReg(unaryOp->operand.get()), 0);
+            } else if (isInteger(unaryOp)) {
+                emitABC(OpCode::NEGI, dst, compileToReg(unaryOp->operand.get()), 0);
+            } else {
+                int operand = compileNumberToReg(unaryOp->operand.get());
+                emitABC(kernelMode ? OpCode::NEGN : OpCode::NEG, dst, operand, 0);
+            }
+        } else if (auto assign = dynamic_cast<Assignment*>(expr)) {
+            compileAssignment(assign, dst);
+        } else if (auto funcCall = dynamic_cast<FunctionCall*>(expr)) {
+            compileCall(funcCall, dst);
+        } else if (auto arrayLit = dynamic_cast<ArrayLiteral*>(expr)) {
+            if (arrayLit->packed) {
+                emitABx(arrayLit->inRegion ? OpCode::NEWARRAYKR : OpCode::NEWARRAYK, dst, packedIndex(arrayLit->packed));
+            } else {
+                int array = allocReg();
+                emitABx(arrayLit->inRegion ? OpCode::NEWARRAYR : OpCode::NEWARRAY, array,
+                        static_cast<int>(std::min<size_t>(arrayLit->elements.size(), 0xffff)));
+                for (auto& element : arrayLit->elements) {
+                    int elementSaved = freeReg;
+                    emitABC(OpCode::APPEND, array, compileToReg(element.get()), 0);
+                    freeReg = elementSaved;
+                }
+                emitABC(OpCode::MOVE, dst, array, 0);
+            }
+        } else if (auto objLit = dynamic_cast<ObjectLiteral*>(expr)) {
+            int record = allocReg();
+            const Shape* shape = Shape::empty();
+            for (auto& member : objLit->members) shape = shape->withKey(member.first);
+            emitABx(objLit->inRegion ? OpCode::NEWOBJECTR : OpCode::NEWOBJECT, record, shapeIndex(shape));
+            uint32_t slot = 0;
+            for (auto& member : objLit->members) {
+                int memberSaved = freeReg;
+                int value = compileToReg(member.second.get());
+                emitABC(OpCode::INITMEMBER, record, value, 0);
+                emit(slot++);
+                freeReg = memberSaved;
+            }
+            emitABC(OpCode::MOVE, dst, record, 0);
+        } else if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr)) {
+            int array = compileVariableToReg(arrAccess->arrayName);
+            int index = compileToReg(arrAccess->index.get());
+            emitABC(OpCode::INDEX, dst, array, index);
+            emit(indexName(arrAccess->shownName()));
+        } else if (auto indexAssign = dynamic_cast<IndexAssignment*>(expr)) {
+            int index = compileToReg(indexAssign->index.get());
+            if (resolvesToLocal(indexAssign->index.get()) && containsAssignment(indexAssign->value.get())) {
+                // The value may reassign the local used as the index
+                int copy = allocReg();
+                emitABC(OpCode::MOVE, copy, index, 0);
+                index = copy;
+            }
+            int value = compileToReg(indexAssign->value.get());
+            int array = compileVariableToReg(indexAssign->arrayName);
+            emitABC(OpCode::SETINDEX, array, index, value);
+            emit(indexName(indexAssign->shownName()));
+            if (value != dst) emitABC(OpCode::MOVE, dst, value, 0);
+        } else if (auto memberAccess = dynamic_cast<MemberAccess*>(expr)) {
+            int object = compileVariableToReg(memberAccess->objectName);
+            emitABC(OpCode::GETMEMBER, dst, object, 0);
+            emit(memberSite(memberAccess->member, memberAccess->shownName()));
+        } else if (auto memberAssign = dynamic_cast<MemberAssignment*>(expr)) {
+            int value = compileToReg(memberAssign->value.get());
+            int object = compileVariableToReg(memberAssign->objectName);
+            emitABC(OpCode::SETMEMBER, object, value, 0);
+            emit(memberSite(memberAssign->member, memberAssign->shownName()));
+            if (value != dst) emitABC(OpCode::MOVE, dst, value, 0);
+        } else {
+            throw std::runtime_error("Compile error: unsupported expression");
+        }
+
+        freeReg = savedFree;
+    }
+
+    int compileVariableToReg(const std::string& name) {
+        int local = resolveLocal(name);
+        if (local >= 0) return local;
+        int reg = allocReg();
+        emitABx(OpCode::GETGLOBAL, reg, resolveGlobal(name));
+        return reg;
+    }
+
+    void compileBinary(BinaryOp* binOp, int dst) {
+        BinaryOpKind kind = binaryOpKind(binOp->op);
+        if (kind == BinaryOpKind::AND || kind == BinaryOpKind::OR) {
+            std::vector<int> falseJumps;
+            compileCondition(binOp, falseJumps);
+            emitABC(OpCode::LOADBOOL, dst, 1, 0);
+            int skip = emitJump(OpCode::JMP);
+            patchJumpsHere(falseJumps);
+            emitABC(OpCode::LOADBOOL, dst, 0, 0);
+            patchJump(skip, currentOffset());
+            return;
+        }
+
+        if (kernelMode && compileNumericArith(binOp, kind, dst)) return;
+
+        int left, right;
+        compileOperandPair(binOp, left, right);
+
+        OpCode op;
+        switch (kind) {
+            case BinaryOpKind::ADD: op = OpCode::ADD; break;
+            case BinaryOpKind::SUB: op = OpCode::SUB; break;
+            case BinaryOpKind::MUL: op = OpCode::MUL; break;
+            case BinaryOpKind::DIV: op = OpCode::DIV; break;
+            case BinaryOpKind::MOD: op = OpCode::MOD; break;
+            case BinaryOpKind::EQ: op = OpCode::EQ; break;
+            case BinaryOpKind::NE: op = OpCode::NE; break;
+            case BinaryOpKind::LT: op = OpCode::LT; break;
+            case BinaryOpKind::LE: op = OpCode::LE; break;
+            case BinaryOpKind::GT: op = OpCode::GT; break;
+            case BinaryOpKind::GE: op = OpCode::GE; break;
+            default:
+                throw std::runtime_error("Compile error: unknown operator '" + binOp->op + "'");
+        }
+        emitABC(op, dst, left, right);
+    }
+
+    // Kernel arithmetic: unchecked number instructions, with the K form when
+    // the right operand is a literal.
+    bool compileNumericArith(BinaryOp* binOp, BinaryOpKind kind, int dst) {
+        static const OpCode registerForms[] = {OpCode::ADDN, OpCode::SUBN, OpCode::MULN, OpCode::DIVN, OpCode::MODN};
+        static const OpCode constantForms[] = {OpCode::ADDNK, OpCode::SUBNK, OpCode::MULNK, OpCode::DIVNK, OpCode::MODNK};
+        static const OpCode integerForms[] = {OpCode::ADDI, OpCode::SUBI, OpCode::MULI, OpCode::DIVN, OpCode::MODI};
+        static const OpCode integerConstantForms[] = {OpCode::ADDIK, OpCode::SUBIK, OpCode::MULIK, OpCode::DIVNK,
+                                                      OpCode::MODIK};
+        if (kind > BinaryOpKind::MOD) return false;
+        int form = static_cast<int>(kind) - static_cast<int>(BinaryOpKind::ADD);
+        bool integer = isInteger(binOp);  // never true for '/'
+
+        int constant = integer ? integerConstantOperand(binOp->right.get()) : kernelConstant(binOp->right.get());
+        if (constant >= 0) {
+            int left = integer ? compileToReg(binOp->left.get()) : compileNumberToReg(binOp->left.get());
+            emitABC((integer ? integerConstantForms : constantForms)[form], dst, left, constant);
+            return true;
+        }
+        int left, right;
+        compileOperandPair(binOp, left, right, !integer);
+        emitABC((integer ? integerForms : registerForms)[form], dst, left, right);
+        return true;
+    }
+
+    bool resolvesToLocal(Expression* expr) const {
+        auto id = dynamic_cast<Identifier*>(expr);
+        return id && resolveLocal(id->name) >= 0;
+    }
+
+    // dst < 0 means the result is unused.
+    void compileAssignment(Assignment* assign, int dst) {
+        int local = resolveLocal(assign->name);
+        if (local >= 0) {
+            compileInto(assign->value.get(), local);
+            if (isInteger(assign->value.get()) && !isInteger(assign)) emitABC(OpCode::ITOF, local, local, 0);
+            if (dst >= 0 && dst != local) emitABC(OpCode::MOVE, dst, local, 0);
+            return;
+        }
+
+        int savedFree = freeReg;
+        int value = dst >= 0 ? dst : allocReg();
+        compileInto(assign->value.get(), value);
+        emitABx(OpCode::SETGLOBAL, value, resolveGlobal(assign->name));
+        freeReg = savedFree;
+    }
+
+    // Compiles the arguments into the registers after a freshly allocated
+    // base. Returns whether they stay int64 for the callee's integer kernel.
+    bool compileArguments(FunctionCall* funcCall) {
+        // Integer kernels pass int64 arguments straight to integer kernels
+        bool integerCall = integers && integerKernelIndex.count(funcCall->name) > 0;
+        for (auto& arg : funcCall->args) {
+            integerCall = integerCall && isInteger(arg.get());
+        }
+        for (auto& arg : funcCall->args) {
+            int reg = allocReg();
+            if (integerCall) {
+                compileInto(arg.get(), reg);
+            } else {
+                compileNumberInto(arg.get(), reg);
+            }
+        }
+        return integerCall;
+    }
+
+    // The prototype a call to a user function enters, or -1 for builtins.
+    int calleeIndex(FunctionCall* funcCall, bool integerCall) {
+        if (integerCall) return integerKernelIndex.at(funcCall->name);
+        auto func = functionIndex.find(funcCall->name);
+        if (func == functionIndex.end()) return -1;
+        const FunctionProto& callee = module.functions[func->second];
+        if (static_cast<size_t>(callee.arity) != funcCall->args.size()) {
+            throw std::runtime_error("Compile error: Function '" + funcCall->name + "' expects " +
+                                     std::to_string(callee.arity) + " arguments, got " +
+                                     std::to_string(funcCall->args.size()));
+        }
+        // Kernels call kernels directly: their arguments are known numbers
+        return kernelMode ? kernelIndex.at(funcCall->name) : func->second;
+    }
+
+    // `wapas f(...)` marked by TailCallAnalysis. A self call moves the new
+    // arguments into the parameter registers and restarts the body, releasing
+    // the call region like a return; an integer kernel whose arguments are not all int64 and
+    // every mutual call use TAILCALL, which replaces the running frame.
+    void compileTailCall(FunctionCall* funcCall) {
+        int savedFree = freeReg;
+        int base = allocReg();
+        bool integerCall = compileArguments(funcCall);
+        int callee = calleeIndex(funcCall, integerCall);
+        if (funcCall->tailCall == TailCall::SELF && (!integers || integerCall)) {
+            for (size_t i = 0; i < funcCall->args.size(); i++) {
+                emitABC(OpCode::MOVE, static_cast<int>(i), base + 1 + static_cast<int>(i), 0);
+            }
+            emitABC(OpCode::RESTART, 0, 0, 0);
+        } else {
+            emitABx(OpCode::TAILCALL, base, callee);
+        }
+        freeReg = savedFree;
+    }
+
+    void compileCall(FunctionCall* funcCall, int dst) {
+        int savedFree = freeReg;
+        int base = allocReg();
+        bool integerCall = compileArguments(funcCall);
+
+        int callee = calleeIndex(funcCall, integerCall);
+        if (callee >= 0) {
+            emitABx(OpCode::CALL, base, callee);
+        } else {
+            BuiltinId builtin = builtinIdFor(funcCall->name);
+            if (builtin == BuiltinId::NONE) {
+                throw std::runtime_error("Compile error: Undefined function '" + funcCall->name + "'");
+            }
+            emitABC(OpCode::BUILTIN, base, static_cast<int>(builtin), static_cast<int>(funcCall->args.size()));
+        }
+        if (isInteger(funcCall)) emitABC(OpCode::FTOI, base, base, 0);
+
+        if (dst != base) emitABC(OpCode::MOVE, dst, base, 0);
+        freeReg = savedFree;
+    }
+};
+
+// ============================================================================
+// x86-64 Baseline JIT
+// ============================================================================
+
+struct JitStats {
+    std::vector<std::pair<std::string, size_t>> compiled;  // name, code bytes
+    std::vector<std::pair<std::string, std::string>> rejected;  // name, reason
+    size_t codeBytes = 0;
+    long long nativeCalls = 0;
+    long long guardFailures = 0;
+    long long stackBailouts = 0;
+};
+
+enum class JitMode {
+    OFF, ON, STATS
+};
+
+#ifdef OURLANG_JIT_X64
+
+// Shared with generated code: the native stack limit and the calls left
+// before Runtime::MAX_CALL_DEPTH, both checked in every prologue, and the
+// flag raised when either runs out.
+struct JitRuntimeState {
+    uintptr_t stackLimit;
+    int64_t callBudget;
+    uint8_t overflow;
+};
+
+JitRuntimeState jitState = {0, 0, 0};
+
+// Generated code reserves at most this much native stack below the VM.
+const size_t JIT_STACK_BUDGET = 4 * 1024 * 1024;
+
+double jitFmod(double a, double b) { return numberModulo(a, b); }
+double jitPow(double a, double b) { return std::pow(a, b); }
+double jitRound(double a) { return std::round(a); }
+
+class X64Assembler {
+private:
+    std::vector<uint8_t> code;
+
+public:
+    size_t offset() const { return code.size(); }
+    const std::vector<uint8_t>& bytes() const { return code; }
+
+    void emit(std::initializer_list<uint8_t> bs) {
+        code.insert(code.end(), bs.begin(), bs.end());
+    }
+
+    void imm32(int32_t v) {
+        for (int i = 0; i < 4; i++) code.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+
+    void imm64(uint64_t v) {
+        for (int i = 0; i < 8; i++) code.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+
+    void patch32(size_t at, int32_t v) {
+        for (int i = 0; i < 4; i++) code[at + i] = static_cast<uint8_t>(v >> (8 * i));
+    }
+
+    // Points the rel32 field at `at` to `target`.
+    void patchRel32(size_t at, size_t target) {
+        patch32(at, static_cast<int32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(at + 4)));
+    }
+
+    void prologue() { emit({0x55, 0x48, 0x89, 0xE5}); }            // push rbp; mov rbp, rsp
+    size_t subRsp() { emit({0x48, 0x81, 0xEC}); imm32(0); return offset() - 4; }
+    void leaveRet() { emit({0xC9, 0xC3}); }
+
+    void movRaxImm(uint64_t v) { emit({0x48, 0xB8}); imm64(v); }
+    void movqXmmRax(int xmm) { emit({0x66, 0x48, 0x0F, 0x6E, static_cast<uint8_t>(0xC0 | (xmm << 3))}); }
+
+    void loadConst(int xmm, double d) {
+        uint64_t bits;
+        std::memcpy(&bits, &d, sizeof(bits));
+        if (bits == 0) {
+            emit({0x66, 0x0F, 0x57, static_cast<uint8_t>(0xC0 | (xmm << 3) | xmm)});  // xorpd
+            return;
+        }
+        movRaxImm(bits);
+        movqXmmRax(xmm);
+    }
+
+    // movsd xmm, [rbp + disp]
+    void loadSlot(int xmm, int32_t disp) {
+        emit({0xF2, 0x0F, 0x10, static_cast<uint8_t>(0x85 | (xmm << 3))});
+        imm32(disp);
+    }
+
+    // movsd [rbp + disp], xmm
+    void storeSlot(int32_t disp, int xmm) {
+        emit({0xF2, 0x0F, 0x11, static_cast<uint8_t>(0x85 | (xmm << 3))});
+        imm32(disp);
+    }
+
+    // movsd xmm0, [rdi + disp]
+    void loadArg(int32_t disp) {
+        emit({0xF2, 0x0F, 0x10, 0x87});
+        imm32(disp);
+    }
+
+    // Scalar double op xmm0, xmm1 (0x58 add, 0x5C sub, 0x59 mul, 0x5E div)
+    void arith(uint8_t opcode) { emit({0xF2, 0x0F, opcode, 0xC1}); }
+    void sqrt0() { emit({0xF2, 0x0F, 0x51, 0xC0}); }
+    void max10() { emit({0xF2, 0x0F, 0x5F, 0xC8}); }          // maxsd xmm1, xmm0
+    void min10() { emit({0xF2, 0x0F, 0x5D, 0xC8}); }          // minsd xmm1, xmm0
+    void movapd01() { emit({0x66, 0x0F, 0x28, 0xC1}); }       // movapd xmm0, xmm1
+    void movapd10() { emit({0x66, 0x0F, 0x28, 0xC8}); }       // movapd xmm1, xmm0
+    void andpd01() { emit({0x66, 0x0F, 0x54, 0xC1}); }
+    void xorpd01() { emit({0x66, 0x0F, 0x57, 0xC1}); }
+    void ucomisd01() { emit({0x66, 0x0F, 0x2E, 0xC1}); }      // ucomisd xmm0, xmm1
+    void ucomisd10() { emit({0x66, 0x0F, 0x2E, 0xC8}); }      // ucomisd xmm1, xmm0
+
+    void leaRdiSlot(int32_t disp) { emit({0x48, 0x8D, 0xBD}); imm32(disp); }
+    void callRax() { emit({0xFF, 0xD0}); }
+    size_t callRel32() { emit({0xE8}); imm32(0); return offset() - 4; }
+    size_t jmpRel32() { emit({0xE9}); imm32(0); return offset() - 4; }
+    size_t jccRel32(uint8_t cc) { emit({0x0F, cc}); imm32(0); return offset() - 4; }
+
+    void callHelper(const void* fn) {
+        movRaxImm(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(fn)));
+        callRax();
+    }
+};
+
+// Condition codes for jcc rel32 (second opcode byte)
+const uint8_t JCC_JB = 0x82, JCC_JAE = 0x83, JCC_JE = 0x84, JCC_JNE = 0x85;
+const uint8_t JCC_JBE = 0x86, JCC_JA = 0x87, JCC_JNS = 0x89, JCC_JP = 0x8A;
+
+// Executable memory holding all compiled functions. Pages are written while
+// RW and flipped to RX before any code runs.
+class JitCodeBuffer {
+private:
+    void* memory;
+    size_t size;
+
+public:
+    JitCodeBuffer() : memory(nullptr), size(0) {}
+
+    ~JitCodeBuffer() {
+        if (memory) munmap(memory, size);
+    }
+
+    JitCodeBuffer(const JitCodeBuffer&) = delete;
+    JitCodeBuffer& operator=(const JitCodeBuffer&) = delete;
+
+    bool install(const std::vector<uint8_t>& code) {
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size = (code.size() + page - 1) / page * page;
+        if (size == 0) size = page;
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            memory = nullptr;
+            return false;
+        }
+        std::memcpy(memory, code.data(), code.size());
+        return mprotect(memory, size, PROT_READ | PROT_EXEC) == 0;
+    }
+
+    JitFunction entry(size_t offset) const {
+        return reinterpret_cast<JitFunction>(static_cast<uint8_t*>(memory) + offset);
+    }
+};
+
+class JitCompiler {
+private:
+    const NumericFunctionAnalysis& analysis;
+    X64Assembler as;
+    std::unordered_map<std::string, size_t> entries;
+    std::vector<std::pair<size_t, std::string>> callFixups;
+
+    // Per-function state
+    std::vector<std::vector<std::pair<std::string, int>>> scopes;
+    int nextSlot;
+    int maxSlot;
+    std::vector<size_t> exitJumps;
+    size_t bodyStart;  // first instruction after the parameters are stored
+
+public:
+    JitCompiler(const NumericFunctionAnalysis& a) : analysis(a), nextSlot(0), maxSlot(0), bodyStart(0) {}
+
+    // Compiles every numeric function into one buffer and installs the entry
+    // points on the matching bytecode prototypes.
+    void compile(BytecodeModule& module, JitCodeBuffer& buffer, JitStats& stats) {
+        std::vector<std::string> compiledNames;
+        for (const auto& name : analysis.functionNames()) {
+            if (!analysis.isNumeric(name)) {
+                stats.rejected.push_back({name, analysis.rejectionReason(name)});
+                continue;
+            }
+            size_t start = as.offset();
+            compileFunction(analysis.getFunction(name));
+            entries[name] = start;
+            compiledNames.push_back(name);
+            stats.compiled.push_back({name, as.offset() - start});
+        }
+        for (const auto& fixup : callFixups) {
+            as.patchRel32(fixup.first, entries.at(fixup.second));
+        }
+        if (compiledNames.empty() || !buffer.install(as.bytes())) return;
+        stats.codeBytes = as.offset();
+
+        for (auto& proto : module.functions) {
+            if (proto.deoptIndex >= 0) continue;  // integer kernels take int64 arguments
+            auto it = entries.find(proto.name);
+            if (it != entries.end()) proto.jitEntry = buffer.entry(it->second);
+        }
+    }
+
+private:
+    static int32_t slotDisp(int slot) {
+        return -8 * (slot + 1);
+    }
+
+    int allocSlot() {
+        int slot = nextSlot++;
+        if (nextSlot > maxSlot) maxSlot = nextSlot;
+        return slot;
+    }
+
+    int resolve(const std::string& name) const {
+        for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+            for (auto it = scope->rbegin(); it != scope->rend(); ++it) {
+                if (it->first == name) return it->second;
+            }
+        }
+        throw std::runtime_error("JIT error: unresolved local '" + name + "'");
+    }
+
+    void emitOverflowCheck() {
+        as.movRaxImm(reinterpret_cast<uintptr_t>(&jitState.overflow));
+        as.emit({0x80, 0x38, 0x00});                 // cmp byte [rax], 0
+        exitJumps.push_back(as.jccRel32(JCC_JNE));
+    }
+
+    void compileFunction(FunctionDeclaration* func) {
+        scopes.clear();
+        scopes.emplace_back();
+        nextSlot = 0;
+        maxSlot = 0;
+        exitJumps.clear();
+
+        as.prologue();
+        size_t frameSize = as.subRsp();
+
+        // Stack and depth guard: raise the overflow flag and return
+        // immediately. The budget is given back on the normal return.
+        as.movRaxImm(reinterpret_cast<uintptr_t>(&jitState.stackLimit));
+        as.emit({0x48, 0x3B, 0x20});                 // cmp rsp, [rax]
+        size_t stackLow = as.jccRel32(JCC_JB);
+        as.movRaxImm(reinterpret_cast<uintptr_t>(&jitState.callBudget));
+        as.emit({0x48, 0xFF, 0x08});                 // dec qword [rax]
+        size_t guardOk = as.jccRel32(JCC_JNS);
+        as.patchRel32(stackLow, as.offset());
+        as.movRaxImm(reinterpret_cast<uintptr_t>(&jitState.overflow));
+        as.emit({0xC6, 0x00, 0x01});                 // mov byte [rax], 1
+        as.leaveRet();
+        as.patchRel32(guardOk, as.offset());
+
+        for (size_t i = 0; i < func->params.size(); i++) {
+            int slot = allocSlot();
+            scopes.back().push_back({func->params[i], slot});
+            as.loadArg(static_cast<int32_t>(8 * i));
+            as.storeSlot(slotDisp(slot), 0);
+        }
+        bodyStart = as.offset();
+
+        compileBlock(func->body, false);
+
+        as.loadConst(0, 0.0);
+        for (size_t at : exitJumps) {
+            as.patchRel32(at, as.offset());
+        }
+        as.movRaxImm(reinterpret_cast<uintptr_t>(&jitState.callBudget));
+        as.emit({0x48, 0xFF, 0x00});                 // inc qword [rax]
+        as.leaveRet();
+        as.patch32(frameSize, (maxSlot * 8 + 15) / 16 * 16);
+    }
+
+    void compileBlock(const std::vector<std::unique_ptr<Statement>>& stmts, bool newScope) {
+        int savedSlot = nextSlot;
+        if (newScope) scopes.emplace_back();
+        for (auto& stmt : stmts) {
+            compileStatement(stmt.get());
+        }
+        if (newScope) {
+            scopes.pop_back();
+            nextSlot = savedSlot;
+        }
+    }
+
+    void compileStatement(Statement* stmt) {
+        if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt)) {
+            compileExpr(varDecl->initializer.get());
+            int slot = allocSlot();
+            as.storeSlot(slotDisp(slot), 0);
+            scopes.back().push_back({varDecl->name, slot});
+        } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt)) {
+            std::vector<size_t> falseJumps;
+            compileJumpIfFalse(ifStmt->condition.get(), falseJumps);
+            compileBlock(ifStmt->thenBranch, true);
+            if (ifStmt->elseBranch.empty()) {
+                patchHere(falseJumps);
+            } else {
+                size_t skipElse = as.jmpRel32();
+                patchHere(falseJumps);
+                compileBlock(ifStmt->elseBranch, true);
+                as.patchRel32(skipElse, as.offset());
+            }
+        } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt)) {
+            size_t top = as.offset();
+            std::vector<size_t> exits;
+            compileJumpIfFalse(loopStmt->condition.get(), exits);
+            compileBlock(loopStmt->body, true);
+            as.patchRel32(as.jmpRel32(), top);
+            patchHere(exits);
+        } else if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt)) {
+            auto funcCall = dynamic_cast<FunctionCall*>(retStmt->value.get());
+            if (funcCall && funcCall->tailCall == TailCall::SELF) {
+                compileSelfTailCall(funcCall);
+                return;
+            }
+            compileExpr(retStmt->value.get());
+            exitJumps.push_back(as.jmpRel32());
+        } else if (auto exprStmt = dynamic_cast<ExpressionStatement*>(stmt)) {
+            compileExpr(exprStmt->expr.get());
+        }
+    }
+
+    // Parameters occupy the first slots; the new arguments are computed into
+    // temporaries, copied over them, and the body starts again.
+    void compileSelfTailCall(FunctionCall* funcCall) {
+        int count = static_cast<int>(funcCall->args.size());
+        int base = nextSlot;
+        for (int i = 0; i < count; i++) allocSlot();
+        for (int i = 0; i < count; i++) {
+            compileExpr(funcCall->args[i].get());
+            as.storeSlot(slotDisp(base + i), 0);
+        }
+        for (int i = 0; i < count; i++) {
+            as.loadSlot(0, slotDisp(base + i));
+            as.storeSlot(slotDisp(i), 0);
+        }
+        nextSlot = base;
+        as.patchRel32(as.jmpRel32(), bodyStart);
+    }
+
+    void patchHere(const std::vector<size_t>& jumps) {
+        for (size_t at : jumps) {
+            as.patchRel32(at, as.offset());
+        }
+    }
+
+    // Leaves the left operand in xmm0 and the right operand in xmm1.
+    void compileOperands(Expression* left, Expression* right) {
+        compileExpr(left);
+        if (auto numLit = dynamic_cast<NumberLiteral*>(right)) {
+            as.loadConst(1, numLit->value);
+            return;
+        }
+        if (auto id = dynamic_cast<Identifier*>(right)) {
+            as.loadSlot(1, slotDisp(resolve(id->name)));
+            return;
+        }
+        int temp = allocSlot();
+        as.storeSlot(slotDisp(temp), 0);
+        compileExpr(right);
+        as.movapd10();
+        as.loadSlot(0, slotDisp(temp));
+        nextSlot--;
+    }
+
+    // Result in xmm0.
+    void compileExpr(Expression* expr) {
+        if (auto numLit = dynamic_cast<NumberLiteral*>(expr)) {
+            as.loadConst(0, numLit->value);
+        } else if (auto id = dynamic_cast<Identifier*>(expr)) {
+            as.loadSlot(0, slotDisp(resolve(id->name)));
+        } else if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            compileOperands(binOp->left.get(), binOp->right.get());
+            switch (binaryOpKind(binOp->op)) {
+                case BinaryOpKind::ADD: as.arith(0x58); break;
+                case BinaryOpKind::SUB: as.arith(0x5C); break;
+                case BinaryOpKind::MUL: as.arith(0x59); break;
+                case BinaryOpKind::DIV: as.arith(0x5E); break;
+                default: as.callHelper(reinterpret_cast<const void*>(&jitFmod)); break;
+            }
+        } else if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) {
+            compileExpr(unaryOp->operand.get());
+            as.movRaxImm(0x8000000000000000ULL);
+            as.movqXmmRax(1);
+            as.xorpd01();
+        } else if (auto assign = dynamic_cast<Assignment*>(expr)) {
+            compileExpr(assign->value.get());
+            as.storeSlot(slotDisp(resolve(assign->name)), 0);
+        } else if (auto funcCall = dynamic_cast<FunctionCall*>(expr)) {
+            compileCall(funcCall);
+        } else {
+            throw std::runtime_error("JIT error: unsupported expression");
+        }
+    }
+
+    void compileCall(FunctionCall* funcCall) {
+        if (analysis.getFunction(funcCall->name)) {
+            int count = static_cast<int>(funcCall->args.size());
+            int base = nextSlot;
+            for (int i = 0; i < count; i++) allocSlot();
+            // args[i] lives at the lowest slot address plus 8 * i
+            for (int i = 0; i < count; i++) {
+                compileExpr(funcCall->args[i].get());
+                as.storeSlot(slotDisp(base + count - 1 - i), 0);
+            }
+            as.leaRdiSlot(slotDisp(base + count - 1));
+            callFixups.push_back({as.callRel32(), funcCall->name});
+            nextSlot = base;
+            emitOverflowCheck();
+            return;
+        }
+
+        switch (builtinIdFor(funcCall->name)) {
+            case BuiltinId::ABS:
+                compileExpr(funcCall->args[0].get());
+                as.movRaxImm(0x7fffffffffffffffULL);
+                as.movqXmmRax(1);
+                as.andpd01();
+                break;
+            case BuiltinId::SQRT:
+                compileExpr(funcCall->args[0].get());
+                as.sqrt0();
+                break;
+            case BuiltinId::ROUND:
+                compileExpr(funcCall->args[0].get());
+                as.callHelper(reinterpret_cast<const void*>(&jitRound));
+                break;
+            case BuiltinId::POW:
+                compileOperands(funcCall->args[0].get(), funcCall->args[1].get());
+                as.callHelper(reinterpret_cast<const void*>(&jitPow));
+                break;
+            case BuiltinId::MAX:
+                // maxsd xmm1, xmm0 yields y > x ? y : x, matching std::max(x, y)
+                compileOperands(funcCall->args[0].get(), funcCall->args[1].get());
+                as.max10();
+                as.movapd01();
+                break;
+            case BuiltinId::MIN:
+                compileOperands(funcCall->args[0].get(), funcCall->args[1].get());
+                as.min10();
+                as.movapd01();
+                break;
+            default:
+                throw std::runtime_error("JIT error: unsupported call to '" + funcCall->name + "'");
+        }
+    }
+
+    void compileComparison(BinaryOp* binOp, bool jumpIfTrue, std::vector<size_t>& jumps) {
+        BinaryOpKind kind = binaryOpKind(binOp->op);
+        compileOperands(binOp->left.get(), binOp->right.get());
+
+        // ucomisd sets CF/ZF like an unsigned compare and PF for NaN; every
+        // ordered test below is false when either side is NaN.
+        if (kind == BinaryOpKind::LT || kind == BinaryOpKind::LE) {
+            as.ucomisd10();
+        } else {
+            as.ucomisd01();
+        }
+
+        switch (kind) {
+            case BinaryOpKind::LT:
+            case BinaryOpKind::GT:
+                jumps.push_back(as.jccRel32(jumpIfTrue ? JCC_JA : JCC_JBE));
+                break;
+            case BinaryOpKind::LE:
+            case BinaryOpKind::GE:
+                jumps.push_back(as.jccRel32(jumpIfTrue ? JCC_JAE : JCC_JB));
+                break;
+            case BinaryOpKind::EQ:
+            case BinaryOpKind::NE: {
+                bool jumpWhenEqual = (kind == BinaryOpKind::EQ) == jumpIfTrue;
+                if (jumpWhenEqual) {
+                    size_t unordered = as.jccRel32(JCC_JP);
+                    jumps.push_back(as.jccRel32(JCC_JE));
+                    as.patchRel32(unordered, as.offset());
+                } else {
+                    jumps.push_back(as.jccRel32(JCC_JP));
+                    jumps.push_back(as.jccRel32(JCC_JNE));
+                }
+                break;
+            }
+            default:
+                throw std::runtime_error("JIT error: unsupported comparison '" + binOp->op + "'");
+        }
+    }
+
+    void compileJumpIfFalse(Expression* cond, std::vector<size_t>& falseJumps) {
+        if (auto boolLit = dynamic_cast<BooleanLiteral*>(cond)) {
+            if (!boolLit->value) falseJumps.push_back(as.jmpRel32());
+            return;
+        }
+        if (auto unaryOp = dynamic_cast<UnaryOp*>(cond)) {
+            compileJumpIfTrue(unaryOp->operand.get(), falseJumps);
+            return;
+        }
+        auto binOp = static_cast<BinaryOp*>(cond);
+        BinaryOpKind kind = binaryOpKind(binOp->op);
+        if (kind == BinaryOpKind::AND) {
+            compileJumpIfFalse(binOp->left.get(), falseJumps);
+            compileJumpIfFalse(binOp->right.get(), falseJumps);
+        } else if (kind == BinaryOpKind::OR) {
+            std::vector<size_t> trueJumps;
+            compileJumpIfTrue(binOp->left.get(), trueJumps);
+            compileJumpIfFalse(binOp->right.get(), falseJumps);
+            patchHere(trueJumps);
+        } else {
+            compileComparison(binOp, false, falseJumps);
+        }
+    }
+
+    void compileJumpIfTrue(Expression* cond, std::vector<size_t>& trueJumps) {
+        if (auto boolLit = dynamic_cast<BooleanLiteral*>(cond)) {
+            if (boolLit->value) trueJumps.push_back(as.jmpRel32());
+            return;
+        }
+        if (auto unaryOp = dynamic_cast<UnaryOp*>(cond)) {
+            compileJumpIfFalse(unaryOp->operand.get(), trueJumps);
+            return;
+        }
+        auto binOp = static_cast<BinaryOp*>(cond);
+        BinaryOpKind kind = binaryOpKind(binOp->op);
+        if (kind == BinaryOpKind::OR) {
+            compileJumpIfTrue(binOp->left.get(), trueJumps);
+            compileJumpIfTrue(binOp->right.get(), trueJumps);
+        } else if (kind == BinaryOpKind::AND) {
+            std::vector<size_t> falseJumps;
+            compileJumpIfFalse(binOp->left.get(), falseJumps);
+            compileJumpIfTrue(binOp->right.get(), trueJumps);
+            patchHere(falseJumps);
+        } else {
+            compileComparison(binOp, true, trueJumps);
+        }
+    }
+};
+
+#endif // OURLANG_JIT_X64
+
+void printJitStats(const JitStats& stats, std::ostream& out) {
+    out << "\n--- JIT Statistics ---" << std::endl;
+#ifndef OURLANG_JIT_X64
+    out << "JIT unavailable in this build; all code ran on the bytecode VM" << std::endl;
+#endif
+    out << "Compiled functions: " << stats.compiled.size() << " (" << stats.codeBytes << " bytes)" << std::endl;
+    for (const auto& entry : stats.compiled) {
+        out << "  " << entry.first << ": " << entry.second << " bytes" << std::endl;
+    }
+    out << "Interpreted functions: " << stats.rejected.size() << std::endl;
+    for (const auto& entry : stats.rejected) {
+        out << "  " << entry.first << ": " << entry.second << std::endl;
+    }
+    out << "Native calls: " << stats.nativeCalls << std::endl;
+    out << "Guard fallbacks (non-number arguments): " << stats.guardFailures << std::endl;
+    out << "Stack bailouts: " << stats.stackBailouts << std::endl;
+}
+
+// ============================================================================
+// Bytecode Virtual Machine
+// ============================================================================
+
+// GCC and Clang support labels-as-values, which lets every handler jump
+// straight to the next one. Other compilers use the portable switch loop.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(OURLANG_NO_COMPUTED_GOTO)
+#define OURLANG_COMPUTED_GOTO 1
+#endif
+
+class VM : private Heap::RootSet {
+private:
+    struct CallFrame {
+        const FunctionProto* proto;
+        const uint32_t* pc;
+        size_t base;
+        size_t returnSlot;
+        size_t regionMark;  // released when the frame returns or tail-calls
+        MemoTable* memo;    // receives the result of a memoized call that missed
+    };
+
+    Runtime& runtime;
+    const BytecodeModule& module;
+    std::vector<Value> globals;
+    std::vector<Value> stack;
+    std::vector<CallFrame> frames;
+    JitStats* jitStats;
+    size_t jitBailoutDepth;
+    std::vector<MemoTable*> memoTables;  // by function index; empty unless memoizing
+    ParallelLoopRunner* parallelLoops;   // runs PARLOOP loops; null runs them sequentially
+    // Slot map of each prototype: how many of its registers the collector
+    // reads. Kernels hold only numbers, and integer kernels hold int64
+    // values that could pass for pointers, so theirs are empty.
+    std::vector<int> referenceSlots;
+
+    static constexpr size_t MAX_FRAMES = Runtime::MAX_CALL_DEPTH;
+    // After native code runs out of stack, this many deeper frames stay
+    // interpreted before native calls are tried again.
+    static constexpr size_t JIT_RETRY_FRAMES = 1024;
+
+public:
+    VM(Runtime& rt, const BytecodeModule& mod, JitStats* jit = nullptr)
+        : runtime(rt), module(mod), globals(mod.globalNames.size()), stack(1024),
+          jitStats(jit), jitBailoutDepth(MAX_FRAMES), parallelLoops(nullptr) {
+        for (const FunctionProto& proto : module.functions) referenceSlots.push_back(proto.frameSize);
+        for (const FunctionProto& proto : module.functions) {
+            if (proto.kernelIndex >= 0) referenceSlots[proto.kernelIndex] = 0;
+            if (proto.integerKernelIndex >= 0) referenceSlots[proto.integerKernelIndex] = 0;
+        }
+        runtime.heap.addRoots(this);
+    }
+
+    ~VM() {
+        runtime.heap.removeRoots(this);
+    }
+
+    // Caches the results of calls to functions the compiler marked
+    // memoizable (--memoize=auto). A function and its kernels share a table.
+    void enableMemoization() {
+        memoTables.assign(module.functions.size(), nullptr);
+        for (size_t i = 0; i < module.functions.size(); i++) {
+            const FunctionProto& proto = module.functions[i];
+            if (!proto.memoizable) continue;
+            MemoTable* table = runtime.addMemoTable(proto.name, proto.arity);
+            memoTables[i] = table;
+            if (proto.kernelIndex >= 0) memoTables[proto.kernelIndex] = table;
+            if (proto.integerKernelIndex >= 0) memoTables[proto.integerKernelIndex] = table;
+        }
+    }
+
+    // Lets PARLOOP hand loops to `runner` (--parallel).
+    void enableParallelLoops(ParallelLoopRunner* runner) {
+        parallelLoops = runner;
+    }
+
+    static const char* dispatchMode() {
+#ifdef OURLANG_COMPUTED_GOTO
+        return "computed goto";
+#else
+        return "switch";
+#endif
+    }
+
+    // Runs the top-level code, then enters kaam main().
+    void run() {
+#ifdef OURLANG_JIT_X64
+        jitState.stackLimit = reinterpret_cast<uintptr_t>(__builtin_frame_address(0)) - JIT_STACK_BUDGET;
+        jitState.overflow = 0;
+#endif
+        try {
+            execute(&module.functions[module.topLevelIndex], 0);
+            if (module.mainIndex < 0) {
+                throw std::runtime_error("Runtime error: Main function 'kaam main()' not found");
+            }
+            execute(&module.functions[module.mainIndex], 0);
+        } catch (const ProgramExit&) {
+            // band() ends the program normally
+        }
+        runtime.out.flush();
+    }
+
+private:
+    // Each stack slot belongs to the deepest frame whose registers cover it;
+    // the registers above a call's base are dead in the caller. Frames
+    // start at or below the end of their caller's registers, so the frames
+    // above a frame cover one run of slots, from the next frame's base to
+    // `covered`.
+    void visitRoots(const std::function<void(Value&)>& visit) override {
+        for (Value& global : globals) visit(global);
+        size_t covered = 0;
+        for (size_t i = frames.size(); i-- > 0;) {
+            const CallFrame& frame = frames[i];
+            size_t end = frame.base + referenceSlots[frame.proto - module.functions.data()];
+            size_t next = i + 1 < frames.size() ? frames[i + 1].base : end;
+            for (size_t slot = frame.base; slot < std::min(next, end); slot++) visit(stack[slot]);
+            for (size_t slot = std::max(covered, frame.base); slot < end; slot++) visit(stack[slot]);
+            covered = std::max(covered, frame.base + frame.proto->frameSize);
+        }
+    }
+
+    // Looks up a call to a memoized function, true on a hit with the cached
+    // result in `result`. A miss pushes the key for RETURN to complete; a call
+    // the table does not take clears `memo`. Integer kernels receive int64
+    // arguments, keyed as the numbers they stand for.
+    bool memoHit(MemoTable*& memo, const FunctionProto* callee, const Value* args, Value& result) {
+        Value numbers[MemoTable::MAX_ARGS];
+        if (callee->deoptIndex >= 0) {
+            for (int i = 0; i < callee->arity; i++) {
+                numbers[i] = Value::number(static_cast<double>(args[i].asInteger()));
+            }
+            args = numbers;
+        }
+        if (!memo->accepts(args, callee->arity)) {
+            memo = nullptr;
+            return false;
+        }
+        if (memo->lookup(args, result)) return true;
+        memo->begin(args);
+        return false;
+    }
+
+#ifdef OURLANG_JIT_X64
+    // Runs a compiled function when every argument is a number. Returns false
+    // when the interpreter must take the call instead; numeric functions have
+    // no side effects, so a call abandoned halfway can simply be repeated.
+    bool callNative(const FunctionProto* callee, Value* args) {
+        size_t depth = frames.size();
+        if (depth >= jitBailoutDepth && depth < jitBailoutDepth + JIT_RETRY_FRAMES) {
+            return false;
+        }
+        for (int i = 0; i < callee->arity; i++) {
+            if (!args[i + 1].isNumber()) {
+                jitStats->guardFailures++;
+                return false;
+            }
+        }
+        jitState.callBudget = static_cast<int64_t>(MAX_FRAMES - depth);
+        double result = callee->jitEntry(reinterpret_cast<const double*>(args + 1));
+        if (jitState.overflow) {
+            jitState.overflow = 0;
+            jitBailoutDepth = depth;
+            jitStats->stackBailouts++;
+            return false;
+        }
+        args[0] = Value::number(result);
+        jitStats->nativeCalls++;
+        return true;
+    }
+#endif
+
+    static bool numberArguments(const Value* args, int count) {
+        for (int i = 0; i < count; i++) {
+            if (!args[i].isNumber()) return false;
+        }
+        return true;
+    }
+
+    // Converts the arguments to int64 for an integer kernel when every one
+    // is an exact integer; otherwise leaves them untouched.
+    static bool integerArguments(Value* args, int count) {
+        for (int i = 0; i < count; i++) {
+            if (!isExactInteger(args[i].asNumber())) return false;
+        }
+        for (int i = 0; i < count; i++) {
+            args[i] = Value::integer(static_cast<int64_t>(args[i].asNumber()));
+        }
+        return true;
+    }
+
+    // The prototype a call enters: a kernel when every argument qualifies.
+    const FunctionProto* entryFor(const FunctionProto* callee, Value* args) const {
+        if (callee->kernelIndex >= 0 && numberArguments(args, callee->arity)) {
+            if (callee->integerKernelIndex >= 0 && integerArguments(args, callee->arity)) {
+                return &module.functions[callee->integerKernelIndex];
+            }
+            return &module.functions[callee->kernelIndex];
+        }
+        return callee;
+    }
+
+    // Integer kernels leave int64 values in their registers, which the
+    // frames below read as their own once the kernel returns.
+    static void clearRegisters(Value* registers, int count) {
+        std::fill(registers, registers + count, Value::nil());
+    }
+
+    void ensureStack(size_t needed) {
+        if (needed > stack.size()) {
+            stack.resize(std::max(needed, stack.size() * 2));
+        }
+    }
+
+    Value execute(const FunctionProto* entry, size_t base) {
+        size_t entryDepth = frames.size();
+        ensureStack(base + entry->frameSize);
+        for (int i = entry->arity; i < entry->frameSize; i++) {
+            stack[base + i] = Value::nil();
+        }
+        frames.push_back({entry, entry->instructions(), base, 0, runtime.heap.regionMark(), nullptr});
+
+        CallFrame* frame = &frames.back();
+        const uint32_t* pc = frame->pc;
+        Value* R = stack.data() + base;
+        const Value* K = entry->constants.data();
+        uint32_t instr;
+
+        try {
+#ifdef OURLANG_COMPUTED_GOTO
+        static void* const dispatchTable[] = {
+#define OURLANG_OPCODE_LABEL(name) &&op_##name,
+            OURLANG_OPCODES(OURLANG_OPCODE_LABEL)
+#undef OURLANG_OPCODE_LABEL
+        };
+#define VM_DISPATCH() do { instr = *pc++; goto *dispatchTable[instr & 0xff]; } while (0)
+#define VM_CASE(name) op_##name:
+        VM_DISPATCH();
+#else
+#define VM_DISPATCH() goto dispatch
+#define VM_CASE(name) case OpCode::name:
+    dispatch:
+        instr = *pc++;
+        switch (instrOp(instr)) {
+#endif
+
+#define VM_ARITH(name, kind, expr)                                           \
+        VM_CASE(name) {                                                      \
+            Value b = R[instrB(instr)], c = R[instrC(instr)];                \
+            if (b.isNumber() && c.isNumber()) {                              \
+                double x = b.asNumber(), y = c.asNumber();                   \
+                R[instrA(instr)] = expr;                                     \
+            } else {                                                         \
+                R[instrA(instr)] = runtime.binary(BinaryOpKind::kind, b, c); \
+            }                                                                \
+            VM_DISPATCH();                                                   \
+        }
+
+        VM_CASE(LOADK) {
+            R[instrA(instr)] = K[instrBx(instr)];
+            VM_DISPATCH();
+        }
+        VM_CASE(LOADKX) {
+            R[instrA(instr)] = K[*pc++];
+            VM_DISPATCH();
+        }
+        VM_CASE(LOADNIL) {
+            R[instrA(instr)] = Value::nil();
+            VM_DISPATCH();
+        }
+        VM_CASE(LOADBOOL) {
+            R[instrA(instr)] = Value::boolean(instrB(instr) != 0);
+            VM_DISPATCH();
+        }
+        VM_CASE(MOVE) {
+            R[instrA(instr)] = R[instrB(instr)];
+            VM_DISPATCH();
+        }
+        VM_CASE(GETGLOBAL) {
+            R[instrA(instr)] = globals[instrBx(instr)];
+            VM_DISPATCH();
+        }
+        VM_CASE(SETGLOBAL) {
+            globals[instrBx(instr)] = R[instrA(instr)];
+            VM_DISPATCH();
+        }
+
+        VM_ARITH(ADD, ADD, Value::number(x + y))
+        VM_ARITH(SUB, SUB, Value::number(x - y))
+        VM_ARITH(MUL, MUL, Value::number(x * y))
+        VM_ARITH(DIV, DIV, Value::number(x / y))
+        VM_ARITH(MOD, MOD, Value::number(numberModulo(x, y)))
+        VM_ARITH(EQ, EQ, Value::boolean(x == y))
+        VM_ARITH(NE, NE, Value::boolean(x != y))
+        VM_ARITH(LT, LT, Value::boolean(x < y))
+        VM_ARITH(LE, LE, Value::boolean(x <= y))
+        VM_ARITH(GT, GT, Value::boolean(x > y))
+        VM_ARITH(GE, GE, Value::boolean(x >= y))
+
+        VM_CASE(NOT) {
+            R[instrA(instr)] = Value::boolean(!runtime.isTruthy(R[instrB(instr)]));
+            VM_DISPATCH();
+        }
+        VM_CASE(NEG) {
+            R[instrA(instr)] = runtime.negate(R[instrB(instr)]);
+            VM_DISPATCH();
+        }
+        VM_CASE(JMP) {
+            pc += instrSAx(instr);
+            if (instrSAx(instr) < 0) runtime.heap.safepoint();
+            VM_DISPATCH();
+        }
+        VM_CASE(JMPIFNOT) {
+            if (!runtime.isTruthy(R[instrA(instr)])) pc += instrSBx(instr);
+            VM_DISPATCH();
+        }
+        VM_CASE(JMPIF) {
+            if (runtime.isTruthy(R[instrA(instr)])) pc += instrSBx(instr);
+            VM_DISPATCH();
+        }
+        VM_CASE(PARLOOP) {
+            const ParallelLoop& loop = frame->proto->parallelLoops[instrBx(instr)];
+            if (parallelLoops && parallelLoops->run(loop, frame->proto, R, R[instrA(instr)], globals)) {
+                pc = frame->proto->instructions() + loop.exit;
+            }
+            VM_DISPATCH();
+        }
+        VM_CASE(CALL) {
+            const FunctionProto* callee = &module.functions[instrBx(instr)];
+            MemoTable* memo = memoTables.empty() ? nullptr : memoTables[instrBx(instr)];
+            if (memo && memoHit(memo, callee, &R[instrA(instr) + 1], R[instrA(instr)])) {
+                VM_DISPATCH();
+            }
+#ifdef OURLANG_JIT_X64
+            // Native code would make its recursive calls past the table
+            if (!memo && callee->jitEntry && callNative(callee, &R[instrA(instr)])) {
+                VM_DISPATCH();
+            }
+#endif
+            callee = entryFor(callee, &R[instrA(instr) + 1]);
+            size_t newBase = frame->base + instrA(instr) + 1;
+            if (frames.size() >= MAX_FRAMES) {
+                throw std::runtime_error("Runtime error: Maximum call depth exceeded in '" + callee->name + "'");
+            }
+            frame->pc = pc;
+            ensureStack(newBase + callee->frameSize);
+            R = stack.data() + newBase;
+            for (int i = callee->arity; i < callee->frameSize; i++) {
+                R[i] = Value::nil();
+            }
+            frames.push_back({callee, callee->instructions(), newBase, newBase - 1, runtime.heap.regionMark(), memo});
+            frame = &frames.back();
+            pc = frame->pc;
+            K = callee->constants.data();
+            runtime.heap.safepoint();
+            VM_DISPATCH();
+        }
+        VM_CASE(RESTART) {
+            // A self tail call: the parameters already hold the new arguments
+            runtime.heap.releaseRegion(frame->regionMark);
+            pc = frame->proto->instructions();
+            runtime.heap.safepoint();
+            VM_DISPATCH();
+        }
+        VM_CASE(TAILCALL) {
+            // The callee takes over this frame: its arguments become the
+            // parameters and its result is returned to our caller.
+            const FunctionProto* callee = entryFor(&module.functions[instrBx(instr)], &R[instrA(instr) + 1]);
+            const Value* args = &R[instrA(instr) + 1];
+            runtime.heap.releaseRegion(frame->regionMark);
+            for (int i = 0; i < callee->arity; i++) {
+                R[i] = args[i];
+            }
+            ensureStack(frame->base + callee->frameSize);
+            R = stack.data() + frame->base;
+            for (int i = callee->arity; i < callee->frameSize; i++) {
+                R[i] = Value::nil();
+            }
+            frame->proto = callee;
+            pc = callee->instructions();
+            K = callee->constants.data();
+            runtime.heap.safepoint();
+            VM_DISPATCH();
+        }
+        VM_CASE(BUILTIN) {
+            int a = instrA(instr);
+            frame->pc = pc;
+            Value result = runtime.callBuiltin(static_cast<BuiltinId>(instrB(instr)), &R[a + 1], instrC(instr));
+            R[a] = result;
+            VM_DISPATCH();
+        }
+        VM_CASE(NEWARRAY) {
+            ArrayObject* array = runtime.heap.allocate<ArrayObject>();
+            array->elements.reserve(instrBx(instr));
+            R[instrA(instr)] = Value::object(array);
+            VM_DISPATCH();
+        }
+        VM_CASE(NEWARRAYR) {
+            ArrayObject* array = runtime.heap.allocateInRegion<ArrayObject>();
+            array->elements.reserve(instrBx(instr));
+            R[instrA(instr)] = Value::object(array);
+            VM_DISPATCH();
+        }
+        VM_CASE(APPEND) {
+            auto array = static_cast<ArrayObject*>(R[instrA(instr)].asObject());
+            array->append(R[instrB(instr)]);
+            runtime.heap.writeBarrier(array, R[instrB(instr)]);
+            VM_DISPATCH();
+        }
+        VM_CASE(NEWARRAYK) {
+            R[instrA(instr)] = runtime.packedArray(*frame->proto->packedArrays[instrBx(instr)], false);
+            VM_DISPATCH();
+        }
+        VM_CASE(NEWARRAYKR) {
+            R[instrA(instr)] = runtime.packedArray(*frame->proto->packedArrays[instrBx(instr)], true);
+            VM_DISPATCH();
+        }
+        VM_CASE(NEWOBJECT) {
+            const Shape* shape = frame->proto->shapes[instrBx(instr)];
+            R[instrA(instr)] = Value::object(runtime.heap.allocate<RecordObject>(shape));
+            VM_DISPATCH();
+        }
+        VM_CASE(NEWOBJECTR) {
+            const Shape* shape = frame->proto->shapes[instrBx(instr)];
+            R[instrA(instr)] = Value::object(runtime.heap.allocateInRegion<RecordObject>(shape));
+            VM_DISPATCH();
+        }
+        VM_CASE(INITMEMBER) {
+            auto record = static_cast<RecordObject*>(R[instrA(instr)].asObject());
+            record->slots[*pc++] = R[instrB(instr)];
+            runtime.heap.writeBarrier(record, R[instrB(instr)]);
+            VM_DISPATCH();
+        }
+        // A hit in the first cache entry is one shape compare and a slot
+        // load; anything else goes through the whole cache.
+        VM_CASE(GETMEMBER) {
+            const MemberSite& site = frame->proto->memberSites[*pc++];
+            Value object = R[instrB(instr)];
+            if (object.isRecord()) {
+                auto record = static_cast<RecordObject*>(object.asObject());
+                if (record->shape == site.cache.shapes[0]) {
+                    R[instrA(instr)] = record->slots[site.cache.slots[0]];
+                    VM_DISPATCH();
+                }
+            }
+            R[instrA(instr)] = runtime.member(object, site.key, site.cache, site.objectName);
+            VM_DISPATCH();
+        }
+        VM_CASE(SETMEMBER) {
+            const MemberSite& site = frame->proto->memberSites[*pc++];
+            Value object = R[instrA(instr)];
+            if (object.isRecord()) {
+                auto record = static_cast<RecordObject*>(object.asObject());
+                if (record->shape == site.cache.shapes[0]) {
+                    record->slots[site.cache.slots[0]] = R[instrB(instr)];
+                    runtime.heap.writeBarrier(record, R[instrB(instr)]);
+                    VM_DISPATCH();
+                }
+            }
+            runtime.setMember(object, site.key, site.cache, site.objectName, R[instrB(instr)]);
+            VM_DISPATCH();
+        }
+        VM_CASE(INDEX) {
+            const std::string& name = frame->proto->indexNames[*pc++];
+            R[instrA(instr)] = runtime.index(R[instrB(instr)], R[instrC(instr)], name);
+            VM_DISPATCH();
+        }
+        VM_CASE(SETINDEX) {
+            const std::string& name = frame->proto->indexNames[*pc++];
+            runtime.setIndex(R[instrA(instr)], R[instrB(instr)], R[instrC(instr)], name);
+            VM_DISPATCH();
+        }
+        VM_CASE(RETURN) {
+            Value result = R[instrA(instr)];
+            size_t slot = frame->returnSlot;
+            if (frame->proto->deoptIndex >= 0) clearRegisters(R, frame->proto->frameSize);
+            runtime.heap.releaseRegion(frame->regionMark);
+            if (frame->memo) frame->memo->finish(result);
+            frames.pop_back();
+            if (frames.size() == entryDepth) return result;
+            frame = &frames.back();
+            stack[slot] = result;
+            pc = frame->pc;
+            R = stack.data() + frame->base;
+            K = frame->proto->constants.data();
+            VM_DISPATCH();
+        }
+        VM_CASE(RETURNNIL) {
+            size_t slot = frame->returnSlot;
+            if (frame->proto->deoptIndex >= 0) clearRegisters(R, frame->proto->frameSize);
+            runtime.heap.releaseRegion(frame->regionMark);
+            if (frame->memo) frame->memo->finish(Value::nil());
+            frames.pop_back();
+            if (frames.size() == entryDepth) return Value::nil();
+            frame = &frames.back();
+            stack[slot] = Value::nil();
+            pc = frame->pc;
+            R = stack.data() + frame->base;
+            K = frame->proto->constants.data();
+            VM_DISPATCH();
+        }
+
+        // Numeric kernel instructions: operands are proven numbers
+#define VM_ARITH_NUMBER(name, expr)                                          \
+        VM_CASE(name) {                                                      \
+            double x = R[instrB(instr)].asNumber(), y = R[instrC(instr)].asNumber(); \
+            R[instrA(instr)] = Value::number(expr);                          \
+            VM_DISPATCH();                                                   \
+        }
+#define VM_TEST_NUMBER(name, op)                                             \
+        VM_CASE(name) {                                                      \
+            bool result = R[instrA(instr)].asNumber() op R[instrB(instr)].asNumber(); \
+            if (result == (instrC(instr) != 0)) pc++;                        \
+            VM_DISPATCH();                                                   \
+        }
+#define VM_ARITH_NUMBER_K(name, expr)                                        \
+        VM_CASE(name) {                                                      \
+            double x = R[instrB(instr)].asNumber(), y = K[instrC(instr)].asNumber(); \
+            R[instrA(instr)] = Value::number(expr);                          \
+            VM_DISPATCH();                                                   \
+        }
+#define VM_TEST_NUMBER_K(name, op)                                           \
+        VM_CASE(name) {                                                      \
+            bool result = R[instrA(instr)].asNumber() op K[instrB(instr)].asNumber(); \
+            if (result == (instrC(instr) != 0)) pc++;                        \
+            VM_DISPATCH();                                                   \
+        }
+
+        VM_ARITH_NUMBER(ADDN, x + y)
+        VM_ARITH_NUMBER(SUBN, x - y)
+        VM_ARITH_NUMBER(MULN, x * y)
+        VM_ARITH_NUMBER(DIVN, x / y)
+        VM_ARITH_NUMBER(MODN, numberModulo(x, y))
+        VM_CASE(NEGN) {
+            R[instrA(instr)] = Value::number(-R[instrB(instr)].asNumber());
+            VM_DISPATCH();
+        }
+        VM_TEST_NUMBER(EQN, ==)
+        VM_TEST_NUMBER(LTN, <)
+        VM_TEST_NUMBER(LEN, <=)
+        VM_ARITH_NUMBER_K(ADDNK, x + y)
+        VM_ARITH_NUMBER_K(SUBNK, x - y)
+        VM_ARITH_NUMBER_K(MULNK, x * y)
+        VM_ARITH_NUMBER_K(DIVNK, x / y)
+        VM_ARITH_NUMBER_K(MODNK, numberModulo(x, y))
+        VM_TEST_NUMBER_K(EQNK, ==)
+        VM_TEST_NUMBER_K(LTNK, <)
+        VM_TEST_NUMBER_K(LENK, <=)
+        VM_TEST_NUMBER_K(GTNK, >)
+        VM_TEST_NUMBER_K(GENK, >=)
+#undef VM_ARITH_NUMBER
+#undef VM_TEST_NUMBER
+#undef VM_ARITH_NUMBER_K
+#undef VM_TEST_NUMBER_K
+
+        // Integer kernel instructions: operands are int64
+#define VM_ARITH_INTEGER(name, operand, check)                               \
+        VM_CASE(name) {                                                      \
+            int64_t r;                                                       \
+            if (!check(R[instrB(instr)].asInteger(), operand[instrC(instr)].asInteger(), r)) goto deoptimize; \
+            R[instrA(instr)] = Value::integer(r);                            \
+            VM_DISPATCH();                                                   \
+        }
+#define VM_TEST_INTEGER(name, operand, op)                                   \
+        VM_CASE(name) {                                                      \
+            bool result = R[instrA(instr)].asInteger() op operand[instrB(instr)].asInteger(); \
+            if (result == (instrC(instr) != 0)) pc++;                        \
+            VM_DISPATCH();                                                   \
+        }
+
+        VM_ARITH_INTEGER(ADDI, R, kernelAdd)
+        VM_ARITH_INTEGER(SUBI, R, kernelSubtract)
+        VM_ARITH_INTEGER(MULI, R, kernelMultiply)
+        VM_ARITH_INTEGER(MODI, R, kernelModulo)
+        VM_ARITH_INTEGER(ADDIK, K, kernelAdd)
+        VM_ARITH_INTEGER(SUBIK, K, kernelSubtract)
+        VM_ARITH_INTEGER(MULIK, K, kernelMultiply)
+        VM_ARITH_INTEGER(MODIK, K, kernelModulo)
+        VM_CASE(NEGI) {
+            int64_t r;
+            if (!kernelNegate(R[instrB(instr)].asInteger(), r)) goto deoptimize;
+            R[instrA(instr)] = Value::integer(r);
+            VM_DISPATCH();
+        }
+        VM_CASE(ITOF) {
+            R[instrA(instr)] = Value::number(static_cast<double>(R[instrB(instr)].asInteger()));
+            VM_DISPATCH();
+        }
+        VM_CASE(FTOI) {
+            double d = R[instrB(instr)].asNumber();
+            if (!isExactInteger(d)) goto deoptimize;
+            R[instrA(instr)] = Value::integer(static_cast<int64_t>(d));
+            VM_DISPATCH();
+        }
+        VM_TEST_INTEGER(EQI, R, ==)
+        VM_TEST_INTEGER(LTI, R, <)
+        VM_TEST_INTEGER(LEI, R, <=)
+        VM_TEST_INTEGER(EQIK, K, ==)
+        VM_TEST_INTEGER(LTIK, K, <)
+        VM_TEST_INTEGER(LEIK, K, <=)
+        VM_TEST_INTEGER(GTIK, K, >)
+        VM_TEST_INTEGER(GEIK, K, >=)
+#undef VM_ARITH_INTEGER
+#undef VM_TEST_INTEGER
+
+        // An integer kernel produced a value int64 cannot mirror exactly:
+        // restart the call from its first instruction in the numeric kernel.
+        // The parameters were never assigned, so they still hold the
+        // arguments.
+    deoptimize: {
+            const FunctionProto* fallback = &module.functions[frame->proto->deoptIndex];
+            for (int i = 0; i < fallback->arity; i++) {
+                R[i] = Value::number(static_cast<double>(R[i].asInteger()));
+            }
+            clearRegisters(R + fallback->arity, frame->proto->frameSize - fallback->arity);
+            ensureStack(frame->base + fallback->frameSize);
+            R = stack.data() + frame->base;
+            frame->proto = fallback;
+            pc = fallback->instructions();
+            K = fallback->constants.data();
+            VM_DISPATCH();
+        }
+
+#ifndef OURLANG_COMPUTED_GOTO
+        }
+        throw std::runtime_error("Runtime error: invalid opcode");
+#endif
+        } catch (const LocatedRuntimeError&) {
+            throw;
+        } catch (const std::runtime_error& e) {
+            // Point the error at the source line of the failing instruction
+            int line = frame->proto->lineAt(static_cast<size_t>(pc - 1 - frame->proto->instructions()));
+            if (line <= 0) throw;
+            throw locatedAt(e, line);
+        }
+#undef VM_ARITH
+#undef VM_CASE
+#undef VM_DISPATCH
+    }
+};
+
+// ============================================================================
+// Closure Compiler
+// ============================================================================
+
+// Each AST node is converted once into a pre-bound C++ closure. Operator kind,
+// variable slot, callee and builtin ID are fixed when the closure is built, so
+// execution is a tree of indirect calls with no dispatch on the node type.
+struct ClosureFunction;
+
+struct ClosureFrame {
+    Value* slots;
+    Value returnValue;
+    const ClosureFunction* function;  // the body running in this frame
+    Heap& heap;
+    size_t regionMark;                // released on return and on each tail call
+    ClosureFrame* caller;             // the frames are the collector's roots
+};
+
+// TAIL_CALL unwinds to invoke(), which runs frame.function again with its
+// arguments already in the slots.
+enum class ClosureFlow {
+    NORMAL, RETURN, TAIL_CALL
+};
+
+using ClosureExpr = std::function<Value(ClosureFrame&)>;
+using ClosureCond = std::function<bool(ClosureFrame&)>;
+using ClosureStmt = std::function<ClosureFlow(ClosureFrame&)>;
+
+struct ClosureFunction {
+    std::string name;
+    int arity = 0;
+    int frameSize = 0;
+    ClosureStmt body;
+    MemoTable* memo = nullptr;  // set for functions run with --memoize=auto
+};
+
+template <BinaryOpKind K>
+inline Value applyBinary(Runtime& runtime, Value a, Value b) {
+    if (a.isNumber() && b.isNumber()) {
+        double x = a.asNumber(), y = b.asNumber();
+        switch (K) {
+            case BinaryOpKind::ADD: return Value::number(x + y);
+            case BinaryOpKind::SUB: return Value::number(x - y);
+            case BinaryOpKind::MUL: return Value::number(x * y);
+            case BinaryOpKind::DIV: return Value::number(x / y);
+            case BinaryOpKind::MOD: return Value::number(numberModulo(x, y));
+            case BinaryOpKind::EQ: return Value::boolean(x == y);
+            case BinaryOpKind::NE: return Value::boolean(x != y);
+            case BinaryOpKind::LT: return Value::boolean(x < y);
+            case BinaryOpKind::LE: return Value::boolean(x <= y);
+            case BinaryOpKind::GT: return Value::boolean(x > y);
+            case BinaryOpKind::GE: return Value::boolean(x >= y);
+            default: break;
+        }
+    }
+    return runtime.binary(K, a, b);
+}
+
+// Operand readers let the common shapes (local slot, constant) skip a nested
+// closure call entirely.
+struct SlotOperand {
+    int slot;
+    Value operator()(ClosureFrame& f) const { return f.slots[slot]; }
+};
+
+struct ConstOperand {
+    Value value;
+    Value operator()(ClosureFrame&) const { return value; }
+};
+
+struct ExprOperand {
+    ClosureExpr fn;
+    Value operator()(ClosureFrame& f) const { return fn(f); }
+};
+
+class ClosureCompiler {
+private:
+    Runtime& runtime;
+    std::vector<Value>& globals;
+    std::unordered_map<std::string, int> globalIndex;
+    std::unordered_map<std::string, ClosureFunction*> functionTable;
+    std::vector<std::unique_ptr<ClosureFunction>>& functions;
+    std::vector<std::pair<ClosureFunction*, ClosureFunction*>> tailCalls;  // caller -> callee
+
+    // Per-function state
+    ClosureFunction* current;
+    std::vector<std::vector<std::pair<std::string, int>>> scopes;
+    int nextSlot;
+    bool atTopLevel;
+
+    static constexpr int INLINE_FRAME_SLOTS = 16;
+
+public:
+    static inline int callDepth = 0;
+    static inline ClosureFrame* topFrame = nullptr;
+
+    ClosureCompiler(Runtime& rt, std::vector<Value>& globalSlots,
+                    std::vector<std::unique_ptr<ClosureFunction>>& functionStore)
+        : runtime(rt), globals(globalSlots), functions(functionStore),
+          current(nullptr), nextSlot(0), atTopLevel(false) {}
+
+    // Builds closures for every function and returns the top-level code.
+    ClosureFunction* compile(Program* program) {
+        std::vector<FunctionDeclaration*> declarations;
+        collectFunctions(program->statements, declarations);
+        for (auto* decl : declarations) {
+            functions.push_back(std::make_unique<ClosureFunction>());
+            functions.back()->name = decl->name;
+            functions.back()->arity = static_cast<int>(decl->params.size());
+            functionTable[decl->name] = functions.back().get();
+        }
+        for (auto& stmt : program->statements) {
+            if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt.get())) {
+                if (globalIndex.find(varDecl->name) == globalIndex.end()) {
+                    globalIndex[varDecl->name] = static_cast<int>(globals.size());
+                    globals.push_back(Value::nil());
+                }
+            }
+        }
+
+        for (size_t i = 0; i < declarations.size(); i++) {
+            beginFunction(functions[i].get(), false);
+            for (const auto& param : declarations[i]->params) {
+                declareLocal(param);
+            }
+            current->body = compileSequence(declarations[i]->body);
+        }
+
+        // A tail call runs the callee in the caller's slots, so a frame must
+        // fit every function its tail calls can reach.
+        bool grown = true;
+        while (grown) {
+            grown = false;
+            for (const auto& call : tailCalls) {
+                if (call.second->frameSize > call.first->frameSize) {
+                    call.first->frameSize = call.second->frameSize;
+                    grown = true;
+                }
+            }
+        }
+
+        functions.push_back(std::make_unique<ClosureFunction>());
+        ClosureFunction* topLevel = functions.back().get();
+        topLevel->name = "<toplevel>";
+        beginFunction(topLevel, true);
+        topLevel->body = compileSequence(program->statements);
+        return topLevel;
+    }
+
+    ClosureFunction* findFunction(const std::string& name) const {
+        auto it = functionTable.find(name);
+        return it != functionTable.end() ? it->second : nullptr;
+    }
+
+    static Value invoke(const ClosureFunction& fn, Value* slots, Heap& heap) {
+        ClosureFrame frame{slots, Value::nil(), &fn, heap, heap.regionMark(), topFrame};
+        topFrame = &frame;
+        ClosureFlow flow;
+        for (;;) {
+            heap.safepoint();
+            flow = frame.function->body(frame);
+            if (flow != ClosureFlow::TAIL_CALL) break;
+            heap.releaseRegion(frame.regionMark);
+        }
+        topFrame = frame.caller;
+        heap.releaseRegion(frame.regionMark);
+        return flow == ClosureFlow::RETURN ? frame.returnValue : Value::nil();
+    }
+
+    static Value invokeWithArgs(const ClosureFunction& fn, const Value* args, Heap& heap) {
+        Value inlineSlots[INLINE_FRAME_SLOTS];
+        std::vector<Value> heapSlots;
+        Value* slots = inlineSlots;
+        if (fn.frameSize > INLINE_FRAME_SLOTS) {
+            heapSlots.resize(fn.frameSize);
+            slots = heapSlots.data();
+        }
+        for (int i = 0; i < fn.arity; i++) {
+            slots[i] = args[i];
+        }
+        return invoke(fn, slots, heap);
+    }
+
+private:
+    void collectFunctions(const std::vector<std::unique_ptr<Statement>>& stmts,
+                          std::vector<FunctionDeclaration*>& out) {
+        for (auto& stmt : stmts) {
+            if (auto funcDecl = dynamic_cast<FunctionDeclaration*>(stmt.get())) {
+                out.push_back(funcDecl);
+                collectFunctions(funcDecl->body, out);
+            } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                collectFunctions(ifStmt->thenBranch, out);
+                collectFunctions(ifStmt->elseBranch, out);
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                collectFunctions(loopStmt->body, out);
+            }
+        }
+    }
+
+    void beginFunction(ClosureFunction* fn, bool topLevel) {
+        current = fn;
+        atTopLevel = topLevel;
+        scopes.clear();
+        scopes.emplace_back();
+        nextSlot = 0;
+        fn->frameSize = 0;
+    }
+
+    int declareLocal(const std::string& name) {
+        int slot = nextSlot++;
+        if (nextSlot > current->frameSize) current->frameSize = nextSlot;
+        scopes.back().push_back({name, slot});
+        return slot;
+    }
+
+    int resolveLocal(const std::string& name) const {
+        for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+            for (auto it = scope->rbegin(); it != scope->rend(); ++it) {
+                if (it->first == name) return it->second;
+            }
+        }
+        return -1;
+    }
+
+    int resolveGlobal(const std::string& name) const {
+        auto it = globalIndex.find(name);
+        if (it == globalIndex.end()) {
+            throw std::runtime_error("Compile error: Undefined variable '" + name + "'");
+        }
+        return it->second;
+    }
+
+    // ---- Statements -------------------------------------------------------
+
+    ClosureStmt compileBlock(const std::vector<std::unique_ptr<Statement>>& stmts) {
+        int savedSlot = nextSlot;
+        scopes.emplace_back();
+        ClosureStmt block = compileSequence(stmts);
+        scopes.pop_back();
+        nextSlot = savedSlot;
+        return block;
+    }
+
+    ClosureStmt compileSequence(const std::vector<std::unique_ptr<Statement>>& stmts) {
+        std::vector<ClosureStmt> compiled;
+        for (auto& stmt : stmts) {
+            if (ClosureStmt fn = compileStatement(stmt.get())) {
+                compiled.push_back(std::move(fn));
+            }
+        }
+        if (compiled.size() == 1) {
+            return compiled[0];
+        }
+        return [compiled](ClosureFrame& f) {
+            for (const auto& stmt : compiled) {
+                ClosureFlow flow = stmt(f);
+                if (flow != ClosureFlow::NORMAL) return flow;
+            }
+            return ClosureFlow::NORMAL;
+        };
+    }
+
+    // Runtime errors raised while a statement evaluates its expressions get
+    // the statement's line (see atLine).
+    ClosureStmt compileStatement(Statement* stmt) {
+        int line = stmt->line;
+        if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt)) {
+            ClosureExpr init = varDecl->initializer ? compileExpr(varDecl->initializer.get())
+                                                    : ClosureExpr([](ClosureFrame&) { return Value::nil(); });
+            if (atTopLevel && scopes.size() == 1) {
+                Value* global = &globals[resolveGlobal(varDecl->name)];
+                return [init, global, line](ClosureFrame& f) {
+                    *global = atLine(line, [&] { return init(f); });
+                    return ClosureFlow::NORMAL;
+                };
+            }
+            int slot = declareLocal(varDecl->name);
+            return [init, slot, line](ClosureFrame& f) {
+                f.slots[slot] = atLine(line, [&] { return init(f); });
+                return ClosureFlow::NORMAL;
+            };
+        }
+
+        if (dynamic_cast<FunctionDeclaration*>(stmt)) {
+            return nullptr;
+        }
+
+        if (auto ifStmt = dynamic_cast<IfStatement*>(stmt)) {
+            ClosureCond cond = compileCond(ifStmt->condition.get());
+            ClosureStmt thenBranch = compileBlock(ifStmt->thenBranch);
+            if (ifStmt->elseBranch.empty()) {
+                return [cond, thenBranch, line](ClosureFrame& f) {
+                    return atLine(line, [&] { return cond(f); }) ? thenBranch(f) : ClosureFlow::NORMAL;
+                };
+            }
+            ClosureStmt elseBranch = compileBlock(ifStmt->elseBranch);
+            return [cond, thenBranch, elseBranch, line](ClosureFrame& f) {
+                return atLine(line, [&] { return cond(f); }) ? thenBranch(f) : elseBranch(f);
+            };
+        }
+
+        if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt)) {
+            ClosureCond cond = compileCond(loopStmt->condition.get());
+            ClosureStmt body = compileBlock(loopStmt->body);
+            return [cond, body, line](ClosureFrame& f) {
+                while (atLine(line, [&] { return cond(f); })) {
+                    ClosureFlow flow = body(f);
+                    if (flow != ClosureFlow::NORMAL) return flow;
+                    f.heap.safepoint();
+                }
+                return ClosureFlow::NORMAL;
+            };
+        }
+
+        if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt)) {
+            if (!retStmt->value) {
+                return [](ClosureFrame& f) {
+                    f.returnValue = Value::nil();
+                    return ClosureFlow::RETURN;
+                };
+            }
+            auto funcCall = dynamic_cast<FunctionCall*>(retStmt->value.get());
+            if (funcCall && funcCall->tailCall != TailCall::NONE) {
+                if (ClosureStmt tailCall = compileTailCall(funcCall, line)) return tailCall;
+            }
+            ClosureExpr value = compileExpr(retStmt->value.get());
+            return [value, line](ClosureFrame& f) {
+                f.returnValue = atLine(line, [&] { return value(f); });
+                return ClosureFlow::RETURN;
+            };
+        }
+
+        if (auto exprStmt = dynamic_cast<ExpressionStatement*>(stmt)) {
+            ClosureExpr expr = compileExpr(exprStmt->expr.get());
+            return [expr, line](ClosureFrame& f) {
+                atLine(line, [&] { expr(f); });
+                return ClosureFlow::NORMAL;
+            };
+        }
+
+        return nullptr;
+    }
+
+    // ---- Conditions -------------------------------------------------------
+
+    ClosureCond compileCond(Expression* expr) {
+        if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            BinaryOpKind kind = binaryOpKind(binOp->op);
+            if (kind == BinaryOpKind::AND) {
+                ClosureCond left = compileCond(binOp->left.get());
+                ClosureCond right = compileCond(binOp->right.get());
+                return [left, right](ClosureFrame& f) { return left(f) && right(f); };
+            }
+            if (kind == BinaryOpKind::OR) {
+                ClosureCond left = compileCond(binOp->left.get());
+                ClosureCond right = compileCond(binOp->right.get());
+                return [left, right](ClosureFrame& f) { return left(f) || right(f); };
+            }
+        }
+        if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) {
+            if (unaryOp->op == "!") {
+                ClosureCond operand = compileCond(unaryOp->operand.get());
+                return [operand](ClosureFrame& f) { return !operand(f); };
+            }
+        }
+
+        ClosureExpr value = compileExpr(expr);
+        Runtime* rt = &runtime;
+        return [value, rt](ClosureFrame& f) {
+            Value v = value(f);
+            return v.isBool() ? v.asBool() : rt->isTruthy(v);
+        };
+    }
+
+    // ---- Expressions ------------------------------------------------------
+
+    template <BinaryOpKind K, typename L, typename R>
+    ClosureExpr makeBinary(L left, R right) {
+        Runtime* rt = &runtime;
+        return [rt, left, right](ClosureFrame& f) {
+            Value a = left(f);
+            return applyBinary<K>(*rt, a, right(f));
+        };
+    }
+
+    // For a right operand that may collect: the left value is a root
+    // until the right one is known.
+    template <BinaryOpKind K, typename L>
+    ClosureExpr makeRootedBinary(L left, ClosureExpr right) {
+        Runtime* rt = &runtime;
+        return [rt, left, right](ClosureFrame& f) {
+            Value a = left(f);
+            if (!a.isObject()) return applyBinary<K>(*rt, a, right(f));
+            Heap::Root keep(f.heap, a);
+            Value b = right(f);
+            return applyBinary<K>(*rt, a, b);
+        };
+    }
+
+    template <BinaryOpKind K, typename L>
+    ClosureExpr makeBinaryRight(L left, Expression* right) {
+        if (auto id = dynamic_cast<Identifier*>(right)) {
+            int slot = resolveLocal(id->name);
+            if (slot >= 0) return makeBinary<K>(left, SlotOperand{slot});
+        }
+        if (auto numLit = dynamic_cast<NumberLiteral*>(right)) {
+            return makeBinary<K>(left, ConstOperand{Value::number(numLit->value)});
+        }
+        if (containsCall(right)) return makeRootedBinary<K>(left, compileExpr(right));
+        return makeBinary<K>(left, ExprOperand{compileExpr(right)});
+    }
+
+    template <BinaryOpKind K>
+    ClosureExpr makeBinaryOperands(BinaryOp* binOp) {
+        Expression* left = binOp->left.get();
+        // Only specialize the left operand when the right cannot reassign it
+        if (auto id = dynamic_cast<Identifier*>(left)) {
+            int slot = resolveLocal(id->name);
+            if (slot >= 0 && !containsAssignment(binOp->right.get())) {
+                return makeBinaryRight<K>(SlotOperand{slot}, binOp->right.get());
+            }
+        }
+        if (auto numLit = dynamic_cast<NumberLiteral*>(left)) {
+            return makeBinaryRight<K>(ConstOperand{Value::number(numLit->value)}, binOp->right.get());
+        }
+        return makeBinaryRight<K>(ExprOperand{compileExpr(left)}, binOp->right.get());
+    }
+
+    ClosureExpr compileBinary(BinaryOp* binOp) {
+        switch (binaryOpKind(binOp->op)) {
+            case BinaryOpKind::ADD: return makeBinaryOperands<BinaryOpKind::ADD>(binOp);
+            case BinaryOpKind::SUB: return makeBinaryOperands<BinaryOpKind::SUB>(binOp);
+            case BinaryOpKind::MUL: return makeBinaryOperands<BinaryOpKind::MUL>(binOp);
+            case BinaryOpKind::DIV: return makeBinaryOperands<BinaryOpKind::DIV>(binOp);
+            case BinaryOpKind::MOD: return makeBinaryOperands<BinaryOpKind::MOD>(binOp);
+            case BinaryOpKind::EQ: return makeBinaryOperands<BinaryOpKind::EQ>(binOp);
+            case BinaryOpKind::NE: return makeBinaryOperands<BinaryOpKind::NE>(binOp);
+            case BinaryOpKind::LT: return makeBinaryOperands<BinaryOpKind::LT>(binOp);
+            case BinaryOpKind::LE: return makeBinaryOperands<BinaryOpKind::LE>(binOp);
+            case BinaryOpKind::GT: return makeBinaryOperands<BinaryOpKind::GT>(binOp);
+            case BinaryOpKind::GE: return makeBinaryOperands<BinaryOpKind::GE>(binOp);
+            case BinaryOpKind::AND:
+            case BinaryOpKind::OR: {
+                ClosureCond cond = compileCond(binOp);
+                return [cond](ClosureFrame& f) { return Value::boolean(cond(f)); };
+            }
+            default:
+                throw std::runtime_error("Compile error: unknown operator '" + binOp->op + "'");
+        }
+    }
+
+    ClosureExpr compileExpr(Expression* expr) {
+        if (auto numLit = dynamic_cast<NumberLiteral*>(expr)) {
+            Value v = Value::number(numLit->value);
+            return [v](ClosureFrame&) { return v; };
+        }
+
+        if (auto strLit = dynamic_cast<StringLiteral*>(expr)) {
+            Value v = runtime.intern(strLit->value);
+            return [v](ClosureFrame&) { return v; };
+        }
+
+        if (auto boolLit = dynamic_cast<BooleanLiteral*>(expr)) {
+            Value v = Value::boolean(boolLit->value);
+            return [v](ClosureFrame&) { return v; };
+        }
+
+        if (auto id = dynamic_cast<Identifier*>(expr)) {
+            int slot = resolveLocal(id->name);
+            if (slot >= 0) {
+                return [slot](ClosureFrame& f) { return f.slots[slot]; };
+            }
+            const Value* global = &globals[resolveGlobal(id->name)];
+            return [global](ClosureFrame&) { return *global; };
+        }
+
+        if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            return compileBinary(binOp);
+        }
+
+        if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) {
+            if (unaryOp->op == "!") {
+                ClosureCond operand = compileCond(unaryOp->operand.get());
+                return [operand](ClosureFrame& f) { return Value::boolean(!operand(f)); };
+            }
+            ClosureExpr operand = compileExpr(unaryOp->operand.get());
+            Runtime* rt = &runtime;
+            return [operand, rt](ClosureFrame& f) {
+                Value v = operand(f);
+                return v.isNumber() ? Value::number(-v.asNumber()) : rt->negate(v);
+            };
+        }
+
+        if (auto assign = dynamic_cast<Assignment*>(expr)) {
+            ClosureExpr value = compileExpr(assign->value.get());
+            int slot = resolveLocal(assign->name);
+            if (slot >= 0) {
+                return [value, slot](ClosureFrame& f) { return f.slots[slot] = value(f); };
+            }
+            Value* global = &globals[resolveGlobal(assign->name)];
+            return [value, global](ClosureFrame& f) { return *global = value(f); };
+        }
+
+        if (auto funcCall = dynamic_cast<FunctionCall*>(expr)) {
+            return compileCall(funcCall);
+        }
+
+        if (auto arrayLit = dynamic_cast<ArrayLiteral*>(expr)) {
+            Runtime* rt = &runtime;
+            if (arrayLit->packed) {
+                std::shared_ptr<const PackedElements> packed = arrayLit->packed;
+                bool inRegion = arrayLit->inRegion;
+                return [packed, inRegion, rt](ClosureFrame&) { return rt->packedArray(*packed, inRegion); };
+            }
+            std::vector<ClosureExpr> elements;
+            for (auto& element : arrayLit->elements) {
+                elements.push_back(compileExpr(element.get()));
+            }
+            if (containsCall(arrayLit)) {
+                bool inRegion = arrayLit->inRegion;
+                return [elements, inRegion, rt](ClosureFrame& f) {
+                    ArrayObject* array = inRegion ? rt->heap.allocateInRegion<ArrayObject>()
+                                                  : rt->heap.allocate<ArrayObject>();
+                    array->elements.reserve(elements.size());
+                    Value result = Value::object(array);
+                    Heap::Root keep(rt->heap, result);
+                    for (const auto& element : elements) {
+                        Value value = element(f);
+                        array = static_cast<ArrayObject*>(result.asObject());
+                        array->append(value);
+                        rt->heap.writeBarrier(array, value);
+                    }
+                    return result;
+                };
+            }
+            if (arrayLit->inRegion) {
+                return [elements, rt](ClosureFrame& f) {
+                    ArrayObject* array = rt->heap.allocateInRegion<ArrayObject>();
+                    array->elements.reserve(elements.size());
+                    for (const auto& element : elements) {
+                        array->append(element(f));
+                    }
+                    return Value::object(array);
+                };
+            }
+            return [elements, rt](ClosureFrame& f) {
+                ArrayObject* array = rt->heap.allocate<ArrayObject>();
+                array->elements.reserve(elements.size());
+                for (const auto& element : elements) {
+                    array->append(element(f));
+                }
+                return Value::object(array);
+            };
+        }
+
+        if (auto objLit = dynamic_cast<ObjectLiteral*>(expr)) {
+            std::vector<ClosureExpr> values;
+            const Shape* shape = Shape::empty();
+            for (auto& member : objLit->members) {
+                values.push_back(compileExpr(member.second.get()));
+                shape = shape->withKey(member.first);
+            }
+            Runtime* rt = &runtime;
+            bool inRegion = objLit->inRegion;
+            if (containsCall(objLit)) {
+                return [values, shape, rt, inRegion](ClosureFrame& f) {
+                    RecordObject* record = inRegion ? rt->heap.allocateInRegion<RecordObject>(shape)
+                                                    : rt->heap.allocate<RecordObject>(shape);
+                    Value result = Value::object(record);
+                    Heap::Root keep(rt->heap, result);
+                    for (size_t i = 0; i < values.size(); i++) {
+                        Value value = values[i](f);
+                        record = static_cast<RecordObject*>(result.asObject());
+                        record->slots[i] = value;
+                        rt->heap.writeBarrier(record, value);
+                    }
+                    return result;
+                };
+            }
+            return [values, shape, rt, inRegion](ClosureFrame& f) {
+                RecordObject* record = inRegion ? rt->heap.allocateInRegion<RecordObject>(shape)
+                                                : rt->heap.allocate<RecordObject>(shape);
+                for (size_t i = 0; i < values.size(); i++) {
+                    record->slots[i] = values[i](f);
+                }
+                return Value::object(record);
+            };
+        }
+
+        if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr)) {
+            Identifier arrayId(arrAccess->arrayName);
+            ClosureExpr array = compileExpr(&arrayId);
+            ClosureExpr index = compileExpr(arrAccess->index.get());
+            std::string name = arrAccess->shownName();
+            Runtime* rt = &runtime;
+            if (containsCall(arrAccess->index.get())) {
+                return [array, index, name, rt](ClosureFrame& f) {
+                    Value container = array(f);
+                    Heap::Root keep(f.heap, container);
+                    Value idx = index(f);
+                    return rt->index(container, idx, name);
+                };
+            }
+            return [array, index, name, rt](ClosureFrame& f) {
+                Value container = array(f);
+                Value idx = index(f);
+                if (container.isArray() && idx.isNumber()) {
+                    const auto& elements = static_cast<ArrayObject*>(container.asObject())->elements;
+                    double d = idx.asNumber();
+                    if (d >= 0 && d < elements.size() && d == static_cast<double>(static_cast<size_t>(d))) {
+                        return elements[static_cast<size_t>(d)];
+                    }
+                }
+                return rt->index(container, idx, name);
+            };
+        }
+
+        if (auto indexAssign = dynamic_cast<IndexAssignment*>(expr)) {
+            Identifier arrayId(indexAssign->arrayName);
+            ClosureExpr array = compileExpr(&arrayId);
+            ClosureExpr index = compileExpr(indexAssign->index.get());
+            ClosureExpr value = compileExpr(indexAssign->value.get());
+            std::string name = indexAssign->shownName();
+            Runtime* rt = &runtime;
+            if (containsCall(indexAssign->value.get())) {
+                return [array, index, value, name, rt](ClosureFrame& f) {
+                    Value idx = index(f);
+                    Heap::Root keep(f.heap, idx);
+                    Value result = value(f);
+                    rt->setIndex(array(f), idx, result, name);
+                    return result;
+                };
+            }
+            return [array, index, value, name, rt](ClosureFrame& f) {
+                Value idx = index(f);
+                Value result = value(f);
+                rt->setIndex(array(f), idx, result, name);
+                return result;
+            };
+        }
+
+        if (auto memberAccess = dynamic_cast<MemberAccess*>(expr)) {
+            Identifier objectId(memberAccess->objectName);
+            ClosureExpr object = compileExpr(&objectId);
+            std::string key = memberAccess->member;
+            std::string name = memberAccess->shownName();
+            auto cache = std::make_shared<InlineCache>();
+            Runtime* rt = &runtime;
+            return [object, key, name, cache, rt](ClosureFrame& f) {
+                Value container = object(f);
+                if (container.isRecord()) {
+                    auto record = static_cast<RecordObject*>(container.asObject());
+                    if (record->shape == cache->shapes[0]) return record->slots[cache->slots[0]];
+                }
+                return rt->member(container, key, *cache, name);
+            };
+        }
+
+        if (auto memberAssign = dynamic_cast<MemberAssignment*>(expr)) {
+            Identifier objectId(memberAssign->objectName);
+            ClosureExpr object = compileExpr(&objectId);
+            ClosureExpr value = compileExpr(memberAssign->value.get());
+            std::string key = memberAssign->member;
+            std::string name = memberAssign->shownName();
+            auto cache = std::make_shared<InlineCache>();
+            Runtime* rt = &runtime;
+            return [object, value, key, name, cache, rt](ClosureFrame& f) {
+                Value result = value(f);
+                rt->setMember(object(f), key, *cache, name, result);
+                return result;
+            };
+        }
+
+        throw std::runtime_error("Compile error: unsupported expression");
+    }
+
+    // The arguments are evaluated before any slot is overwritten, then
+    // become the callee's parameters in the current frame. Frames are sized
+    // in compile() to hold every function reachable through tail calls.
+    ClosureStmt compileTailCall(FunctionCall* funcCall, int line) {
+        ClosureFunction* callee = findFunction(funcCall->name);
+        if (!callee || static_cast<size_t>(callee->arity) != funcCall->args.size()) return nullptr;
+        std::vector<ClosureExpr> args;
+        for (auto& arg : funcCall->args) {
+            args.push_back(compileExpr(arg.get()));
+        }
+        tailCalls.push_back({current, callee});
+        return [callee, args, line](ClosureFrame& f) {
+            Value inlineArgs[INLINE_FRAME_SLOTS];
+            std::vector<Value> heapArgs;
+            Value* values = inlineArgs;
+            if (args.size() > INLINE_FRAME_SLOTS) {
+                heapArgs.resize(args.size());
+                values = heapArgs.data();
+            }
+            Heap::Root keep(f.heap, values, args.size());
+            atLine(line, [&] {
+                for (size_t i = 0; i < args.size(); i++) {
+                    values[i] = args[i](f);
+                }
+            });
+            std::copy(values, values + args.size(), f.slots);
+            f.function = callee;
+            return ClosureFlow::TAIL_CALL;
+        };
+    }
+
+    ClosureExpr compileCall(FunctionCall* funcCall) {
+        std::vector<ClosureExpr> args;
+        for (auto& arg : funcCall->args) {
+            args.push_back(compileExpr(arg.get()));
+        }
+        // Arguments already evaluated are roots while later ones call
+        size_t rootedArgs = 0;
+        for (auto& arg : funcCall->args) {
+            if (containsCall(arg.get())) rootedArgs = funcCall->args.size();
+        }
+
+        if (ClosureFunction* callee = findFunction(funcCall->name)) {
+            if (static_cast<size_t>(callee->arity) != args.size()) {
+                throw std::runtime_error("Compile error: Function '" + funcCall->name + "' expects " +
+                                         std::to_string(callee->arity) + " arguments, got " +
+                                         std::to_string(args.size()));
+            }
+            return [callee, args, rootedArgs](ClosureFrame& f) {
+                Value inlineSlots[INLINE_FRAME_SLOTS];
+                std::vector<Value> heapSlots;
+                Value* slots = inlineSlots;
+                if (callee->frameSize > INLINE_FRAME_SLOTS) {
+                    heapSlots.resize(callee->frameSize);
+                    slots = heapSlots.data();
+                }
+                Heap::Root keep(f.heap, slots, rootedArgs);
+                for (size_t i = 0; i < args.size(); i++) {
+                    slots[i] = args[i](f);
+                }
+                Value result;
+                MemoTable* memo = callee->memo;
+                if (memo && memo->accepts(slots, args.size())) {
+                    if (memo->lookup(slots, result)) return result;
+                    memo->begin(slots);
+                } else {
+                    memo = nullptr;
+                }
+                if (++callDepth > Runtime::MAX_CALL_DEPTH) {
+                    throw std::runtime_error("Runtime error: Maximum call depth exceeded in '" + callee->name + "'");
+                }
+                result = invoke(*callee, slots, f.heap);
+                callDepth--;
+                if (memo) memo->finish(result);
+                return result;
+            };
+        }
+
+        BuiltinId builtin = builtinIdFor(funcCall->name);
+        if (builtin == BuiltinId::NONE) {
+            throw std::runtime_error("Compile error: Undefined function '" + funcCall->name + "'");
+        }
+        Runtime* rt = &runtime;
+
+        // Pure numeric builtins get direct closures; the rest go through callBuiltin
+        if (args.size() == 1 && (builtin == BuiltinId::ABS || builtin == BuiltinId::SQRT ||
+                                 builtin == BuiltinId::ROUND)) {
+            ClosureExpr arg = args[0];
+            return [arg, builtin, rt](ClosureFrame& f) {
+                Value v = arg(f);
+                if (v.isNumber()) {
+                    double d = v.asNumber();
+                    switch (builtin) {
+                        case BuiltinId::ABS: return Value::number(std::fabs(d));
+                        case BuiltinId::SQRT: return Value::number(std::sqrt(d));
+                        default: return Value::number(std::round(d));
+                    }
+                }
+                return rt->callBuiltin(builtin, &v, 1);
+            };
+        }
+
+        return [args, rootedArgs, builtin, rt](ClosureFrame& f) {
+            Value argValues[8];
+            std::vector<Value> manyArgs;
+            Value* values = argValues;
+            if (args.size() > 8) {
+                manyArgs.resize(args.size());
+                values = manyArgs.data();
+            }
+            Heap::Root keep(f.heap, values, rootedArgs);
+            for (size_t i = 0; i < args.size(); i++) {
+                values[i] = args[i](f);
+            }
+            return rt->callBuiltin(builtin, values, args.size());
+        };
+    }
+};
+
+class ClosureEngine : private Heap::RootSet {
+private:
+    Runtime& runtime;
+    std::vector<Value> globals;
+    std::vector<std::unique_ptr<ClosureFunction>> functions;
+    ClosureFunction* topLevel;
+    ClosureFunction* mainFunction;
+
+public:
+    ClosureEngine(Runtime& rt, Program* program) : runtime(rt), topLevel(nullptr), mainFunction(nullptr) {
+        // Globals are addressed by pointer from inside closures, so the slot
+        // vector is sized before any closure captures an element.
+        size_t globalCount = 0;
+        for (auto& stmt : program->statements) {
+            if (dynamic_cast<VariableDeclaration*>(stmt.get())) globalCount++;
+        }
+        globals.reserve(globalCount);
+
+        ClosureCompiler compiler(runtime, globals, functions);
+        topLevel = compiler.compile(program);
+        mainFunction = compiler.findFunction("main");
+        runtime.heap.addRoots(this);
+    }
+
+    ~ClosureEngine() {
+        runtime.heap.removeRoots(this);
+    }
+
+    // Caches the results of calls to `name` in `table`.
+    void memoize(const std::string& name, MemoTable* table) {
+        for (auto& fn : functions) {
+            if (fn->name == name) fn->memo = table;
+        }
+    }
+
+    // Runs the top-level code, then enters kaam main().
+    void run() {
+        ClosureCompiler::callDepth = 0;
+        ClosureCompiler::topFrame = nullptr;
+        try {
+            std::vector<Value> topSlots(std::max(topLevel->frameSize, 1));
+            ClosureCompiler::invoke(*topLevel, topSlots.data(), runtime.heap);
+            if (!mainFunction) {
+                throw std::runtime_error("Runtime error: Main function 'kaam main()' not found");
+            }
+            ClosureCompiler::callDepth = 1;  // main counts as a call, as in the other engines
+            ClosureCompiler::invokeWithArgs(*mainFunction, nullptr, runtime.heap);
+        } catch (const ProgramExit&) {
+            // band() ends the program normally
+        }
+        runtime.out.flush();
+    }
+
+private:
+    void visitRoots(const std::function<void(Value&)>& visit) override {
+        for (Value& global : globals) visit(global);
+        for (ClosureFrame* frame = ClosureCompiler::topFrame; frame; frame = frame->caller) {
+            for (int i = 0; i < frame->function->frameSize; i++) visit(frame->slots[i]);
+        }
+    }
+};
+
+// ============================================================================
+// C++ Backend (ahead-of-time)
+// ============================================================================
+
+// Runtime support for generated C++. It is written next to every generated
+// source file so the output builds with nothing but a C++17 compiler. The
+// semantics (printing, truthiness, operators, error messages) mirror Runtime.
+const char* const AOT_RUNTIME_HEADER = R"OLRT(// Our-Lang V1 runtime for generated C++ code
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace olrt {
+
+struct Exit {};
+
+class Value;
+struct Record;
+using Array = std::vector<Value>;
+
+// Hidden class: the keys of a record in slot order. Records built with the
+// same keys share one Shape, found through the transition tree rooted at
+// Shape::empty().
+class Shape {
+public:
+    static const Shape* empty() { static const Shape root; return &root; }
+
+    static const Shape* of(std::initializer_list<const char*> keys) {
+        const Shape* shape = empty();
+        for (const char* key : keys) shape = shape->withKey(key);
+        return shape;
+    }
+
+    const Shape* withKey(const std::string& key) const {
+        for (const auto& transition : transitions) {
+            if (transition.first == key) return transition.second.get();
+        }
+        std::unique_ptr<Shape> child(new Shape());
+        child->keys = keys;
+        child->keys.push_back(key);
+        transitions.emplace_back(key, std::move(child));
+        return transitions.back().second.get();
+    }
+
+    int find(const char* key) const {
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (keys[i] == key) return static_cast<int>(i);
+        }
+        return -1;
+    }
+
+    const std::string& keyAt(size_t slot) const { return keys[slot]; }
+
+private:
+    std::vector<std::string> keys;
+    mutable std::vector<std::pair<std::string, std::unique_ptr<Shape>>> transitions;
+};
+
+// Tagged value for variables that are not proven to be numbers. Strings,
+// arrays and records are shared by reference, like heap objects in the VM.
+class Value {
+public:
+    enum Tag { NIL, BOOL, NUMBER, STRING, ARRAY, RECORD };
+
+    Value() : tag(NIL), num(0) {}
+    explicit Value(double d) : tag(NUMBER), num(d) {}
+
+    static Value boolean(bool b) { Value v; v.tag = BOOL; v.num = b ? 1 : 0; return v; }
+    static Value string(std::string s) { Value v; v.tag = STRING; v.ref = std::make_shared<std::string>(std::move(s)); return v; }
+    static Value array(Array elements) { Value v; v.tag = ARRAY; v.ref = std::make_shared<Array>(std::move(elements)); return v; }
+    static Value record(const Shape* shape, Array slots);
+
+    Tag kind() const { return tag; }
+    bool isNumber() const { return tag == NUMBER; }
+    double number() const { return num; }
+    bool asBool() const { return num != 0; }
+    const std::string& str() const { return *static_cast<const std::string*>(ref.get()); }
+    const Array& elements() const { return *static_cast<const Array*>(ref.get()); }
+    Array& elements() { return *static_cast<Array*>(ref.get()); }
+    const Record& members() const { return *static_cast<const Record*>(ref.get()); }
+    Record& members() { return *static_cast<Record*>(ref.get()); }
+    bool sameObject(const Value& other) const { return ref == other.ref; }
+
+private:
+    Tag tag;
+    double num;
+    std::shared_ptr<void> ref;
+};
+
+struct Record {
+    const Shape* shape;
+    Array slots;
+};
+
+inline Value Value::record(const Shape* shape, Array slots) {
+    Value v;
+    v.tag = RECORD;
+    v.ref = std::make_shared<Record>(Record{shape, std::move(slots)});
+    return v;
+}
+
+// A member site's inline cache: the shapes seen there and the key's slot in
+// each. Shapes past the last entry look the key up every time.
+struct MemberCache {
+    static const int ENTRIES = 4;
+    const Shape* shapes[ENTRIES] = {};
+    int slots[ENTRIES] = {};
+    int count = 0;
+};
+
+inline std::string formatNumber(double d) {
+    if (std::isfinite(d) && d == std::floor(d) && std::fabs(d) < 1e15) {
+        return std::to_string(static_cast<long long>(d));
+    }
+    std::ostringstream oss;
+    oss.precision(15);
+    oss << d;
+    return oss.str();
+}
+
+inline std::string toString(const Value& v, bool quoteStrings = false) {
+    switch (v.kind()) {
+        case Value::NUMBER: return formatNumber(v.number());
+        case Value::NIL: return "nil";
+        case Value::BOOL: return v.asBool() ? "haan" : "na";
+        case Value::STRING: return quoteStrings ? "'" + v.str() + "'" : v.str();
+        case Value::ARRAY: {
+            std::string result = "[";
+            for (size_t i = 0; i < v.elements().size(); i++) {
+                if (i > 0) result += ", ";
+                result += toString(v.elements()[i], true);
+            }
+            return result + "]";
+        }
+        default: {
+            const Record& record = v.members();
+            if (record.slots.empty()) return "{}";
+            std::string result = "{ ";
+            for (size_t i = 0; i < record.slots.size(); i++) {
+                if (i > 0) result += ", ";
+                result += record.shape->keyAt(i) + ": " + toString(record.slots[i], true);
+            }
+            return result + " }";
+        }
+    }
+}
+
+inline std::string typeName(const Value& v) {
+    static const char* const names[] = {"nil", "boolean", "number", "string", "array", "object"};
+    return names[v.kind()];
+}
+
+inline bool truthy(const Value& v) {
+    switch (v.kind()) {
+        case Value::BOOL: return v.asBool();
+        case Value::NUMBER: return v.number() != 0;
+        case Value::NIL: return false;
+        case Value::STRING: return !v.str().empty();
+        default: return true;
+    }
+}
+
+inline bool equals(const Value& a, const Value& b) {
+    if (a.kind() != b.kind()) return false;
+    switch (a.kind()) {
+        case Value::NIL: return true;
+        case Value::BOOL: return a.asBool() == b.asBool();
+        case Value::NUMBER: return a.number() == b.number();
+        case Value::STRING: return a.sameObject(b) || a.str() == b.str();
+        default: return a.sameObject(b);
+    }
+}
+
+[[noreturn]] inline void operandError(const Value& a, const Value& b) {
+    throw std::runtime_error("Runtime error: unsupported operands " + typeName(a) + " and " +
+                             typeName(b) + " for binary operator");
+}
+
+inline Value add(const Value& a, const Value& b) {
+    if (a.isNumber() && b.isNumber()) return Value(a.number() + b.number());
+    if (a.kind() == Value::STRING || b.kind() == Value::STRING) return Value::string(toString(a) + toString(b));
+    operandError(a, b);
+}
+
+// -, *, / and % either produce a number or fail.
+inline double arith(char op, const Value& a, const Value& b) {
+    if (!a.isNumber() || !b.isNumber()) operandError(a, b);
+    double x = a.number(), y = b.number();
+    switch (op) {
+        case '-': return x - y;
+        case '*': return x * y;
+        case '/': return x / y;
+        default: return std::fmod(x, y);
+    }
+}
+
+inline int compare(const Value& a, const Value& b) {
+    if (a.kind() == Value::STRING && b.kind() == Value::STRING) return a.str().compare(b.str());
+    operandError(a, b);
+}
+
+inline bool less(const Value& a, const Value& b) {
+    return a.isNumber() && b.isNumber() ? a.number() < b.number() : compare(a, b) < 0;
+}
+inline bool lessEqual(const Value& a, const Value& b) {
+    return a.isNumber() && b.isNumber() ? a.number() <= b.number() : compare(a, b) <= 0;
+}
+inline bool greater(const Value& a, const Value& b) {
+    return a.isNumber() && b.isNumber() ? a.number() > b.number() : compare(a, b) > 0;
+}
+inline bool greaterEqual(const Value& a, const Value& b) {
+    return a.isNumber() && b.isNumber() ? a.number() >= b.number() : compare(a, b) >= 0;
+}
+
+inline double negate(const Value& v) {
+    if (!v.isNumber()) {
+        throw std::runtime_error("Runtime error: Operand of '-' must be number, got " + typeName(v));
+    }
+    return -v.number();
+}
+
+// One shared string per character, like the literals hoisted by the emitter.
+inline const Value& character(unsigned char c) {
+    static const std::vector<Value> table = [] {
+        std::vector<Value> strings;
+        for (int i = 0; i < 256; i++) strings.push_back(Value::string(std::string(1, static_cast<char>(i))));
+        return strings;
+    }();
+    return table[c];
+}
+
+inline Value index(const Value& container, const Value& idx, const char* name) {
+    if (!idx.isNumber()) {
+        throw std::runtime_error("Runtime error: Array index must be number, got " + typeName(idx));
+    }
+    double d = idx.number();
+    size_t size;
+    if (container.kind() == Value::ARRAY) {
+        size = container.elements().size();
+        if (d >= 0 && d < size && d == std::floor(d)) return container.elements()[static_cast<size_t>(d)];
+    } else if (container.kind() == Value::STRING) {
+        size = container.str().size();
+        if (d >= 0 && d < size && d == std::floor(d)) {
+            return character(static_cast<unsigned char>(container.str()[static_cast<size_t>(d)]));
+        }
+    } else {
+        throw std::runtime_error(std::string("Runtime error: Cannot index non-array type '") + name + "'");
+    }
+    throw std::runtime_error("Runtime error: Index " + formatNumber(d) + " out of bounds for '" + name +
+                             "' of length " + std::to_string(size));
+}
+
+inline Value setIndex(Value container, const Value& idx, const Value& value, const char* name) {
+    if (!idx.isNumber()) {
+        throw std::runtime_error("Runtime error: Array index must be number, got " + typeName(idx));
+    }
+    if (container.kind() != Value::ARRAY) {
+        throw std::runtime_error(std::string("Runtime error: Cannot assign to an element of non-array '") + name + "'");
+    }
+    double d = idx.number();
+    Array& elements = container.elements();
+    if (d >= 0 && d < elements.size() && d == std::floor(d)) return elements[static_cast<size_t>(d)] = value;
+    throw std::runtime_error("Runtime error: Index " + formatNumber(d) + " out of bounds for '" + name +
+                             "' of length " + std::to_string(elements.size()));
+}
+
+inline size_t slotOf(const Value& object, const char* key, const char* name, MemberCache& cache) {
+    if (object.kind() != Value::RECORD) {
+        throw std::runtime_error(std::string("Runtime error: Cannot access member '") + key + "' of non-object '" +
+                                 name + "'");
+    }
+    const Shape* shape = object.members().shape;
+    for (int i = 0; i < cache.count; i++) {
+        if (cache.shapes[i] == shape) return static_cast<size_t>(cache.slots[i]);
+    }
+    int slot = shape->find(key);
+    if (slot < 0) {
+        throw std::runtime_error(std::string("Runtime error: Object '") + name + "' has no member '" + key + "'");
+    }
+    if (cache.count < MemberCache::ENTRIES) {
+        cache.shapes[cache.count] = shape;
+        cache.slots[cache.count] = slot;
+        cache.count++;
+    }
+    return static_cast<size_t>(slot);
+}
+
+inline Value getMember(const Value& object, const char* key, const char* name, MemberCache& cache) {
+    size_t slot = slotOf(object, key, name, cache);
+    return object.members().slots[slot];
+}
+
+inline Value setMember(Value object, const char* key, const Value& value, const char* name, MemberCache& cache) {
+    size_t slot = slotOf(object, key, name, cache);
+    return object.members().slots[slot] = value;
+}
+
+inline double numberArg(const char* builtin, const Value& v) {
+    if (!v.isNumber()) {
+        throw std::runtime_error(std::string("Runtime error: ") + builtin +
+                                 "() expects number arguments, got " + typeName(v));
+    }
+    return v.number();
+}
+
+inline double length(const Value& v) {
+    switch (v.kind()) {
+        case Value::STRING: return static_cast<double>(v.str().size());
+        case Value::ARRAY: return static_cast<double>(v.elements().size());
+        case Value::RECORD: return static_cast<double>(v.members().slots.size());
+        default:
+            throw std::runtime_error("Runtime error: nikal() expects array or string, got " + typeName(v));
+    }
+}
+
+template <size_t N>
+inline Value packedArray(const double (&table)[N]) {
+    Array elements;
+    elements.reserve(N);
+    for (double d : table) elements.push_back(Value(d));
+    return Value::array(std::move(elements));
+}
+
+template <size_t N>
+inline Value packedArray(const char* const (&table)[N]) {
+    Array elements;
+    elements.reserve(N);
+    for (const char* s : table) elements.push_back(Value::string(s));
+    return Value::array(std::move(elements));
+}
+
+// The array builtins. Reductions keep four partial results and combine them
+// in the interpreter's order (ArrayKernels), so both print the same numbers.
+inline const Array& numberArray(const char* builtin, const Value& v) {
+    if (v.kind() != Value::ARRAY) {
+        throw std::runtime_error(std::string("Runtime error: ") + builtin + "() expects array arguments, got " +
+                                 typeName(v));
+    }
+    for (const Value& element : v.elements()) {
+        if (!element.isNumber()) {
+            throw std::runtime_error(std::string("Runtime error: ") + builtin +
+                                     "() expects an array of numbers, got " + typeName(element));
+        }
+    }
+    return v.elements();
+}
+
+inline double sum(const Value& a) {
+    const Array& x = numberArray("sum", a);
+    double lanes[4] = {0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + 4 <= x.size(); i += 4) {
+        for (size_t j = 0; j < 4; j++) lanes[j] += x[i + j].number();
+    }
+    double total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < x.size(); i++) total += x[i].number();
+    return total;
+}
+
+inline double dot(const Value& a, const Value& b) {
+    const Array& x = numberArray("dot", a);
+    const Array& y = numberArray("dot", b);
+    if (x.size() != y.size()) {
+        throw std::runtime_error("Runtime error: dot() expects arrays of the same length, got " +
+                                 std::to_string(x.size()) + " and " + std::to_string(y.size()));
+    }
+    double lanes[4] = {0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + 4 <= x.size(); i += 4) {
+        for (size_t j = 0; j < 4; j++) {
+            double product = x[i + j].number() * y[i + j].number();
+            lanes[j] += product;
+        }
+    }
+    double total = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < x.size(); i++) {
+        double product = x[i].number() * y[i].number();
+        total += product;
+    }
+    return total;
+}
+
+inline Value scale(const Value& a, const Value& k) {
+    const Array& x = numberArray("scale", a);
+    double factor = numberArg("scale", k);
+    Array result;
+    result.reserve(x.size());
+    for (const Value& element : x) result.push_back(Value(element.number() * factor));
+    return Value::array(std::move(result));
+}
+
+// Like MINPD/MAXPD: ties between 0 and -0 keep the value already held.
+inline double extreme(const char* builtin, const Value& a, bool largest) {
+    const Array& x = numberArray(builtin, a);
+    if (x.empty()) throw std::runtime_error(std::string("Runtime error: ") + builtin + "() of an empty array");
+    auto pick = [largest](double held, double next) { return (largest ? held > next : held < next) ? held : next; };
+    bool nan = false;
+    for (const Value& element : x) nan |= std::isnan(element.number());
+    if (nan) return std::nan("");
+    size_t i = 1;
+    double result = x[0].number();
+    if (x.size() >= 4) {
+        double lanes[4] = {x[0].number(), x[1].number(), x[2].number(), x[3].number()};
+        for (i = 4; i + 4 <= x.size(); i += 4) {
+            for (size_t j = 0; j < 4; j++) lanes[j] = pick(lanes[j], x[i + j].number());
+        }
+        result = pick(pick(lanes[0], lanes[1]), pick(lanes[2], lanes[3]));
+    }
+    for (; i < x.size(); i++) result = pick(result, x[i].number());
+    return result;
+}
+
+inline double minval(const Value& a) { return extreme("minval", a, false); }
+inline double maxval(const Value& a) { return extreme("maxval", a, true); }
+
+template <typename F>
+inline Value map(const Value& a, F f) {
+    const Array& x = numberArray("map", a);
+    Array result;
+    result.reserve(x.size());
+    for (const Value& element : x) result.push_back(Value(f(element.number())));
+    return Value::array(std::move(result));
+}
+
+inline Value dekh(std::initializer_list<Value> args) {
+    bool first = true;
+    for (const Value& arg : args) {
+        if (!first) std::cout << ' ';
+        std::cout << toString(arg);
+        first = false;
+    }
+    std::cout << '\n';
+    return Value();
+}
+
+inline Value lou(std::initializer_list<Value> args) {
+    if (args.size() > 0) std::cout << toString(*args.begin());
+    std::cout.flush();
+    std::string line;
+    std::getline(std::cin, line);
+    char* end = nullptr;
+    double d = std::strtod(line.c_str(), &end);
+    if (!line.empty() && end && *end == '\0') return Value(d);
+    return Value::string(line);
+}
+
+inline double random() {
+    static std::mt19937_64 rng(std::random_device{}());
+    return std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+}
+
+// Bounds native recursion the same way the other engines do; the generated
+// code defines OLRT_MAX_CALL_DEPTH.
+class CallDepth {
+public:
+    explicit CallDepth(const char* function) {
+        if (++depth() > OLRT_MAX_CALL_DEPTH) {
+            depth()--;
+            throw std::runtime_error(std::string("Runtime error: Maximum call depth exceeded in '") + function + "'");
+        }
+    }
+    ~CallDepth() { depth()--; }
+
+private:
+    static int& depth() { static int value = 0; return value; }
+};
+
+// A runtime error that already ends with its source line; the innermost
+// statement adds it (see atLine) and the ones further out pass it on.
+struct LocatedError : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+[[noreturn]] __attribute__((noinline, cold)) inline void rethrowAtLine(int line) {
+    try {
+        throw;
+    } catch (const LocatedError&) {
+        throw;
+    } catch (const std::runtime_error& e) {
+        throw LocatedError(std::string(e.what()) + " (line " + std::to_string(line) + ")");
+    }
+}
+
+template <typename F>
+inline auto atLine(int line, F&& body) -> decltype(body()) {
+    try {
+        return body();
+    } catch (...) {
+        rethrowAtLine(line);
+    }
+}
+
+// Mutual tail calls. The body of a function in a tail-call cycle stores the
+// callee's arguments, names the callee's body here and returns; the entry
+// that started the cycle then runs the bodies one after another, so the
+// cycle keeps a single C++ frame and a single call depth.
+template <typename T>
+using Body = T (*)();
+
+template <typename T>
+Body<T>& pendingTailCall() {
+    static Body<T> body = nullptr;
+    return body;
+}
+
+template <typename T>
+T trampoline(Body<T> body) {
+    T result = body();
+    while (Body<T> next = pendingTailCall<T>()) {
+        pendingTailCall<T>() = nullptr;
+        result = next();
+    }
+    return result;
+}
+
+} // namespace olrt
+)OLRT";
+
+// Lowers an analyzed Program to C++17 against AOT_RUNTIME_HEADER.
+//
+// Functions proven numeric by NumericFunctionAnalysis get a second body over
+// plain doubles (n_<name>); the generic body f_<name> enters it when every
+// argument is a number. Within generic bodies, a local whose initializer and
+// every assignment produce a number is declared double; everything else is an
+// olrt::Value. C++ leaves the order of call arguments and operator operands
+// unspecified, so operands with side effects are evaluated into temporaries.
+// Self tail calls jump back to the start of the body; functions on a cycle of
+// mutual tail calls run through olrt::trampoline.
+class CppEmitter {
+private:
+    enum class CppKind {
+        NUMBER, BOOL, VALUE
+    };
+
+    struct CppVariable {
+        std::string cppName;
+        bool isNumber;
+        std::vector<Expression*> sources;
+    };
+
+    struct Operand {
+        std::string code;
+        CppKind kind;
+    };
+
+    const NumericFunctionAnalysis& numeric;
+    std::unordered_map<std::string, FunctionDeclaration*> functions;
+    std::vector<std::unique_ptr<CppVariable>> variables;
+    std::unordered_map<std::string, CppVariable*> globals;
+    std::unordered_map<const VariableDeclaration*, CppVariable*> declared;
+    std::unordered_map<const Expression*, CppVariable*> resolved;
+    // Functions in a cycle of mutual tail calls: f_/n_ are entries that run
+    // the bodies fb_/nb_ through olrt::trampoline, passing arguments in the
+    // slots fa_/na_
+    std::unordered_set<std::string> tailCycles;
+
+    // Per-body state (scopes are only used while resolving names)
+    std::vector<std::unordered_map<std::string, CppVariable*>> scopes;
+    std::unordered_map<std::string, int> shadowCount;
+    bool numericBody;
+    FunctionDeclaration* function;  // being emitted
+    int statementLine;              // for runtime errors; see located()
+    int tempCounter;
+    std::ostringstream out;
+    int indent;
+
+    // File-scope shapes, member-site caches, string literals and packed
+    // literal tables, declared ahead of the code
+    std::ostringstream siteDeclarations;
+    std::unordered_map<std::string, std::string> shapeNames;  // by key list
+    int memberSites;
+    std::unordered_map<const PackedElements*, std::string> packedNames;
+    std::unordered_map<std::string, std::string> stringNames;  // by content
+
+public:
+    CppEmitter(const NumericFunctionAnalysis& analysis)
+        : numeric(analysis), numericBody(false), function(nullptr), statementLine(0), tempCounter(0), indent(0),
+          memberSites(0) {}
+
+    std::string emit(Program* program, const std::string& sourceName) {
+        for (const auto& name : numeric.functionNames()) {
+            functions[name] = numeric.getFunction(name);
+            TailCallAnalysis::collectMutualTailCalls(name, functions[name]->body, tailCycles);
+        }
+        for (auto& stmt : program->statements) {
+            if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt.get())) {
+                if (!globals.count(varDecl->name)) {
+                    globals[varDecl->name] = newVariable("g_" + varDecl->name, false);
+                }
+            }
+        }
+
+        out << "// Generated by Our-Lang V1 from " << sourceName << "\n";
+        out << "#define OLRT_MAX_CALL_DEPTH " << Runtime::MAX_CALL_DEPTH << "\n";
+        out << "#include \"ourlang_runtime.h\"\n\n";
+
+        if (!globals.empty()) {
+            for (const auto& name : sortedGlobalNames()) {
+                out << "static olrt::Value g_" << name << ";\n";
+            }
+            out << "\n";
+        }
+
+        for (const auto& name : numeric.functionNames()) {
+            FunctionDeclaration* func = functions[name];
+            if (numeric.isNumeric(name)) {
+                out << "static double n_" << name << "(" << paramList(func, "double") << ");\n";
+                if (tailCycles.count(name)) declareTrampolined(func, "n", "double");
+            }
+            out << "static olrt::Value f_" << name << "(" << paramList(func, "olrt::Value") << ");\n";
+            if (tailCycles.count(name)) declareTrampolined(func, "f", "olrt::Value");
+        }
+        out << "\n";
+        auto declarationsAt = static_cast<size_t>(out.tellp());
+
+        for (const auto& name : numeric.functionNames()) {
+            if (numeric.isNumeric(name)) emitFunction(functions[name], true);
+            emitFunction(functions[name], false);
+        }
+
+        out << "static void run_toplevel() {\n";
+        beginBody(false);
+        indent = 1;
+        emitTopLevel(program->statements);
+        out << "}\n\n";
+
+        out << "int main() {\n"
+            << "    try {\n"
+            << "        run_toplevel();\n";
+        if (functions.count("main")) {
+            out << "        f_main();\n";
+        } else {
+            out << "        throw std::runtime_error(\"Runtime error: Main function 'kaam main()' not found\");\n";
+        }
+        out << "    } catch (const olrt::Exit&) {\n"
+            << "        // band() ends the program normally\n"
+            << "    } catch (const std::exception& e) {\n"
+            << "        std::cout.flush();\n"
+            << "        std::cerr << \"Fatal error: \" << e.what() << std::endl;\n"
+            << "        return 1;\n"
+            << "    }\n"
+            << "    std::cout.flush();\n"
+            << "    return 0;\n"
+            << "}\n";
+        std::string code = out.str();
+        std::string declarations = siteDeclarations.str();
+        if (!declarations.empty()) code.insert(declarationsAt, declarations + "\n");
+        return code;
+    }
+
+private:
+    CppVariable* newVariable(const std::string& cppName, bool isNumber) {
+        variables.push_back(std::unique_ptr<CppVariable>(new CppVariable{cppName, isNumber, {}}));
+        return variables.back().get();
+    }
+
+    std::vector<std::string> sortedGlobalNames() const {
+        std::vector<std::string> names;
+        for (const auto& entry : globals) names.push_back(entry.first);
+        std::sort(names.begin(), names.end());
+        return names;
+    }
+
+    void declareTrampolined(FunctionDeclaration* func, const std::string& prefix, const std::string& type) {
+        out << "static " << type << " " << prefix << "b_" << func->name << "();\n";
+        if (!func->params.empty()) {
+            out << "static " << type << " " << prefix << "a_" << func->name << "[" << func->params.size() << "];\n";
+        }
+    }
+
+    static std::string paramList(FunctionDeclaration* func, const std::string& type) {
+        std::string list;
+        for (size_t i = 0; i < func->params.size(); i++) {
+            if (i > 0) list += ", ";
+            list += type + " v_" + func->params[i];
+        }
+        return list;
+    }
+
+    static std::string quote(const std::string& s) {
+        std::string result = "\"";
+        for (unsigned char ch : s) {
+            switch (ch) {
+                case '"': result += "\\\""; break;
+                case '\\': result += "\\\\"; break;
+                case '\n': result += "\\n"; break;
+                case '\t': result += "\\t"; break;
+                case '\r': result += "\\r"; break;
+                default:
+                    if (ch < 0x20 || ch >= 0x7f) {
+                        char buf[8];
+                        std::snprintf(buf, sizeof(buf), "\\%03o", ch);
+                        result += buf;
+                    } else {
+                        result += static_cast<char>(ch);
+                    }
+            }
+        }
+        return result + "\"";
+    }
+
+    static std::string numberLiteral(double d) {
+        if (std::isinf(d)) return d > 0 ? "HUGE_VAL" : "-HUGE_VAL";
+        if (d == std::floor(d) && std::fabs(d) < 1e15) return std::to_string(static_cast<long long>(d)) + ".0";
+        // Shortest text that reads back as the same double
+        std::string text;
+        for (int precision = 1; precision <= 17; precision++) {
+            std::ostringstream oss;
+            oss.precision(precision);
+            oss << d;
+            text = oss.str();
+            if (std::strtod(text.c_str(), nullptr) == d) break;
+        }
+        if (text.find_first_of(".en") == std::string::npos) text += ".0";
+        return text;
+    }
+
+    std::string pad() const {
+        return std::string(indent * 4, ' ');
+    }
+
+    // ------------------------------------------------------------------
+    // Name resolution and type inference
+    // ------------------------------------------------------------------
+
+    void beginBody(bool numericFunction) {
+        scopes.clear();
+        scopes.emplace_back();
+        shadowCount.clear();
+        numericBody = numericFunction;
+        tempCounter = 0;
+    }
+
+    CppVariable* declareLocal(const std::string& name, bool isNumber) {
+        bool visible = false;
+        for (auto& scope : scopes) {
+            if (scope.count(name)) visible = true;
+        }
+        // A shadowing banao gets its own C++ name so its initializer can
+        // still read the outer variable.
+        std::string cppName = "v_" + name;
+        if (visible) cppName = "v" + std::to_string(++shadowCount[name]) + "_" + name;
+        CppVariable* var = newVariable(cppName, isNumber);
+        scopes.back()[name] = var;
+        return var;
+    }
+
+    CppVariable* lookup(const std::string& name) const {
+        for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+            auto found = it->find(name);
+            if (found != it->end()) return found->second;
+        }
+        auto global = globals.find(name);
+        return global != globals.end() ? global->second : nullptr;
+    }
+
+    // Resolves every variable reference in a body and records what is
+    // assigned to each local, then demotes locals to olrt::Value until every
+    // remaining double is only ever assigned numbers.
+    void inferBody(FunctionDeclaration* func, const std::vector<std::unique_ptr<Statement>>& body, bool topLevel) {
+        std::vector<CppVariable*> locals;
+        scopes.clear();
+        scopes.emplace_back();
+        shadowCount.clear();
+        if (func) {
+            for (const auto& param : func->params) {
+                scopes.back()[param] = newVariable("v_" + param, numericBody);
+            }
+        }
+        resolveBlock(body, topLevel, locals);
+
+        if (numericBody) return;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (CppVariable* var : locals) {
+                if (!var->isNumber) continue;
+                for (Expression* source : var->sources) {
+                    if (kindOf(source) != CppKind::NUMBER) {
+                        var->isNumber = false;
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    void resolveBlock(const std::vector<std::unique_ptr<Statement>>& stmts, bool topLevel,
+                      std::vector<CppVariable*>& locals) {
+        for (auto& stmt : stmts) {
+            if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt.get())) {
+                if (varDecl->initializer) resolveExpr(varDecl->initializer.get());
+                if (topLevel) {
+                    declared[varDecl] = globals.at(varDecl->name);
+                    continue;
+                }
+                CppVariable* var = declareLocal(varDecl->name, varDecl->initializer != nullptr);
+                if (varDecl->initializer) var->sources.push_back(varDecl->initializer.get());
+                declared[varDecl] = var;
+                locals.push_back(var);
+            } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt.get())) {
+                resolveExpr(ifStmt->condition.get());
+                scopes.emplace_back();
+                resolveBlock(ifStmt->thenBranch, false, locals);
+                scopes.back().clear();
+                resolveBlock(ifStmt->elseBranch, false, locals);
+                scopes.pop_back();
+            } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt.get())) {
+                resolveExpr(loopStmt->condition.get());
+                scopes.emplace_back();
+                resolveBlock(loopStmt->body, false, locals);
+                scopes.pop_back();
+            } else if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt.get())) {
+                if (retStmt->value) resolveExpr(retStmt->value.get());
+            } else if (auto exprStmt = dynamic_cast<ExpressionStatement*>(stmt.get())) {
+                resolveExpr(exprStmt->expr.get());
+            }
+        }
+    }
+
+    void resolveExpr(Expression* expr) {
+        if (auto id = dynamic_cast<Identifier*>(expr)) {
+            resolved[id] = lookup(id->name);
+        } else if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            resolveExpr(binOp->left.get());
+            resolveExpr(binOp->right.get());
+        } else if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) {
+            resolveExpr(unaryOp->operand.get());
+        } else if (auto assign = dynamic_cast<Assignment*>(expr)) {
+            resolveExpr(assign->value.get());
+            CppVariable* var = lookup(assign->name);
+            resolved[assign] = var;
+            if (var) var->sources.push_back(assign->value.get());
+        } else if (auto funcCall = dynamic_cast<FunctionCall*>(expr)) {
+            for (auto& arg : funcCall->args) resolveExpr(arg.get());
+        } else if (auto arrayLit = dynamic_cast<ArrayLiteral*>(expr)) {
+            for (auto& element : arrayLit->elements) resolveExpr(element.get());
+        } else if (auto objLit = dynamic_cast<ObjectLiteral*>(expr)) {
+            for (auto& member : objLit->members) resolveExpr(member.second.get());
+        } else if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr)) {
+            resolved[arrAccess] = lookup(arrAccess->arrayName);
+            resolveExpr(arrAccess->index.get());
+        } else if (auto indexAssign = dynamic_cast<IndexAssignment*>(expr)) {
+            resolved[indexAssign] = lookup(indexAssign->arrayName);
+            resolveExpr(indexAssign->index.get());
+            resolveExpr(indexAssign->value.get());
+        } else if (auto memberAccess = dynamic_cast<MemberAccess*>(expr)) {
+            resolved[memberAccess] = lookup(memberAccess->objectName);
+        } else if (auto memberAssign = dynamic_cast<MemberAssignment*>(expr)) {
+            resolved[memberAssign] = lookup(memberAssign->objectName);
+            resolveExpr(memberAssign->value.get());
+        }
+    }
+
+    CppVariable* variableFor(const Expression* expr, const std::string& name) const {
+        auto it = resolved.find(expr);
+        if (it == resolved.end() || !it->second) {
+            throw std::runtime_error("Compile error: Undefined variable '" + name + "'");
+        }
+        return it->second;
+    }
+
+    bool isNumericCall(FunctionCall* funcCall) const {
+        if (!numeric.isNumeric(funcCall->name)) return false;
+        for (auto& arg : funcCall->args) {
+            if (kindOf(arg.get()) != CppKind::NUMBER) return false;
+        }
+        return true;
+    }
+
+    CppKind kindOf(Expression* expr) const {
+        if (dynamic_cast<NumberLiteral*>(expr)) return CppKind::NUMBER;
+        if (dynamic_cast<BooleanLiteral*>(expr)) return CppKind::BOOL;
+        if (auto id = dynamic_cast<Identifier*>(expr)) {
+            return variableFor(id, id->name)->isNumber ? CppKind::NUMBER : CppKind::VALUE;
+        }
+        if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            switch (binaryOpKind(binOp->op)) {
+                case BinaryOpKind::ADD:
+                    return kindOf(binOp->left.get()) == CppKind::NUMBER &&
+                           kindOf(binOp->right.get()) == CppKind::NUMBER ? CppKind::NUMBER : CppKind::VALUE;
+                case BinaryOpKind::SUB: case BinaryOpKind::MUL:
+                case BinaryOpKind::DIV: case BinaryOpKind::MOD:
+                    return CppKind::NUMBER;
+                default:
+                    return CppKind::BOOL;
+            }
+        }
+        if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) {
+            return unaryOp->op == "!" ? CppKind::BOOL : CppKind::NUMBER;
+        }
+        if (auto assign = dynamic_cast<Assignment*>(expr)) {
+            return variableFor(assign, assign->name)->isNumber ? CppKind::NUMBER : CppKind::VALUE;
+        }
+        if (auto funcCall = dynamic_cast<FunctionCall*>(expr)) {
+            if (functions.count(funcCall->name)) {
+                return isNumericCall(funcCall) ? CppKind::NUMBER : CppKind::VALUE;
+            }
+            BuiltinId builtin = builtinIdFor(funcCall->name);
+            if (NumericFunctionAnalysis::isNumericBuiltin(builtin) || builtin == BuiltinId::NIKAL ||
+                builtin == BuiltinId::RANDOM || builtin == BuiltinId::SUM || builtin == BuiltinId::DOT ||
+                builtin == BuiltinId::MINVAL || builtin == BuiltinId::MAXVAL) {
+                return CppKind::NUMBER;
+            }
+        }
+        return CppKind::VALUE;
+    }
+
+    // True when evaluating the expression can print, read input, or write a
+    // variable, i.e. when its position in the evaluation order is observable.
+    bool hasEffects(Expression* expr) const {
+        if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            return hasEffects(binOp->left.get()) || hasEffects(binOp->right.get());
+        }
+        if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) return hasEffects(unaryOp->operand.get());
+        if (dynamic_cast<Assignment*>(expr) || dynamic_cast<IndexAssignment*>(expr) ||
+            dynamic_cast<MemberAssignment*>(expr)) {
+            return true;
+        }
+        if (auto funcCall = dynamic_cast<FunctionCall*>(expr)) {
+            if (functions.count(funcCall->name)) return true;
+            BuiltinId builtin = builtinIdFor(funcCall->name);
+            if (builtin == BuiltinId::DEKH || builtin == BuiltinId::LOU || builtin == BuiltinId::BAND ||
+                builtin == BuiltinId::RANDOM) {
+                return true;
+            }
+            for (auto& arg : funcCall->args) {
+                if (hasEffects(arg.get())) return true;
+            }
+            return false;
+        }
+        if (auto arrayLit = dynamic_cast<ArrayLiteral*>(expr)) {
+            for (auto& element : arrayLit->elements) {
+                if (hasEffects(element.get())) return true;
+            }
+            return false;
+        }
+        if (auto objLit = dynamic_cast<ObjectLiteral*>(expr)) {
+            for (auto& member : objLit->members) {
+                if (hasEffects(member.second.get())) return true;
+            }
+            return false;
+        }
+        if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr)) return hasEffects(arrAccess->index.get());
+        return false;
+    }
+
+    static bool isConstant(Expression* expr) {
+        return dynamic_cast<NumberLiteral*>(expr) || dynamic_cast<StringLiteral*>(expr) ||
+               dynamic_cast<BooleanLiteral*>(expr);
+    }
+
+    // Element and member stores count: they change what a later ArrayAccess
+    // or MemberAccess reads.
+    static bool hasAssignment(Expression* expr) {
+        if (dynamic_cast<Assignment*>(expr) || dynamic_cast<IndexAssignment*>(expr) ||
+            dynamic_cast<MemberAssignment*>(expr)) {
+            return true;
+        }
+        if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            return hasAssignment(binOp->left.get()) || hasAssignment(binOp->right.get());
+        }
+        if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) return hasAssignment(unaryOp->operand.get());
+        if (auto funcCall = dynamic_cast<FunctionCall*>(expr)) {
+            for (auto& arg : funcCall->args) {
+                if (hasAssignment(arg.get())) return true;
+            }
+        }
+        if (auto arrayLit = dynamic_cast<ArrayLiteral*>(expr)) {
+            for (auto& element : arrayLit->elements) {
+                if (hasAssignment(element.get())) return true;
+            }
+        }
+        if (auto objLit = dynamic_cast<ObjectLiteral*>(expr)) {
+            for (auto& member : objLit->members) {
+                if (hasAssignment(member.second.get())) return true;
+            }
+        }
+        if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr)) return hasAssignment(arrAccess->index.get());
+        return false;
+    }
+
+    // An operand whose value and failure behaviour cannot depend on when it
+    // runs relative to the one operand with effects.
+    bool isStable(Expression* operand, bool effectAssigns) const {
+        if (isConstant(operand)) return true;
+        if (effectAssigns) return false;
+        if (auto id = dynamic_cast<Identifier*>(operand)) {
+            return !globals.count(id->name) || resolved.at(id) != globals.at(id->name);
+        }
+        // Arithmetic on doubles cannot fail, and calls only write globals
+        return numericBody && !hasEffects(operand);
+    }
+
+    // Whether evaluating the expression may raise a runtime error.
+    bool mayFail(Expression* expr) const {
+        if (isConstant(expr) || dynamic_cast<Identifier*>(expr)) return false;
+        if (numericBody) return hasEffects(expr);
+        if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            if (mayFail(binOp->left.get()) || mayFail(binOp->right.get())) return true;
+            BinaryOpKind kind = binaryOpKind(binOp->op);
+            if (kind == BinaryOpKind::EQ || kind == BinaryOpKind::NE) return false;
+            return kindOf(binOp->left.get()) != CppKind::NUMBER || kindOf(binOp->right.get()) != CppKind::NUMBER;
+        }
+        if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) {
+            return mayFail(unaryOp->operand.get()) || kindOf(unaryOp->operand.get()) == CppKind::VALUE;
+        }
+        return true;
+    }
+
+    bool needsOrdering(const std::vector<Expression*>& operands) const {
+        // Errors are reported in source order
+        int failing = 0;
+        for (Expression* operand : operands) {
+            if (mayFail(operand) && ++failing > 1) return true;
+        }
+        Expression* effect = nullptr;
+        for (Expression* operand : operands) {
+            if (!hasEffects(operand)) continue;
+            if (effect) return true;
+            effect = operand;
+        }
+        if (!effect) return false;
+        bool effectAssigns = hasAssignment(effect);
+        for (Expression* operand : operands) {
+            if (operand != effect && !isStable(operand, effectAssigns)) return true;
+        }
+        return false;
+    }
+
+    // ------------------------------------------------------------------
+    // Code generation
+    // ------------------------------------------------------------------
+
+    static const char* cppType(CppKind kind) {
+        switch (kind) {
+            case CppKind::NUMBER: return "double";
+            case CppKind::BOOL: return "bool";
+            default: return "olrt::Value";
+        }
+    }
+
+    static std::string asValue(const Operand& op) {
+        switch (op.kind) {
+            case CppKind::NUMBER: return "olrt::Value(" + op.code + ")";
+            case CppKind::BOOL: return "olrt::Value::boolean(" + op.code + ")";
+            default: return op.code;
+        }
+    }
+
+    static std::string asCondition(const Operand& op) {
+        switch (op.kind) {
+            case CppKind::NUMBER: return "(" + op.code + " != 0)";
+            case CppKind::BOOL: return op.code;
+            default: return "olrt::truthy(" + op.code + ")";
+        }
+    }
+
+    static std::string asKind(const Operand& op, CppKind kind) {
+        if (kind == CppKind::VALUE) return asValue(op);
+        if (kind == CppKind::BOOL) return asCondition(op);
+        if (op.kind != CppKind::NUMBER) {
+            throw std::runtime_error("Compile error: expected a number in generated code");
+        }
+        return op.code;
+    }
+
+    std::vector<Operand> emitOperands(const std::vector<Expression*>& exprs) {
+        std::vector<Operand> operands;
+        for (Expression* expr : exprs) {
+            operands.push_back(emitExpr(expr));
+        }
+        return operands;
+    }
+
+    // Wraps `body` (which refers to the operands through `operands`) in an
+    // immediately invoked lambda that evaluates the operands left to right.
+    std::string ordered(std::vector<Operand>& operands, const std::function<std::string()>& body) {
+        std::string code = "[&]() { ";
+        for (auto& operand : operands) {
+            std::string temp = "t" + std::to_string(tempCounter++);
+            code += std::string(cppType(operand.kind)) + " " + temp + " = " + operand.code + "; ";
+            operand.code = temp;
+        }
+        return code + "return " + body() + "; }()";
+    }
+
+    Operand emitExpr(Expression* expr) {
+        if (auto numLit = dynamic_cast<NumberLiteral*>(expr)) {
+            return {numberLiteral(numLit->value), CppKind::NUMBER};
+        }
+        if (auto strLit = dynamic_cast<StringLiteral*>(expr)) {
+            return {stringConstant(strLit->value), CppKind::VALUE};
+        }
+        if (auto boolLit = dynamic_cast<BooleanLiteral*>(expr)) {
+            return {boolLit->value ? "true" : "false", CppKind::BOOL};
+        }
+        if (auto id = dynamic_cast<Identifier*>(expr)) {
+            return {variableFor(id, id->name)->cppName, kindOf(id)};
+        }
+        if (auto binOp = dynamic_cast<BinaryOp*>(expr)) {
+            return emitBinary(binOp);
+        }
+        if (auto unaryOp = dynamic_cast<UnaryOp*>(expr)) {
+            Operand operand = emitExpr(unaryOp->operand.get());
+            if (unaryOp->op == "!") return {"!" + asCondition(operand), CppKind::BOOL};
+            if (operand.kind == CppKind::NUMBER) return {"(-" + operand.code + ")", CppKind::NUMBER};
+            return {"olrt::negate(" + asValue(operand) + ")", CppKind::NUMBER};
+        }
+        if (auto assign = dynamic_cast<Assignment*>(expr)) {
+            CppVariable* var = variableFor(assign, assign->name);
+            Operand value = emitExpr(assign->value.get());
+            CppKind kind = var->isNumber ? CppKind::NUMBER : CppKind::VALUE;
+            return {"(" + var->cppName + " = " + asKind(value, kind) + ")", kind};
+        }
+        if (auto funcCall = dynamic_cast<FunctionCall*>(expr)) {
+            return emitCall(funcCall);
+        }
+        if (auto arrayLit = dynamic_cast<ArrayLiteral*>(expr)) {
+            if (arrayLit->packed) return {"olrt::packedArray(" + packedTable(*arrayLit->packed) + ")", CppKind::VALUE};
+            // Braced initializers are evaluated left to right.
+            std::string code = "olrt::Value::array({";
+            for (size_t i = 0; i < arrayLit->elements.size(); i++) {
+                if (i > 0) code += ", ";
+                code += asValue(emitExpr(arrayLit->elements[i].get()));
+            }
+            return {code + "})", CppKind::VALUE};
+        }
+        if (auto objLit = dynamic_cast<ObjectLiteral*>(expr)) {
+            std::string code = "olrt::Value::record(" + shapeFor(objLit) + ", {";
+            for (size_t i = 0; i < objLit->members.size(); i++) {
+                if (i > 0) code += ", ";
+                code += asValue(emitExpr(objLit->members[i].second.get()));
+            }
+            return {code + "})", CppKind::VALUE};
+        }
+        if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr)) {
+            CppVariable* var = variableFor(arrAccess, arrAccess->arrayName);
+            Operand container = {var->cppName, var->isNumber ? CppKind::NUMBER : CppKind::VALUE};
+            Operand index = emitExpr(arrAccess->index.get());
+            return {"olrt::index(" + asValue(container) + ", " + asValue(index) + ", " +
+                    quote(arrAccess->shownName()) + ")", CppKind::VALUE};
+        }
+        if (auto indexAssign = dynamic_cast<IndexAssignment*>(expr)) {
+            // The index and value are evaluated before the array variable is read
+            CppVariable* var = variableFor(indexAssign, indexAssign->arrayName);
+            std::vector<Operand> operands = {emitExpr(indexAssign->index.get()), emitExpr(indexAssign->value.get())};
+            Operand container = {var->cppName, var->isNumber ? CppKind::NUMBER : CppKind::VALUE};
+            auto store = [&]() {
+                return "olrt::setIndex(" + asValue(container) + ", " + asValue(operands[0]) + ", " +
+                       asValue(operands[1]) + ", " + quote(indexAssign->shownName()) + ")";
+            };
+            if (hasEffects(indexAssign->index.get()) || hasEffects(indexAssign->value.get())) {
+                return {ordered(operands, store), CppKind::VALUE};
+            }
+            return {store(), CppKind::VALUE};
+        }
+        if (auto memberAccess = dynamic_cast<MemberAccess*>(expr)) {
+            CppVariable* var = variableFor(memberAccess, memberAccess->objectName);
+            Operand object = {var->cppName, var->isNumber ? CppKind::NUMBER : CppKind::VALUE};
+            return {"olrt::getMember(" + asValue(object) + ", " + quote(memberAccess->member) + ", " +
+                    quote(memberAccess->shownName()) + ", " + newMemberSite() + ")", CppKind::VALUE};
+        }
+        if (auto memberAssign = dynamic_cast<MemberAssignment*>(expr)) {
+            // The value is evaluated before the object variable is read
+            CppVariable* var = variableFor(memberAssign, memberAssign->objectName);
+            std::vector<Operand> operands = {emitExpr(memberAssign->value.get())};
+            Operand object = {var->cppName, var->isNumber ? CppKind::NUMBER : CppKind::VALUE};
+            std::string site = newMemberSite();
+            auto store = [&]() {
+                return "olrt::setMember(" + asValue(object) + ", " + quote(memberAssign->member) + ", " +
+                       asValue(operands[0]) + ", " + quote(memberAssign->shownName()) + ", " + site + ")";
+            };
+            if (hasEffects(memberAssign->value.get())) return {ordered(operands, store), CppKind::VALUE};
+            return {store(), CppKind::VALUE};
+        }
+        throw std::runtime_error("Compile error: unsupported expression in C++ backend");
+    }
+
+    // Object literals with the same keys share one file-scope shape.
+    std::string shapeFor(ObjectLiteral* objLit) {
+        if (objLit->members.empty()) return "olrt::Shape::empty()";
+        std::string keys;
+        for (size_t i = 0; i < objLit->members.size(); i++) {
+            keys += (i > 0 ? ", " : "") + quote(objLit->members[i].first);
+        }
+        auto found = shapeNames.find(keys);
+        if (found != shapeNames.end()) return found->second;
+        std::string name = "shape_" + std::to_string(shapeNames.size());
+        siteDeclarations << "static const olrt::Shape* const " << name << " = olrt::Shape::of({" << keys << "});\n";
+        shapeNames[keys] = name;
+        return name;
+    }
+
+    // Each distinct string literal is built once, before main, and shared.
+    std::string stringConstant(const std::string& text) {
+        auto found = stringNames.find(text);
+        if (found != stringNames.end()) return found->second;
+        std::string name = "string_" + std::to_string(stringNames.size());
+        siteDeclarations << "static const olrt::Value " << name << " = olrt::Value::string(" << quote(text) << ");\n";
+        stringNames[text] = name;
+        return name;
+    }
+
+    // A packed array literal becomes a static table copied on every evaluation.
+    std::string packedTable(const PackedElements& packed) {
+        auto found = packedNames.find(&packed);
+        if (found != packedNames.end()) return found->second;
+        std::string name = "data_" + std::to_string(packedNames.size());
+        if (packed.strings.empty()) {
+            siteDeclarations << "static const double " << name << "[] = {";
+            for (size_t i = 0; i < packed.numbers.size(); i++) {
+                double d = packed.numbers[i];
+                siteDeclarations << (i > 0 ? ", " : "") << (d == 0 && std::signbit(d) ? "-0.0" : numberLiteral(d));
+            }
+        } else {
+            siteDeclarations << "static const char* const " << name << "[] = {";
+            for (size_t i = 0; i < packed.strings.size(); i++) {
+                siteDeclarations << (i > 0 ? ", " : "") << quote(packed.strings[i]);
+            }
+        }
+        siteDeclarations << "};\n";
+        packedNames[&packed] = name;
+        return name;
+    }
+
+    std::string newMemberSite() {
+        std::string name = "site_" + std::to_string(memberSites++);
+        siteDeclarations << "static olrt::MemberCache " << name << ";\n";
+        return name;
+    }
+
+    Operand emitBinary(BinaryOp* binOp) {
+        BinaryOpKind kind = binaryOpKind(binOp->op);
+        if (kind == BinaryOpKind::AND || kind == BinaryOpKind::OR) {
+            std::string left = asCondition(emitExpr(binOp->left.get()));
+            std::string right = asCondition(emitExpr(binOp->right.get()));
+            return {"(" + left + (kind == BinaryOpKind::AND ? " && " : " || ") + right + ")", CppKind::BOOL};
+        }
+
+        std::vector<Expression*> exprs = {binOp->left.get(), binOp->right.get()};
+        std::vector<Operand> operands = emitOperands(exprs);
+        CppKind resultKind = kindOf(binOp);
+        auto combine = [&]() { return combineBinary(kind, binOp->op, operands[0], operands[1]); };
+        if (needsOrdering(exprs)) return {ordered(operands, combine), resultKind};
+        return {combine(), resultKind};
+    }
+
+    static std::string combineBinary(BinaryOpKind kind, const std::string& op, const Operand& l, const Operand& r) {
+        bool numbers = l.kind == CppKind::NUMBER && r.kind == CppKind::NUMBER;
+        switch (kind) {
+            case BinaryOpKind::ADD:
+                if (numbers) return "(" + l.code + " + " + r.code + ")";
+                return "olrt::add(" + asValue(l) + ", " + asValue(r) + ")";
+            case BinaryOpKind::SUB: case BinaryOpKind::MUL: case BinaryOpKind::DIV:
+                if (numbers) return "(" + l.code + " " + op + " " + r.code + ")";
+                return "olrt::arith('" + op + "', " + asValue(l) + ", " + asValue(r) + ")";
+            case BinaryOpKind::MOD:
+                if (numbers) return "std::fmod(" + l.code + ", " + r.code + ")";
+                return "olrt::arith('%', " + asValue(l) + ", " + asValue(r) + ")";
+            case BinaryOpKind::EQ: case BinaryOpKind::NE: {
+                std::string test = numbers ? "(" + l.code + " == " + r.code + ")"
+                                           : "olrt::equals(" + asValue(l) + ", " + asValue(r) + ")";
+                return kind == BinaryOpKind::EQ ? test : "!" + test;
+            }
+            default: break;
+        }
+        if (numbers) return "(" + l.code + " " + op + " " + r.code + ")";
+        const char* helper = kind == BinaryOpKind::LT ? "olrt::less" :
+                             kind == BinaryOpKind::LE ? "olrt::lessEqual" :
+                             kind == BinaryOpKind::GT ? "olrt::greater" : "olrt::greaterEqual";
+        return std::string(helper) + "(" + asValue(l) + ", " + asValue(r) + ")";
+    }
+
+    Operand emitCall(FunctionCall* funcCall) {
+        std::vector<Expression*> exprs;
+        for (auto& arg : funcCall->args) exprs.push_back(arg.get());
+        std::vector<Operand> args = emitOperands(exprs);
+
+        BuiltinId builtin = functions.count(funcCall->name) ? BuiltinId::NONE : builtinIdFor(funcCall->name);
+        if (builtin == BuiltinId::DEKH || builtin == BuiltinId::LOU) {
+            // Braced initializers are evaluated left to right.
+            std::string code = std::string("olrt::") + funcCall->name + "({";
+            for (size_t i = 0; i < args.size(); i++) {
+                if (i > 0) code += ", ";
+                code += asValue(args[i]);
+            }
+            return {code + "})", CppKind::VALUE};
+        }
+
+        CppKind resultKind = kindOf(funcCall);
+        auto combine = [&]() { return combineCall(funcCall, builtin, args, resultKind); };
+        if (needsOrdering(exprs)) return {ordered(args, combine), resultKind};
+        return {combine(), resultKind};
+    }
+
+    static std::string numberArgument(BuiltinId builtin, const Operand& arg) {
+        if (arg.kind == CppKind::NUMBER) return arg.code;
+        return std::string("olrt::numberArg(\"") + builtinInfo(builtin).name + "\", " + asValue(arg) + ")";
+    }
+
+    // map()'s function as a C++ lambda, from the postfix text the semantic
+    // analyzer left in its place (see ArrayLambda).
+    static std::string mapLambda(FunctionCall* funcCall) {
+        auto text = dynamic_cast<StringLiteral*>(funcCall->args[1].get());
+        if (!text) throw std::runtime_error("Compile error: map() expects a function");
+        std::vector<std::string> stack;
+        std::istringstream in(text->value);
+        std::string token;
+        while (in >> token) {
+            if (token == "+" || token == "-" || token == "*" || token == "/") {
+                std::string right = stack.back();
+                stack.pop_back();
+                stack.back() = "(" + stack.back() + " " + token + " " + right + ")";
+            } else if (token == "neg") {
+                stack.back() = "(-" + stack.back() + ")";
+            } else if (token == "sqrt" || token == "abs") {
+                stack.back() = (token == "abs" ? "std::fabs(" : "std::sqrt(") + stack.back() + ")";
+            } else {
+                stack.push_back(token == "x" ? "x" : numberLiteral(std::strtod(token.c_str(), nullptr)));
+            }
+        }
+        return "[](double x) { return " + stack.back() + "; }";
+    }
+
+    std::string combineCall(FunctionCall* funcCall, BuiltinId builtin, const std::vector<Operand>& args,
+                            CppKind resultKind) const {
+        std::string list;
+        if (builtin == BuiltinId::NONE) {
+            bool native = resultKind == CppKind::NUMBER;
+            for (size_t i = 0; i < args.size(); i++) {
+                if (i > 0) list += ", ";
+                list += native ? args[i].code : asValue(args[i]);
+            }
+            return (native ? "n_" : "f_") + funcCall->name + "(" + list + ")";
+        }
+
+        switch (builtin) {
+            case BuiltinId::NIKAL: return "olrt::length(" + asValue(args[0]) + ")";
+            case BuiltinId::BAND: return "(throw olrt::Exit(), olrt::Value())";
+            case BuiltinId::RANDOM: return "olrt::random()";
+            case BuiltinId::ABS: return "std::fabs(" + numberArgument(builtin, args[0]) + ")";
+            case BuiltinId::SQRT: return "std::sqrt(" + numberArgument(builtin, args[0]) + ")";
+            case BuiltinId::ROUND: return "std::round(" + numberArgument(builtin, args[0]) + ")";
+            case BuiltinId::POW:
+                return "std::pow(" + numberArgument(builtin, args[0]) + ", " + numberArgument(builtin, args[1]) + ")";
+            case BuiltinId::MAX:
+                return "std::max(" + numberArgument(builtin, args[0]) + ", " + numberArgument(builtin, args[1]) + ")";
+            case BuiltinId::MIN:
+                return "std::min(" + numberArgument(builtin, args[0]) + ", " + numberArgument(builtin, args[1]) + ")";
+            case BuiltinId::SUM: return "olrt::sum(" + asValue(args[0]) + ")";
+            case BuiltinId::DOT: return "olrt::dot(" + asValue(args[0]) + ", " + asValue(args[1]) + ")";
+            case BuiltinId::SCALE: return "olrt::scale(" + asValue(args[0]) + ", " + asValue(args[1]) + ")";
+            case BuiltinId::MINVAL: return "olrt::minval(" + asValue(args[0]) + ")";
+            case BuiltinId::MAXVAL: return "olrt::maxval(" + asValue(args[0]) + ")";
+            case BuiltinId::MAP: return "olrt::map(" + asValue(args[0]) + ", " + mapLambda(funcCall) + ")";
+            default:
+                throw std::runtime_error("Compile error: Undefined function '" + funcCall->name + "'");
+        }
+    }
+
+    // ------------------------------------------------------------------
+    // Statements
+    // ------------------------------------------------------------------
+
+    void emitFunction(FunctionDeclaration* func, bool numericVersion) {
+        beginBody(numericVersion);
+        inferBody(func, func->body, false);
+
+        std::string prefix = numericVersion ? "n" : "f";
+        std::string type = numericVersion ? "double" : "olrt::Value";
+        out << "static " << type << " " << prefix << "_" << func->name << "(" << paramList(func, type) << ") {\n";
+        indent = 1;
+        function = func;
+        out << pad() << "olrt::CallDepth depth(" << quote(func->name) << ");\n";
+        if (tailCycles.count(func->name)) {
+            for (size_t i = 0; i < func->params.size(); i++) {
+                out << pad() << prefix << "a_" << func->name << "[" << i << "] = v_" << func->params[i] << ";\n";
+            }
+            out << pad() << "return olrt::trampoline<" << type << ">(&" << prefix << "b_" << func->name << ");\n";
+            out << "}\n\n";
+            out << "static " << type << " " << prefix << "b_" << func->name << "() {\n";
+            for (size_t i = 0; i < func->params.size(); i++) {
+                out << pad() << type << " v_" << func->params[i] << " = " << prefix << "a_" << func->name << "[" << i
+                    << "];\n";
+            }
+        }
+        if (TailCallAnalysis::hasSelfTailCall(func->body)) {
+            out << "tail_call:\n";
+        }
+
+        if (!numericVersion && numeric.isNumeric(func->name)) {
+            std::string test, args;
+            for (size_t i = 0; i < func->params.size(); i++) {
+                if (i > 0) {
+                    test += " && ";
+                    args += ", ";
+                }
+                test += "v_" + func->params[i] + ".isNumber()";
+                args += "v_" + func->params[i] + ".number()";
+            }
+            if (test.empty()) test = "true";
+            out << pad() << "if (" << test << ") return olrt::Value(n_" << func->name << "(" << args << "));\n";
+        }
+
+        emitBlock(func->body);
+        if (!numericVersion && !NumericFunctionAnalysis::alwaysReturns(func->body)) {
+            out << pad() << "return olrt::Value();\n";
+        }
+        out << "}\n\n";
+    }
+
+    void emitTopLevel(const std::vector<std::unique_ptr<Statement>>& stmts) {
+        inferBody(nullptr, stmts, true);
+        for (auto& stmt : stmts) {
+            if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt.get())) {
+                CppVariable* var = declared.at(varDecl);
+                statementLine = stmt->line;
+                std::string value = varDecl->initializer
+                                        ? located(asValue(emitExpr(varDecl->initializer.get())), varDecl->initializer.get())
+                                        : "olrt::Value()";
+                out << pad() << var->cppName << " = " << value << ";\n";
+            } else {
+                emitStatement(stmt.get());
+            }
+        }
+    }
+
+    void emitBlock(const std::vector<std::unique_ptr<Statement>>& stmts) {
+        for (auto& stmt : stmts) {
+            emitStatement(stmt.get());
+        }
+    }
+
+    void emitNestedBlock(const std::vector<std::unique_ptr<Statement>>& stmts) {
+        indent++;
+        emitBlock(stmts);
+        indent--;
+    }
+
+    void emitStatement(Statement* stmt) {
+        statementLine = stmt->line;
+        if (auto varDecl = dynamic_cast<VariableDeclaration*>(stmt)) {
+            CppVariable* var = declared.at(varDecl);
+            CppKind kind = var->isNumber ? CppKind::NUMBER : CppKind::VALUE;
+            out << pad() << cppType(kind) << " " << var->cppName;
+            if (varDecl->initializer) {
+                out << " = " << located(asKind(emitExpr(varDecl->initializer.get()), kind), varDecl->initializer.get());
+            }
+            out << ";\n";
+        } else if (auto ifStmt = dynamic_cast<IfStatement*>(stmt)) {
+            out << pad() << "if ("
+                << located(asCondition(emitExpr(ifStmt->condition.get())), ifStmt->condition.get()) << ") {\n";
+            emitNestedBlock(ifStmt->thenBranch);
+            if (!ifStmt->elseBranch.empty()) {
+                out << pad() << "} else {\n";
+                emitNestedBlock(ifStmt->elseBranch);
+            }
+            out << pad() << "}\n";
+        } else if (auto loopStmt = dynamic_cast<LoopStatement*>(stmt)) {
+            std::string condition =
+                located(asCondition(emitExpr(loopStmt->condition.get())), loopStmt->condition.get());
+            out << pad() << "while (" << condition << ") {\n";
+            emitNestedBlock(loopStmt->body);
+            out << pad() << "}\n";
+        } else if (auto retStmt = dynamic_cast<ReturnStatement*>(stmt)) {
+            CppKind kind = numericBody ? CppKind::NUMBER : CppKind::VALUE;
+            auto funcCall = dynamic_cast<FunctionCall*>(retStmt->value.get());
+            if (funcCall && funcCall->tailCall == TailCall::SELF) {
+                emitSelfTailCall(funcCall, kind);
+            } else if (funcCall && funcCall->tailCall == TailCall::MUTUAL &&
+                       (kind == CppKind::VALUE || numeric.isNumeric(funcCall->name))) {
+                emitMutualTailCall(funcCall, kind);
+            } else if (retStmt->value) {
+                out << pad() << "return " << located(asKind(emitExpr(retStmt->value.get()), kind), retStmt->value.get())
+                    << ";\n";
+            } else {
+                out << pad() << "return olrt::Value();\n";
+            }
+        } else if (auto exprStmt = dynamic_cast<ExpressionStatement*>(stmt)) {
+            std::string code = emitExpr(exprStmt->expr.get()).code;
+            if (dynamic_cast<Assignment*>(exprStmt->expr.get())) {
+                code = code.substr(1, code.size() - 2);  // drop the parentheses around a = b
+            }
+            out << pad() << located(code, exprStmt->expr.get()) << ";\n";
+        }
+        // Nested kaam declarations are hoisted to file scope by emit().
+    }
+
+    // Runs the code of an expression of the current statement under
+    // olrt::atLine, so a runtime error it raises names the statement's line
+    // as it does in the other engines. Code that cannot fail stays as it is.
+    std::string located(const std::string& code, Expression* expr) const {
+        if (statementLine <= 0 || !mayFail(expr)) return code;
+        return "olrt::atLine(" + std::to_string(statementLine) + ", [&]() { return " + code + "; })";
+    }
+
+    // Rebinds the parameters and restarts the body.
+    void emitSelfTailCall(FunctionCall* funcCall, CppKind kind) {
+        out << pad() << "{\n";
+        indent++;
+        std::vector<std::string> temps = emitTailArguments(funcCall, kind);
+        for (size_t i = 0; i < temps.size(); i++) {
+            out << pad() << "v_" << function->params[i] << " = " << temps[i] << ";\n";
+        }
+        out << pad() << "goto tail_call;\n";
+        indent--;
+        out << pad() << "}\n";
+    }
+
+    // Fills the callee's argument slots and leaves its body to the
+    // trampoline that entered the cycle. The arguments go through
+    // temporaries first: evaluating one may enter the callee again and
+    // overwrite the slots.
+    void emitMutualTailCall(FunctionCall* funcCall, CppKind kind) {
+        std::string prefix = kind == CppKind::NUMBER ? "n" : "f";
+        out << pad() << "{\n";
+        indent++;
+        std::vector<std::string> temps = emitTailArguments(funcCall, kind);
+        for (size_t i = 0; i < temps.size(); i++) {
+            out << pad() << prefix << "a_" << funcCall->name << "[" << i << "] = " << temps[i] << ";\n";
+        }
+        out << pad() << "olrt::pendingTailCall<" << cppType(kind) << ">() = &" << prefix << "b_" << funcCall->name
+            << ";\n";
+        out << pad() << "return " << (kind == CppKind::NUMBER ? "0" : "olrt::Value()") << ";\n";
+        indent--;
+        out << pad() << "}\n";
+    }
+
+    // Evaluates the arguments of a tail call in order into temporaries.
+    std::vector<std::string> emitTailArguments(FunctionCall* funcCall, CppKind kind) {
+        std::vector<std::string> temps;
+        for (auto& arg : funcCall->args) {
+            temps.push_back("t" + std::to_string(tempCounter++));
+            out << pad() << cppType(kind) << " " << temps.back() << " = " << located(asKind(emitExpr(arg.get()), kind), arg.get())
+                << ";\n";
+        }
+        return temps;
+    }
+};
+
+std::string generateCpp(Program* program, const std::string& sourceName) {
+    NumericFunctionAnalysis numeric;
+    numeric.analyze(program);
+    CppEmitter emitter(numeric);
+    return emitter.emit(program, sourceName);
+}
+
+void writeTextFile(const std::string& path, const std::string& contents) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open() || !(file << contents)) {
+        throw std::runtime_error("Cannot write " + path);
+    }
+}
+
+// Writes the generated source and its runtime header side by side.
+void writeCppSources(const std::string& cppPath, const std::string& cpp) {
+    writeTextFile(cppPath, cpp);
+    std::filesystem::path header = std::filesystem::path(cppPath).parent_path() / "ourlang_runtime.h";
+    writeTextFile(header.string(), AOT_RUNTIME_HEADER);
+}
+
+std::string shellQuote(const std::string& s) {
+    std::string result = "'";
+    for (char ch : s) {
+        result += ch == '\'' ? std::string("'\\''") : std::string(1, ch);
+    }
+    return result + "'";
+}
+
+uint64_t fnv1aHash(const uint8_t* data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+uint64_t fnv1aHash(const std::string& data, uint64_t hash = 0xcbf29ce484222325ULL) {
+    return fnv1aHash(reinterpret_cast<const uint8_t*>(data.data()), data.size(), hash);
+}
+
+const char* const AOT_CACHE_DIR = ".ourlang-cache";
+
+struct NativeBinary {
+    std::string path;
+    bool cached;
+};
+
+// Compiles generated C++ with the system compiler ($CXX, default g++). The
+// binary is cached under AOT_CACHE_DIR by a hash of the lowered source and
+// runtime header, so an unchanged program is only compiled once.
+NativeBinary buildNativeBinary(const std::string& cpp) {
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx",
+                  static_cast<unsigned long long>(fnv1aHash(AOT_RUNTIME_HEADER, fnv1aHash(cpp))));
+    std::filesystem::path dir = std::filesystem::path(AOT_CACHE_DIR) / key;
+    std::filesystem::path binary = dir / "program";
+    if (std::filesystem::exists(binary)) {
+        return {binary.string(), true};
+    }
+
+    std::filesystem::create_directories(dir);
+    std::filesystem::path source = dir / "program.cpp";
+    writeCppSources(source.string(), cpp);
+
+    const char* cxx = std::getenv("CXX");
+    std::string partial = binary.string() + ".partial";
+    std::string command = std::string(cxx && *cxx ? cxx : "g++") + " -std=c++17 -O2 -o " +
+                          shellQuote(partial) + " " + shellQuote(source.string());
+    int status = std::system(command.c_str());
+    if (status != 0) {
+        throw std::runtime_error("AOT error: C++ compiler failed: " + command);
+    }
+    std::filesystem::rename(partial, binary);
+    return {binary.string(), false};
+}
+
+// ============================================================================
+// Bytecode Files (.olc)
+// ============================================================================
+
+// An .olc file stores a compiled BytecodeModule so later runs skip lexing,
+// parsing, analysis and compilation. All integers are little-endian and every
+// reference is an offset from the start of the file, so the image can be
+// mapped anywhere; code sections are 4-byte aligned and executed in place.
+// Code is not verified instruction by instruction, so the header carries a
+// checksum of everything after it, and a file that fails it is rebuilt. The
+// header also records a hash of the options that shape the bytecode (the
+// pass pipeline and its parameters, --kernels), and a run with other options
+// rebuilds the file as well.
+//
+//   header      OlcHeader fields (see OLC_HEADER_SIZE)
+//   strings     count x {u32 offset, u32 length}, then the bytes
+//   globals     count x u32 string index
+//   functions   count x 21 u32 fields (see writeFunction)
+//   constants   per function, count x {u32 tag, u32 string index, u64 bits}
+//   code        per function, count x u32 instruction words
+//   lines       per function, count x {u32 pc, u32 line}
+//   shapes      per function, count x u32 key count, then every key's
+//               u32 string index
+//   members     per function, count x {u32 key, u32 object name} string
+//               indices
+//   names       per function, count x u32 string index (INDEX / SETINDEX)
+//   arrays      per function, count x {u32 kind, u32 length} (kind 0:
+//               numbers, 1: strings), then every element as u64 number
+//               bits or u32 string index
+const char OLC_MAGIC[4] = {'O', 'L', 'C', '\x1a'};
+const uint32_t OLC_VERSION = 14;
+const size_t OLC_HEADER_SIZE = 64;
+const size_t OLC_FUNCTION_ENTRY_SIZE = 84;
+
+enum class OlcConstantTag : uint32_t {
+    NIL, FALSE, TRUE, NUMBER, STRING, INTEGER
+};
+
+// FNV-1a of the bytes after the header, folded to 32 bits.
+uint32_t olcChecksum(const uint8_t* file, size_t size) {
+    uint64_t hash = fnv1aHash(file + OLC_HEADER_SIZE, size - OLC_HEADER_SIZE);
+    return static_cast<uint32_t>(hash ^ (hash >> 32));
+}
+
+class OlcWriter {
+private:
+    std::string bytes;
+    std::vector<std::string> strings;
+    std::unordered_map<std::string, uint32_t> stringIndex;
+
+public:
+    std::string write(const BytecodeModule& module, uint64_t sourceHash, uint64_t optionsHash) {
+        // Intern every string first so the table can be laid out up front
+        for (const auto& name : module.globalNames) intern(name);
+        for (const auto& proto : module.functions) {
+            intern(proto.name);
+            for (size_t k = 0; k < proto.constants.size(); k++) {
+                Value v = proto.constants[k];
+                if (!proto.integerConstants[k] && v.isString()) intern(std::string(static_cast<StringObject*>(v.asObject())->view()));
+            }
+            for (const Shape* shape : proto.shapes) {
+                for (int slot = 0; slot < shape->size(); slot++) intern(shape->keyAt(slot));
+            }
+            for (const auto& site : proto.memberSites) {
+                intern(site.key);
+                intern(site.objectName);
+            }
+            for (const auto& name : proto.indexNames) intern(name);
+            for (const auto& packed : proto.packedArrays) {
+                for (const auto& str : packed->strings) intern(str);
+            }
+        }
+
+        bytes.assign(OLC_HEADER_SIZE, '\0');
+
+        uint32_t stringsOffset = offset();
+        uint32_t dataOffset = stringsOffset + static_cast<uint32_t>(strings.size()) * 8;
+        for (const auto& s : strings) {
+            put32(dataOffset);
+            put32(static_cast<uint32_t>(s.size()));
+            dataOffset += static_cast<uint32_t>(s.size());
+        }
+        for (const auto& s : strings) bytes += s;
+        align(4);
+
+        uint32_t globalsOffset = offset();
+        for (const auto& name : module.globalNames) put32(stringIndex.at(name));
+
+        uint32_t functionsOffset = offset();
+        bytes.append(module.functions.size() * OLC_FUNCTION_ENTRY_SIZE, '\0');
+        for (size_t i = 0; i < module.functions.size(); i++) {
+            writeFunction(module.functions[i], functionsOffset + static_cast<uint32_t>(i * OLC_FUNCTION_ENTRY_SIZE));
+        }
+
+        uint32_t at = 0;
+        bytes.replace(at, 4, OLC_MAGIC, 4);
+        patch32(at + 4, OLC_VERSION);
+        patch64(at + 8, sourceHash);
+        patch32(at + 16, offset());  // file size
+        patch32(at + 20, static_cast<uint32_t>(strings.size()));
+        patch32(at + 24, stringsOffset);
+        patch32(at + 28, static_cast<uint32_t>(module.globalNames.size()));
+        patch32(at + 32, globalsOffset);
+        patch32(at + 36, static_cast<uint32_t>(module.functions.size()));
+        patch32(at + 40, functionsOffset);
+        patch32(at + 44, static_cast<uint32_t>(module.topLevelIndex));
+        patch32(at + 48, static_cast<uint32_t>(module.mainIndex));
+        patch64(at + 56, optionsHash);
+        patch32(at + 52, olcChecksum(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size()));
+        return bytes;
+    }
+
+private:
+    uint32_t offset() const {
+        return static_cast<uint32_t>(bytes.size());
+    }
+
+    void intern(const std::string& s) {
+        if (stringIndex.count(s)) return;
+        stringIndex[s] = static_cast<uint32_t>(strings.size());
+        strings.push_back(s);
+    }
+
+    void align(size_t n) {
+        while (bytes.size() % n != 0) bytes += '\0';
+    }
+
+    void put32(uint32_t v) {
+        for (int i = 0; i < 4; i++) bytes += static_cast<char>(v >> (8 * i));
+    }
+
+    void put64(uint64_t v) {
+        for (int i = 0; i < 8; i++) bytes += static_cast<char>(v >> (8 * i));
+    }
+
+    void patch32(size_t at, uint32_t v) {
+        for (int i = 0; i < 4; i++) bytes[at + i] = static_cast<char>(v >> (8 * i));
+    }
+
+    void patch64(size_t at, uint64_t v) {
+        for (int i = 0; i < 8; i++) bytes[at + i] = static_cast<char>(v >> (8 * i));
+    }
+
+    void writeFunction(const FunctionProto& proto, uint32_t entry) {
+        uint32_t constantsOffset = offset();
+        for (size_t k = 0; k < proto.constants.size(); k++) {
+            Value v = proto.constants[k];
+            OlcConstantTag tag = OlcConstantTag::NIL;
+            uint32_t string = 0;
+            uint64_t bits = 0;
+            if (proto.integerConstants[k]) {
+                tag = OlcConstantTag::INTEGER;
+                bits = v.raw();
+            } else if (v.isNumber()) {
+                tag = OlcConstantTag::NUMBER;
+                bits = v.raw();
+            } else if (v.isBool()) {
+                tag = v.asBool() ? OlcConstantTag::TRUE : OlcConstantTag::FALSE;
+            } else if (v.isString()) {
+                tag = OlcConstantTag::STRING;
+                string = stringIndex.at(std::string(static_cast<StringObject*>(v.asObject())->view()));
+            } else if (!v.isNil()) {
+                throw std::runtime_error("Compile error: constant of type " + std::string(v.isArray() ? "array" : "object") +
+                                         " cannot be stored in an .olc file");
+            }
+            put32(static_cast<uint32_t>(tag));
+            put32(string);
+            put64(bits);
+        }
+
+        uint32_t codeOffset = offset();
+        for (uint32_t word : proto.code) put32(word);
+
+        uint32_t linesOffset = offset();
+        for (const auto& entryLine : proto.lines) {
+            put32(entryLine.pc);
+            put32(static_cast<uint32_t>(entryLine.line));
+        }
+
+        uint32_t shapesOffset = offset();
+        for (const Shape* shape : proto.shapes) put32(static_cast<uint32_t>(shape->size()));
+        for (const Shape* shape : proto.shapes) {
+            for (int slot = 0; slot < shape->size(); slot++) put32(stringIndex.at(shape->keyAt(slot)));
+        }
+
+        uint32_t membersOffset = offset();
+        for (const auto& site : proto.memberSites) {
+            put32(stringIndex.at(site.key));
+            put32(stringIndex.at(site.objectName));
+        }
+
+        uint32_t namesOffset = offset();
+        for (const auto& name : proto.indexNames) put32(stringIndex.at(name));
+
+        uint32_t arraysOffset = offset();
+        for (const auto& packed : proto.packedArrays) {
+            put32(packed->strings.empty() ? 0 : 1);
+            put32(static_cast<uint32_t>(packed->size()));
+        }
+        for (const auto& packed : proto.packedArrays) {
+            for (double d : packed->numbers) put64(Value::number(d).raw());
+            for (const auto& str : packed->strings) put32(stringIndex.at(str));
+        }
+
+        const uint32_t fields[21] = {
+            stringIndex.at(proto.name), static_cast<uint32_t>(proto.arity), static_cast<uint32_t>(proto.frameSize),
+            constantsOffset, static_cast<uint32_t>(proto.constants.size()),
+            codeOffset, static_cast<uint32_t>(proto.code.size()),
+            linesOffset, static_cast<uint32_t>(proto.lines.size()),
+            static_cast<uint32_t>(proto.kernelIndex), static_cast<uint32_t>(proto.integerKernelIndex),
+            static_cast<uint32_t>(proto.deoptIndex), proto.memoizable ? 1u : 0u,
+            shapesOffset, static_cast<uint32_t>(proto.shapes.size()),
+            membersOffset, static_cast<uint32_t>(proto.memberSites.size()),
+            arraysOffset, static_cast<uint32_t>(proto.packedArrays.size()),
+            namesOffset, static_cast<uint32_t>(proto.indexNames.size())
+        };
+        for (int i = 0; i < 21; i++) patch32(entry + 4 * i, fields[i]);
+    }
+};
+
+// Read-only view of an .olc file: mmap'd where the platform allows it,
+// otherwise read into memory.
+class OlcImage {
+private:
+    const uint8_t* data;
+    size_t size;
+    void* mapping;
+    std::vector<uint8_t> buffer;
+
+public:
+    OlcImage() : data(nullptr), size(0), mapping(nullptr) {}
+
+    ~OlcImage() {
+#ifdef OURLANG_HAVE_MMAP
+        if (mapping) munmap(mapping, size);
+#endif
+    }
+
+    OlcImage(const OlcImage&) = delete;
+    OlcImage& operator=(const OlcImage&) = delete;
+
+    bool open(const std::string& path) {
+#ifdef OURLANG_HAVE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+            ::close(fd);
+            return false;
+        }
+        size = static_cast<size_t>(info.st_size);
+        mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            mapping = nullptr;
+            return false;
+        }
+        data = static_cast<const uint8_t*>(mapping);
+        return true;
+#else
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) return false;
+        buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        data = buffer.data();
+        size = buffer.size();
+        return size > 0;
+#endif
+    }
+
+    size_t getSize() const { return size; }
+
+    bool contains(size_t offset, size_t length) const {
+        return offset <= size && length <= size - offset;
+    }
+
+    uint32_t read32(size_t at) const {
+        uint32_t v = 0;
+        for (int i = 0; i < 4; i++) v |= static_cast<uint32_t>(data[at + i]) << (8 * i);
+        return v;
+    }
+
+    uint64_t read64(size_t at) const {
+        uint64_t v = 0;
+        for (int i = 0; i < 8; i++) v |= static_cast<uint64_t>(data[at + i]) << (8 * i);
+        return v;
+    }
+
+    const uint8_t* at(size_t offset) const { return data + offset; }
+};
+
+bool hostIsLittleEndian() {
+    const uint16_t probe = 1;
+    uint8_t first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+// Rebuilds a BytecodeModule from an image. Code is used in place; constants
+// are materialized in the runtime heap. Returns false with `reason` set if
+// the file is malformed or corrupted, from another format version, or built
+// from other source.
+bool loadOlc(const OlcImage& image, uint64_t sourceHash, uint64_t optionsHash, Runtime& runtime,
+             BytecodeModule& module, std::string& reason) {
+    if (!image.contains(0, OLC_HEADER_SIZE) || std::memcmp(image.at(0), OLC_MAGIC, 4) != 0) {
+        reason = "not an .olc file";
+        return false;
+    }
+    if (image.read32(4) != OLC_VERSION) {
+        reason = "format version " + std::to_string(image.read32(4)) + ", expected " + std::to_string(OLC_VERSION);
+        return false;
+    }
+    if (image.read64(8) != sourceHash) {
+        reason = "source changed since it was compiled";
+        return false;
+    }
+    if (image.read64(56) != optionsHash) {
+        reason = "compiled with different options";
+        return false;
+    }
+    if (image.read32(16) != image.getSize()) {
+        reason = "truncated file";
+        return false;
+    }
+    if (image.read32(52) != olcChecksum(image.at(0), image.getSize())) {
+        reason = "checksum mismatch";
+        return false;
+    }
+    if (!hostIsLittleEndian()) {
+        reason = "code sections need a little-endian host";
+        return false;
+    }
+
+    uint32_t stringCount = image.read32(20), stringsOffset = image.read32(24);
+    uint32_t globalCount = image.read32(28), globalsOffset = image.read32(32);
+    uint32_t functionCount = image.read32(36), functionsOffset = image.read32(40);
+    int32_t topLevel = static_cast<int32_t>(image.read32(44));
+    int32_t mainIndex = static_cast<int32_t>(image.read32(48));
+    if (!image.contains(stringsOffset, static_cast<size_t>(stringCount) * 8) ||
+        !image.contains(globalsOffset, static_cast<size_t>(globalCount) * 4) ||
+        !image.contains(functionsOffset, static_cast<size_t>(functionCount) * OLC_FUNCTION_ENTRY_SIZE) ||
+        topLevel < 0 || static_cast<uint32_t>(topLevel) >= functionCount ||
+        mainIndex < -1 || mainIndex >= static_cast<int32_t>(functionCount)) {
+        reason = "corrupt header";
+        return false;
+    }
+
+    std::vector<std::string> strings;
+    strings.reserve(stringCount);
+    for (uint32_t i = 0; i < stringCount; i++) {
+        uint32_t offset = image.read32(stringsOffset + 8 * i), length = image.read32(stringsOffset + 8 * i + 4);
+        if (!image.contains(offset, length)) {
+            reason = "corrupt string table";
+            return false;
+        }
+        strings.emplace_back(reinterpret_cast<const char*>(image.at(offset)), length);
+    }
+    auto stringAt = [&](uint32_t index) -> const std::string& {
+        if (index >= strings.size()) throw std::runtime_error("corrupt string reference");
+        return strings[index];
+    };
+
+    try {
+        for (uint32_t i = 0; i < globalCount; i++) {
+            module.globalNames.push_back(stringAt(image.read32(globalsOffset + 4 * i)));
+        }
+
+        module.functions.resize(functionCount);
+        for (uint32_t i = 0; i < functionCount; i++) {
+            size_t entry = functionsOffset + static_cast<size_t>(i) * OLC_FUNCTION_ENTRY_SIZE;
+            FunctionProto& proto = module.functions[i];
+            proto.name = stringAt(image.read32(entry));
+            proto.arity = static_cast<int>(image.read32(entry + 4));
+            proto.frameSize = static_cast<int>(image.read32(entry + 8));
+            uint32_t constantsOffset = image.read32(entry + 12), constantCount = image.read32(entry + 16);
+            uint32_t codeOffset = image.read32(entry + 20), codeCount = image.read32(entry + 24);
+            uint32_t linesOffset = image.read32(entry + 28), lineCount = image.read32(entry + 32);
+            proto.kernelIndex = static_cast<int32_t>(image.read32(entry + 36));
+            proto.integerKernelIndex = static_cast<int32_t>(image.read32(entry + 40));
+            proto.deoptIndex = static_cast<int32_t>(image.read32(entry + 44));
+            uint32_t memoizable = image.read32(entry + 48);
+            proto.memoizable = memoizable == 1;
+            uint32_t shapesOffset = image.read32(entry + 52), shapeCount = image.read32(entry + 56);
+            uint32_t membersOffset = image.read32(entry + 60), memberCount = image.read32(entry + 64);
+            uint32_t arraysOffset = image.read32(entry + 68), arrayCount = image.read32(entry + 72);
+            uint32_t namesOffset = image.read32(entry + 76), nameCount = image.read32(entry + 80);
+            auto validIndex = [&](int index) { return index >= -1 && index < static_cast<int>(functionCount); };
+            if (!validIndex(proto.kernelIndex) || !validIndex(proto.integerKernelIndex) || !validIndex(proto.deoptIndex) ||
+                memoizable > 1 || (proto.memoizable && (proto.arity < 1 || proto.arity > MemoTable::MAX_ARGS)) ||
+                !image.contains(constantsOffset, static_cast<size_t>(constantCount) * 16) ||
+                !image.contains(codeOffset, static_cast<size_t>(codeCount) * 4) || codeOffset % 4 != 0 ||
+                codeCount == 0 || !image.contains(linesOffset, static_cast<size_t>(lineCount) * 8) ||
+                !image.contains(shapesOffset, static_cast<size_t>(shapeCount) * 4) ||
+                !image.contains(membersOffset, static_cast<size_t>(memberCount) * 8) ||
+                !image.contains(arraysOffset, static_cast<size_t>(arrayCount) * 8) ||
+                !image.contains(namesOffset, static_cast<size_t>(nameCount) * 4) ||
+                proto.frameSize < proto.arity || proto.frameSize > BYTECODE_MAX_REGISTERS) {
+                throw std::runtime_error("corrupt function '" + proto.name + "'");
+            }
+
+            proto.constants.reserve(constantCount);
+            proto.integerConstants.assign(constantCount, false);
+            for (uint32_t k = 0; k < constantCount; k++) {
+                size_t at = constantsOffset + static_cast<size_t>(k) * 16;
+                switch (static_cast<OlcConstantTag>(image.read32(at))) {
+                    case OlcConstantTag::NIL: proto.constants.push_back(Value::nil()); break;
+                    case OlcConstantTag::FALSE: proto.constants.push_back(Value::boolean(false)); break;
+                    case OlcConstantTag::TRUE: proto.constants.push_back(Value::boolean(true)); break;
+                    case OlcConstantTag::NUMBER: {
+                        uint64_t bits = image.read64(at + 8);
+                        double d;
+                        std::memcpy(&d, &bits, sizeof(d));
+                        proto.constants.push_back(Value::number(d));
+                        break;
+                    }
+                    case OlcConstantTag::STRING:
+                        proto.constants.push_back(runtime.intern(stringAt(image.read32(at + 4))));
+                        break;
+                    case OlcConstantTag::INTEGER:
+                        proto.constants.push_back(Value::integer(static_cast<int64_t>(image.read64(at + 8))));
+                        proto.integerConstants[k] = true;
+                        break;
+                    default:
+                        throw std::runtime_error("corrupt constant in '" + proto.name + "'");
+                }
+            }
+
+            proto.mappedCode = reinterpret_cast<const uint32_t*>(image.at(codeOffset));
+            proto.lines.reserve(lineCount);
+            for (uint32_t k = 0; k < lineCount; k++) {
+                proto.lines.push_back({image.read32(linesOffset + 8 * k),
+                                       static_cast<int>(image.read32(linesOffset + 8 * k + 4))});
+            }
+
+            size_t keyAt = shapesOffset + static_cast<size_t>(shapeCount) * 4;
+            for (uint32_t k = 0; k < shapeCount; k++) {
+                uint32_t keyCount = image.read32(shapesOffset + 4 * k);
+                if (!image.contains(keyAt, static_cast<size_t>(keyCount) * 4)) {
+                    throw std::runtime_error("corrupt shape in '" + proto.name + "'");
+                }
+                const Shape* shape = Shape::empty();
+                for (uint32_t key = 0; key < keyCount; key++, keyAt += 4) {
+                    shape = shape->withKey(stringAt(image.read32(keyAt)));
+                }
+                proto.shapes.push_back(shape);
+            }
+            for (uint32_t k = 0; k < memberCount; k++) {
+                size_t at = membersOffset + static_cast<size_t>(k) * 8;
+                proto.memberSites.push_back({stringAt(image.read32(at)), stringAt(image.read32(at + 4)),
+                                             InlineCache()});
+            }
+            for (uint32_t k = 0; k < nameCount; k++) {
+                proto.indexNames.push_back(stringAt(image.read32(namesOffset + 4 * k)));
+            }
+            size_t elementAt = arraysOffset + static_cast<size_t>(arrayCount) * 8;
+            for (uint32_t k = 0; k < arrayCount; k++) {
+                uint32_t kind = image.read32(arraysOffset + 8 * k), length = image.read32(arraysOffset + 8 * k + 4);
+                size_t width = kind == 0 ? 8 : 4;
+                if (kind > 1 || !image.contains(elementAt, static_cast<size_t>(length) * width)) {
+                    throw std::runtime_error("corrupt array literal in '" + proto.name + "'");
+                }
+                auto packed = std::make_shared<PackedElements>();
+                for (uint32_t e = 0; e < length; e++, elementAt += width) {
+                    if (kind == 0) {
+                        uint64_t bits = image.read64(elementAt);
+                        double d;
+                        std::memcpy(&d, &bits, sizeof(d));
+                        packed->numbers.push_back(d);
+                    } else {
+                        packed->strings.push_back(stringAt(image.read32(elementAt)));
+                    }
+                }
+                proto.packedArrays.push_back(std::move(packed));
+            }
+        }
+    } catch (const std::runtime_error& e) {
+        module = BytecodeModule();
+        reason = e.what();
+        return false;
+    }
+
+    module.topLevelIndex = topLevel;
+    module.mainIndex = mainIndex;
+    return true;
+}
+
+std::string olcPathFor(const std::string& sourcePath) {
+    return std::filesystem::path(sourcePath).replace_extension(".olc").string();
+}
+
+uint64_t sourceHashFor(const std::string& code) {
+    return fnv1aHash(code);
+}
+
+uint64_t olcOptionsHash(const PassManager& passes, bool numericKernels) {
+    return fnv1aHash(passes.fingerprint() + (numericKernels ? ",kernels" : ""));
+}
+
+// ============================================================================
+// Main Program
+// ============================================================================
+
+std::vector<Token> tokenize(const std::string& code) {
+    Lexer lexer(code);
+    std::vector<Token> tokens;
+    Token token = lexer.nextToken();
+    while (token.type != TokenType::EOF_TOKEN) {
+        tokens.push_back(token);
+        token = lexer.nextToken();
+    }
+    tokens.push_back(token); // Add EOF token
+    return tokens;
+}
+
+// Lexes, parses and analyzes a program without printing progress; used where
+// only the analyzed AST matters (benchmarks).
+std::unique_ptr<Program> buildProgram(const std::string& code) {
+    Parser parser(tokenize(code));
+    auto program = parser.parse();
+    PassManager passes{OptimizationOptions()};
+    std::ostringstream report;
+    if (!passes.run(program.get(), report)) {
+        throw std::runtime_error("Semantic analysis failed: " + passes.errors().front());
+    }
+    return program;
+}
+
+enum class ExecutionEngine {
+    AST, VM, CLOSURE
+};
 
-        if (auto assign = dynamic_cast<Assignment*>(expr)) {
-            return analyzeAssignment(assign);
-        }
+const char* engineName(ExecutionEngine engine) {
+    switch (engine) {
+        case ExecutionEngine::AST: return "tree-walker";
+        case ExecutionEngine::CLOSURE: return "closure-compiler";
+        default: return "bytecode-vm";
+    }
+}
 
-        if (auto funcCall = dynamic_cast<FunctionCall*>(expr)) {
-            return analyzeFunctionCall(funcCall);
-        }
+enum class MemoMode {
+    OFF, AUTO, STATS
+};
 
-        if (auto arrayLit = dynamic_cast<ArrayLiteral*>(expr)) {
-            return DataType::ARRAY;
-        }
+enum class ParallelMode {
+    OFF, ON, STATS
+};
 
-        if (auto objLit = dynamic_cast<ObjectLiteral*>(expr)) {
-            return DataType::OBJECT;
-        }
+struct ExecutionOptions {
+    ExecutionEngine engine = ExecutionEngine::VM;
+    JitMode jit = JitMode::OFF;
+    bool numericKernels = true;  // VM: unchecked bodies for proven-numeric functions
+    MemoMode memoize = MemoMode::OFF;  // cache results of memoizableFunctions()
+    ParallelMode parallel = ParallelMode::OFF;  // VM: run independent loop iterations on threads
+    int threads = 0;  // for --parallel; 0 uses every hardware thread
+    bool gcStats = false;   // print collector statistics after the run
+    bool gcStress = false;  // collect at every safepoint that follows an allocation
+};
 
-        if (auto arrAccess = dynamic_cast<ArrayAccess*>(expr)) {
-            Symbol sym("", DataType::UNKNOWN);
-            if (symbolTable.lookup(arrAccess->arrayName, sym)) {
-                if (sym.type != DataType::ARRAY && sym.type != DataType::UNKNOWN) {
-                    errors.push_back("ERROR: Cannot index non-array type '" + arrAccess->arrayName + "'");
-                }
-                DataType indexType = analyzeExpression(arrAccess->index.get());
-                if (indexType != DataType::NUMBER && indexType != DataType::UNKNOWN) {
-                    errors.push_back("ERROR: Array index must be number, got " + dataTypeToString(indexType));
-                }
-                return DataType::UNKNOWN; // Element type unknown
-            } else {
-                errors.push_back("ERROR: Undefined array '" + arrAccess->arrayName + "'");
-                return DataType::UNKNOWN;
-            }
-        }
+std::string optionsName(const ExecutionOptions& options) {
+    std::string name = engineName(options.engine);
+    if (options.jit != JitMode::OFF) name += " + jit";
+    if (options.engine == ExecutionEngine::VM && !options.numericKernels) name += " (no kernels)";
+    if (options.memoize != MemoMode::OFF) name += " + memoize";
+    if (options.parallel != ParallelMode::OFF) name += " + parallel";
+    return name;
+}
 
-        return DataType::UNKNOWN;
+void printMemoStats(const Runtime& runtime, std::ostream& out) {
+    out << "\n--- Memoization ---" << std::endl;
+    out << "Memoized functions: " << runtime.memoTables.size() << std::endl;
+    for (const auto& table : runtime.memoTables) {
+        out << "  " << table->name << ": " << table->hits << " hits, " << table->misses << " misses, "
+            << table->evictions << " evictions, " << table->size() << " cached" << std::endl;
     }
+}
 
-    DataType analyzeBinaryOp(BinaryOp* binOp) {
-        DataType leftType = analyzeExpression(binOp->left.get());
-        DataType rightType = analyzeExpression(binOp->right.get());
+void printGcStats(const Heap& heap, std::ostream& out) {
+    const GcStats& stats = heap.stats;
+    out << "\n--- Garbage Collection ---" << std::endl;
+    out << "Nursery: " << Heap::nurseryCapacity() / 1024 << " KB" << std::endl;
+    out << "Allocated: " << stats.objectsAllocated << " objects, " << stats.bytesAllocated << " bytes" << std::endl;
+    out << "Minor collections: " << stats.minorCollections << ", " << stats.minorPauseMs << " ms" << std::endl;
+    out << "Major collections: " << stats.majorCollections << ", " << stats.majorPauseMs << " ms" << std::endl;
+    out << "Longest pause: " << stats.longestPauseMs << " ms" << std::endl;
+    out << "Promoted: " << stats.objectsPromoted << " objects, " << stats.bytesPromoted << " bytes" << std::endl;
+    out << "Freed: " << stats.objectsFreed << " objects" << std::endl;
+    out << "Old generation: " << heap.oldGenerationBytes() << " bytes, peak " << stats.peakOldBytes << " bytes"
+        << std::endl;
+}
 
-        // Arithmetic operators
-        if (binOp->op == "+" || binOp->op == "-" || binOp->op == "*" ||
-            binOp->op == "/" || binOp->op == "%") {
-            // Allow void or unknown for recursive function calls
-            if (leftType != DataType::NUMBER && leftType != DataType::UNKNOWN && leftType != DataType::VOID) {
-                errors.push_back("ERROR: Left operand of '" + binOp->op + "' must be number");
-            }
-            if (rightType != DataType::NUMBER && rightType != DataType::UNKNOWN && rightType != DataType::VOID) {
-                errors.push_back("ERROR: Right operand of '" + binOp->op + "' must be number");
-            }
-            return DataType::NUMBER;
-        }
+void printParallelStats(const ParallelStats& stats, std::ostream& out) {
+    out << "\n--- Parallel Loops ---" << std::endl;
+    out << "Threads: " << stats.threads << ", minimum trip count: " << ParallelLoopRunner::MIN_TRIPS << std::endl;
+    out << "Parallel loops: " << stats.loops.size() << std::endl;
+    for (const auto& loop : stats.loops) {
+        out << "  " << loop.function << ":" << loop.line << ": " << loop.parallelRuns << " parallel runs ("
+            << loop.iterations << " iterations), " << loop.sequentialRuns << " sequential" << std::endl;
+    }
+    out << "Sequential loops: " << stats.rejected.size() << std::endl;
+    for (const auto& entry : stats.rejected) {
+        out << "  " << entry.first << ": " << entry.second << std::endl;
+    }
+    out << "Chunks: " << stats.chunks << ", stolen: " << stats.steals << std::endl;
+}
 
-        // Comparison operators
-        if (binOp->op == "<" || binOp->op == "<=" || binOp->op == ">" || binOp->op == ">=") {
-            if (leftType != DataType::NUMBER && leftType != DataType::UNKNOWN) {
-                errors.push_back("ERROR: Left operand of '" + binOp->op + "' must be number");
-            }
-            if (rightType != DataType::NUMBER && rightType != DataType::UNKNOWN) {
-                errors.push_back("ERROR: Right operand of '" + binOp->op + "' must be number");
-            }
-            return DataType::BOOLEAN;
-        }
+void runOnVm(Program* program, const ExecutionOptions& options, Runtime& runtime) {
+    BytecodeModule module;
+    ParallelStats parallelStats;
+    bool parallel = options.parallel != ParallelMode::OFF;
+    BytecodeCompiler compiler(runtime, module, options.numericKernels, parallel ? &parallelStats : nullptr);
+    compiler.compile(program);
+    std::unique_ptr<ParallelLoopRunner> parallelLoops;
+    if (parallel) {
+        int threads = options.threads > 0 ? options.threads
+                                          : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        parallelLoops = std::make_unique<ParallelLoopRunner>(runtime, threads, parallelStats);
+    }
+    auto prepare = [&](VM& vm) {
+        if (options.memoize != MemoMode::OFF) vm.enableMemoization();
+        if (parallelLoops) vm.enableParallelLoops(parallelLoops.get());
+    };
 
-        // Equality operators
-        if (binOp->op == "==" || binOp->op == "!=") {
-            return DataType::BOOLEAN;
+    if (options.jit == JitMode::OFF) {
+        VM vm(runtime, module);
+        prepare(vm);
+        vm.run();
+    } else {
+        JitStats stats;
+#ifdef OURLANG_JIT_X64
+        NumericFunctionAnalysis numeric;
+        numeric.analyze(program);
+        JitCodeBuffer codeBuffer;
+        JitCompiler jit(numeric);
+        jit.compile(module, codeBuffer, stats);
+#endif
+        VM vm(runtime, module, &stats);
+        prepare(vm);
+        vm.run();
+        if (options.jit == JitMode::STATS) {
+            printJitStats(stats, runtime.out);
         }
+    }
+    if (options.parallel == ParallelMode::STATS) {
+        printParallelStats(parallelStats, runtime.out);
+    }
+}
 
-        // Logical operators
-        if (binOp->op == "&&" || binOp->op == "||") {
-            if (leftType != DataType::BOOLEAN && leftType != DataType::UNKNOWN) {
-                errors.push_back("ERROR: Left operand of '" + binOp->op + "' must be boolean");
+void executeProgram(Program* program, const ExecutionOptions& options, Runtime& runtime) {
+    ExecutionEngine engine = options.engine;
+    bool memoize = options.memoize != MemoMode::OFF;
+    runtime.heap.stress = options.gcStress;
+    if (engine == ExecutionEngine::AST) {
+        Interpreter interpreter(runtime);
+        if (memoize) {
+            for (FunctionDeclaration* func : memoizableFunctions(program)) {
+                interpreter.memoize(func->name, runtime.addMemoTable(func->name, static_cast<int>(func->params.size())));
             }
-            if (rightType != DataType::BOOLEAN && rightType != DataType::UNKNOWN) {
-                errors.push_back("ERROR: Right operand of '" + binOp->op + "' must be boolean");
+        }
+        interpreter.run(program);
+    } else if (engine == ExecutionEngine::CLOSURE) {
+        ClosureEngine closures(runtime, program);
+        if (memoize) {
+            for (FunctionDeclaration* func : memoizableFunctions(program)) {
+                closures.memoize(func->name, runtime.addMemoTable(func->name, static_cast<int>(func->params.size())));
             }
-            return DataType::BOOLEAN;
         }
+        closures.run();
+    } else {
+        runOnVm(program, options, runtime);
+    }
+    if (options.memoize == MemoMode::STATS) {
+        printMemoStats(runtime, runtime.out);
+    }
+    if (options.gcStats) {
+        printGcStats(runtime.heap, runtime.out);
+    }
+}
 
-        return DataType::UNKNOWN;
+// ============================================================================
+// Benchmarks
+// ============================================================================
+
+struct BenchmarkCase {
+    const char* name;
+    const char* unit;
+    double ops;
+    const char* source;
+};
+
+const BenchmarkCase BENCHMARKS[] = {
+    {"fib(25) recursion", "calls", 242785, R"(
+kaam fib(n) {
+    agar (n < 2) {
+        wapas n;
     }
+    wapas fib(n - 1) + fib(n - 2);
+}
 
-    DataType analyzeUnaryOp(UnaryOp* unaryOp) {
-        DataType operandType = analyzeExpression(unaryOp->operand.get());
+kaam main() {
+    fib(25);
+}
+)"},
+    {"sumOfNaturalNumbers(1000000) loop", "iterations", 1000000, R"(
+kaam sumOfNaturalNumbers(n) {
+    banao sum = 0;
+    banao i = 1;
+
+    daura (i <= n) {
+        sum = sum + i;
+        i = i + 1;
+    }
 
-        if (unaryOp->op == "-") {
-            if (operandType != DataType::NUMBER && operandType != DataType::UNKNOWN) {
-                errors.push_back("ERROR: Operand of '-' must be number");
-            }
-            return DataType::NUMBER;
-        }
+    wapas sum;
+}
 
-        if (unaryOp->op == "!") {
-            if (operandType != DataType::BOOLEAN && operandType != DataType::UNKNOWN) {
-                errors.push_back("ERROR: Operand of '!' must be boolean");
-            }
-            return DataType::BOOLEAN;
-        }
+kaam main() {
+    sumOfNaturalNumbers(1000000);
+}
+)"},
+    {"factorial(20) x 20000 recursion", "calls", 20000 * 21, R"(
+kaam factorial(n) {
+    agar (n <= 1) {
+        wapas 1;
+    } warnah {
+        wapas n * factorial(n - 1);
+    }
+}
 
-        return DataType::UNKNOWN;
+kaam main() {
+    banao i = 0;
+    daura (i < 20000) {
+        factorial(20);
+        i = i + 1;
+    }
+}
+)"},
+    {"isPrime(1000003) x 50 loop", "iterations", 50 * 1000, R"(
+kaam isPrime(num) {
+    agar (num <= 1) {
+        wapas na;
     }
 
-    DataType analyzeAssignment(Assignment* assign) {
-        Symbol sym("", DataType::UNKNOWN);
-        if (!symbolTable.lookup(assign->name, sym)) {
-            errors.push_back("ERROR: Undefined variable '" + assign->name + "'");
-            return DataType::UNKNOWN;
+    banao i = 2;
+    daura (i * i <= num) {
+        agar (num % i == 0) {
+            wapas na;
         }
+        i = i + 1;
+    }
 
-        DataType valueType = analyzeExpression(assign->value.get());
+    wapas haan;
+}
 
-        if (sym.type != DataType::UNKNOWN && valueType != DataType::UNKNOWN &&
-            sym.type != valueType) {
-            errors.push_back("ERROR: Type mismatch in assignment to '" + assign->name +
-                           "': expected " + dataTypeToString(sym.type) +
-                           ", got " + dataTypeToString(valueType));
-        }
+kaam main() {
+    banao k = 0;
+    daura (k < 50) {
+        isPrime(1000003);
+        k = k + 1;
+    }
+}
+)"}
+};
 
-        symbolTable.update(assign->name);
-        return valueType;
+double timeExecution(Program* program, const ExecutionOptions& options) {
+    std::ostringstream sink;
+    Runtime runtime(sink);
+    auto start = std::chrono::steady_clock::now();
+    executeProgram(program, options, runtime);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// A synthetic program with many small functions, for measuring startup.
+std::string generateLargeProgram(int functionCount) {
+    std::ostringstream src;
+    for (int i = 0; i < functionCount; i++) {
+        src << "kaam f" << i << "(n) {\n"
+            << "    banao total = 0;\n"
+            << "    banao k = 0;\n"
+            << "    daura (k < n) {\n"
+            << "        agar (k % 3 == 0 && total < 1000) {\n"
+            << "            total = total + k * " << i << ";\n"
+            << "        } warnah {\n"
+            << "            total = total - 1;\n"
+            << "        }\n"
+            << "        k = k + 1;\n"
+            << "    }\n"
+            << "    banao scores = [total, k, " << i << "];\n"
+            << "    dekh('f" << i << "', scores);\n"
+            << "    wapas total;\n"
+            << "}\n\n";
     }
+    src << "kaam main() {\n    f0(3);\n}\n";
+    return src.str();
+}
 
-    DataType analyzeFunctionCall(FunctionCall* funcCall) {
-        Symbol funcSym("", DataType::VOID);
-        if (!symbolTable.lookup(funcCall->name, funcSym)) {
-            errors.push_back("ERROR: Undefined function '" + funcCall->name + "'");
-            return DataType::UNKNOWN;
-        }
+template <typename F>
+double bestOf(int runs, F&& body) {
+    double best = 0;
+    for (int i = 0; i < runs; i++) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (i == 0 || seconds < best) best = seconds;
+    }
+    return best;
+}
 
-        if (!funcSym.isFunction) {
-            errors.push_back("ERROR: '" + funcCall->name + "' is not a function");
-            return DataType::UNKNOWN;
+// Time from program text to a runnable module: the full front end plus
+// bytecode compilation, versus hashing the source and loading an .olc file.
+void runColdStartBenchmark() {
+    const int functionCount = 2000;
+    std::string source = generateLargeProgram(functionCount);
+    std::string olcPath = (std::filesystem::temp_directory_path() / "ourlang-coldstart.olc").string();
+    std::ostringstream sink;
+
+    Runtime runtime(sink);
+    BytecodeModule compiled;
+    auto compile = [&](BytecodeModule& module) {
+        auto program = buildProgram(source);
+        BytecodeCompiler compiler(runtime, module);
+        compiler.compile(program.get());
+    };
+    double fromSource = bestOf(5, [&]() {
+        BytecodeModule module;
+        compile(module);
+    });
+    compile(compiled);
+    std::string image = OlcWriter().write(compiled, sourceHashFor(source), 0);
+    writeTextFile(olcPath, image);
+
+    double fromOlc = bestOf(5, [&]() {
+        BytecodeModule module;
+        OlcImage file;
+        std::string reason;
+        if (!file.open(olcPath) || !loadOlc(file, sourceHashFor(source), 0, runtime, module, reason)) {
+            throw std::runtime_error("cold-start benchmark could not load " + olcPath + ": " + reason);
         }
+    });
+    std::filesystem::remove(olcPath);
+
+    std::cout << "Cold start (" << functionCount << " functions, " << source.size() / 1024 << " KB source, "
+              << image.size() / 1024 << " KB .olc)" << std::endl;
+    std::cout << "  source (lex, parse, analyze, compile): " << fromSource * 1000.0 << " ms" << std::endl;
+    std::cout << "  .olc (hash source, map, load): " << fromOlc * 1000.0 << " ms ("
+              << fromSource / fromOlc << "x)" << std::endl;
+    std::cout << std::endl;
+}
 
-        // Check argument count for built-ins
-        if (funcCall->name == "dekh") {
-            for (auto& arg : funcCall->args) {
-                analyzeExpression(arg.get());
-            }
-            return DataType::VOID;
-        }
+int runBenchmarks() {
+    std::cout << "=== Our-Lang V1 Benchmarks ===" << std::endl;
+    std::cout << "VM dispatch: " << VM::dispatchMode() << std::endl << std::endl;
 
-        if (funcCall->name == "lou") {
-            if (!funcCall->args.empty()) {
-                analyzeExpression(funcCall->args[0].get());
+    const ExecutionOptions configs[] = {
+        {ExecutionEngine::AST, JitMode::OFF},
+        {ExecutionEngine::VM, JitMode::OFF, false},
+        {ExecutionEngine::VM, JitMode::OFF},
+        {ExecutionEngine::CLOSURE, JitMode::OFF},
+        {ExecutionEngine::VM, JitMode::ON},
+    };
+
+    for (const auto& bench : BENCHMARKS) {
+        auto program = buildProgram(bench.source);
+        std::cout << bench.name << std::endl;
+
+        double baseline = 0;
+        for (const auto& config : configs) {
+            double seconds = timeExecution(program.get(), config);
+            bool isBaseline = config.engine == ExecutionEngine::AST;
+            if (isBaseline) baseline = seconds;
+            std::cout << "  " << optionsName(config) << ": " << seconds * 1000.0 << " ms, "
+                      << static_cast<long long>(bench.ops / seconds) << " " << bench.unit << "/sec";
+            if (!isBaseline) {
+                std::cout << " (" << baseline / seconds << "x)";
             }
-            return DataType::NUMBER;
+            std::cout << std::endl;
         }
+        std::cout << std::endl;
+    }
+    runColdStartBenchmark();
+    return 0;
+}
 
-        if (funcCall->name == "nikal") {
-            if (funcCall->args.size() != 1) {
-                errors.push_back("ERROR: nikal() expects 1 argument, got " + std::to_string(funcCall->args.size()));
-            } else {
-                analyzeExpression(funcCall->args[0].get());
+int main(int argc, char* argv[]) {
+    std::string inputPath = "test.txt";
+    bool benchmark = false;
+    ExecutionOptions options;
+    bool emitCpp = false;
+    bool aot = false;
+    bool useOlc = false;
+    std::string emitCppPath;
+    OptimizationOptions optimization;
+    int optimizationLevel = 0;
+    std::string passList;
+    bool timePasses = false;
+    bool dumpIrText = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--bench") {
+            benchmark = true;
+        } else if (arg == "--engine=ast") {
+            options.engine = ExecutionEngine::AST;
+        } else if (arg == "--engine=vm") {
+            options.engine = ExecutionEngine::VM;
+        } else if (arg == "--engine=closure") {
+            options.engine = ExecutionEngine::CLOSURE;
+        } else if (arg == "--jit=off") {
+            options.jit = JitMode::OFF;
+        } else if (arg == "--jit=on") {
+            options.jit = JitMode::ON;
+        } else if (arg == "--jit=stats") {
+            options.jit = JitMode::STATS;
+        } else if (arg == "--memoize=off") {
+            options.memoize = MemoMode::OFF;
+        } else if (arg == "--memoize=auto") {
+            options.memoize = MemoMode::AUTO;
+        } else if (arg == "--memoize=stats") {
+            options.memoize = MemoMode::STATS;
+        } else if (arg == "--parallel=off") {
+            options.parallel = ParallelMode::OFF;
+        } else if (arg == "--parallel" || arg == "--parallel=on") {
+            options.parallel = ParallelMode::ON;
+        } else if (arg == "--parallel=stats") {
+            options.parallel = ParallelMode::STATS;
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            std::string value = arg.substr(std::string("--threads=").size());
+            if (value.empty() || value.size() > 3 || value.find_first_not_of("0123456789") != std::string::npos ||
+                std::stoi(value) < 1) {
+                std::cerr << "ERROR: --threads expects a thread count of at least 1, got '" << value << "'" << std::endl;
+                return 1;
             }
-            return DataType::NUMBER;
+            options.threads = std::stoi(value);
+        } else if (arg == "--gc-stats") {
+            options.gcStats = true;
+        } else if (arg == "--gc-stress") {
+            options.gcStress = true;
+        } else if (arg == "--kernels=on") {
+            options.numericKernels = true;
+        } else if (arg == "--kernels=off") {
+            options.numericKernels = false;
+        } else if (arg == "--simd=off") {
+            ArrayKernels::simd() = false;
+        } else if (arg == "--emit-cpp") {
+            emitCpp = true;
+        } else if (arg.rfind("--emit-cpp=", 0) == 0) {
+            emitCpp = true;
+            emitCppPath = arg.substr(std::string("--emit-cpp=").size());
+        } else if (arg == "--aot") {
+            aot = true;
+        } else if (arg == "--olc") {
+            useOlc = true;
+        } else if (arg == "--inline") {
+            optimization.inlining = true;
+        } else if (arg.rfind("--inline=", 0) == 0) {
+            std::string value = arg.substr(std::string("--inline=").size());
+            if (value.empty() || value.size() > 9 || value.find_first_not_of("0123456789") != std::string::npos) {
+                std::cerr << "ERROR: --inline expects a node count, got '" << value << "'" << std::endl;
+                return 1;
+            }
+            optimization.inlining = true;
+            optimization.inlineThreshold = std::stoi(value);
+        } else if (arg == "--simplify" || arg == "--simplify=fast") {
+            optimization.simplify = true;
+            optimization.fastMath = arg == "--simplify=fast";
+        } else if (arg == "--licm") {
+            optimization.licm = true;
+        } else if (arg == "--unroll") {
+            optimization.unroll = true;
+        } else if (arg.rfind("--unroll=", 0) == 0) {
+            std::string value = arg.substr(std::string("--unroll=").size());
+            if (value.empty() || value.size() > 2 || value.find_first_not_of("0123456789") != std::string::npos ||
+                std::stoi(value) < 2) {
+                std::cerr << "ERROR: --unroll expects a factor of at least 2, got '" << value << "'" << std::endl;
+                return 1;
+            }
+            optimization.unroll = true;
+            optimization.unrollFactor = std::stoi(value);
+        } else if (arg == "--cse") {
+            optimization.cse = true;
+        } else if (arg == "-O0" || arg == "-O1" || arg == "-O2") {
+            optimizationLevel = arg[2] - '0';
+        } else if (arg.rfind("--passes=", 0) == 0) {
+            passList = arg.substr(std::string("--passes=").size());
+        } else if (arg == "--time-passes") {
+            timePasses = true;
+        } else if (arg == "--dump-ir") {
+            dumpIrText = true;
+        } else if (arg.rfind("--", 0) == 0) {
+            std::cerr << "ERROR: Unknown option " << arg << std::endl;
+            return 1;
+        } else {
+            inputPath = arg;
         }
+    }
 
-        if (funcCall->name == "band") {
-            return DataType::VOID;
-        }
+    if (options.jit != JitMode::OFF && options.engine != ExecutionEngine::VM) {
+        std::cerr << "ERROR: --jit requires the bytecode VM (--engine=vm)" << std::endl;
+        return 1;
+    }
 
-        if (funcCall->name == "abs" || funcCall->name == "sqrt" || funcCall->name == "round") {
-            if (funcCall->args.size() != 1) {
-                errors.push_back("ERROR: " + funcCall->name + "() expects 1 argument");
-            } else {
-                DataType argType = analyzeExpression(funcCall->args[0].get());
-                if (argType != DataType::NUMBER && argType != DataType::UNKNOWN) {
-                    errors.push_back("ERROR: " + funcCall->name + "() expects number argument");
-                }
-            }
-            return DataType::NUMBER;
+    PassManager passes(optimization);
+    if (!passList.empty()) {
+        std::string error;
+        if (!passes.addList(passList, error)) {
+            std::cerr << "ERROR: --passes: " << error << std::endl;
+            return 1;
         }
+    } else {
+        passes.addLevel(optimizationLevel);
+    }
+    passes.addRequested();
 
-        if (funcCall->name == "pow" || funcCall->name == "max" || funcCall->name == "min") {
-            if (funcCall->args.size() != 2) {
-                errors.push_back("ERROR: " + funcCall->name + "() expects 2 arguments");
-            } else {
-                for (auto& arg : funcCall->args) {
-                    DataType argType = analyzeExpression(arg.get());
-                    if (argType != DataType::NUMBER && argType != DataType::UNKNOWN) {
-                        errors.push_back("ERROR: " + funcCall->name + "() expects number arguments");
-                    }
-                }
-            }
-            return DataType::NUMBER;
-        }
+    if (!options.numericKernels && options.engine != ExecutionEngine::VM) {
+        std::cerr << "ERROR: --kernels requires the bytecode VM (--engine=vm)" << std::endl;
+        return 1;
+    }
 
-        if (funcCall->name == "random") {
-            return DataType::NUMBER;
-        }
+    if (options.parallel != ParallelMode::OFF && options.engine != ExecutionEngine::VM) {
+        std::cerr << "ERROR: --parallel requires the bytecode VM (--engine=vm)" << std::endl;
+        return 1;
+    }
 
-        // User-defined function
-        if (funcCall->args.size() != funcSym.paramTypes.size()) {
-            errors.push_back("ERROR: Function '" + funcCall->name + "' expects " +
-                           std::to_string(funcSym.paramTypes.size()) + " arguments, got " +
-                           std::to_string(funcCall->args.size()));
-        }
+    if (useOlc && (options.engine != ExecutionEngine::VM || options.jit != JitMode::OFF ||
+                   options.parallel != ParallelMode::OFF)) {
+        std::cerr << "ERROR: --olc runs on the bytecode VM and cannot be combined with --engine, --jit or --parallel"
+                  << std::endl;
+        return 1;
+    }
 
-        for (auto& arg : funcCall->args) {
-            analyzeExpression(arg.get());
-        }
+    if (options.memoize != MemoMode::OFF && (aot || emitCpp)) {
+        std::cerr << "ERROR: --memoize runs on the interpreters and cannot be combined with --aot or --emit-cpp" << std::endl;
+        return 1;
+    }
 
-        return funcSym.returnType;
+    if (options.parallel != ParallelMode::OFF && (aot || emitCpp)) {
+        std::cerr << "ERROR: --parallel runs on the bytecode VM and cannot be combined with --aot or --emit-cpp" << std::endl;
+        return 1;
     }
-};
 
-// ============================================================================
-// Main Program
-// ============================================================================
+    if (benchmark) {
+        try {
+            return runBenchmarks();
+        } catch (const std::exception& e) {
+            std::cerr << "Fatal error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
 
-int main() {
-    // Read code from test.txt file
-    std::ifstream inputFile("test.txt");
+    // Read code from the input file (test.txt by default)
+    std::ifstream inputFile(inputPath);
     if (!inputFile.is_open()) {
-        std::cerr << "ERROR: Cannot open test.txt file" << std::endl;
+        std::cerr << "ERROR: Cannot open " << inputPath << " file" << std::endl;
         return 1;
     }
 
@@ -1275,20 +14871,47 @@ int main() {
     inputFile.close();
 
     std::cout << "=== Our-Lang V1 Semantic Analyzer ===" << std::endl << std::endl;
-    std::cout << "Reading from: test.txt" << std::endl << std::endl;
+    std::cout << "Reading from: " << inputPath << std::endl << std::endl;
+
+    // An up-to-date .olc file replaces everything up to execution
+    std::string olcPath, olcStatus;
+    uint64_t sourceHash = 0, optionsHash = 0;
+    if (useOlc) {
+        olcPath = olcPathFor(inputPath);
+        sourceHash = sourceHashFor(code);
+        optionsHash = olcOptionsHash(passes, options.numericKernels);
+        try {
+            Runtime runtime;
+            BytecodeModule module;
+            OlcImage image;
+            if (timePasses || dumpIrText) {
+                // Both report on the passes, which only a rebuild runs
+                olcStatus = timePasses ? "rebuilt for --time-passes" : "rebuilt for --dump-ir";
+            } else if (!image.open(olcPath)) {
+                olcStatus = "no compiled file yet";
+            } else if (loadOlc(image, sourceHash, optionsHash, runtime, module, olcStatus)) {
+                std::cout << "Bytecode: " << olcPath << " (up to date; lexing, parsing and analysis skipped)" << std::endl;
+                std::cout << "\n--- Execution ---" << std::endl;
+                runtime.heap.stress = options.gcStress;
+                VM vm(runtime, module);
+                if (options.memoize != MemoMode::OFF) vm.enableMemoization();
+                vm.run();
+                if (options.memoize == MemoMode::STATS) printMemoStats(runtime, runtime.out);
+                if (options.gcStats) printGcStats(runtime.heap, runtime.out);
+                return 0;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Fatal error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
     std::cout << "Source Code:" << std::endl << code << std::endl << std::endl;
 
     try {
         // Lexical Analysis
         std::cout << "--- Lexical Analysis ---" << std::endl;
-        Lexer lexer(code);
-        std::vector<Token> tokens;
-        Token token = lexer.nextToken();
-        while (token.type != TokenType::EOF_TOKEN) {
-            tokens.push_back(token);
-            token = lexer.nextToken();
-        }
-        tokens.push_back(token); // Add EOF token
+        std::vector<Token> tokens = tokenize(code);
 
         std::cout << "Tokens generated: " << tokens.size() << std::endl << std::endl;
 
@@ -1305,15 +14928,79 @@ int main() {
         std::cout << "- Variable Declaration Validation" << std::endl;
         std::cout << "- Function Declaration Validation" << std::endl;
 
-        SemanticAnalyzer analyzer;
-        bool success = analyzer.analyze(program.get());
+        std::ostringstream report;
+        bool success = passes.run(program.get(), report);
 
         if (success) {
             std::cout << "\n✓ Semantic Analysis PASSED" << std::endl;
+
+            if (passes.optimizes()) {
+                std::cout << "\n--- Optimization ---" << std::endl;
+                std::cout << report.str();
+            }
+            if (timePasses) passes.printTiming(std::cout);
+
+            if (dumpIrText) {
+                std::cout << "\n--- SSA IR ---" << std::endl;
+                std::vector<std::string> errors;
+                for (const IrFunction& fn : lowerProgramToIr(program.get())) {
+                    dumpIr(fn, std::cout);
+                    for (auto& error : verifyIr(fn)) errors.push_back(error);
+                }
+                if (errors.empty()) {
+                    std::cout << "IR verification passed" << std::endl;
+                } else {
+                    for (auto& error : errors) std::cout << "  " << error << std::endl;
+                    std::cout << "IR verification FAILED" << std::endl;
+                    return 1;
+                }
+            }
+
+            if (emitCpp) {
+                if (emitCppPath.empty()) {
+                    emitCppPath = std::filesystem::path(inputPath).replace_extension(".cpp").string();
+                }
+                std::cout << "\n--- C++ Backend ---" << std::endl;
+                writeCppSources(emitCppPath, generateCpp(program.get(), inputPath));
+                std::cout << "Wrote " << emitCppPath << " (with ourlang_runtime.h)" << std::endl;
+                return 0;
+            }
+
+            if (useOlc) {
+                Runtime runtime;
+                BytecodeModule module;
+                BytecodeCompiler compiler(runtime, module, options.numericKernels);
+                compiler.compile(program.get());
+                writeTextFile(olcPath, OlcWriter().write(module, sourceHash, optionsHash));
+                std::cout << "\nBytecode written to " << olcPath << " (" << olcStatus << ")" << std::endl;
+
+                std::cout << "\n--- Execution ---" << std::endl;
+                runtime.heap.stress = options.gcStress;
+                VM vm(runtime, module);
+                if (options.memoize != MemoMode::OFF) vm.enableMemoization();
+                vm.run();
+                if (options.memoize == MemoMode::STATS) printMemoStats(runtime, runtime.out);
+                if (options.gcStats) printGcStats(runtime.heap, runtime.out);
+                return 0;
+            }
+
+            if (aot) {
+                std::cout << "\n--- Native Compilation ---" << std::endl;
+                NativeBinary native = buildNativeBinary(generateCpp(program.get(), inputPath));
+                std::cout << "Binary: " << native.path << (native.cached ? " (cached)" : " (compiled)") << std::endl;
+
+                std::cout << "\n--- Execution ---" << std::endl;
+                return std::system(shellQuote(native.path).c_str()) == 0 ? 0 : 1;
+            }
+
+            // Execution
+            std::cout << "\n--- Execution ---" << std::endl;
+            Runtime runtime;
+            executeProgram(program.get(), options, runtime);
         } else {
             std::cout << "\n✗ Semantic Analysis FAILED" << std::endl;
             std::cout << "\nErrors found:" << std::endl;
-            for (const auto& error : analyzer.getErrors()) {
+            for (const auto& error : passes.errors()) {
                 std::cout << "  " << error << std::endl;
             }
         }